@@ -0,0 +1,28 @@
+/* --------------------------------------------------------------------------
+ * bench.h
+ *
+ * Benchmarks of the renderer's mesh loading, spatial structures and frame
+ * loop, run from the command line ( see main.cpp ).
+ *
+ * -------------------------------------------------------------------------- */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <QElapsedTimer>
+
+/* Each benchmark takes the arguments after its name, prints its results
+ * and returns the exit code. */
+int treeBenchmark( int argc, char *argv[] );
+int bvhBenchmark( int argc, char *argv[] );
+int frameBenchmark( int argc, char *argv[] );
+int loaderBenchmark( int argc, char *argv[] );
+
+/* Milliseconds since the timer was started, with sub-millisecond
+ * resolution. */
+inline double elapsedMs( const QElapsedTimer &timer )
+{
+    return timer.nsecsElapsed() / 1e6;
+}
+
+#endif /* BENCH_H */
@@ -0,0 +1,59 @@
+######################################################################
+# Benchmarks, built against the sources of the application:
+#   qmake bench.pro && make && ../bin/bench
+######################################################################
+
+TEMPLATE = app
+TARGET = bench
+DESTDIR = ../bin
+OBJECTS_DIR = obj
+MOC_DIR = moc
+DEPENDPATH += . ../src
+INCLUDEPATH += . ../src
+LIBS += -lGLU -lGL
+QT += opengl
+CONFIG += console release
+
+# Input
+HEADERS += bench.h \
+           ../src/drawableobjects.h \
+           ../src/renderer.h \
+           ../src/wf_loader.h \
+           ../src/meshoptimizer.h \
+           ../src/meshbuffer.h \
+           ../src/meshbvh.h \
+           ../src/renderqueue.h \
+           ../src/statemanager.h \
+           ../src/frustum.h \
+           ../src/aabbtree.h \
+           ../src/slotmap.h \
+           ../src/scenestore.h \
+           ../src/transformhierarchy.h \
+           ../src/geometrycache.h \
+           ../src/instancerenderer.h \
+           ../src/meshmanager.h \
+           ../src/meshsimplifier.h \
+           ../src/timer.h
+
+SOURCES += main.cpp \
+           treebench.cpp \
+           bvhbench.cpp \
+           framebench.cpp \
+           loaderbench.cpp \
+           ../src/drawableobjects.cpp \
+           ../src/renderer.cpp \
+           ../src/wf_loader.cpp \
+           ../src/meshoptimizer.cpp \
+           ../src/meshbuffer.cpp \
+           ../src/meshbvh.cpp \
+           ../src/renderqueue.cpp \
+           ../src/statemanager.cpp \
+           ../src/frustum.cpp \
+           ../src/aabbtree.cpp \
+           ../src/scenestore.cpp \
+           ../src/transformhierarchy.cpp \
+           ../src/geometrycache.cpp \
+           ../src/instancerenderer.cpp \
+           ../src/meshmanager.cpp \
+           ../src/meshsimplifier.cpp \
+           ../src/timer.cpp
@@ -0,0 +1,206 @@
+/* --------------------------------------------------------------------------
+ * bvhbench.cpp
+ *
+ * Build time and ray throughput of the MeshBVH on OBJ files, loaded the
+ * way the MeshManager loads them.
+ *
+ * -------------------------------------------------------------------------- */
+
+#include "bench.h"
+#include "meshbvh.h"
+#include "wf_loader.h"
+#include <QFileInfo>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <float.h>
+#include <vector>
+
+static const int    RAY_COUNT = 200000;
+/* Rays checked against every triangle. */
+static const int    CHECK_COUNT = 100;
+
+/* The models of the scene ( see MainWindow::createScene ), looked for in
+ * the working directory when no files are given. */
+static const char   *SCENE_MODELS[] = {
+    "bowl.obj", "brickwall.obj", "whiteboard.obj", "floor.obj"
+};
+
+static GLfloat randomFloat()
+{
+    return rand() / ( GLfloat )RAND_MAX;
+}
+
+/* --------------------------------------------------------------------------
+ *  bruteForce
+ *
+ *  Nearest hit of all the triangles, in double precision.
+ * -------------------------------------------------------------------------- */
+static bool bruteForce( const std::vector< MeshVertex > &vertices,
+                        const std::vector< GLuint > &indices,
+                        const Vector3f &origin, const Vector3f &direction,
+                        double &nearest )
+{
+    const double    d[] = { direction.x, direction.y, direction.z };
+    bool            found = false;
+
+    for( size_t i = 0; i < indices.size(); i += 3 )
+    {
+        const GLfloat *a = vertices[ indices[ i ] ].position;
+        const GLfloat *b = vertices[ indices[ i + 1 ] ].position;
+        const GLfloat *c = vertices[ indices[ i + 2 ] ].position;
+        double e1[] = { b[ 0 ] - a[ 0 ], b[ 1 ] - a[ 1 ], b[ 2 ] - a[ 2 ] };
+        double e2[] = { c[ 0 ] - a[ 0 ], c[ 1 ] - a[ 1 ], c[ 2 ] - a[ 2 ] };
+        double p[] = { d[ 1 ] * e2[ 2 ] - d[ 2 ] * e2[ 1 ],
+                       d[ 2 ] * e2[ 0 ] - d[ 0 ] * e2[ 2 ],
+                       d[ 0 ] * e2[ 1 ] - d[ 1 ] * e2[ 0 ] };
+        double det = e1[ 0 ] * p[ 0 ] + e1[ 1 ] * p[ 1 ] + e1[ 2 ] * p[ 2 ];
+        if( det == 0 )
+            continue;
+
+        double s[] = { origin.x - a[ 0 ], origin.y - a[ 1 ], origin.z - a[ 2 ] };
+        double u = ( s[ 0 ] * p[ 0 ] + s[ 1 ] * p[ 1 ] + s[ 2 ] * p[ 2 ] ) / det;
+        if( u < 0 || u > 1 )
+            continue;
+
+        double q[] = { s[ 1 ] * e1[ 2 ] - s[ 2 ] * e1[ 1 ],
+                       s[ 2 ] * e1[ 0 ] - s[ 0 ] * e1[ 2 ],
+                       s[ 0 ] * e1[ 1 ] - s[ 1 ] * e1[ 0 ] };
+        double v = ( d[ 0 ] * q[ 0 ] + d[ 1 ] * q[ 1 ] + d[ 2 ] * q[ 2 ] ) / det;
+        if( v < 0 || u + v > 1 )
+            continue;
+
+        double t = ( e2[ 0 ] * q[ 0 ] + e2[ 1 ] * q[ 1 ] + e2[ 2 ] * q[ 2 ] ) / det;
+        if( t > 0 && t < nearest )
+        {
+            nearest = t;
+            found = true;
+        }
+    }
+    return found;
+}
+
+/* --------------------------------------------------------------------------
+ *  runFile
+ *
+ *  Rays start on a sphere around the mesh and aim at random points of its
+ *  bounds, so most of them hit. Returns false if a checked ray disagreed
+ *  with the brute force answer.
+ * -------------------------------------------------------------------------- */
+static bool runFile( const char *filename )
+{
+    WFLoader        loader;
+    MeshBVH         bvh;
+    QElapsedTimer   timer;
+
+    loader.setOptimizeMesh( true );
+    loader.setBuildLods( true );
+    if( !loader.load( filename, WFLoader::OBJ_FILE ) ||
+        loader.m_LoadedData.weldedIndices.empty() )
+    {
+        printf( "%s: no mesh\n", filename );
+        return false;
+    }
+
+    const std::vector< MeshVertex > &vertices = loader.m_LoadedData.weldedVertices;
+    const std::vector< GLuint >     &indices = loader.m_LoadedData.weldedIndices;
+
+    timer.start();
+    bvh.build( vertices, indices, 1 );
+    double singleMs = elapsedMs( timer );
+    timer.start();
+    bvh.build( vertices, indices );
+    double parallelMs = elapsedMs( timer );
+
+    BoundingBox bounds;
+    for( size_t i = 0; i < vertices.size(); i++ )
+        bounds.extend( Vector3f( vertices[ i ].position[ 0 ],
+                                 vertices[ i ].position[ 1 ],
+                                 vertices[ i ].position[ 2 ] ) );
+    const Vector3f  center = bounds.center();
+    const Vector3f  size( bounds.max.x - bounds.min.x,
+                          bounds.max.y - bounds.min.y,
+                          bounds.max.z - bounds.min.z );
+    const GLfloat   radius = sqrt( size.x * size.x + size.y * size.y +
+                                   size.z * size.z );
+
+    std::vector< Vector3f > origins( RAY_COUNT ), directions( RAY_COUNT );
+    srand( 1 );
+    for( int i = 0; i < RAY_COUNT; i++ )
+    {
+        GLfloat theta = 2 * M_PI * randomFloat();
+        GLfloat phi = acos( 2 * randomFloat() - 1 );
+        origins[ i ] = Vector3f( center.x + radius * sin( phi ) * cos( theta ),
+                                 center.y + radius * sin( phi ) * sin( theta ),
+                                 center.z + radius * cos( phi ) );
+        directions[ i ] = Vector3f(
+            bounds.min.x + randomFloat() * size.x - origins[ i ].x,
+            bounds.min.y + randomFloat() * size.y - origins[ i ].y,
+            bounds.min.z + randomFloat() * size.z - origins[ i ].z );
+    }
+
+    RayHit  hit;
+    int     hits = 0, occluded = 0;
+    timer.start();
+    for( int i = 0; i < RAY_COUNT; i++ )
+        hits += bvh.intersect( origins[ i ], directions[ i ], FLT_MAX, hit );
+    double closestMs = elapsedMs( timer );
+    timer.start();
+    for( int i = 0; i < RAY_COUNT; i++ )
+        occluded += bvh.occluded( origins[ i ], directions[ i ], FLT_MAX );
+    double anyMs = elapsedMs( timer );
+
+    int mismatches = hits != occluded;
+    timer.start();
+    for( int i = 0; i < CHECK_COUNT; i++ )
+    {
+        double  nearest = DBL_MAX;
+        bool    expected = bruteForce( vertices, indices, origins[ i ],
+                                       directions[ i ], nearest );
+        bool    found = bvh.intersect( origins[ i ], directions[ i ], FLT_MAX,
+                                       hit );
+        if( expected != found ||
+            ( found && fabs( hit.distance - nearest ) > 1e-4 * nearest ) )
+            mismatches++;
+    }
+    double bruteMs = elapsedMs( timer );
+
+    printf( "%-24s %9d %8d %9.1f %9.1f %8.2f %8.2f %9.0f %5.1f%% %5d\n",
+            QFileInfo( filename ).fileName().toLocal8Bit().constData(),
+            ( int )bvh.triangleCount(), ( int )bvh.nodeCount(), singleMs,
+            parallelMs, RAY_COUNT / closestMs / 1000, RAY_COUNT / anyMs / 1000,
+            CHECK_COUNT / bruteMs * 1000, 100.0 * hits / RAY_COUNT,
+            mismatches );
+    return mismatches == 0;
+}
+
+/* --------------------------------------------------------------------------
+ *  bvhBenchmark
+ *
+ *  Builds are timed on one thread and on the default thread count, rays
+ *  on the calling thread.
+ * -------------------------------------------------------------------------- */
+int bvhBenchmark( int argc, char *argv[] )
+{
+    std::vector< const char * > files( argv, argv + argc );
+
+    if( files.empty() )
+        for( size_t i = 0; i < sizeof( SCENE_MODELS ) / sizeof( SCENE_MODELS[ 0 ] ); i++ )
+        {
+            if( QFileInfo( SCENE_MODELS[ i ] ).exists() )
+                files.push_back( SCENE_MODELS[ i ] );
+            else
+                printf( "%s: not found\n", SCENE_MODELS[ i ] );
+        }
+    if( files.empty() )
+        return 1;
+
+    printf( "%-24s %9s %8s %9s %9s %8s %8s %9s %6s %5s\n", "file",
+            "triangles", "nodes", "build ms", "par. ms", "Mrays/s",
+            "any", "brute/s", "hits", "wrong" );
+
+    bool ok = true;
+    for( size_t i = 0; i < files.size(); i++ )
+        ok = runFile( files[ i ] ) && ok;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,125 @@
+/* --------------------------------------------------------------------------
+ * framebench.cpp
+ *
+ * Time per frame of the Renderer with many boxes and planes, a few of them
+ * moving every frame.
+ *
+ * -------------------------------------------------------------------------- */
+
+#include "bench.h"
+#include "renderer.h"
+#include "drawableobjects.h"
+#include <QApplication>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include <algorithm>
+
+static const int    WIDTH = 800;
+static const int    HEIGHT = 600;
+static const int    DEFAULT_FRAMES = 100;
+
+static GLfloat randomFloat( GLfloat low, GLfloat high )
+{
+    return low + ( high - low ) * ( rand() / ( GLfloat )RAND_MAX );
+}
+
+/* --------------------------------------------------------------------------
+ *  runScene
+ *
+ *  Objects are placed between 5 and 19 units in front of the eye. With
+ *  spread false they fill the view, otherwise they are spread over a
+ *  block about three times as wide and high as the view, so most of them
+ *  are culled. Every frame moves the next moving objects a little.
+ * -------------------------------------------------------------------------- */
+static void runScene( int count, int frames, int moving, bool spread )
+{
+    Renderer                    renderer;
+    std::vector< IDrawable * >  objects( count );
+    QElapsedTimer               timer;
+
+    /* Frames are not to wait for the display. */
+    QGLFormat format = renderer.format();
+    format.setSwapInterval( 0 );
+    renderer.setFormat( format );
+    renderer.resize( WIDTH, HEIGHT );
+    renderer.show();
+    QApplication::processEvents();
+
+    srand( 3 );
+    for( int i = 0; i < count; i++ )
+    {
+        IDrawable   *object;
+        if( i % 2 )
+            object = new Box( 0.2f, 0.2f, 0.2f );
+        else
+            object = new Plane( 0.3f, 0.3f );
+
+        /* The view is 4/3 by 1 at distance 4 and grows with the distance. */
+        GLfloat z = randomFloat( -19, -5 );
+        GLfloat half = spread ? 10 : -z / 4 * 0.8f;
+        object->setPosition( randomFloat( -half * WIDTH / HEIGHT, half * WIDTH / HEIGHT ),
+                             randomFloat( -half, half ), z );
+        object->setRotation( randomFloat( 0, 360 ), randomFloat( 0, 360 ),
+                             randomFloat( 0, 360 ) );
+        object->setMovable( true );
+        objects[ i ] = object;
+        renderer.attachObject( object );
+    }
+
+    /* The first frame builds the tree and the render items. */
+    renderer.updateGL();
+
+    timer.start();
+    for( int f = 0; f < frames; f++ )
+    {
+        for( int m = 0; m < moving; m++ )
+            objects[ ( f * moving + m ) % count ]->move( 0.001f, 0, 0 );
+        renderer.updateGL();
+    }
+    glFinish();
+    double frameMs = elapsedMs( timer ) / frames;
+
+    const FrameStats &stats = renderer.frameStats();
+    printf( "%8d %7s %7d %9.3f %8d %7d %6d %7d\n", count,
+            spread ? "spread" : "in view", moving, frameMs, stats.items,
+            stats.culled, stats.drawCalls, stats.stateChanges );
+}
+
+/* --------------------------------------------------------------------------
+ *  frameBenchmark
+ *
+ *  Arguments are the object count, the number of frames and the number of
+ *  objects moved per frame. Without an object count, 2000 and 20000
+ *  objects are run. One percent of the objects move by default.
+ * -------------------------------------------------------------------------- */
+int frameBenchmark( int argc, char *argv[] )
+{
+    std::vector< int >  counts;
+    int                 frames = argc > 1 ? atoi( argv[ 1 ] ) : DEFAULT_FRAMES;
+    int                 moving = argc > 2 ? atoi( argv[ 2 ] ) : -1;
+
+    if( argc > 0 )
+        counts.push_back( atoi( argv[ 0 ] ) );
+    else
+    {
+        counts.push_back( 2000 );
+        counts.push_back( 20000 );
+    }
+    if( frames <= 0 )
+        return 1;
+
+    printf( "time per frame, from before the objects move to the end of the swap\n" );
+    printf( "%8s %7s %7s %9s %8s %7s %6s %7s\n", "objects", "layout",
+            "moving", "frame ms", "items", "culled", "calls", "states" );
+
+    for( size_t i = 0; i < counts.size(); i++ )
+    {
+        if( counts[ i ] <= 0 )
+            return 1;
+        int objectsMoving = moving >= 0 ? moving : std::max( counts[ i ] / 100, 1 );
+        runScene( counts[ i ], frames, objectsMoving, false );
+        runScene( counts[ i ], frames, objectsMoving, true );
+    }
+    return 0;
+}
@@ -0,0 +1,219 @@
+/* --------------------------------------------------------------------------
+ * loaderbench.cpp
+ *
+ * Load times of a generated OBJ file through the WFLoader: parsed on one
+ * thread, parsed in chunks on all cores and read from the .tmesh cache,
+ * against the fgetc and sscanf loop the loader used to have.
+ *
+ * -------------------------------------------------------------------------- */
+
+#include "bench.h"
+#include "wf_loader.h"
+#include <QDir>
+#include <QFile>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+
+static const int    DEFAULT_GRID = 1000;
+static const int    REPEATS = 3;
+
+/* --------------------------------------------------------------------------
+ *  writeGrid
+ *
+ *  A wavy grid of size x size vertices with normals and texture
+ *  coordinates, two triangles per cell, written with v/t/n faces.
+ * -------------------------------------------------------------------------- */
+static bool writeGrid( const QString &path, int size )
+{
+    FILE *file = fopen( QFile::encodeName( path ).constData(), "w" );
+    if( file == NULL )
+        return false;
+
+    for( int y = 0; y < size; y++ )
+        for( int x = 0; x < size; x++ )
+            fprintf( file, "v %f %f %f\n", x / ( float )size,
+                     0.05f * sin( x * 0.1f ) * cos( y * 0.1f ),
+                     y / ( float )size );
+    for( int y = 0; y < size; y++ )
+        for( int x = 0; x < size; x++ )
+            fprintf( file, "vt %f %f\n", x / ( float )( size - 1 ),
+                     y / ( float )( size - 1 ) );
+    for( int y = 0; y < size; y++ )
+        for( int x = 0; x < size; x++ )
+            fprintf( file, "vn %f %f %f\n", -0.005f * cos( x * 0.1f ) *
+                     cos( y * 0.1f ), 1.0f, 0.005f * sin( x * 0.1f ) *
+                     sin( y * 0.1f ) );
+    fprintf( file, "s 1\n" );
+    for( int y = 0; y + 1 < size; y++ )
+        for( int x = 0; x + 1 < size; x++ )
+        {
+            int a = y * size + x + 1, b = a + 1, c = a + size, d = c + 1;
+            fprintf( file, "f %d/%d/%d %d/%d/%d %d/%d/%d\n",
+                     a, a, a, c, c, c, b, b, b );
+            fprintf( file, "f %d/%d/%d %d/%d/%d %d/%d/%d\n",
+                     b, b, b, c, c, c, d, d, d );
+        }
+    return fclose( file ) == 0;
+}
+
+/* --------------------------------------------------------------------------
+ *  loadOld
+ *
+ *  The loader's old loop, for the forms writeGrid uses: one character at
+ *  a time into a 100 character line, each line read with sscanf.
+ * -------------------------------------------------------------------------- */
+static void loadOld( const QString &path, ModelData &data )
+{
+    FILE    *file = fopen( QFile::encodeName( path ).constData(), "r" );
+    char    line[ 100 ];
+    int     c, i = 0;
+    float   x, y, z;
+    int     v[ 3 ], t[ 3 ], n[ 3 ];
+
+    if( file == NULL )
+        return;
+
+    while( ( c = fgetc( file ) ) != EOF )
+    {
+        if( c != '\n' && i < 99 )
+        {
+            line[ i++ ] = c;
+            continue;
+        }
+        line[ i ] = '\0';
+        i = 0;
+
+        if( line[ 0 ] == 'v' && line[ 1 ] == ' ' )
+        {
+            sscanf( line, "%*s %f %f %f", &x, &y, &z );
+            data.vertices.push_back( Vector3f( x, y, z ) );
+        }
+        else if( line[ 0 ] == 'v' && line[ 1 ] == 'n' )
+        {
+            sscanf( line, "%*s %f %f %f", &x, &y, &z );
+            data.normals.push_back( Vector3f( x, y, z ) );
+        }
+        else if( line[ 0 ] == 'v' && line[ 1 ] == 't' )
+        {
+            sscanf( line, "%*s %f %f", &x, &y );
+            ModelData::TexCoord texCoord = { x, y };
+            data.textureCoords.push_back( texCoord );
+        }
+        else if( line[ 0 ] == 'f' )
+        {
+            sscanf( line, "%*c %d%*c%d%*c%d %d%*c%d%*c%d %d%*c%d%*c%d",
+                    &v[ 0 ], &t[ 0 ], &n[ 0 ], &v[ 1 ], &t[ 1 ], &n[ 1 ],
+                    &v[ 2 ], &t[ 2 ], &n[ 2 ] );
+            data.vertexFaces.insert( data.vertexFaces.end(), v, v + 3 );
+            data.textureFaces.insert( data.textureFaces.end(), t, t + 3 );
+            data.normalFaces.insert( data.normalFaces.end(), n, n + 3 );
+        }
+    }
+    fclose( file );
+}
+
+/* Same parsed lists, compared bit for bit. */
+static bool sameData( const ModelData &a, const ModelData &b )
+{
+    return a.vertices.size() == b.vertices.size() &&
+           a.normals.size() == b.normals.size() &&
+           a.textureCoords.size() == b.textureCoords.size() &&
+           a.vertexFaces == b.vertexFaces &&
+           a.normalFaces == b.normalFaces &&
+           a.textureFaces == b.textureFaces &&
+           memcmp( &a.vertices[ 0 ], &b.vertices[ 0 ],
+                   a.vertices.size() * sizeof( Vector3f ) ) == 0 &&
+           memcmp( &a.normals[ 0 ], &b.normals[ 0 ],
+                   a.normals.size() * sizeof( Vector3f ) ) == 0 &&
+           memcmp( &a.textureCoords[ 0 ], &b.textureCoords[ 0 ],
+                   a.textureCoords.size() * sizeof( ModelData::TexCoord ) ) == 0;
+}
+
+/* Fastest of REPEATS loads through a WFLoader set up by threads and cache.
+ * The parsed lists of the last load are left in data. */
+static double timeLoader( const QString &path, int threads, bool cache,
+                          ModelData &data )
+{
+    double best = 0;
+
+    for( int r = 0; r < REPEATS; r++ )
+    {
+        WFLoader        loader;
+        QElapsedTimer   timer;
+
+        loader.setThreadCount( threads );
+        loader.setCacheEnabled( cache );
+        timer.start();
+        loader.load( QFile::encodeName( path ).constData(), WFLoader::OBJ_FILE );
+        double ms = elapsedMs( timer );
+        if( r == 0 || ms < best )
+            best = ms;
+        if( r == REPEATS - 1 )
+            std::swap( data, loader.m_LoadedData );
+    }
+    return best;
+}
+
+static void printRow( const char *name, double ms, double oldMs, bool same )
+{
+    printf( "%-20s %10.1f %8.1fx %5s\n", name, ms, oldMs / ms,
+            same ? "yes" : "NO" );
+}
+
+/* --------------------------------------------------------------------------
+ *  loaderBenchmark
+ *
+ *  The argument is the side of the grid, 1000 by default ( 1M vertices,
+ *  2M triangles, about 160 MB ). The file and its cache are written to the
+ *  temporary directory and removed afterwards. Loader times are the best
+ *  of three and include welding; the old loop only parsed.
+ * -------------------------------------------------------------------------- */
+int loaderBenchmark( int argc, char *argv[] )
+{
+    int             size = argc > 0 ? atoi( argv[ 0 ] ) : DEFAULT_GRID;
+    const QString   path = QDir::tempPath() + "/loaderbench.obj";
+    const QString   cachePath = QDir::tempPath() + "/loaderbench.tmesh";
+    QElapsedTimer   timer;
+
+    if( size < 2 )
+        return 1;
+    if( !writeGrid( path, size ) )
+    {
+        printf( "%s: can't write\n", QFile::encodeName( path ).constData() );
+        return 1;
+    }
+    printf( "%d vertices, %d triangles, %.1f MB\n", size * size,
+            2 * ( size - 1 ) * ( size - 1 ),
+            QFile( path ).size() / ( 1024.0 * 1024.0 ) );
+    printf( "%-20s %10s %9s %5s\n", "", "ms", "speedup", "same" );
+
+    ModelData   old, parsed;
+    timer.start();
+    loadOld( path, old );
+    double oldMs = elapsedMs( timer );
+    printRow( "fgetc + sscanf", oldMs, oldMs, true );
+
+    bool ok = true, same;
+    double singleMs = timeLoader( path, 1, false, parsed );
+    ok = ( same = sameData( old, parsed ) ) && ok;
+    printRow( "mapped, 1 thread", singleMs, oldMs, same );
+
+    double chunkedMs = timeLoader( path, 0, false, parsed );
+    ok = ( same = sameData( old, parsed ) ) && ok;
+    printRow( "mapped, chunked", chunkedMs, oldMs, same );
+
+    /* The first load writes the cache, the timed ones read it. */
+    QFile::remove( cachePath );
+    timeLoader( path, 0, true, parsed );
+    double cachedMs = timeLoader( path, 0, true, parsed );
+    ok = ( same = sameData( old, parsed ) ) && ok;
+    printRow( "cache hit", cachedMs, oldMs, same );
+
+    QFile::remove( cachePath );
+    QFile::remove( path );
+    return ok ? 0 : 1;
+}
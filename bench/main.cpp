@@ -0,0 +1,43 @@
+/* --------------------------------------------------------------------------
+ * main.cpp
+ *
+ * Command line front end of the benchmarks. Build with bench.pro and run
+ * bin/bench <benchmark> [ arguments ].
+ *
+ * -------------------------------------------------------------------------- */
+
+#include <QApplication>
+#include <stdio.h>
+#include <string.h>
+#include "bench.h"
+
+struct Benchmark
+{
+    const char  *name;
+    const char  *arguments;
+    int         ( *run )( int argc, char *argv[] );
+};
+
+static const Benchmark BENCHMARKS[] = {
+    { "tree", "[ object counts ]", treeBenchmark },
+    { "bvh", "[ obj files ]", bvhBenchmark },
+    { "frame", "[ objects [ frames [ moving objects ] ] ]", frameBenchmark },
+    { "loader", "[ grid size ]", loaderBenchmark }
+};
+
+static const int BENCHMARK_COUNT = sizeof( BENCHMARKS ) / sizeof( BENCHMARKS[ 0 ] );
+
+int main( int argc, char *argv[] )
+{
+    QApplication app( argc, argv );
+
+    for( int i = 0; argc > 1 && i < BENCHMARK_COUNT; i++ )
+        if( strcmp( argv[ 1 ], BENCHMARKS[ i ].name ) == 0 )
+            return BENCHMARKS[ i ].run( argc - 2, argv + 2 );
+
+    fprintf( stderr, "usage:\n" );
+    for( int i = 0; i < BENCHMARK_COUNT; i++ )
+        fprintf( stderr, "  %s %s %s\n", argv[ 0 ], BENCHMARKS[ i ].name,
+                 BENCHMARKS[ i ].arguments );
+    return 1;
+}
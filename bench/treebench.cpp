@@ -0,0 +1,199 @@
+/* --------------------------------------------------------------------------
+ * treebench.cpp
+ *
+ * Frustum, ray and update queries of the AABBTree against a linear scan,
+ * for growing numbers of objects.
+ *
+ * -------------------------------------------------------------------------- */
+
+#include "bench.h"
+#include "aabbtree.h"
+#include "frustum.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+
+/* Objects per cubic unit. The scene grows with the object count, so about
+ * as many objects are visible at every size and the query times show how
+ * the tree scales rather than how many objects it returns. */
+static const GLfloat    DENSITY = 0.05f;
+static const int        QUERY_REPEATS = 100;
+static const int        RAY_COUNT = 10000;
+
+static GLfloat randomFloat( GLfloat low, GLfloat high )
+{
+    return low + ( high - low ) * ( rand() / ( GLfloat )RAND_MAX );
+}
+
+static BoundingBox unitBox( const Vector3f &center )
+{
+    return BoundingBox( Vector3f( center.x - 0.5f, center.y - 0.5f, center.z - 0.5f ),
+                        Vector3f( center.x + 0.5f, center.y + 0.5f, center.z + 0.5f ) );
+}
+
+/* Slab test, the same as the tree's leaves get. */
+static bool hitsBox( const BoundingBox &box, const Vector3f &origin,
+                     const Vector3f &direction, GLfloat maxDistance )
+{
+    const GLfloat o[] = { origin.x, origin.y, origin.z };
+    const GLfloat d[] = { direction.x, direction.y, direction.z };
+    const GLfloat lo[] = { box.min.x, box.min.y, box.min.z };
+    const GLfloat hi[] = { box.max.x, box.max.y, box.max.z };
+    GLfloat enter = 0, leave = maxDistance;
+
+    for( int k = 0; k < 3; k++ )
+    {
+        GLfloat t1 = ( lo[ k ] - o[ k ] ) / d[ k ];
+        GLfloat t2 = ( hi[ k ] - o[ k ] ) / d[ k ];
+        enter = std::max( enter, std::min( t1, t2 ) );
+        leave = std::min( leave, std::max( t1, t2 ) );
+    }
+    return enter <= leave;
+}
+
+/* --------------------------------------------------------------------------
+ *  runSize
+ *
+ *  Unit boxes spread over a block in front of the eye, which is at the
+ *  origin looking down -z with the Renderer's projection. Prints one line
+ *  per object count. Returns false if the tree missed an object the scans
+ *  found.
+ * -------------------------------------------------------------------------- */
+static bool runSize( int count )
+{
+    const GLfloat   side = pow( count / DENSITY, 1.0f / 3.0f );
+    AABBTree        tree;
+    Frustum         frustum;
+    QElapsedTimer   timer;
+
+    frustum.extract( Matrix4f::frustum( -1.33f, 1.33f, -1, 1, 4, 20 ) );
+
+    std::vector< BoundingBox >  boxes( count );
+    std::vector< int >          proxies( count );
+    for( int i = 0; i < count; i++ )
+        boxes[ i ] = unitBox( Vector3f( randomFloat( -side / 2, side / 2 ),
+                                        randomFloat( -side / 2, side / 2 ),
+                                        randomFloat( -side, 0 ) ) );
+
+    timer.start();
+    for( int i = 0; i < count; i++ )
+        proxies[ i ] = tree.createProxy( boxes[ i ], ( ObjectHandle )( i + 1 ) );
+    double insertMs = elapsedMs( timer );
+
+    /* Frustum query. Handles are index + 1. */
+    std::vector< ObjectHandle > result;
+    timer.start();
+    for( int r = 0; r < QUERY_REPEATS; r++ )
+    {
+        result.clear();
+        tree.query( frustum, result );
+    }
+    double queryMs = elapsedMs( timer ) / QUERY_REPEATS;
+
+    std::vector< int > visible( count, 0 );
+    int linearCount = 0;
+    timer.start();
+    for( int r = 0; r < QUERY_REPEATS; r++ )
+    {
+        linearCount = 0;
+        for( int i = 0; i < count; i++ )
+            linearCount += visible[ i ] = frustum.isVisible( boxes[ i ] );
+    }
+    double linearMs = elapsedMs( timer ) / QUERY_REPEATS;
+
+    /* The tree tests enlarged boxes, so it may find more, never less. */
+    int missed = linearCount;
+    for( size_t i = 0; i < result.size(); i++ )
+        missed -= visible[ result[ i ] - 1 ];
+
+    /* Rays from the eye through the near plane. */
+    std::vector< Vector3f > directions( RAY_COUNT );
+    for( int i = 0; i < RAY_COUNT; i++ )
+        directions[ i ] = Vector3f( randomFloat( -1.33f, 1.33f ),
+                                    randomFloat( -1, 1 ), -4 );
+    const Vector3f eye( 0, 0, 0 );
+    timer.start();
+    for( int i = 0; i < RAY_COUNT; i++ )
+    {
+        result.clear();
+        tree.queryRay( eye, directions[ i ], 5, result );
+    }
+    double rayUs = elapsedMs( timer ) * 1000 / RAY_COUNT;
+
+    /* A hundredth of the rays tested against every box, then checked
+     * against the tree's answer. */
+    const int linearRays = RAY_COUNT / 100;
+    int linearHits = 0;
+    timer.start();
+    for( int i = 0; i < linearRays; i++ )
+        for( int j = 0; j < count; j++ )
+            linearHits += hitsBox( boxes[ j ], eye, directions[ i ], 5 );
+    double linearRayUs = elapsedMs( timer ) * 1000 / linearRays;
+
+    for( int i = 0; i < linearRays; i++ )
+    {
+        result.clear();
+        tree.queryRay( eye, directions[ i ], 5, result );
+        for( size_t j = 0; j < result.size(); j++ )
+            visible[ result[ j ] - 1 ] = -1 - i;
+        for( int j = 0; j < count; j++ )
+            if( visible[ j ] != -1 - i &&
+                hitsBox( boxes[ j ], eye, directions[ i ], 5 ) )
+                missed++;
+    }
+
+    /* One percent of the objects move a little each frame. */
+    const int moves = std::max( count / 100, 1 ) * QUERY_REPEATS;
+    int reinserted = 0;
+    timer.start();
+    for( int m = 0; m < moves; m++ )
+    {
+        int i = rand() % count;
+        Vector3f center = boxes[ i ].center();
+        center.x += randomFloat( -0.05f, 0.05f );
+        center.y += randomFloat( -0.05f, 0.05f );
+        center.z += randomFloat( -0.05f, 0.05f );
+        boxes[ i ] = unitBox( center );
+        reinserted += tree.moveProxy( proxies[ i ], boxes[ i ] );
+    }
+    double moveUs = elapsedMs( timer ) * 1000 / moves;
+
+    printf( "%8d %6d %9.1f %8d %9.4f %9.4f %8.2f %9.2f %5.1f %7.3f %6.2f%% %6d\n",
+            count, tree.getHeight(), insertMs, linearCount, queryMs,
+            linearMs, rayUs, linearRayUs, ( double )linearHits / linearRays,
+            moveUs, 100.0 * reinserted / moves, missed );
+    return missed == 0;
+}
+
+/* --------------------------------------------------------------------------
+ *  treeBenchmark
+ *
+ *  Object counts default to 1k to 100k. The tree's height and query
+ *  times should grow with the logarithm of the count, the scans linearly.
+ * -------------------------------------------------------------------------- */
+int treeBenchmark( int argc, char *argv[] )
+{
+    static const int DEFAULT_COUNTS[] = { 1000, 3000, 10000, 30000, 100000 };
+    std::vector< int > counts;
+
+    for( int i = 0; i < argc; i++ )
+        counts.push_back( atoi( argv[ i ] ) );
+    if( counts.empty() )
+        counts.assign( DEFAULT_COUNTS, DEFAULT_COUNTS +
+                       sizeof( DEFAULT_COUNTS ) / sizeof( DEFAULT_COUNTS[ 0 ] ) );
+
+    srand( 1 );
+    printf( "frustum and ray times per query, linear scans for comparison\n" );
+    printf( "%8s %6s %9s %8s %9s %9s %8s %9s %5s %7s %7s %6s\n",
+            "objects", "height", "insert ms", "visible", "query ms",
+            "linear ms", "ray us", "linear us", "hits", "move us",
+            "reins.", "missed" );
+
+    bool ok = true;
+    for( size_t i = 0; i < counts.size(); i++ )
+        if( counts[ i ] > 0 )
+            ok = runSize( counts[ i ] ) && ok;
+    return ok ? 0 : 1;
+}
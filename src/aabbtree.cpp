@@ -0,0 +1,413 @@
+/* --------------------------------------------------------------------------
+ * aabbtree.cpp
+ *
+ * Implementation of the AABBTree class.
+ *
+ * -------------------------------------------------------------------------- */
+
+#include "aabbtree.h"
+#include <float.h>
+#include <cassert>
+#include <algorithm>
+
+/* Box enclosing both boxes. */
+static inline BoundingBox combine( const BoundingBox &a, const BoundingBox &b )
+{
+    BoundingBox box = a;
+    box.extend( b );
+    return box;
+}
+
+/* Box enlarged by margin on every side. */
+static inline BoundingBox fatten( const BoundingBox &box, GLfloat margin )
+{
+    return BoundingBox(
+        Vector3f( box.min.x - margin, box.min.y - margin, box.min.z - margin ),
+        Vector3f( box.max.x + margin, box.max.y + margin, box.max.z + margin ) );
+}
+
+AABBTree::AABBTree( GLfloat margin ) :
+    m_Root( NULL_NODE ),
+    m_FreeList( NULL_NODE ),
+    m_ProxyCount( 0 ),
+    m_Margin( margin )
+{
+}
+
+/* --------------------------------------------------------------------------
+ *  allocateNode & freeNode
+ *
+ *  Nodes live in one vector and are recycled through a free list, so node
+ *  ids stay valid while the vector grows.
+ * -------------------------------------------------------------------------- */
+int AABBTree::allocateNode()
+{
+    int node;
+
+    if( m_FreeList != NULL_NODE )
+    {
+        node = m_FreeList;
+        m_FreeList = m_Nodes[ node ].parent;
+    }
+    else
+    {
+        node = m_Nodes.size();
+        m_Nodes.push_back( Node() );
+    }
+
+    m_Nodes[ node ].box     = BoundingBox();
+    m_Nodes[ node ].handle  = NULL_HANDLE;
+    m_Nodes[ node ].parent  = NULL_NODE;
+    m_Nodes[ node ].child1  = NULL_NODE;
+    m_Nodes[ node ].child2  = NULL_NODE;
+    m_Nodes[ node ].height  = 0;
+    return node;
+}
+
+void AABBTree::freeNode( int node )
+{
+    m_Nodes[ node ].parent = m_FreeList;
+    m_Nodes[ node ].height = -1;
+    m_FreeList = node;
+}
+
+/* --------------------------------------------------------------------------
+ *  createProxy, destroyProxy & moveProxy
+ * -------------------------------------------------------------------------- */
+int AABBTree::createProxy( const BoundingBox &box, ObjectHandle handle )
+{
+    int leaf = allocateNode();
+
+    m_Nodes[ leaf ].box = fatten( box, m_Margin );
+    m_Nodes[ leaf ].handle = handle;
+
+    insertLeaf( leaf );
+    m_ProxyCount++;
+    return leaf;
+}
+
+void AABBTree::destroyProxy( int proxy )
+{
+    assert( m_Nodes[ proxy ].isLeaf() );
+
+    removeLeaf( proxy );
+    freeNode( proxy );
+    m_ProxyCount--;
+}
+
+bool AABBTree::moveProxy( int proxy, const BoundingBox &box )
+{
+    assert( m_Nodes[ proxy ].isLeaf() );
+
+    if( m_Nodes[ proxy ].box.contains( box ) )
+        return false;
+
+    removeLeaf( proxy );
+    m_Nodes[ proxy ].box = fatten( box, m_Margin );
+    insertLeaf( proxy );
+    return true;
+}
+
+/* --------------------------------------------------------------------------
+ *  insertLeaf
+ *
+ *  Walks down towards the child whose box grows the surface area least,
+ *  stopping when making a new parent here is cheaper than going on. The
+ *  boxes and heights of the ancestors are then refit on the way back up.
+ * -------------------------------------------------------------------------- */
+void AABBTree::insertLeaf( int leaf )
+{
+    if( m_Root == NULL_NODE )
+    {
+        m_Root = leaf;
+        m_Nodes[ m_Root ].parent = NULL_NODE;
+        return;
+    }
+
+    const BoundingBox   leafBox = m_Nodes[ leaf ].box;
+    int                 index = m_Root;
+
+    while( !m_Nodes[ index ].isLeaf() )
+    {
+        int     child1 = m_Nodes[ index ].child1;
+        int     child2 = m_Nodes[ index ].child2;
+        GLfloat area = m_Nodes[ index ].box.surfaceArea();
+        GLfloat combinedArea = combine( m_Nodes[ index ].box, leafBox ).surfaceArea();
+
+        /* Cost of a new parent for this node and the leaf, and the minimum
+         * cost of pushing the leaf further down. */
+        GLfloat cost = 2 * combinedArea;
+        GLfloat inheritanceCost = 2 * ( combinedArea - area );
+        GLfloat cost1, cost2;
+
+        GLfloat newArea1 = combine( leafBox, m_Nodes[ child1 ].box ).surfaceArea();
+        cost1 = m_Nodes[ child1 ].isLeaf() ?
+                newArea1 + inheritanceCost :
+                newArea1 - m_Nodes[ child1 ].box.surfaceArea() + inheritanceCost;
+
+        GLfloat newArea2 = combine( leafBox, m_Nodes[ child2 ].box ).surfaceArea();
+        cost2 = m_Nodes[ child2 ].isLeaf() ?
+                newArea2 + inheritanceCost :
+                newArea2 - m_Nodes[ child2 ].box.surfaceArea() + inheritanceCost;
+
+        if( cost < cost1 && cost < cost2 )
+            break;
+
+        index = cost1 < cost2 ? child1 : child2;
+    }
+
+    /* New parent for the sibling and the leaf. */
+    int sibling   = index;
+    int oldParent = m_Nodes[ sibling ].parent;
+    int newParent = allocateNode();
+
+    m_Nodes[ newParent ].parent = oldParent;
+    m_Nodes[ newParent ].box    = combine( leafBox, m_Nodes[ sibling ].box );
+    m_Nodes[ newParent ].height = m_Nodes[ sibling ].height + 1;
+    m_Nodes[ newParent ].child1 = sibling;
+    m_Nodes[ newParent ].child2 = leaf;
+    m_Nodes[ sibling ].parent   = newParent;
+    m_Nodes[ leaf ].parent      = newParent;
+
+    if( oldParent != NULL_NODE )
+    {
+        if( m_Nodes[ oldParent ].child1 == sibling )
+            m_Nodes[ oldParent ].child1 = newParent;
+        else
+            m_Nodes[ oldParent ].child2 = newParent;
+    }
+    else
+    {
+        m_Root = newParent;
+    }
+
+    for( index = m_Nodes[ leaf ].parent; index != NULL_NODE;
+         index = m_Nodes[ index ].parent )
+    {
+        index = balance( index );
+
+        int child1 = m_Nodes[ index ].child1;
+        int child2 = m_Nodes[ index ].child2;
+        m_Nodes[ index ].height = 1 + std::max( m_Nodes[ child1 ].height,
+                                                m_Nodes[ child2 ].height );
+        m_Nodes[ index ].box = combine( m_Nodes[ child1 ].box,
+                                        m_Nodes[ child2 ].box );
+    }
+}
+
+/* --------------------------------------------------------------------------
+ *  removeLeaf
+ *
+ *  The parent of the leaf is replaced by the leaf's sibling.
+ * -------------------------------------------------------------------------- */
+void AABBTree::removeLeaf( int leaf )
+{
+    if( leaf == m_Root )
+    {
+        m_Root = NULL_NODE;
+        return;
+    }
+
+    int parent      = m_Nodes[ leaf ].parent;
+    int grandParent = m_Nodes[ parent ].parent;
+    int sibling     = m_Nodes[ parent ].child1 == leaf ?
+                      m_Nodes[ parent ].child2 : m_Nodes[ parent ].child1;
+
+    if( grandParent == NULL_NODE )
+    {
+        m_Root = sibling;
+        m_Nodes[ sibling ].parent = NULL_NODE;
+        freeNode( parent );
+        return;
+    }
+
+    if( m_Nodes[ grandParent ].child1 == parent )
+        m_Nodes[ grandParent ].child1 = sibling;
+    else
+        m_Nodes[ grandParent ].child2 = sibling;
+    m_Nodes[ sibling ].parent = grandParent;
+    freeNode( parent );
+
+    for( int index = grandParent; index != NULL_NODE;
+         index = m_Nodes[ index ].parent )
+    {
+        index = balance( index );
+
+        int child1 = m_Nodes[ index ].child1;
+        int child2 = m_Nodes[ index ].child2;
+        m_Nodes[ index ].box = combine( m_Nodes[ child1 ].box,
+                                        m_Nodes[ child2 ].box );
+        m_Nodes[ index ].height = 1 + std::max( m_Nodes[ child1 ].height,
+                                                m_Nodes[ child2 ].height );
+    }
+}
+
+/* --------------------------------------------------------------------------
+ *  balance
+ *
+ *  If one child of node a is more than one level higher than the other, the
+ *  higher child is rotated up to take a's place. Returns the node now at
+ *  a's position.
+ * -------------------------------------------------------------------------- */
+int AABBTree::balance( int a )
+{
+    Node &A = m_Nodes[ a ];
+    if( A.isLeaf() || A.height < 2 )
+        return a;
+
+    int b = A.child1;
+    int c = A.child2;
+    int difference = m_Nodes[ c ].height - m_Nodes[ b ].height;
+
+    if( difference > 1 || difference < -1 )
+    {
+        /* Rotate the higher child ( up ) and give its lower child to a. */
+        int up    = difference > 1 ? c : b;
+        int other = difference > 1 ? b : c;
+        Node &U   = m_Nodes[ up ];
+        int f     = U.child1;
+        int g     = U.child2;
+
+        U.child1 = a;
+        U.parent = A.parent;
+        A.parent = up;
+
+        if( U.parent != NULL_NODE )
+        {
+            if( m_Nodes[ U.parent ].child1 == a )
+                m_Nodes[ U.parent ].child1 = up;
+            else
+                m_Nodes[ U.parent ].child2 = up;
+        }
+        else
+        {
+            m_Root = up;
+        }
+
+        /* The higher grandchild stays with up, the lower one goes to a. */
+        int keep = m_Nodes[ f ].height > m_Nodes[ g ].height ? f : g;
+        int give = keep == f ? g : f;
+
+        U.child2 = keep;
+        if( difference > 1 )
+            A.child2 = give;
+        else
+            A.child1 = give;
+        m_Nodes[ give ].parent = a;
+
+        A.box = combine( m_Nodes[ other ].box, m_Nodes[ give ].box );
+        U.box = combine( A.box, m_Nodes[ keep ].box );
+        A.height = 1 + std::max( m_Nodes[ other ].height,
+                                 m_Nodes[ give ].height );
+        U.height = 1 + std::max( A.height, m_Nodes[ keep ].height );
+        return up;
+    }
+    return a;
+}
+
+/* --------------------------------------------------------------------------
+ *  query
+ *
+ *  Subtrees completely inside the frustum are collected without testing
+ *  their nodes.
+ * -------------------------------------------------------------------------- */
+void AABBTree::query( const Frustum &frustum,
+                      std::vector< ObjectHandle > &result ) const
+{
+    if( m_Root == NULL_NODE )
+        return;
+
+    /* Entries are ~node for subtrees already known to be inside. */
+    m_Stack.clear();
+    m_Stack.push_back( m_Root );
+    while( !m_Stack.empty() )
+    {
+        int     entry = m_Stack.back();
+        bool    inside = entry < 0;
+        int     index = inside ? ~entry : entry;
+        m_Stack.pop_back();
+
+        const Node &node = m_Nodes[ index ];
+        if( !inside )
+        {
+            Frustum::Result r = frustum.classify( node.box );
+            if( r == Frustum::OUTSIDE )
+                continue;
+            inside = r == Frustum::INSIDE;
+        }
+
+        if( node.isLeaf() )
+        {
+            result.push_back( node.handle );
+        }
+        else
+        {
+            m_Stack.push_back( inside ? ~node.child1 : node.child1 );
+            m_Stack.push_back( inside ? ~node.child2 : node.child2 );
+        }
+    }
+}
+
+/* --------------------------------------------------------------------------
+ *  queryRay
+ *
+ *  Slab test against each node box.
+ * -------------------------------------------------------------------------- */
+static bool rayHitsBox( const Vector3f &origin, const Vector3f &inverse,
+                        const BoundingBox &box, GLfloat maxDistance )
+{
+    GLfloat tMin = 0, tMax = maxDistance;
+    const GLfloat o[ 3 ]    = { origin.x, origin.y, origin.z };
+    const GLfloat inv[ 3 ]  = { inverse.x, inverse.y, inverse.z };
+    const GLfloat bmin[ 3 ] = { box.min.x, box.min.y, box.min.z };
+    const GLfloat bmax[ 3 ] = { box.max.x, box.max.y, box.max.z };
+
+    for( int i = 0; i < 3; i++ )
+    {
+        GLfloat t1 = ( bmin[ i ] - o[ i ] ) * inv[ i ];
+        GLfloat t2 = ( bmax[ i ] - o[ i ] ) * inv[ i ];
+        if( t1 > t2 ) std::swap( t1, t2 );
+        /* NaN ( 0 * inf for a ray in the slab plane ) fails neither test. */
+        if( t1 > tMin ) tMin = t1;
+        if( t2 < tMax ) tMax = t2;
+        if( tMin > tMax )
+            return false;
+    }
+    return true;
+}
+
+void AABBTree::queryRay( const Vector3f &origin, const Vector3f &direction,
+                         GLfloat maxDistance,
+                         std::vector< ObjectHandle > &result ) const
+{
+    if( m_Root == NULL_NODE )
+        return;
+
+    Vector3f inverse( 1 / direction.x, 1 / direction.y, 1 / direction.z );
+
+    m_Stack.clear();
+    m_Stack.push_back( m_Root );
+    while( !m_Stack.empty() )
+    {
+        const Node &node = m_Nodes[ m_Stack.back() ];
+        m_Stack.pop_back();
+
+        if( !rayHitsBox( origin, inverse, node.box, maxDistance ) )
+            continue;
+
+        if( node.isLeaf() )
+        {
+            result.push_back( node.handle );
+        }
+        else
+        {
+            m_Stack.push_back( node.child1 );
+            m_Stack.push_back( node.child2 );
+        }
+    }
+}
+
+int AABBTree::getHeight() const
+{
+    return m_Root == NULL_NODE ? 0 : m_Nodes[ m_Root ].height;
+}
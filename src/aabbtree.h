@@ -0,0 +1,89 @@
+/* --------------------------------------------------------------------------
+ * aabbtree.h
+ *
+ * Dynamic bounding volume hierarchy over the drawables of a scene.
+ *
+ * -------------------------------------------------------------------------- */
+
+#ifndef AABBTREE_H
+#define AABBTREE_H
+
+#include "renderer.h"
+#include <vector>
+
+/* --------------------------------------------------------------------------
+ *  AABBTree
+ *
+ *  Binary tree of axis aligned boxes with the handle of one drawable in
+ *  each leaf. Leaf boxes are enlarged by a margin, so that a drawable can
+ *  move a little without its leaf having to be reinserted. Leaves are
+ *  inserted next to the sibling that grows the total surface area least,
+ *  and the tree is kept balanced with rotations like an AVL tree, so
+ *  queries stay logarithmic as drawables are added, moved and removed.
+ *
+ *  Reference: Erin Catto, b2DynamicTree in Box2D ( 2009 )
+ * -------------------------------------------------------------------------- */
+class AABBTree
+{
+public:
+    enum { NULL_NODE = -1 };
+
+    explicit AABBTree( GLfloat margin = 0.1f );
+
+    /* Adds a leaf and returns its id, which stays the same until the leaf
+     * is removed. */
+    int         createProxy( const BoundingBox &box, ObjectHandle handle );
+    void        destroyProxy( int proxy );
+
+    /* Updates the box of a leaf. The leaf is only reinserted if the new box
+     * is not inside the enlarged one. Returns true if it was. */
+    bool        moveProxy( int proxy, const BoundingBox &box );
+
+    ObjectHandle getHandle( int proxy ) const { return m_Nodes[ proxy ].handle; }
+    const BoundingBox &getFatBounds( int proxy ) const
+                                { return m_Nodes[ proxy ].box; }
+
+    /* Appends the handles of the leaves not outside the frustum. */
+    void        query( const Frustum &frustum,
+                       std::vector< ObjectHandle > &result ) const;
+
+    /* Appends the handles of the leaves the ray hits closer than
+     * maxDistance. direction does not need to be of unit length, distances
+     * are in its units. */
+    void        queryRay( const Vector3f &origin, const Vector3f &direction,
+                          GLfloat maxDistance,
+                          std::vector< ObjectHandle > &result ) const;
+
+    int         getHeight() const;
+    int         getProxyCount() const { return m_ProxyCount; }
+
+private:
+    struct Node
+    {
+        BoundingBox box;
+        ObjectHandle handle;
+        /* Parent, or the next free node when on the free list. */
+        int         parent;
+        int         child1;
+        int         child2;
+        /* Leaves are at height 0, free nodes at -1. */
+        int         height;
+
+        bool isLeaf() const { return child1 == NULL_NODE; }
+    };
+
+    std::vector< Node >         m_Nodes;
+    int                         m_Root;
+    int                         m_FreeList;
+    int                         m_ProxyCount;
+    GLfloat                     m_Margin;
+    mutable std::vector< int >  m_Stack;
+
+    int         allocateNode();
+    void        freeNode( int node );
+    void        insertLeaf( int leaf );
+    void        removeLeaf( int leaf );
+    int         balance( int node );
+};
+
+#endif /* AABBTREE_H */
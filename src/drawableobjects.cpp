@@ -54,18 +54,34 @@
             2.1.1. BaseDrawable ( ctor )
             2.1.2. setScaling & scale
             2.1.3. checkBounds
+            2.1.4. getRenderItem
+            2.1.5. colorMaterialId
+            2.1.6. setLocalBounds
+            2.1.7. computeWorldMatrix
+            2.1.8. getWorldBounds & getBoundingSphere
+            2.1.9. intersectRay
+            2.1.10. parts
         2.2. Box
             2.2.1. Box ( ctor )
             2.2.2. draw
-            2.2.3. draw ( overloaded )
+            2.2.3. drawShape
+            2.2.4. applyMaterial & materialId
+            2.2.5. computeWorldMatrix
+            2.2.6. getMeshMatrix
         2.3. Plane
             2.3.1. Plane ( ctor )
             2.3.2. draw
+            2.3.3. applyMaterial & materialId
+            2.3.4. getMeshMatrix
         2.4. WFObject
-            2.4.1. WFObject ( ctor )
+            2.4.1. WFObject ( ctor & dtor )
             2.4.2. draw
-            2.4.3. setMaterial
+            2.4.3. setMaterial & lookUpMaterial
             2.4.4. setTexture
+            2.4.5. applyMaterial
+            2.4.6. textureId
+            2.4.7. intersectRay
+            2.4.8. meshLoaded
         2.5. RasterMap
             2.5.1. RasterMap ( ctor & dtor )
             2.5.2. drawPixel
@@ -73,6 +89,7 @@
             2.5.4. drawLine
             2.5.5. drawCircle
             2.5.6. draw
+            2.5.7. computeWorldMatrix
         2.6. ParticleBox
             2.6.1. ParticleBox ( ctor )
             2.6.2. draw
@@ -92,14 +109,13 @@
 
    ************************************************************************** */
 
-#include "wf_loader.h"
 #include <cassert>
 //#include <QGLWidget>
 #include <math.h>
 #include "timer.h"
 #include "stdio.h"
 #include "drawableobjects.h"
-#include <GL/glu.h>
+#include "statemanager.h"
 
 /* **************************************************************************
 
@@ -121,8 +137,13 @@ const float PI = 3.14159265;
  *  Constructor
  * -------------------------------------------------------------------------- */
 BaseDrawable::BaseDrawable() :
+    m_Handle( NULL_HANDLE ),
     m_IsMovable( false ),
-    m_IsRotatable( false )
+    m_IsRotatable( false ),
+    m_RenderFlags( RenderItem::LIGHTING | RenderItem::SMOOTH_SHADING ),
+    m_pListener( NULL ),
+    m_WorldMatrixValid( false ),
+    m_pParts( NULL )
 {
     m_Position  = Vector3f( 0, 0, 0 );
     m_Rotation  = Vector3f( 0, 0, 0 );
@@ -134,17 +155,20 @@ BaseDrawable::BaseDrawable() :
 /* --------------------------------------------------------------------------
  *  2.1.2. setScaling & scale
  *
- *  Setters for scale values. Each function also checks the scale bounds.
+ *  Setters for scale values. Each function also checks the scale bounds and
+ *  notifies the listener.
  * -------------------------------------------------------------------------- */
 void BaseDrawable::setScaling( const Vector3f &scale )
 {
     m_Scaling = scale;
     checkBounds();
+    notifyTransform();
 }
 void BaseDrawable::setScaling( GLfloat x, GLfloat y, GLfloat z )
 {
     m_Scaling = Vector3f( x, y ,z );
     checkBounds();
+    notifyTransform();
 }
 void BaseDrawable::scale( GLfloat x, GLfloat y, GLfloat z )
 {
@@ -152,6 +176,7 @@ void BaseDrawable::scale( GLfloat x, GLfloat y, GLfloat z )
     m_Scaling.y += y;
     m_Scaling.z += z;
     checkBounds();
+    notifyTransform();
 }
 
 /* --------------------------------------------------------------------------
@@ -169,6 +194,126 @@ void BaseDrawable::checkBounds()
     if( m_Scaling.z > 2 ) m_Scaling.z = 2;
 }
 
+/* --------------------------------------------------------------------------
+ *  2.1.4. getRenderItem
+ * -------------------------------------------------------------------------- */
+RenderItem BaseDrawable::getRenderItem()
+{
+    RenderItem item;
+
+    item.pDrawable  = this;
+    item.pMesh      = renderMesh();
+    item.pLods      = renderLods();
+    item.flags      = m_RenderFlags;
+    item.texture    = textureId();
+    item.material   = materialId();
+    /* The camera looks down the negative z-axis from the origin. */
+    item.depth      = -m_Position.z;
+
+    return item;
+}
+
+/* --------------------------------------------------------------------------
+ *  2.1.5. colorMaterialId
+ *
+ *  Packs the 8-bit color components and shininess into an id with the
+ *  highest bit set.
+ * -------------------------------------------------------------------------- */
+GLuint BaseDrawable::colorMaterialId( const Vector3f &color, int shininess )
+{
+    return 0x80000000u |
+           ( ( GLuint )shininess & 0x7f ) << 24 |
+           ( ( GLuint )color.x & 0xff ) << 16 |
+           ( ( GLuint )color.y & 0xff ) << 8 |
+           ( ( GLuint )color.z & 0xff );
+}
+
+/* --------------------------------------------------------------------------
+ *  2.1.6. setLocalBounds
+ *
+ *  The sphere is centred on the box and touches its corners.
+ * -------------------------------------------------------------------------- */
+void BaseDrawable::setLocalBounds( const BoundingBox &box )
+{
+    Vector3f e = box.extents();
+
+    m_LocalBounds = box;
+    m_LocalSphere = BoundingSphere( box.center(),
+                                    sqrt( e.x * e.x + e.y * e.y + e.z * e.z ) );
+}
+
+/* --------------------------------------------------------------------------
+ *  2.1.7. computeWorldMatrix
+ *
+ *  Translation * rotations, the translation going straight into the last
+ *  column.
+ * -------------------------------------------------------------------------- */
+Matrix4f BaseDrawable::computeWorldMatrix()
+{
+    Matrix4f r = Matrix4f::rotationXYZ( m_Rotation.x, m_Rotation.y,
+                                        m_Rotation.z );
+    r.m[ 12 ] = m_Position.x;
+    r.m[ 13 ] = m_Position.y;
+    r.m[ 14 ] = m_Position.z;
+    return r;
+}
+
+/* --------------------------------------------------------------------------
+ *  2.1.8. getWorldBounds & getBoundingSphere
+ * -------------------------------------------------------------------------- */
+BoundingBox BaseDrawable::getWorldBounds()
+{
+    if( m_pParts )
+        return updateParts().bounds();
+    return m_LocalBounds.transformed( worldMatrix() );
+}
+
+BoundingSphere BaseDrawable::getBoundingSphere()
+{
+    return m_LocalSphere.transformed( worldMatrix() );
+}
+
+/* --------------------------------------------------------------------------
+ *  2.1.9. intersectRay
+ *
+ *  The ray is moved to object space, where it is tested against the local
+ *  bounds. An affine transformation keeps the distances along the ray, so
+ *  the hit distance needs no converting back.
+ * -------------------------------------------------------------------------- */
+bool BaseDrawable::intersectRay( const Vector3f &origin,
+                                 const Vector3f &direction,
+                                 GLfloat &distance )
+{
+    if( m_pParts )
+        return intersectPart( origin, direction, distance ) >= 0;
+
+    Matrix4f toLocal = worldMatrix().affineInverse();
+    GLfloat  hit;
+
+    if( !m_LocalBounds.intersectRay( toLocal.transformPoint( origin ),
+                                     toLocal.transformVector( direction ),
+                                     distance, hit ) )
+        return false;
+
+    distance = hit;
+    return true;
+}
+
+/* --------------------------------------------------------------------------
+ *  2.1.10. parts
+ * -------------------------------------------------------------------------- */
+TransformHierarchy &BaseDrawable::parts()
+{
+    if( !m_pParts )
+    {
+        /* The root's matrix is set when the world matrix is next built. */
+        m_pParts = new TransformHierarchy;
+        m_pParts->addNode( TransformHierarchy::NO_PARENT );
+        m_WorldMatrixValid = false;
+    }
+    return *m_pParts;
+}
+
 /* --------------------------------------------------------------------------
  *  2.2. Box
  *
@@ -178,58 +323,22 @@ void BaseDrawable::checkBounds()
 /* --------------------------------------------------------------------------
  *  2.2.1. Box
  *
- *  Creates vertices and normals for a box object. Size can be given as width,
- *  height an depth values. Origin is at the centre of the object.
+ *  Creates a box object. Size can be given as width, height an depth values.
+ *  Origin is at the centre of the object. All boxes share the unit cube of
+ *  the GeometryCache, scaled to their size when drawn.
  * -------------------------------------------------------------------------- */
-Box::Box( GLfloat w, GLfloat h, GLfloat d )
+Box::Box( GLfloat w, GLfloat h, GLfloat d ) :
+    m_Size( w, h, d ),
+    m_pCube( &GeometryCache::getInstance()->cube() )
 {
     assert( w > 0 && h > 0 && d > 0 );
     w /= 2;
     h /= 2;
     d /= 2;
 
-    /* Coord of each corner. */
-    GLfloat temp[] = { -w, -h, -d,
-                        w, -h, -d,
-                        w,  h, -d,
-                       -w,  h, -d,
-                       -w, -h,  d,
-                        w, -h,  d,
-                        w,  h,  d,
-                       -w,  h,  d };
-
-    memcpy( m_Vertices, temp, sizeof(temp) );
-
-    /* Generate normal vectors, one for each side */
-    GLfloat normals[] = { 0,  0,  1,
-                          1,  0,  0,
-                          0, -1,  0,
-                          0,  0, -1,
-                         -1,  0,  0,
-                          0,  1,  0 };
-
-    memcpy( m_Normals, normals, sizeof( normals ) );
-
-    /* Define which side is assosiated to which corner coords.
-     * All coords must be on the same plane. */
-    GLubyte frontIndices[]      = { 4, 5, 6, 7 };
-    GLubyte rightIndices[]      = { 1, 2, 6, 5 };
-    GLubyte bottomIndices[]     = { 0, 1, 5, 4 };
-    GLubyte backIndices[]       = { 0, 3, 2, 1 };
-    GLubyte leftIndices[]       = { 0, 4, 7, 3 };
-    GLubyte topIndices[]        = { 2, 3, 7, 6 };
-
-    memcpy( m_Indices[0], frontIndices, sizeof( frontIndices ) );
-    memcpy( m_Indices[1], rightIndices, sizeof( rightIndices ) );
-    memcpy( m_Indices[2], bottomIndices, sizeof( bottomIndices ) );
-    memcpy( m_Indices[3], backIndices, sizeof( backIndices ) );
-    memcpy( m_Indices[4], leftIndices, sizeof( leftIndices ) );
-    memcpy( m_Indices[5], topIndices, sizeof( topIndices ) );
-
-    /* Defines how many points each indice has.
-     * This is for the glMultiDrawElements. */
-    GLsizei tempCount[] = { 4, 4, 4, 4, 4, 4 };
-    memcpy( m_Count, tempCount, sizeof( tempCount ) );
+    m_RenderFlags |= RenderItem::COLOR_MATERIAL;
+
+    setLocalBounds( BoundingBox( Vector3f( -w, -h, -d ), Vector3f( w, h, d ) ) );
 
 }
 
@@ -237,66 +346,93 @@ Box::Box( GLfloat w, GLfloat h, GLfloat d )
  *  2.2.2. draw
  *
  *  Implementation of the pure virtual method.
- *  Calls draw( bool, bool ) which does the real drawing.
+ *  Loads the world matrix and calls drawShape which does the real drawing.
  * -------------------------------------------------------------------------- */
 void Box::draw()
 {
-    draw( true );
+    /* Position, scaling, rotation and origin translation.
+     */
+    loadWorldMatrix();
+    drawShape();
 }
 
 /* --------------------------------------------------------------------------
- *  2.2.3. draw ( overloaded )
+ *  2.2.3. drawShape
  *
- *  Draws the box using vertex array. Can be drawn as a solid or a wireframe
- *  model. Parameter loadIdentity defines if the matrix multiplications should
- *  be done on a identity matrix or on top of previous multiplications.
+ *  Draws the box from the shared cube. The box's own transformations are
+ *  not applied, so a box can also be drawn as a part of another drawable.
+ *  Leaves the modelview matrix scaled to the box's size.
  * -------------------------------------------------------------------------- */
-void Box::draw( bool loadIdentity, bool wireframe )
+void Box::drawShape()
 {
-    glMatrixMode( GL_MODELVIEW );
-    if( loadIdentity )
-        glLoadIdentity();
-
-    /* Position, scaling and rotation.
-     */
-    glTranslatef( m_Position.x, m_Position.y, m_Position.z );
-
-    glScalef( m_Scaling.x, m_Scaling.y, m_Scaling.z );
-
-    glRotatef( m_Rotation.x, 1.0, 0.0, 0.0 );
-    glRotatef( m_Rotation.y, 0.0, 1.0, 0.0 );
-    glRotatef( m_Rotation.z, 0.0, 0.0, 1.0 );
-
-    /* Origin translation */
-    glTranslatef( m_Origin.x, m_Origin.y, m_Origin.z );
+    glScalef( m_Size.x, m_Size.y, m_Size.z );
+    m_pCube->draw();
+}
 
+/* --------------------------------------------------------------------------
+ *  2.2.4. applyMaterial & materialId
+ *
+ *  The material of a box is defined by its color.
+ * -------------------------------------------------------------------------- */
+void Box::applyMaterial()
+{
     GLfloat color[] = { m_Color.x / 255, m_Color.y / 255, m_Color.z / 255, 1.0 };
     GLfloat shininess[] = { 2.0 };
 
     /* Set material's ambient and diffuse parameters.
      * In other words: What color our object seems to be. */
-    glMaterialfv( GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE, color );
-    glMaterialfv( GL_FRONT, GL_SHININESS, shininess );
+    StateManager *state = StateManager::getInstance();
+    state->materialfv( GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE, color );
+    state->materialfv( GL_FRONT, GL_SHININESS, shininess );
+}
 
-    /* Enable vertex array and tell OpenGL where our stored vertices lie. */
-    glEnableClientState( GL_VERTEX_ARRAY );
-    glVertexPointer( 3, GL_FLOAT, 0, m_Vertices );
+/* The color comes with each instance, see RenderItem::COLOR_MATERIAL. */
+GLuint Box::materialId()
+{
+    return colorMaterialId( Vector3f( 0, 0, 0 ), 2 );
+}
 
-    /* Draw each side of the box. */
-    for( int i = 0; i < 6; i++ )
+/* --------------------------------------------------------------------------
+ *  2.2.5. computeWorldMatrix
+ *
+ *  Boxes are also scaled and translated by their origin:
+ *  translation * scaling * rotations * origin translation. The scaling
+ *  scales the rows of the rotation, and the origin is moved by both.
+ * -------------------------------------------------------------------------- */
+Matrix4f Box::computeWorldMatrix()
+{
+    Matrix4f r = Matrix4f::rotationXYZ( m_Rotation.x, m_Rotation.y,
+                                        m_Rotation.z );
+    for( int col = 0; col < 3; col++ )
     {
-        if( wireframe )
-            glBegin( GL_LINE_STRIP );
-        else
-            glBegin( GL_QUADS );
-
-        glNormal3fv( &m_Normals[ i * 3 ] );
-        glArrayElement( m_Indices[ i ][ 0 ] );
-        glArrayElement( m_Indices[ i ][ 1 ] );
-        glArrayElement( m_Indices[ i ][ 2 ] );
-        glArrayElement( m_Indices[ i ][ 3 ] );
-        glEnd();
+        r.m[ col * 4 ]     *= m_Scaling.x;
+        r.m[ col * 4 + 1 ] *= m_Scaling.y;
+        r.m[ col * 4 + 2 ] *= m_Scaling.z;
     }
+
+    Vector3f origin = r.transformVector( m_Origin );
+    r.m[ 12 ] = m_Position.x + origin.x;
+    r.m[ 13 ] = m_Position.y + origin.y;
+    r.m[ 14 ] = m_Position.z + origin.z;
+    return r;
+}
+
+/* --------------------------------------------------------------------------
+ *  2.2.6. getMeshMatrix
+ *
+ *  The world matrix scaled to the size of the box, the first three columns
+ *  of it scaled like glScalef would.
+ * -------------------------------------------------------------------------- */
+Matrix4f Box::getMeshMatrix()
+{
+    Matrix4f m = worldMatrix();
+    for( int row = 0; row < 3; row++ )
+    {
+        m.m[ row ]     *= m_Size.x;
+        m.m[ 4 + row ] *= m_Size.y;
+        m.m[ 8 + row ] *= m_Size.z;
+    }
+    return m;
 }
 
 /* --------------------------------------------------------------------------
@@ -311,59 +447,69 @@ void Box::draw( bool loadIdentity, bool wireframe )
  *
  *  Constructor for a plane object.
  * -------------------------------------------------------------------------- */
-Plane::Plane( GLfloat w, GLfloat h )
+Plane::Plane( GLfloat w, GLfloat h ) :
+    m_Width( w ),
+    m_Height( h ),
+    m_pSquare( &GeometryCache::getInstance()->square() )
 {
     assert( w > 0 && h > 0 );
 
+    m_RenderFlags |= RenderItem::COLOR_MATERIAL;
+
     w /= 2;
     h /= 2;
-    /* Create coords that lie on a z-plane. */
-    GLfloat vertices[] = { -w, -h, 0,
-                            w, -h, 0,
-                           -w,  h, 0,
-                            w,  h, 0 };
-
-    memcpy( m_Vertices, vertices, sizeof( vertices ) );
+    /* The plane lies on a z-plane. */
+    setLocalBounds( BoundingBox( Vector3f( -w, -h, 0 ), Vector3f( w, h, 0 ) ) );
 }
 
 /* --------------------------------------------------------------------------
  *  2.3.2. draw
  *
- *  Draw the plane.
+ *  Draw the plane from the shared square, scaled to the plane's size.
  * -------------------------------------------------------------------------- */
 void Plane::draw()
 {
-    glMatrixMode( GL_MODELVIEW );
-    glLoadIdentity();
-
-    glTranslatef( m_Position.x, m_Position.y, m_Position.z );
-    glRotatef( m_Rotation.x, 1.0, 0.0, 0.0 );
-    glRotatef( m_Rotation.y, 0.0, 1.0, 0.0 );
-    glRotatef( m_Rotation.z, 0.0, 0.0, 1.0 );
+    loadWorldMatrix();
+    glScalef( m_Width, m_Height, 1.0 );
+    m_pSquare->draw();
+}
 
+/* --------------------------------------------------------------------------
+ *  2.3.3. applyMaterial & materialId
+ *
+ *  The material of a plane is defined by its color.
+ * -------------------------------------------------------------------------- */
+void Plane::applyMaterial()
+{
     GLfloat color[] = { m_Color.x / 255, m_Color.y / 255, m_Color.z / 255, 1.0 };
-
-
     GLfloat shininess[] = { 50.0 };
 
-
     /* Set material's ambient and diffuse parameters.
      * In other words: What color our object seems to be. */
+    StateManager *state = StateManager::getInstance();
+    state->materialfv( GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE, color );
+    state->materialfv( GL_FRONT, GL_SHININESS, shininess );
+}
 
-    glMaterialfv( GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE, color );
-
-    glMaterialfv( GL_FRONT, GL_SHININESS, shininess );
-
-    /* Draw using triangle strips. */
-    glBegin( GL_TRIANGLE_STRIP );
-
-    glNormal3f( 0.0, -1.0, 0.0 );
-    glTexCoord2f( 0, 0 );        glVertex3fv( &m_Vertices[0] );
-    glTexCoord2f( 1, 0 );        glVertex3fv( &m_Vertices[3] );
-    glTexCoord2f( 0, 1 );        glVertex3fv( &m_Vertices[6] );
-    glTexCoord2f( 1, 1 );        glVertex3fv( &m_Vertices[9] );
+GLuint Plane::materialId()
+{
+    return colorMaterialId( Vector3f( 0, 0, 0 ), 50 );
+}
 
-    glEnd();
+/* --------------------------------------------------------------------------
+ *  2.3.4. getMeshMatrix
+ *
+ *  The world matrix scaled to the size of the plane.
+ * -------------------------------------------------------------------------- */
+Matrix4f Plane::getMeshMatrix()
+{
+    Matrix4f m = worldMatrix();
+    for( int row = 0; row < 3; row++ )
+    {
+        m.m[ row ]     *= m_Width;
+        m.m[ 4 + row ] *= m_Height;
+    }
+    return m;
 }
 
 /* --------------------------------------------------------------------------
@@ -374,115 +520,181 @@ void Plane::draw()
 
 
 /* --------------------------------------------------------------------------
- *  2.4.1. WFObject ( ctor )
+ *  2.4.1. WFObject ( ctor & dtor )
  *
- *  Loads a WaveFront object file and parses model data to m_ModelData.
+ *  Gets the model of a WaveFront object file from the MeshManager, which
+ *  loads it unless another object already has, now or in the background.
  * -------------------------------------------------------------------------- */
-WFObject::WFObject( const char *filename )
+WFObject::WFObject( const char *filename, LoadMode mode,
+                    const BoundingBox &placeholder,
+                    CachedMesh::VertexFormat format ) :
+    m_MaterialId( 0 )
 {
-    WFLoader loader;
-    loader.load( filename, WFLoader::OBJ_FILE );
+    m_RenderFlags |= RenderItem::TEXTURE;
 
-    m_ModelData = loader.m_LoadedData;
+    if( mode == LOAD_NOW )
+    {
+        meshLoaded( MeshManager::getInstance()->getMesh( filename, format ) );
+        return;
+    }
+
+    if( placeholder.isEmpty() )
+        setLocalBounds( BoundingBox( Vector3f( -0.5, -0.5, -0.5 ),
+                                     Vector3f( 0.5, 0.5, 0.5 ) ) );
+    else
+        setLocalBounds( placeholder );
+    MeshManager::getInstance()->requestMesh( filename, this, format );
+}
+
+WFObject::~WFObject()
+{
+    if( !m_pMesh )
+        MeshManager::getInstance()->cancelRequests( this );
 }
 
 /* --------------------------------------------------------------------------
  *  2.4.2. draw
  *
- *  Draws the model using parameters from m_ModelData and m_MaterialData.
+ *  Draws the model's mesh. Texture and material are set by the render
+ *  queue, which draws the mesh itself ( see RenderItem::pMesh ); this is
+ *  used for the ID buffer, and for the placeholder until the mesh is
+ *  loaded.
  * -------------------------------------------------------------------------- */
 void WFObject::draw()
 {
-    GLfloat color[ 4 ];
-
-    glMatrixMode( GL_MODELVIEW );
-    glLoadIdentity();
-
     /* Orientations
      */
-    glTranslatef( m_Position.x, m_Position.y, m_Position.z );
-    glRotatef( m_Rotation.x, 1.0, 0.0, 0.0 );
-    glRotatef( m_Rotation.y, 0.0, 1.0, 0.0 );
-    glRotatef( m_Rotation.z, 0.0, 0.0, 1.0 );
+    loadWorldMatrix();
+
+    if( m_pMesh )
+    {
+        m_pMesh->mesh.draw();
+        return;
+    }
+
+    Vector3f center = m_LocalBounds.center();
+    Vector3f extents = m_LocalBounds.extents();
+    glTranslatef( center.x, center.y, center.z );
+    glScalef( 2 * extents.x, 2 * extents.y, 2 * extents.z );
+
+    glPushAttrib( GL_POLYGON_BIT );
+    glPolygonMode( GL_FRONT_AND_BACK, GL_LINE );
+    GeometryCache::getInstance()->cube().draw();
+    glPopAttrib();
+}
+
+/* --------------------------------------------------------------------------
+ *  2.4.3. setMaterial & lookUpMaterial
+ *
+ *  Get material 'name' from Material manager and sets it to this model's
+ *  material.
+ * -------------------------------------------------------------------------- */
+bool WFObject::setMaterial( const char *name )
+{
+    m_MaterialName = std::string( name );
+    lookUpMaterial();
+    notifyState();
+    return true;
+}
+
+void WFObject::lookUpMaterial()
+{
+    MaterialManager *matMngrPtr = MaterialManager::getInstance();
+    m_MaterialData = matMngrPtr->getMaterial( m_MaterialName.c_str() );
+    m_MaterialId   = matMngrPtr->getMaterialId( m_MaterialName.c_str() );
+}
+
+/* --------------------------------------------------------------------------
+ *  2.4.4. setTexture
+ *
+ *  Sets the name of the texture used in this model.
+ * -------------------------------------------------------------------------- */
+void WFObject::setTexture( const char *name )
+{
+    m_TextureName = std::string( name );
+    notifyState();
+}
+
+/* --------------------------------------------------------------------------
+ *  2.4.5. applyMaterial
+ *
+ *  Sets the material reflective attributes from m_MaterialData.
+ * -------------------------------------------------------------------------- */
+void WFObject::applyMaterial()
+{
+    StateManager *state = StateManager::getInstance();
+    GLfloat color[ 4 ];
 
-    /* Material reflective attributes
-     */
     color[ 3 ] = 1.0;
     color[ 0 ] = m_MaterialData.ambient.r;
     color[ 1 ] = m_MaterialData.ambient.g;
     color[ 2 ] = m_MaterialData.ambient.b;
-    glMaterialfv( GL_FRONT_AND_BACK, GL_AMBIENT, color );
+    state->materialfv( GL_FRONT_AND_BACK, GL_AMBIENT, color );
     color[ 0 ] = m_MaterialData.diffuse.r;
     color[ 1 ] = m_MaterialData.diffuse.g;
     color[ 2 ] = m_MaterialData.diffuse.b;
-    glMaterialfv( GL_FRONT_AND_BACK, GL_DIFFUSE, color );
+    state->materialfv( GL_FRONT_AND_BACK, GL_DIFFUSE, color );
     color[ 0 ] = m_MaterialData.specular.r;
     color[ 1 ] = m_MaterialData.specular.g;
     color[ 2 ] = m_MaterialData.specular.b;
-    glMaterialfv( GL_FRONT_AND_BACK, GL_SPECULAR, color );
+    state->materialfv( GL_FRONT_AND_BACK, GL_SPECULAR, color );
 
-    glMaterialf( GL_FRONT, GL_SHININESS, m_MaterialData.shininess );
+    state->materialf( GL_FRONT, GL_SHININESS, m_MaterialData.shininess );
+}
 
+/* --------------------------------------------------------------------------
+ *  2.4.6. textureId
+ *
+ *  Textures are created with the GL context, so the id is looked up when the
+ *  render item is asked for, which the Renderer does again for every object
+ *  once the context is there.
+ * -------------------------------------------------------------------------- */
+GLuint WFObject::textureId()
+{
     TextureManager *texMngrPtr;
     texMngrPtr = TextureManager::getInstance();
     const Texture *tex = texMngrPtr->getTexturePtr( m_TextureName.c_str() );
 
-
-    glEnable( GL_TEXTURE_2D );
-
-    glTexEnvf( GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE );
-
-    glBindTexture( GL_TEXTURE_2D, tex->id );
-
-    /* Vertices
-     */
-    glBegin( GL_TRIANGLES );
-    for( unsigned int i = 0; i < m_ModelData.vertexFaces.size(); i++ )
-        {
-            /* Subtract one, because numbering starts from 1 in
-               WaveFront files. */
-            int v = m_ModelData.vertexFaces[ i ] - 1;
-            int n = m_ModelData.normalFaces[ i ] - 1;
-            int t = m_ModelData.textureFaces[ i ] - 1;
-
-            glTexCoord2f( m_ModelData.textureCoords[ t ].x,
-                          m_ModelData.textureCoords[ t ].y );
-            glNormal3f( m_ModelData.normals[ n ].x, m_ModelData.normals[ n ].y,
-                        m_ModelData.normals[ n ].z );
-            glVertex3f( m_ModelData.vertices[ v ].x,
-                        m_ModelData.vertices[ v ].y,
-                        m_ModelData.vertices[ v ].z );
-        }
-    glEnd();
-    glDisable( GL_TEXTURE_2D );
+    return tex->id;
 }
 
 /* --------------------------------------------------------------------------
- *  2.4.3. setMaterial
+ *  2.4.7. intersectRay
  *
- *  Get material 'name' from Material manager and sets it to this model's
- *  material.
+ *  The ray is moved to object space and traced through the triangle BVH of
+ *  the model. Until the model is loaded its placeholder box is hit.
  * -------------------------------------------------------------------------- */
-bool WFObject::setMaterial( const char *name )
+bool WFObject::intersectRay( const Vector3f &origin, const Vector3f &direction,
+                             GLfloat &distance )
 {
-    MaterialManager *matMngrPtr = NULL;
-    matMngrPtr = MaterialManager::getInstance();
-    if( matMngrPtr != NULL )
-    {
-        m_MaterialData = matMngrPtr->getMaterial( name );
-        return true;
-    }
-    return false;
+    if( !m_pMesh )
+        return BaseDrawable::intersectRay( origin, direction, distance );
+
+    Matrix4f toLocal = worldMatrix().affineInverse();
+    RayHit   hit;
+
+    if( !m_pMesh->bvh.intersect( toLocal.transformPoint( origin ),
+                                 toLocal.transformVector( direction ),
+                                 distance, hit ) )
+        return false;
+
+    distance = hit.distance;
+    return true;
 }
 
 /* --------------------------------------------------------------------------
- *  2.4.4. setTexture
+ *  2.4.8. meshLoaded
  *
- *  Sets the name of the texture used in this model.
+ *  Replaces the placeholder with the mesh and its bounds.
  * -------------------------------------------------------------------------- */
-void WFObject::setTexture( const char *name )
+void WFObject::meshLoaded( const MeshAssetPtr &mesh )
 {
-    m_TextureName = std::string( name );
+    m_pMesh = mesh;
+    m_LocalBounds = mesh->bounds;
+    m_LocalSphere = mesh->sphere;
+    if( !m_MaterialName.empty() )
+        lookUpMaterial();
+    notifyState();
 }
 
 /* --------------------------------------------------------------------------
@@ -501,6 +713,9 @@ RasterMap::RasterMap( int width, int height, GLfloat pixelSize ) :
     m_GridHeight( height ),
     m_PixelSize( pixelSize )
 {
+    /* Drawn with vertex colors only. */
+    m_RenderFlags = 0;
+
     /* Simulate raster map by allocating grid of color values. */
     m_RasterMap = new Color4f*[ width ];
     for( int x = 0; x < width; x++ )
@@ -513,6 +728,9 @@ RasterMap::RasterMap( int width, int height, GLfloat pixelSize ) :
         }
 
     }
+    setLocalBounds( BoundingBox( Vector3f( 0, 0, 0 ),
+                                 Vector3f( width * pixelSize,
+                                           height * pixelSize, 0 ) ) );
 }
 
 RasterMap::~RasterMap()
@@ -709,16 +927,7 @@ void RasterMap::drawCircle( int x0, int y0, int R )
  * -------------------------------------------------------------------------- */
 void RasterMap::draw()
 {
-    glShadeModel( GL_FLAT );
-    glDisable( GL_LIGHTING );
-    glMatrixMode( GL_MODELVIEW );
-    glLoadIdentity();
-
-    glTranslatef( m_Position.x, m_Position.y, m_Position.z );
-    glRotatef( m_Rotation.x, 1.0, 0.0, 0.0 );
-    glRotatef( m_Rotation.y, 0.0, 1.0, 0.0 );
-    glRotatef( m_Rotation.z, 0.0, 0.0, 1.0 );
-    glScalef( m_Scaling.x, m_Scaling.y, m_Scaling.z );
+    loadWorldMatrix();
 
     /* Draw the grid */
     glColor4f( 0.3, 0.3, 0.3, 1.0 );
@@ -751,9 +960,24 @@ void RasterMap::draw()
 
     setColor( Color4f( 145, 20, 0, 0 ) );
     drawCircle( 17, 17, 10 );
+}
 
-    glEnable( GL_LIGHTING );
-    glShadeModel( GL_SMOOTH );
+/* --------------------------------------------------------------------------
+ *  2.5.7. computeWorldMatrix
+ *
+ *  The map is scaled after the rotations, which scales the columns of the
+ *  rotation.
+ * -------------------------------------------------------------------------- */
+Matrix4f RasterMap::computeWorldMatrix()
+{
+    Matrix4f r = BaseDrawable::computeWorldMatrix();
+    for( int row = 0; row < 3; row++ )
+    {
+        r.m[ row ]     *= m_Scaling.x;
+        r.m[ 4 + row ] *= m_Scaling.y;
+        r.m[ 8 + row ] *= m_Scaling.z;
+    }
+    return r;
 }
 
 /* --------------------------------------------------------------------------
@@ -774,6 +998,9 @@ ParticleBox::ParticleBox( float sideLength, bool gravity, float coef ) :
     m_Coef( coef ),
     m_GravityEnabled( gravity )
 {
+    /* Particles are drawn with their own colors. */
+    m_RenderFlags = 0;
+
     /* Initialize particle positions and velocities. */
     for( int i = 0; i < MAX_PARTICLES; i++ )
     {
@@ -790,6 +1017,11 @@ ParticleBox::ParticleBox( float sideLength, bool gravity, float coef ) :
         m_Particles[ i ].velocity[ 3 ] = 0.0;
         m_Particles[ i ].color[ 3 ] = 1.0;
     }
+
+    /* Particles bounce off the sides of the box. */
+    GLfloat half = sideLength / 2;
+    setLocalBounds( BoundingBox( Vector3f( -half, -half, -half ),
+                                 Vector3f( half, half, half ) ) );
     /* Generate new buffer object */
 //    glGenBuffers( 1, m_Buffers[0] );
 }
@@ -852,15 +1084,7 @@ GLfloat ParticleBox::getBoxPos( int j )
 void ParticleBox::draw()
 {
     glPointSize( 5 );
-    glShadeModel( GL_FLAT );
-    glDisable( GL_LIGHTING );
-    glMatrixMode( GL_MODELVIEW );
-    glLoadIdentity();
-
-    glTranslatef( m_Position.x, m_Position.y, m_Position.z );
-    glRotatef( m_Rotation.x, 1.0, 0.0, 0.0 );
-    glRotatef( m_Rotation.y, 0.0, 1.0, 0.0 );
-    glRotatef( m_Rotation.z, 0.0, 0.0, 1.0 );
+    loadWorldMatrix();
 
     float dt = 0.001 * m_Timer.getDelta();
 
@@ -880,10 +1104,6 @@ void ParticleBox::draw()
 
     }
     glEnd();
-
-    glEnable( GL_LIGHTING );
-    glShadeModel( GL_SMOOTH );
-
 }
 
 /* --------------------------------------------------------------------------
@@ -892,24 +1112,23 @@ void ParticleBox::draw()
  *  See drawableobjects.h for class definition.
  * -------------------------------------------------------------------------- */
 
-
-void CALLBACK errorCallback( GLenum errorCode )
-{
-    const GLubyte *estring;
-    estring = gluErrorString( errorCode );
-    fprintf( stderr, "Quadric Error: %s\n", estring );
-    exit(0);
-}
-
 /* --------------------------------------------------------------------------
  *  2.7.1. Robot
  *
  *  creates an animated robot
  * -------------------------------------------------------------------------- */
 Robot::Robot() :
-    m_WheelRotation( 0 )
+    m_WheelRotation( 0 ),
+    m_Direction( STILL )
 {
     createBody();
+
+    /* From the top of the head down to the bottom of the wheel. The head
+     * turns around the y-axis, so x and z cover its diagonal. Only the
+     * bounding sphere is made of these, culling and picking use the
+     * bounds of the parts. */
+    setLocalBounds( BoundingBox( Vector3f( -0.65, -3.25, -0.65 ),
+                                 Vector3f( 0.65, 0.5, 0.65 ) ) );
 }
 
 Robot::~Robot()
@@ -922,15 +1141,16 @@ Robot::~Robot()
 /* --------------------------------------------------------------------------
  *  2.7.2. createBody
  *
- *  creates the Body of the robot
+ *  creates the Body of the robot and places its parts in the transform
+ *  hierarchy. The lower body hangs from the body, the rest from the robot
+ *  itself. Boxes' own transformations come after the offsets.
  * -------------------------------------------------------------------------- */
 void Robot::createBody()
 {
-    /* Create quadric object for the wheel */
-    m_Wheel = gluNewQuadric();
-    gluQuadricCallback( m_Wheel, GLU_ERROR, (_GLUfuncptr)errorCallback );
-    gluQuadricDrawStyle( m_Wheel, GLU_FILL );
-    gluQuadricNormals( m_Wheel, GLU_SMOOTH );
+    /* Wheel and hubcap meshes, generated by the first robot. */
+    GeometryCache *geometry = GeometryCache::getInstance();
+    m_pWheel  = &geometry->closedCylinder( 15, 5 );
+    m_pHubcap = &geometry->square();
 
     /* body of the robot */
     m_Body[ 0 ] = new Box( 1.0, 1.5, 1.2 );
@@ -938,86 +1158,82 @@ void Robot::createBody()
 
     m_Head = new Box( 0.8, 1.0, 1.0 );
     m_Head->setColor( 100, 60, 60 );
+
+    TransformHierarchy &hierarchy = parts();
+    hierarchy.addNode( PART_ROOT, m_Head->getWorldMatrix(),
+                       m_Head->getLocalBounds() );
+    hierarchy.addNode( PART_ROOT,
+                       Matrix4f::translation( 0.0, -1.25, 0.0 ) *
+                       m_Body[ 0 ]->getWorldMatrix(),
+                       m_Body[ 0 ]->getLocalBounds() );
+    hierarchy.addNode( PART_BODY,
+                       Matrix4f::translation( 0.0, -1.15, -0.4 ) *
+                       m_Body[ 1 ]->getWorldMatrix(),
+                       m_Body[ 1 ]->getLocalBounds() );
+    /* Cylinder and hubcaps. */
+    hierarchy.addNode( PART_ROOT, Matrix4f::translation( 0.0, -2.75, -0.3 ),
+                       BoundingBox( Vector3f( -0.5, -0.5, -0.01 ),
+                                    Vector3f( 0.5, 0.5, 0.51 ) ) );
+    hierarchy.addNode( PART_AXLE );
 }
 
 /* --------------------------------------------------------------------------
  *  2.7.3. drawWheel
  *
- *  Draws a wheel of the robot. Rotation of the wheel can be specified.
+ *  Draws the wheel of the robot in its spinning node: a cylinder of radius
+ *  and length 0.5 along the z-axis with a hubcap just off each end.
  * -------------------------------------------------------------------------- */
-void Robot::drawWheel( int direction ) //GLfloat rotation )
+void Robot::drawWheel()
 {
 
     GLfloat color[] = { 1.0, 1.0, 0.0, 1.0 };
     GLfloat shininess[] = { 30.0 };
+    StateManager *state = StateManager::getInstance();
 
-    glShadeModel( GL_SMOOTH );
-    glDisable( GL_LIGHTING );
+    glLoadMatrixf( m_pParts->getWorld( PART_WHEEL ).m );
+    glScalef( 0.5, 0.5, 0.5 );
 
-    if( direction == STILL )
-        glRotatef( m_WheelRotation, 0.0, 0.0, 1.0 );
-
-    if( direction == FORWARD )
-        glRotatef( m_WheelRotation+= 6, 0.0, 0.0, 1.0 );
-    else if( direction == BACKWARD )
-        glRotatef( m_WheelRotation-= 6, 0.0, 0.0, 1.0 );
+    state->disable( GL_LIGHTING );
+    glColor3f( 0.4, 0.4, 0.6 );
 
     glPushMatrix();
-        glTranslatef( 0.0, 0.0, 0.51 );
-        glBegin( GL_QUADS );
-            glColor3f( 0.4, 0.4, 0.6 );
-            glVertex3f( -0.3, -0.3, 0 );
-            glVertex3f( 0.3, -0.3, 0 );
-            glVertex3f( 0.3, 0.3, 0 );
-            glVertex3f( -0.3, 0.3, 0 );
-        glEnd();
+        glTranslatef( 0.0, 0.0, 1.02 );
+        glScalef( 1.2, 1.2, 1.0 );
+        m_pHubcap->draw();
     glPopMatrix();
 
     glPushMatrix();
-        glTranslatef( 0.0, 0.0, -0.01 );
+        glTranslatef( 0.0, 0.0, -0.02 );
         glRotatef( 180, 1.0, 0.0, 0.0 );
-        glBegin( GL_QUADS );
-            glColor3f( 0.4, 0.4, 0.6 );
-            glVertex3f( -0.3, -0.3, 0 );
-            glVertex3f( 0.3, -0.3, 0 );
-            glVertex3f( 0.3, 0.3, 0 );
-            glVertex3f( -0.3, 0.3, 0 );
-        glEnd();
+        glScalef( 1.2, 1.2, 1.0 );
+        m_pHubcap->draw();
     glPopMatrix();
 
-    glEnable( GL_LIGHTING );
-
-    glMaterialfv( GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE, color );
-    glMaterialfv( GL_FRONT, GL_SHININESS, shininess );
+    state->enable( GL_LIGHTING );
 
-    gluCylinder( m_Wheel, 0.5, 0.5, 0.5, 15, 5 );
-
-    glPushMatrix();
-        glRotatef( 180, 0.0, 1.0, 0.0 );
-        gluDisk( m_Wheel, 0, 0.5, 15, 5 );
-        glPopMatrix();
-    glTranslatef( 0, 0, 0.5 );
-
-    gluDisk( m_Wheel, 0, 0.5, 15, 5 );
+    state->materialfv( GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE, color );
+    state->materialfv( GL_FRONT, GL_SHININESS, shininess );
 
+    m_pWheel->draw();
 }
 
 /* --------------------------------------------------------------------------
  *  2.7.4. drawBody
  *
- *  Draws the body and head of the robot.
+ *  Draws the body and head of the robot, each with the world matrix of its
+ *  node.
  * -------------------------------------------------------------------------- */
 void Robot::drawBody()
 {
-    glPushMatrix();
-    m_Head->draw( false );
-    glPopMatrix();
-    glPushMatrix();
-    glTranslatef( 0.0, -1.25, 0.0 );
-    m_Body[ 0 ]->draw( false );
-    glTranslatef( 0.0, -1.15, -0.4 );
-    m_Body[ 1 ]->draw( false );
-    glPopMatrix();
+    glLoadMatrixf( m_pParts->getWorld( PART_HEAD ).m );
+    m_Head->applyMaterial();
+    m_Head->drawShape();
+    glLoadMatrixf( m_pParts->getWorld( PART_BODY ).m );
+    m_Body[ 0 ]->applyMaterial();
+    m_Body[ 0 ]->drawShape();
+    glLoadMatrixf( m_pParts->getWorld( PART_LOWER_BODY ).m );
+    m_Body[ 1 ]->applyMaterial();
+    m_Body[ 1 ]->drawShape();
 }
 
 /* --------------------------------------------------------------------------
@@ -1037,11 +1253,13 @@ void Robot::move( int direction )
         m_Position.z = m_Position.z + 0.2 * sin( m_Rotation.y * PI / 180 );
         m_Position.x = m_Position.x - 0.2 * cos( m_Rotation.y * PI / 180 );
         m_Direction = FORWARD;
+        notifyTransform();
         break;
     case BACKWARD:
         m_Position.z = m_Position.z - 0.2 * sin( m_Rotation.y * PI / 180 );
         m_Position.x = m_Position.x + 0.2 * cos( m_Rotation.y * PI / 180 );
         m_Direction = BACKWARD;
+        notifyTransform();
         break;
     case TURN_LEFT:
         rotate( 0, 4, 0 );
@@ -1058,10 +1276,14 @@ void Robot::move( int direction )
     case TURN_HEAD_RIGHT:
         m_Head->rotate( 0, -4, 0 );
         m_Direction = STILL;
+        parts().setLocal( PART_HEAD, m_Head->getWorldMatrix() );
+        notifyBounds();
         break;
     case TURN_HEAD_LEFT:
         m_Head->rotate( 0, 4, 0 );
         m_Direction = STILL;
+        parts().setLocal( PART_HEAD, m_Head->getWorldMatrix() );
+        notifyBounds();
         break;
     }
 }
@@ -1069,26 +1291,25 @@ void Robot::move( int direction )
 /* --------------------------------------------------------------------------
  *  2.7.6. draw
  *
- *  draws the robot
+ *  draws the robot. The wheel keeps spinning while the robot moves; the
+ *  spin only changes its own node, so the rest of the hierarchy is not
+ *  updated for it.
  * -------------------------------------------------------------------------- */
 void Robot::draw()
 {
-
-    glEnable( GL_LIGHTING );
-    glShadeModel( GL_SMOOTH );
+    if( m_Direction == FORWARD || m_Direction == BACKWARD )
+    {
+        m_WheelRotation += m_Direction == FORWARD ? 6 : -6;
+        parts().setLocal( PART_WHEEL,
+                          Matrix4f::rotation( m_WheelRotation, 0.0, 0.0, 1.0 ) );
+    }
+    updateParts();
 
     glMatrixMode( GL_MODELVIEW );
-    glLoadIdentity();
-
-    glTranslatef( m_Position.x, m_Position.y, m_Position.z );
-    glRotatef( m_Rotation.x, 1.0, 0.0, 0.0 );
-    glRotatef( m_Rotation.y, 0.0, 1.0, 0.0 );
-    glRotatef( m_Rotation.z, 0.0, 0.0, 1.0 );
     glColor3f( 1, 0, 1 );
 
     drawBody();
-    glTranslatef( 0.0, -2.75, -0.3 );
-    drawWheel( m_Direction );
+    drawWheel();
 }
 
 /* End of drawableobjects.cpp */
@@ -71,6 +71,10 @@
 
 #include "renderer.h"
 #include "timer.h"
+#include "meshbuffer.h"
+#include "meshmanager.h"
+#include "transformhierarchy.h"
+#include "geometrycache.h"
 #include <GL/glut.h>
 /* **************************************************************************
 
@@ -120,57 +124,184 @@ protected:
     Vector3f    m_Rotation;
     Vector3f    m_Color;
     Vector3f    m_Scaling;
-    int         m_Name;
+    ObjectHandle m_Handle;
     bool        m_IsMovable;
     bool        m_IsRotatable;
     Vector3f    m_Origin;
+    /* RenderItem::Flags of the object's render item. */
+    GLuint      m_RenderFlags;
+    /* Bounds in object space, set by the inheriting classes. */
+    BoundingBox     m_LocalBounds;
+    BoundingSphere  m_LocalSphere;
+    /* Told about the changes of position, rotation, scaling and origin. */
+    ITransformListener *m_pListener;
+    /* Built from the above by worldMatrix() when first needed after a
+     * change. */
+    Matrix4f        m_WorldMatrix;
+    bool            m_WorldMatrixValid;
+    /* Transformations of the parts of an articulated drawable, created by
+     * parts(). NULL for drawables without parts. */
+    TransformHierarchy *m_pParts;
 
 public:
     BaseDrawable();
-    virtual ~BaseDrawable() {}
+    virtual ~BaseDrawable() { delete m_pParts; }
+
+    virtual Type        getType() { return TYPE_OTHER; }
 
     /* Basic setters and getters.
      */
-    virtual void        setMovable( bool state ) { m_IsMovable = state; }
+    virtual void        setMovable( bool state )
+                                   { m_IsMovable = state; notifyState(); }
     virtual bool        isMovable() { return m_IsMovable; }
-    virtual void        setRotatable( bool state ) { m_IsRotatable = state; }
+    virtual void        setRotatable( bool state )
+                                   { m_IsRotatable = state; notifyState(); }
     virtual bool        isRotatable() { return m_IsRotatable; }
-    virtual void        setPosition( const Vector3f &pos ) { m_Position = pos; }
+    virtual void        setPosition( const Vector3f &pos )
+                                   { m_Position = pos; notifyTransform(); }
     virtual void        setPosition( GLfloat x, GLfloat y, GLfloat z )
-                                   { m_Position = Vector3f( x, y, z ); }
+                                   { m_Position = Vector3f( x, y, z );
+                                     notifyTransform(); }
     virtual Vector3f    getPosition() { return m_Position; }
 
-    virtual void        setRotation( const Vector3f &rot ) { m_Rotation = rot; }
+    virtual void        setRotation( const Vector3f &rot )
+                                   { m_Rotation = rot; notifyTransform(); }
     virtual void        setRotation( GLfloat x, GLfloat y, GLfloat z )
-                                   { m_Rotation = Vector3f( x, y, z ); }
+                                   { m_Rotation = Vector3f( x, y, z );
+                                     notifyTransform(); }
     virtual void        rotate( GLfloat x, GLfloat y, GLfloat z )
                                    { m_Rotation = Vector3f( m_Rotation.x+x,
-                                     m_Rotation.y+y, m_Rotation.z+z ); }
+                                     m_Rotation.y+y, m_Rotation.z+z );
+                                     notifyTransform(); }
     virtual Vector3f    getRotation() { return m_Rotation; }
 
     virtual void        setOrigin( GLfloat x, GLfloat y, GLfloat z )
-                                   { m_Origin = Vector3f( x, y, z ); }
-    virtual void        setOrigin( const Vector3f &pos ) { m_Origin = pos; }
+                                   { m_Origin = Vector3f( x, y, z );
+                                     notifyTransform(); }
+    virtual void        setOrigin( const Vector3f &pos )
+                                   { m_Origin = pos; notifyTransform(); }
     virtual Vector3f    getOrigin() { return m_Origin; }
 
     virtual void        setScaling( const Vector3f &scale );
     virtual void        setScaling( GLfloat x, GLfloat y, GLfloat z );
     virtual void        scale( GLfloat x, GLfloat y, GLfloat z );
 
-    virtual void        setName( int name ) { m_Name = name; }
-    virtual int         getName() { return m_Name; }
+    virtual void        setHandle( ObjectHandle handle ) { m_Handle = handle; }
+    virtual ObjectHandle getHandle() { return m_Handle; }
 
     virtual void        move( GLfloat x, GLfloat y, GLfloat z );
 
     virtual void        setColor( int r, int g, int b )
-                                { m_Color = Vector3f( r, g, b ); }
+                                { m_Color = Vector3f( r, g, b );
+                                  notifyState(); }
     virtual Vector3f    getColor() { return m_Color; }
 
+    /* The cached world matrix, see computeWorldMatrix(). World bounds are
+     * the local bounds transformed by it, or the union of the parts' world
+     * bounds if the drawable has parts. */
+    virtual Matrix4f        getWorldMatrix() { return worldMatrix(); }
+    virtual Matrix4f        getMeshMatrix() { return worldMatrix(); }
+    virtual BoundingBox     getWorldBounds();
+    virtual BoundingSphere  getBoundingSphere();
+    const BoundingBox       &getLocalBounds() const { return m_LocalBounds; }
+    virtual void            setTransformListener( ITransformListener *listener )
+                                        { m_pListener = listener; }
+    /* Hits the local bounds, or the bounds of the parts. */
+    virtual bool            intersectRay( const Vector3f &origin,
+                                          const Vector3f &direction,
+                                          GLfloat &distance );
+
+    /* The parts by their node in the hierarchy, part 0 being the drawable
+     * itself. */
+    int                     getPartCount()
+                            { return m_pParts ? m_pParts->size() : 0; }
+    Matrix4f                getPartWorldMatrix( int part )
+                            { return updateParts().getWorld( part ); }
+    BoundingBox             getPartWorldBounds( int part )
+                            { return updateParts().getWorldBounds( part ); }
+    /* The part hit nearest, or -1. */
+    int                     intersectPart( const Vector3f &origin,
+                                           const Vector3f &direction,
+                                           GLfloat &distance )
+                            {
+                                return m_pParts ? updateParts().intersectRay(
+                                           origin, direction, distance ) : -1;
+                            }
+
+    /* One render item using m_RenderFlags, textureId(), materialId(),
+     * renderMesh() and renderLods(). */
+    virtual RenderItem  getRenderItem();
+    virtual void        applyMaterial() {}
+
     /* Left for inheriting classes to implement. */
     virtual void draw() = 0;
 
 protected:
     virtual void checkBounds();
+
+    /* Translation followed by rotations around x, y and z, as done by most
+     * of the drawables. */
+    virtual Matrix4f    computeWorldMatrix();
+    const Matrix4f      &worldMatrix()
+                        {
+                            if( !m_WorldMatrixValid )
+                            {
+                                m_WorldMatrix = computeWorldMatrix();
+                                m_WorldMatrixValid = true;
+                                if( m_pParts )
+                                    m_pParts->setLocal( 0, m_WorldMatrix );
+                            }
+                            return m_WorldMatrix;
+                        }
+    /* Replaces the modelview matrix with the world matrix. */
+    void                loadWorldMatrix()
+                        {
+                            glMatrixMode( GL_MODELVIEW );
+                            glLoadMatrixf( worldMatrix().m );
+                        }
+
+    /* Render state of the object's render item. */
+    virtual GLuint      textureId() { return 0; }
+    virtual GLuint      materialId() { return 0; }
+    /* Mesh drawn by the RenderQueue in place of draw(), if any. */
+    virtual const CachedMesh *renderMesh() { return NULL; }
+    /* Levels of detail of the render mesh, if it has any. */
+    virtual const MeshLodChain *renderLods() { return NULL; }
+
+    /* Material id for objects whose material is defined by their color and
+     * shininess alone. Never clashes with the MaterialManager ids. */
+    static GLuint       colorMaterialId( const Vector3f &color, int shininess );
+
+    /* Sets the local bounds and a bounding sphere around them. */
+    void                setLocalBounds( const BoundingBox &box );
+
+    /* The part hierarchy, created on first use with the root node 0 that
+     * follows the world matrix. Parts are added as its descendants. */
+    TransformHierarchy  &parts();
+    /* The part hierarchy with the world matrices up to date. */
+    const TransformHierarchy &updateParts()
+                        {
+                            worldMatrix();
+                            m_pParts->update();
+                            return *m_pParts;
+                        }
+
+    /* To be called after the world matrix may have changed. */
+    void                notifyTransform()
+                        {
+                            m_WorldMatrixValid = false;
+                            notifyBounds();
+                        }
+    /* To be called after the world bounds alone may have changed, as when
+     * a part has moved. */
+    void                notifyBounds()
+                        {
+                            if( m_pListener )
+                                m_pListener->transformChanged( this );
+                        }
+    /* To be called after the flags, color or render item may have changed. */
+    void                notifyState()
+                        { if( m_pListener ) m_pListener->stateChanged( this ); }
 };
 
 inline void BaseDrawable::move( GLfloat x, GLfloat y, GLfloat z )
@@ -178,6 +309,7 @@ inline void BaseDrawable::move( GLfloat x, GLfloat y, GLfloat z )
     m_Position.x += x;
     m_Position.y += y;
     m_Position.z += z;
+    notifyTransform();
 }
 
 /* --------------------------------------------------------------------------
@@ -188,15 +320,23 @@ inline void BaseDrawable::move( GLfloat x, GLfloat y, GLfloat z )
 class Box : public BaseDrawable
 {
 private:
-    GLfloat     m_Vertices[ 3 * 8 ];
-    GLfloat     m_Normals[ 3 * 6 ];
-    GLubyte     m_Indices[ 6 ][ 4 ];
-    GLsizei     m_Count[ 6 ];
+    Vector3f    m_Size;
+    /* Shared by all boxes, see GeometryCache. */
+    CachedMesh  *m_pCube;
 
 public:
     explicit Box( GLfloat w, GLfloat h, GLfloat d );
+    Type getType() { return TYPE_BOX; }
+    void applyMaterial();
     void draw();
-    void draw( bool loadIdentity, bool wireframe = false );
+    /* Draws the box with the current modelview matrix. */
+    void drawShape();
+    Matrix4f getMeshMatrix();
+
+protected:
+    GLuint materialId();
+    const CachedMesh *renderMesh() { return m_pCube; }
+    Matrix4f computeWorldMatrix();
 };
 
 /* --------------------------------------------------------------------------
@@ -210,32 +350,81 @@ public:
     GLuint      m_Texture;
     GLubyte     m_CheckImage[ 64 ][ 64 ][ 4 ];
 private:
-    GLfloat     m_Vertices[ 12 ];
-
-
+    GLfloat     m_Width;
+    GLfloat     m_Height;
+    /* Shared by all planes, see GeometryCache. */
+    CachedMesh  *m_pSquare;
 
 public:
     explicit Plane( GLfloat w, GLfloat h );
+    Type getType() { return TYPE_PLANE; }
+    void applyMaterial();
     void draw();
+    Matrix4f getMeshMatrix();
+
+protected:
+    GLuint materialId();
+    const CachedMesh *renderMesh() { return m_pSquare; }
 };
 
 /* --------------------------------------------------------------------------
  *  4.4. WFObject
  *
- *  Supports imported WaveFront files.
+ *  Supports imported WaveFront files. The model is drawn from buffer objects
+ *  uploaded on the first draw, or from vertex arrays if those are not
+ *  available ( see CachedMesh ). Objects loading the same file share its
+ *  mesh ( see MeshManager ), and are drawn as instances of it.
+ *
+ *  Loaded in the background, the object is drawn as the outline of a
+ *  placeholder box until its mesh arrives. The material is looked up again
+ *  then, as the material library is loaded with the mesh. The mesh can be
+ *  asked for with quantized vertices, which take half the memory.
  * -------------------------------------------------------------------------- */
-class WFObject : public BaseDrawable
+class WFObject : public BaseDrawable, public IMeshListener
 {
 private:
-    ModelData           m_ModelData;
+    std::string         m_MaterialName;
     MaterialData        m_MaterialData;
     std::string         m_TextureName;
+    GLuint              m_MaterialId;
+    /* The model's mesh, BVH and bounds, shared with the other objects
+     * loading the file. NULL until loaded. */
+    MeshAssetPtr        m_pMesh;
+
+    void lookUpMaterial();
 
 public:
-    WFObject( const char *filename );
+    enum LoadMode { LOAD_NOW, LOAD_IN_BACKGROUND };
+
+    /* An empty placeholder box stands for a unit cube. */
+    WFObject( const char *filename, LoadMode mode = LOAD_NOW,
+              const BoundingBox &placeholder = BoundingBox(),
+              CachedMesh::VertexFormat format = CachedMesh::FLOAT_VERTICES );
+    ~WFObject();
+    Type getType() { return TYPE_WFOBJECT; }
+    bool isLoaded() const { return !m_pMesh.isNull(); }
+    /* The shared mesh, NULL until loaded. */
+    const MeshAssetPtr &meshAsset() const { return m_pMesh; }
+    /* Reimplementation from IMeshListener. */
+    void meshLoaded( const MeshAssetPtr &mesh );
+    void applyMaterial();
     void draw();
     bool setMaterial( const char *name );
     void setTexture( const char *name );
+    /* Hits the triangles of the model, see MeshBVH. */
+    bool intersectRay( const Vector3f &origin, const Vector3f &direction,
+                       GLfloat &distance );
+
+protected:
+    GLuint textureId();
+    GLuint materialId() { return m_MaterialId; }
+    const CachedMesh *renderMesh()
+                      { return m_pMesh ? &m_pMesh->mesh : NULL; }
+    const MeshLodChain *renderLods()
+                      {
+                          return m_pMesh && m_pMesh->lods.count > 1 ?
+                                 &m_pMesh->lods : NULL;
+                      }
 };
 
 /* --------------------------------------------------------------------------
@@ -269,6 +458,9 @@ public:
     RasterMap( int width, int height, GLfloat pixelSize );
     ~RasterMap();
     void draw();
+
+protected:
+    Matrix4f computeWorldMatrix();
 };
 
 /* --------------------------------------------------------------------------
@@ -288,6 +480,7 @@ private:
 
 public:
     ParticleBox( float sideLength, bool gravity, float coef );
+    Type getType() { return TYPE_PARTICLE_BOX; }
     void draw();
 
 private:
@@ -296,11 +489,6 @@ private:
     GLfloat getBoxPos( int j );
 };
 
-#ifndef CALLBACK
-#define CALLBACK
-#endif
-void CALLBACK errorCallback( GLenum errorCode );
-
 /* --------------------------------------------------------------------------
  *  4.7. Robot
  *
@@ -310,10 +498,17 @@ class Robot : public BaseDrawable
 {
 private:
 
+    /* Nodes of the parts in the transform hierarchy. The wheel spins on its
+     * axle, which holds the bounds as they do not change with the spin. */
+    enum Part { PART_ROOT, PART_HEAD, PART_BODY, PART_LOWER_BODY,
+                PART_AXLE, PART_WHEEL };
+
     Box *m_Body[ 2 ];
     Box *m_Head;
     Timer m_Timer;
-    GLUquadricObj       *m_Wheel;
+    /* Shared with the other robots, see GeometryCache. */
+    CachedMesh          *m_pWheel;
+    CachedMesh          *m_pHubcap;
     float               m_WheelRotation;
     int                 m_Direction;
 
@@ -328,7 +523,7 @@ public:
 
 private:
     void createBody();
-    void drawWheel( int direction );
+    void drawWheel();
     void drawBody();
     void draw();
 
@@ -0,0 +1,188 @@
+/* --------------------------------------------------------------------------
+ * frustum.cpp
+ *
+ * Implementation of the Frustum class.
+ *
+ * -------------------------------------------------------------------------- */
+
+#include "frustum.h"
+#include "renderer.h"
+#include <math.h>
+#include <float.h>
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+Frustum::Frustum()
+{
+    for( int i = 0; i < PLANE_COUNT; i++ )
+    {
+        m_X[ i ] = m_Y[ i ] = m_Z[ i ] = 0;
+        m_AbsX[ i ] = m_AbsY[ i ] = m_AbsZ[ i ] = 0;
+        m_D[ i ] = FLT_MAX;
+    }
+}
+
+/* --------------------------------------------------------------------------
+ *  extract
+ *
+ *  Each plane is the fourth row of the matrix plus or minus one of the
+ *  other rows: left, right, bottom, top, near and far.
+ * -------------------------------------------------------------------------- */
+void Frustum::extract( const Matrix4f &clip )
+{
+    const GLfloat *m = clip.m;
+
+    for( int i = 0; i < 6; i++ )
+    {
+        int     row = i / 2;
+        GLfloat sign = ( i % 2 == 0 ) ? 1.0f : -1.0f;
+        GLfloat a = m[ 3 ]  + sign * m[ row ];
+        GLfloat b = m[ 7 ]  + sign * m[ 4 + row ];
+        GLfloat c = m[ 11 ] + sign * m[ 8 + row ];
+        GLfloat d = m[ 15 ] + sign * m[ 12 + row ];
+        GLfloat length = sqrt( a * a + b * b + c * c );
+
+        m_X[ i ] = a / length;
+        m_Y[ i ] = b / length;
+        m_Z[ i ] = c / length;
+        m_D[ i ] = d / length;
+        m_AbsX[ i ] = fabs( m_X[ i ] );
+        m_AbsY[ i ] = fabs( m_Y[ i ] );
+        m_AbsZ[ i ] = fabs( m_Z[ i ] );
+    }
+}
+
+/* --------------------------------------------------------------------------
+ *  isVisible
+ *
+ *  A box is outside of a plane if its corner furthest along the plane
+ *  normal is, i.e. n . c + |n| . e + d < 0 for centre c and extents e.
+ * -------------------------------------------------------------------------- */
+bool Frustum::isVisible( const BoundingBox &box ) const
+{
+    Vector3f c = box.center();
+    Vector3f e = box.extents();
+
+#ifdef __SSE__
+    const __m128 cx = _mm_set1_ps( c.x ), cy = _mm_set1_ps( c.y ),
+                 cz = _mm_set1_ps( c.z );
+    const __m128 ex = _mm_set1_ps( e.x ), ey = _mm_set1_ps( e.y ),
+                 ez = _mm_set1_ps( e.z );
+    int outside = 0;
+
+    for( int i = 0; i < PLANE_COUNT; i += 4 )
+    {
+        __m128 dist = _mm_add_ps(
+            _mm_add_ps( _mm_mul_ps( _mm_loadu_ps( &m_X[ i ] ), cx ),
+                        _mm_mul_ps( _mm_loadu_ps( &m_Y[ i ] ), cy ) ),
+            _mm_add_ps( _mm_mul_ps( _mm_loadu_ps( &m_Z[ i ] ), cz ),
+                        _mm_loadu_ps( &m_D[ i ] ) ) );
+        __m128 radius = _mm_add_ps(
+            _mm_add_ps( _mm_mul_ps( _mm_loadu_ps( &m_AbsX[ i ] ), ex ),
+                        _mm_mul_ps( _mm_loadu_ps( &m_AbsY[ i ] ), ey ) ),
+            _mm_mul_ps( _mm_loadu_ps( &m_AbsZ[ i ] ), ez ) );
+        outside |= _mm_movemask_ps( _mm_cmplt_ps( _mm_add_ps( dist, radius ),
+                                                  _mm_setzero_ps() ) );
+    }
+    return outside == 0;
+#else
+    for( int i = 0; i < PLANE_COUNT; i++ )
+    {
+        GLfloat dist = m_X[ i ] * c.x + m_Y[ i ] * c.y + m_Z[ i ] * c.z +
+                       m_D[ i ];
+        GLfloat radius = m_AbsX[ i ] * e.x + m_AbsY[ i ] * e.y +
+                         m_AbsZ[ i ] * e.z;
+        if( dist + radius < 0 )
+            return false;
+    }
+    return true;
+#endif
+}
+
+/* --------------------------------------------------------------------------
+ *  classify
+ *
+ *  A box is inside of a plane if its corner nearest along the normal is,
+ *  i.e. n . c - |n| . e + d >= 0.
+ * -------------------------------------------------------------------------- */
+Frustum::Result Frustum::classify( const BoundingBox &box ) const
+{
+    Vector3f c = box.center();
+    Vector3f e = box.extents();
+
+#ifdef __SSE__
+    const __m128 cx = _mm_set1_ps( c.x ), cy = _mm_set1_ps( c.y ),
+                 cz = _mm_set1_ps( c.z );
+    const __m128 ex = _mm_set1_ps( e.x ), ey = _mm_set1_ps( e.y ),
+                 ez = _mm_set1_ps( e.z );
+    const __m128 zero = _mm_setzero_ps();
+    int outside = 0, intersecting = 0;
+
+    for( int i = 0; i < PLANE_COUNT; i += 4 )
+    {
+        __m128 dist = _mm_add_ps(
+            _mm_add_ps( _mm_mul_ps( _mm_loadu_ps( &m_X[ i ] ), cx ),
+                        _mm_mul_ps( _mm_loadu_ps( &m_Y[ i ] ), cy ) ),
+            _mm_add_ps( _mm_mul_ps( _mm_loadu_ps( &m_Z[ i ] ), cz ),
+                        _mm_loadu_ps( &m_D[ i ] ) ) );
+        __m128 radius = _mm_add_ps(
+            _mm_add_ps( _mm_mul_ps( _mm_loadu_ps( &m_AbsX[ i ] ), ex ),
+                        _mm_mul_ps( _mm_loadu_ps( &m_AbsY[ i ] ), ey ) ),
+            _mm_mul_ps( _mm_loadu_ps( &m_AbsZ[ i ] ), ez ) );
+        outside |= _mm_movemask_ps(
+            _mm_cmplt_ps( _mm_add_ps( dist, radius ), zero ) );
+        intersecting |= _mm_movemask_ps(
+            _mm_cmplt_ps( _mm_sub_ps( dist, radius ), zero ) );
+    }
+    if( outside )
+        return OUTSIDE;
+    return intersecting ? INTERSECTING : INSIDE;
+#else
+    Result result = INSIDE;
+
+    for( int i = 0; i < PLANE_COUNT; i++ )
+    {
+        GLfloat dist = m_X[ i ] * c.x + m_Y[ i ] * c.y + m_Z[ i ] * c.z +
+                       m_D[ i ];
+        GLfloat radius = m_AbsX[ i ] * e.x + m_AbsY[ i ] * e.y +
+                         m_AbsZ[ i ] * e.z;
+        if( dist + radius < 0 )
+            return OUTSIDE;
+        if( dist - radius < 0 )
+            result = INTERSECTING;
+    }
+    return result;
+#endif
+}
+
+bool Frustum::isVisible( const BoundingSphere &sphere ) const
+{
+    const Vector3f &c = sphere.center;
+
+#ifdef __SSE__
+    const __m128 cx = _mm_set1_ps( c.x ), cy = _mm_set1_ps( c.y ),
+                 cz = _mm_set1_ps( c.z );
+    const __m128 r = _mm_set1_ps( -sphere.radius );
+    int outside = 0;
+
+    for( int i = 0; i < PLANE_COUNT; i += 4 )
+    {
+        __m128 dist = _mm_add_ps(
+            _mm_add_ps( _mm_mul_ps( _mm_loadu_ps( &m_X[ i ] ), cx ),
+                        _mm_mul_ps( _mm_loadu_ps( &m_Y[ i ] ), cy ) ),
+            _mm_add_ps( _mm_mul_ps( _mm_loadu_ps( &m_Z[ i ] ), cz ),
+                        _mm_loadu_ps( &m_D[ i ] ) ) );
+        outside |= _mm_movemask_ps( _mm_cmplt_ps( dist, r ) );
+    }
+    return outside == 0;
+#else
+    for( int i = 0; i < PLANE_COUNT; i++ )
+    {
+        if( m_X[ i ] * c.x + m_Y[ i ] * c.y + m_Z[ i ] * c.z + m_D[ i ] <
+            -sphere.radius )
+            return false;
+    }
+    return true;
+#endif
+}
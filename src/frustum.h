@@ -0,0 +1,60 @@
+/* --------------------------------------------------------------------------
+ * frustum.h
+ *
+ * View frustum planes and visibility tests for bounding volumes.
+ *
+ * -------------------------------------------------------------------------- */
+
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include <QGLWidget>
+
+struct Matrix4f;
+struct BoundingBox;
+struct BoundingSphere;
+
+/* --------------------------------------------------------------------------
+ *  Frustum
+ *
+ *  The six planes are stored component by component and padded to eight,
+ *  so that the tests can check four planes at a time with SSE. The padding
+ *  planes have every point on their inside. Without SSE the same tests run
+ *  one plane at a time.
+ * -------------------------------------------------------------------------- */
+class Frustum
+{
+private:
+    enum { PLANE_COUNT = 8 };
+
+    /* Plane normals, their absolute values and distances. A point p is
+     * inside a plane if n . p + d >= 0. */
+    GLfloat     m_X[ PLANE_COUNT ];
+    GLfloat     m_Y[ PLANE_COUNT ];
+    GLfloat     m_Z[ PLANE_COUNT ];
+    GLfloat     m_AbsX[ PLANE_COUNT ];
+    GLfloat     m_AbsY[ PLANE_COUNT ];
+    GLfloat     m_AbsZ[ PLANE_COUNT ];
+    GLfloat     m_D[ PLANE_COUNT ];
+
+public:
+    Frustum();
+
+    /* Extracts the planes from a projection * modelview matrix, giving
+     * them in the space the modelview matrix transforms from.
+     * Reference: Gribb, Hartmann, 'Fast Extraction of Viewing Frustum
+     *            Planes from the World-View-Projection Matrix' ( 2001 ) */
+    void extract( const Matrix4f &clip );
+
+    enum Result { OUTSIDE = 0, INTERSECTING, INSIDE };
+
+    /* False if the volume is completely outside of any of the planes. */
+    bool isVisible( const BoundingBox &box ) const;
+    bool isVisible( const BoundingSphere &sphere ) const;
+
+    /* Like isVisible(), but also tells if the box is completely inside, so
+     * that e.g. a tree query can skip testing its children. */
+    Result classify( const BoundingBox &box ) const;
+};
+
+#endif /* FRUSTUM_H */
@@ -0,0 +1,356 @@
+/* --------------------------------------------------------------------------
+ * geometrycache.cpp
+ *
+ * Implementation of the CachedMesh and GeometryCache classes.
+ *
+ * -------------------------------------------------------------------------- */
+
+#include "geometrycache.h"
+#include <math.h>
+#include <algorithm>
+
+GeometryCache *GeometryCache::m_pInstance = NULL;
+
+/* --------------------------------------------------------------------------
+ *  Static meshes
+ *
+ *  Corners of each face counter-clockwise when seen from outside, the
+ *  texture spanning the face.
+ * -------------------------------------------------------------------------- */
+static const MeshVertex CUBE_VERTICES[] = {
+    { { 0, 0 }, {  0,  0,  1 }, { -0.5, -0.5,  0.5 } },
+    { { 1, 0 }, {  0,  0,  1 }, {  0.5, -0.5,  0.5 } },
+    { { 1, 1 }, {  0,  0,  1 }, {  0.5,  0.5,  0.5 } },
+    { { 0, 1 }, {  0,  0,  1 }, { -0.5,  0.5,  0.5 } },
+
+    { { 0, 0 }, {  1,  0,  0 }, {  0.5, -0.5,  0.5 } },
+    { { 1, 0 }, {  1,  0,  0 }, {  0.5, -0.5, -0.5 } },
+    { { 1, 1 }, {  1,  0,  0 }, {  0.5,  0.5, -0.5 } },
+    { { 0, 1 }, {  1,  0,  0 }, {  0.5,  0.5,  0.5 } },
+
+    { { 0, 0 }, {  0, -1,  0 }, { -0.5, -0.5, -0.5 } },
+    { { 1, 0 }, {  0, -1,  0 }, {  0.5, -0.5, -0.5 } },
+    { { 1, 1 }, {  0, -1,  0 }, {  0.5, -0.5,  0.5 } },
+    { { 0, 1 }, {  0, -1,  0 }, { -0.5, -0.5,  0.5 } },
+
+    { { 0, 0 }, {  0,  0, -1 }, {  0.5, -0.5, -0.5 } },
+    { { 1, 0 }, {  0,  0, -1 }, { -0.5, -0.5, -0.5 } },
+    { { 1, 1 }, {  0,  0, -1 }, { -0.5,  0.5, -0.5 } },
+    { { 0, 1 }, {  0,  0, -1 }, {  0.5,  0.5, -0.5 } },
+
+    { { 0, 0 }, { -1,  0,  0 }, { -0.5, -0.5, -0.5 } },
+    { { 1, 0 }, { -1,  0,  0 }, { -0.5, -0.5,  0.5 } },
+    { { 1, 1 }, { -1,  0,  0 }, { -0.5,  0.5,  0.5 } },
+    { { 0, 1 }, { -1,  0,  0 }, { -0.5,  0.5, -0.5 } },
+
+    { { 0, 0 }, {  0,  1,  0 }, { -0.5,  0.5,  0.5 } },
+    { { 1, 0 }, {  0,  1,  0 }, {  0.5,  0.5,  0.5 } },
+    { { 1, 1 }, {  0,  1,  0 }, {  0.5,  0.5, -0.5 } },
+    { { 0, 1 }, {  0,  1,  0 }, { -0.5,  0.5, -0.5 } }
+};
+
+/* Two triangles per face. */
+static const GLuint CUBE_INDICES[] = {
+     0,  1,  2,  0,  2,  3,
+     4,  5,  6,  4,  6,  7,
+     8,  9, 10,  8, 10, 11,
+    12, 13, 14, 12, 14, 15,
+    16, 17, 18, 16, 18, 19,
+    20, 21, 22, 20, 22, 23
+};
+
+static const MeshVertex SQUARE_VERTICES[] = {
+    { { 0, 0 }, { 0, -1, 0 }, { -0.5, -0.5, 0 } },
+    { { 1, 0 }, { 0, -1, 0 }, {  0.5, -0.5, 0 } },
+    { { 1, 1 }, { 0, -1, 0 }, {  0.5,  0.5, 0 } },
+    { { 0, 1 }, { 0, -1, 0 }, { -0.5,  0.5, 0 } }
+};
+
+static const GLuint SQUARE_INDICES[] = { 0, 1, 2, 0, 2, 3 };
+
+#define ARRAY_END( a ) ( ( a ) + sizeof( a ) / sizeof( ( a )[ 0 ] ) )
+
+/* --------------------------------------------------------------------------
+ *  Mesh building
+ * -------------------------------------------------------------------------- */
+static void addVertex( CachedMesh &mesh, GLfloat x, GLfloat y, GLfloat z,
+                       GLfloat nx, GLfloat ny, GLfloat nz )
+{
+    MeshVertex vertex = { { 0, 0 }, { nx, ny, nz }, { x, y, z } };
+    mesh.vertices.push_back( vertex );
+}
+
+/* Two counter-clockwise triangles of the quad a, b, c, d. */
+static void addQuad( CachedMesh &mesh, GLuint a, GLuint b, GLuint c, GLuint d )
+{
+    GLuint quad[] = { a, b, c, a, c, d };
+    mesh.indices.insert( mesh.indices.end(), quad, quad + 6 );
+}
+
+/* Vertex i of ring r of a disk starting at vertex first, see addDisk. */
+static GLuint ringVertex( GLuint first, int slices, int ring, int i )
+{
+    return first + 1 + ( ring - 1 ) * slices + i % slices;
+}
+
+/* Disk of radius 1 at height z facing the positive z-axis, or the negative
+ * one if flip is set: a fan around the centre vertex and rings - 1 annuli
+ * around it. The angle increases counter-clockwise when seen from the
+ * positive z-axis. */
+static void addDisk( CachedMesh &mesh, GLfloat z, bool flip,
+                     int slices, int rings )
+{
+    const GLfloat nz    = flip ? -1 : 1;
+    const GLuint  first = mesh.vertices.size();
+
+    addVertex( mesh, 0, 0, z, 0, 0, nz );
+    for( int ring = 1; ring <= rings; ring++ )
+    {
+        GLfloat radius = ( GLfloat )ring / rings;
+        for( int i = 0; i < slices; i++ )
+        {
+            GLfloat angle = 2 * M_PI * i / slices;
+            addVertex( mesh, radius * cos( angle ), radius * sin( angle ), z,
+                       0, 0, nz );
+        }
+    }
+
+    for( int i = 0; i < slices; i++ )
+    {
+        GLuint a = ringVertex( first, slices, 1, i );
+        GLuint b = ringVertex( first, slices, 1, i + 1 );
+        GLuint fan[] = { first, flip ? b : a, flip ? a : b };
+        mesh.indices.insert( mesh.indices.end(), fan, fan + 3 );
+    }
+    for( int ring = 1; ring < rings; ring++ )
+        for( int i = 0; i < slices; i++ )
+        {
+            GLuint a = ringVertex( first, slices, ring, i );
+            GLuint b = ringVertex( first, slices, ring + 1, i );
+            GLuint c = ringVertex( first, slices, ring + 1, i + 1 );
+            GLuint d = ringVertex( first, slices, ring, i + 1 );
+            if( flip )
+                addQuad( mesh, a, d, c, b );
+            else
+                addQuad( mesh, a, b, c, d );
+        }
+}
+
+/* --------------------------------------------------------------------------
+ *  CachedMesh::draw & buffer
+ *
+ *  Without buffer objects a mesh is drawn from its client copy, which is
+ *  then kept. Once uploaded, only float vertices stay on the CPU.
+ * -------------------------------------------------------------------------- */
+void CachedMesh::draw() const
+{
+    if( indexCount() == 0 )
+        return;
+
+    if( m_IsQuantized )
+    {
+        glMatrixMode( GL_TEXTURE );
+        glPushMatrix();
+        glLoadMatrixf( m_TexCoordDecode.m );
+        glMatrixMode( GL_MODELVIEW );
+        glPushMatrix();
+        glMultMatrixf( m_PositionDecode.m );
+    }
+
+    MeshBuffer *meshBuffer = buffer();
+    if( meshBuffer )
+        meshBuffer->draw();
+    else
+    {
+        glPushClientAttrib( GL_CLIENT_VERTEX_ARRAY_BIT );
+        if( m_IsQuantized )
+            MeshBuffer::setVertexPointers( true, &m_QuantizedVertices[ 0 ] );
+        else
+            MeshBuffer::setVertexPointers( false, &vertices[ 0 ] );
+        glDrawElements( GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT,
+                        &indices[ 0 ] );
+        glPopClientAttrib();
+    }
+
+    if( m_IsQuantized )
+    {
+        glPopMatrix();
+        glMatrixMode( GL_TEXTURE );
+        glPopMatrix();
+        glMatrixMode( GL_MODELVIEW );
+    }
+}
+
+MeshBuffer *CachedMesh::buffer() const
+{
+    if( m_UseMeshBuffer && !m_MeshBuffer.isUploaded() )
+    {
+        if( !m_IsQuantized )
+            m_UseMeshBuffer = m_MeshBuffer.upload( vertices, indices );
+        else if( ( m_UseMeshBuffer = m_MeshBuffer.upload( m_QuantizedVertices,
+                                                          indices ) ) )
+            std::vector< QuantizedVertex >().swap( m_QuantizedVertices );
+        if( m_UseMeshBuffer )
+            std::vector< GLuint >().swap( indices );
+    }
+
+    return m_UseMeshBuffer ? &m_MeshBuffer : NULL;
+}
+
+/* --------------------------------------------------------------------------
+ *  CachedMesh::quantize
+ *
+ *  Positions map [ -32767, 32767 ] onto the largest extent of the box
+ *  around its centre, so the error is at most 1 / 65534 of that extent.
+ *  One scale for all axes keeps the decode a similarity, which leaves the
+ *  normals as they are ( GL_NORMALIZE is enabled ). Texture coordinates
+ *  may repeat, so their range is taken per mesh as well, per axis.
+ * -------------------------------------------------------------------------- */
+static inline GLshort quantizeShort( GLfloat value, GLfloat center,
+                                     GLfloat scale )
+{
+    GLfloat q = floor( ( value - center ) / scale + 0.5f );
+    if( q > 32767 ) q = 32767;
+    if( q < -32767 ) q = -32767;
+    return ( GLshort )q;
+}
+
+void CachedMesh::quantize()
+{
+    if( m_IsQuantized || vertices.empty() )
+        return;
+
+    GLfloat lower[ 5 ], upper[ 5 ], center[ 5 ], scale[ 5 ];
+    for( int k = 0; k < 5; k++ )
+    {
+        lower[ k ] = HUGE_VAL;
+        upper[ k ] = -HUGE_VAL;
+    }
+    for( size_t i = 0; i < vertices.size(); i++ )
+    {
+        const MeshVertex &vertex = vertices[ i ];
+        for( int k = 0; k < 3; k++ )
+        {
+            lower[ k ] = std::min( lower[ k ], vertex.position[ k ] );
+            upper[ k ] = std::max( upper[ k ], vertex.position[ k ] );
+        }
+        for( int k = 0; k < 2; k++ )
+        {
+            lower[ 3 + k ] = std::min( lower[ 3 + k ], vertex.texCoord[ k ] );
+            upper[ 3 + k ] = std::max( upper[ 3 + k ], vertex.texCoord[ k ] );
+        }
+    }
+
+    GLfloat extent = 0;
+    for( int k = 0; k < 5; k++ )
+    {
+        center[ k ] = ( lower[ k ] + upper[ k ] ) / 2;
+        scale[ k ] = ( upper[ k ] - lower[ k ] ) / 2 / 32767;
+        if( k < 3 )
+            extent = std::max( extent, scale[ k ] );
+    }
+    for( int k = 0; k < 5; k++ )
+    {
+        if( k < 3 )
+            scale[ k ] = extent;
+        if( scale[ k ] <= 0 )
+            scale[ k ] = 1;
+    }
+
+    m_QuantizedVertices.resize( vertices.size() );
+    for( size_t i = 0; i < vertices.size(); i++ )
+    {
+        const MeshVertex    &vertex = vertices[ i ];
+        QuantizedVertex     &packed = m_QuantizedVertices[ i ];
+        const GLfloat       *n = vertex.normal;
+        GLfloat             length = sqrt( n[ 0 ] * n[ 0 ] + n[ 1 ] * n[ 1 ] +
+                                           n[ 2 ] * n[ 2 ] );
+
+        for( int k = 0; k < 3; k++ )
+        {
+            packed.position[ k ] = quantizeShort( vertex.position[ k ],
+                                                  center[ k ], scale[ k ] );
+            packed.normal[ k ] = length > 0 ?
+                ( GLbyte )floor( n[ k ] / length * 127 + 0.5f ) : 0;
+        }
+        for( int k = 0; k < 2; k++ )
+            packed.texCoord[ k ] = quantizeShort( vertex.texCoord[ k ],
+                                                  center[ 3 + k ],
+                                                  scale[ 3 + k ] );
+        packed.position[ 3 ] = 0;
+        packed.normal[ 3 ] = 0;
+    }
+
+    m_PositionDecode = Matrix4f::translation( center[ 0 ], center[ 1 ],
+                                              center[ 2 ] ) *
+                       Matrix4f::scaling( scale[ 0 ], scale[ 1 ], scale[ 2 ] );
+    m_TexCoordDecode = Matrix4f::translation( center[ 3 ], center[ 4 ], 0 ) *
+                       Matrix4f::scaling( scale[ 3 ], scale[ 4 ], 1 );
+    std::vector< MeshVertex >().swap( vertices );
+    m_IsQuantized = true;
+}
+
+/* --------------------------------------------------------------------------
+ *  GeometryCache ( ctor, dtor ) & getInstance
+ * -------------------------------------------------------------------------- */
+GeometryCache::GeometryCache()
+{
+    m_Cube.vertices.assign( CUBE_VERTICES, ARRAY_END( CUBE_VERTICES ) );
+    m_Cube.indices.assign( CUBE_INDICES, ARRAY_END( CUBE_INDICES ) );
+    m_Square.vertices.assign( SQUARE_VERTICES, ARRAY_END( SQUARE_VERTICES ) );
+    m_Square.indices.assign( SQUARE_INDICES, ARRAY_END( SQUARE_INDICES ) );
+}
+
+GeometryCache::GeometryCache( const GeometryCache & ) {}
+GeometryCache &GeometryCache::operator=( const GeometryCache & ) { return *this; }
+
+GeometryCache::~GeometryCache()
+{
+    for( MeshMap::iterator it = m_Cylinders.begin(); it != m_Cylinders.end(); ++it )
+        delete it->second;
+}
+
+GeometryCache *GeometryCache::getInstance()
+{
+    if( !m_pInstance )
+    {
+        m_pInstance = new GeometryCache();
+    }
+    return m_pInstance;
+}
+
+/* --------------------------------------------------------------------------
+ *  closedCylinder
+ *
+ *  Side vertices are shared between the quads of a slice, so the normals
+ *  are smooth around the cylinder. The disks have vertices of their own.
+ * -------------------------------------------------------------------------- */
+CachedMesh &GeometryCache::closedCylinder( int slices, int stacks )
+{
+    CachedMesh *&mesh = m_Cylinders[ std::make_pair( slices, stacks ) ];
+    if( mesh )
+        return *mesh;
+
+    mesh = new CachedMesh;
+
+    for( int stack = 0; stack <= stacks; stack++ )
+        for( int i = 0; i < slices; i++ )
+        {
+            GLfloat angle = 2 * M_PI * i / slices;
+            GLfloat x = cos( angle ), y = sin( angle );
+            addVertex( *mesh, x, y, ( GLfloat )stack / stacks, x, y, 0 );
+        }
+    for( int stack = 0; stack < stacks; stack++ )
+        for( int i = 0; i < slices; i++ )
+        {
+            GLuint bottom = stack * slices, top = bottom + slices;
+            GLuint next   = ( i + 1 ) % slices;
+            addQuad( *mesh, bottom + i, bottom + next, top + next, top + i );
+        }
+
+    addDisk( *mesh, 0, true, slices, stacks );
+    addDisk( *mesh, 1, false, slices, stacks );
+
+    return *mesh;
+}
+
@@ -0,0 +1,151 @@
+/* --------------------------------------------------------------------------
+ * geometrycache.h
+ *
+ * Procedural meshes generated once and shared by all the drawables using
+ * them.
+ *
+ * -------------------------------------------------------------------------- */
+
+#ifndef GEOMETRYCACHE_H
+#define GEOMETRYCACHE_H
+
+#include "renderer.h"
+#include "meshbuffer.h"
+#include <map>
+#include <vector>
+
+/* --------------------------------------------------------------------------
+ *  CachedMesh
+ *
+ *  Indexed triangles, uploaded to a MeshBuffer on the first draw. Drawn
+ *  from client side vertex arrays if buffer objects are not supported.
+ *  Meshes with clusters can be drawn in part, one index range per run of
+ *  visible clusters ( see Renderer::cullClusters ).
+ *
+ *  A quantized mesh holds QuantizedVertex instead, in coordinates of its
+ *  own. Whoever draws its buffer multiplies the mesh matrix by
+ *  positionDecode and loads texCoordDecode as the texture matrix, so the
+ *  vertices are decoded by the transformation the GL does anyway.
+ * -------------------------------------------------------------------------- */
+class CachedMesh
+{
+public:
+    enum VertexFormat { FLOAT_VERTICES, QUANTIZED_VERTICES };
+
+    /* Empty once quantized. */
+    std::vector< MeshVertex >   vertices;
+    /* Empty once uploaded, see indexCount(). */
+    mutable std::vector< GLuint > indices;
+    /* Clusters covering indices in order, or none. */
+    std::vector< MeshCluster >  clusters;
+
+    CachedMesh() : m_UseMeshBuffer( true ), m_IsQuantized( false ) {}
+
+    /* Draws the mesh with the current matrices and material. */
+    void        draw() const;
+    /* The buffer objects of the mesh, uploaded on the first call. NULL if
+     * buffer objects are not supported. */
+    MeshBuffer  *buffer() const;
+    /* Number of indices, also after they moved to the buffer. */
+    GLsizei     indexCount() const
+    {
+        return indices.empty() ? m_MeshBuffer.indexCount() : indices.size();
+    }
+
+    /* Replaces the vertices by QuantizedVertex, before the first draw.
+     * Positions are stored relative to the bounding box of the mesh, with
+     * the same scale on all axes, and texture coordinates relative to
+     * their range. Once the buffer is uploaded the mesh keeps no vertices
+     * on the CPU. */
+    void        quantize();
+    bool        isQuantized() const { return m_IsQuantized; }
+    /* Empty for float meshes and once uploaded. */
+    const std::vector< QuantizedVertex > &quantizedVertices() const
+    {
+        return m_QuantizedVertices;
+    }
+    VertexFormat format() const
+    {
+        return m_IsQuantized ? QUANTIZED_VERTICES : FLOAT_VERTICES;
+    }
+    /* Map the quantized positions to object space and the quantized
+     * texture coordinates to the original ones. Identities for float
+     * vertices. */
+    const Matrix4f &positionDecode() const { return m_PositionDecode; }
+    const Matrix4f &texCoordDecode() const { return m_TexCoordDecode; }
+
+private:
+    /* Uploading leaves the mesh as it is, so const meshes can be drawn,
+     * apart from dropping the indices and quantized vertices, which
+     * nothing reads after that. */
+    mutable MeshBuffer  m_MeshBuffer;
+    mutable bool        m_UseMeshBuffer;
+    mutable std::vector< QuantizedVertex >  m_QuantizedVertices;
+    bool                m_IsQuantized;
+    Matrix4f            m_PositionDecode;
+    Matrix4f            m_TexCoordDecode;
+};
+
+/* --------------------------------------------------------------------------
+ *  MeshLodChain
+ *
+ *  Levels of detail of a mesh, from the mesh itself at level 0 to the
+ *  coarsest. errors[ i ] estimates how far level i is from level 0,
+ *  relative to the radius of the mesh, so that it scales with the
+ *  drawable showing it. Errors grow with the level.
+ * -------------------------------------------------------------------------- */
+struct MeshLodChain
+{
+    enum { MAX_LEVELS = 5 };
+
+    const CachedMesh    *levels[ MAX_LEVELS ];
+    GLfloat             errors[ MAX_LEVELS ];
+    int                 count;
+
+    MeshLodChain() : count( 0 ) {}
+};
+
+/* --------------------------------------------------------------------------
+ *  GeometryCache
+ *
+ *  Singleton class holding the meshes of the shapes shared by drawables:
+ *  the cube and square, copied from static tables, and the shapes GLU
+ *  would otherwise tessellate on every draw, generated once per
+ *  tessellation. Meshes are kept for the lifetime of the program; the
+ *  returned references stay valid. Shapes are of unit size, drawables
+ *  scale them to their needs ( GL_NORMALIZE is enabled ).
+ * -------------------------------------------------------------------------- */
+class GeometryCache
+{
+private:
+    typedef std::map< std::pair< int, int >, CachedMesh* > MeshMap;
+
+    MeshMap             m_Cylinders;
+    CachedMesh          m_Cube;
+    CachedMesh          m_Square;
+
+    /* Handles own static pointer. */
+    static GeometryCache *m_pInstance;
+
+    /* Prevent outside calling of ctor, copy-ctor and assignment operator. */
+    GeometryCache();
+    GeometryCache( const GeometryCache & );
+    GeometryCache& operator=( const GeometryCache & );
+
+public:
+    ~GeometryCache();
+    static GeometryCache* getInstance();
+
+    /* Cylinder of radius and length 1 along the z-axis from 0, closed by a
+     * disk at both ends. The side has slices x stacks quads like
+     * gluCylinder and the disks slices x stacks rings like gluDisk. */
+    CachedMesh          &closedCylinder( int slices, int stacks );
+    /* Cube of side 1 centred on the origin, with a normal per face. */
+    CachedMesh          &cube() { return m_Cube; }
+    /* Square of side 1 in the xy-plane, centred on the origin and facing
+     * the positive z-axis. Its normal is ( 0, -1, 0 ), as Plane has always
+     * lit it. */
+    CachedMesh          &square() { return m_Square; }
+};
+
+#endif /* GEOMETRYCACHE_H */
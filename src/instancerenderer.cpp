@@ -0,0 +1,317 @@
+/* --------------------------------------------------------------------------
+ * instancerenderer.cpp
+ *
+ * Implementation of the InstanceRenderer class.
+ *
+ * -------------------------------------------------------------------------- */
+
+#include "instancerenderer.h"
+#include "renderer.h"
+#include "geometrycache.h"
+#include "statemanager.h"
+#include <QGLShaderProgram>
+#include <string.h>
+#include <stdio.h>
+#include <stddef.h>
+
+/* --------------------------------------------------------------------------
+ *  Vertex shader
+ *
+ *  The fixed-function lighting equation for one light, with the ambient
+ *  and diffuse material from the instance color if colorMaterial is set.
+ *  Normals are transformed by the cofactors of the instance matrix, its
+ *  inverse transpose up to scale, as boxes are scaled non-uniformly.
+ *  Texture coordinates go through the texture matrix, which decodes those
+ *  of quantized meshes.
+ * -------------------------------------------------------------------------- */
+static const char *VERTEX_SHADER =
+    "#version 120\n"
+    "attribute mat4 instanceMatrix;\n"
+    "attribute vec4 instanceColor;\n"
+    "uniform bool lighting;\n"
+    "uniform bool colorMaterial;\n"
+    "\n"
+    "void main()\n"
+    "{\n"
+    "    vec4 eye = gl_ModelViewMatrix * ( instanceMatrix * gl_Vertex );\n"
+    "    gl_Position = gl_ProjectionMatrix * eye;\n"
+    "    gl_TexCoord[ 0 ] = gl_TextureMatrix[ 0 ] * gl_MultiTexCoord0;\n"
+    "    gl_FrontSecondaryColor = vec4( 0.0 );\n"
+    "\n"
+    "    if( !lighting )\n"
+    "    {\n"
+    "        gl_FrontColor = colorMaterial ? instanceColor : gl_Color;\n"
+    "        return;\n"
+    "    }\n"
+    "\n"
+    "    vec4 ambient = colorMaterial ? instanceColor : gl_FrontMaterial.ambient;\n"
+    "    vec4 diffuse = colorMaterial ? instanceColor : gl_FrontMaterial.diffuse;\n"
+    "\n"
+    "    mat3 m = mat3( instanceMatrix );\n"
+    "    mat3 cofactors = mat3( cross( m[ 1 ], m[ 2 ] ),\n"
+    "                           cross( m[ 2 ], m[ 0 ] ),\n"
+    "                           cross( m[ 0 ], m[ 1 ] ) );\n"
+    "    vec3 normal = normalize( gl_NormalMatrix * ( cofactors * gl_Normal ) );\n"
+    "\n"
+    "    vec4 position = gl_LightSource[ 0 ].position;\n"
+    "    vec3 toLight = position.xyz - eye.xyz * position.w;\n"
+    "    float d = length( toLight );\n"
+    "    float attenuation = 1.0;\n"
+    "    if( position.w != 0.0 )\n"
+    "        attenuation = 1.0 / ( gl_LightSource[ 0 ].constantAttenuation +\n"
+    "                              gl_LightSource[ 0 ].linearAttenuation * d +\n"
+    "                              gl_LightSource[ 0 ].quadraticAttenuation * d * d );\n"
+    "    toLight /= d;\n"
+    "\n"
+    "    float diffuseTerm = max( dot( normal, toLight ), 0.0 );\n"
+    "    float specularTerm = 0.0;\n"
+    "    if( diffuseTerm > 0.0 )\n"
+    "    {\n"
+    "        vec3 halfway = normalize( toLight + vec3( 0.0, 0.0, 1.0 ) );\n"
+    "        specularTerm = pow( max( dot( normal, halfway ), 0.0 ),\n"
+    "                            gl_FrontMaterial.shininess );\n"
+    "    }\n"
+    "\n"
+    "    gl_FrontColor = gl_FrontMaterial.emission +\n"
+    "                    gl_LightModel.ambient * ambient +\n"
+    "                    attenuation * ( gl_LightSource[ 0 ].ambient * ambient +\n"
+    "                                    diffuseTerm * gl_LightSource[ 0 ].diffuse * diffuse );\n"
+    "    gl_FrontColor.a = diffuse.a;\n"
+    "    gl_FrontSecondaryColor = attenuation * specularTerm *\n"
+    "                             gl_LightSource[ 0 ].specular *\n"
+    "                             gl_FrontMaterial.specular;\n"
+    "}\n";
+
+InstanceRenderer::InstanceRenderer() :
+    m_pProgram( NULL ),
+    m_InstanceBuffer( QGLBuffer::VertexBuffer ),
+    m_VertexAttribDivisor( NULL ),
+    m_DrawElementsInstanced( NULL ),
+    m_LightingLocation( -1 ),
+    m_ColorMaterialLocation( -1 )
+{
+}
+
+InstanceRenderer::~InstanceRenderer()
+{
+    destroy();
+}
+
+/* --------------------------------------------------------------------------
+ *  initialize & destroy
+ * -------------------------------------------------------------------------- */
+void InstanceRenderer::initialize()
+{
+    destroy();
+
+    const QGLContext *context = QGLContext::currentContext();
+    const char *extensions = ( const char * )glGetString( GL_EXTENSIONS );
+    if( !context || !extensions ||
+        !strstr( extensions, "GL_ARB_instanced_arrays" ) ||
+        !strstr( extensions, "GL_ARB_draw_instanced" ) ||
+        !QGLShaderProgram::hasOpenGLShaderPrograms() )
+        return;
+
+    m_VertexAttribDivisor = ( VertexAttribDivisorFunc )
+        context->getProcAddress( "glVertexAttribDivisorARB" );
+    m_DrawElementsInstanced = ( DrawElementsInstancedFunc )
+        context->getProcAddress( "glDrawElementsInstancedARB" );
+    if( !m_VertexAttribDivisor || !m_DrawElementsInstanced )
+        return;
+
+    if( !m_InstanceBuffer.create() )
+        return;
+    m_InstanceBuffer.setUsagePattern( QGLBuffer::StreamDraw );
+
+    m_pProgram = new QGLShaderProgram;
+    m_pProgram->bindAttributeLocation( "instanceMatrix", MATRIX_ATTRIBUTE );
+    m_pProgram->bindAttributeLocation( "instanceColor", COLOR_ATTRIBUTE );
+    if( !m_pProgram->addShaderFromSourceCode( QGLShader::Vertex,
+                                              VERTEX_SHADER ) ||
+        !m_pProgram->link() )
+    {
+        /* Qt has printed the shader log. */
+        fprintf( stderr, "InstanceRenderer: no shader, instances are drawn "
+                         "one at a time\n" );
+        destroy();
+        return;
+    }
+
+    m_LightingLocation      = m_pProgram->uniformLocation( "lighting" );
+    m_ColorMaterialLocation = m_pProgram->uniformLocation( "colorMaterial" );
+}
+
+void InstanceRenderer::destroy()
+{
+    delete m_pProgram;
+    m_pProgram = NULL;
+    m_InstanceBuffer.destroy();
+    m_VertexAttribDivisor = NULL;
+    m_DrawElementsInstanced = NULL;
+}
+
+/* --------------------------------------------------------------------------
+ *  draw
+ *
+ *  The texture matrix of a quantized mesh is set for all its instances and
+ *  reset to the identity after them.
+ * -------------------------------------------------------------------------- */
+int InstanceRenderer::draw( const CachedMesh &mesh,
+                            const RenderItem *items, int count,
+                            const IndexRange *ranges, int rangeCount )
+{
+    int calls;
+
+    if( mesh.isQuantized() )
+    {
+        glMatrixMode( GL_TEXTURE );
+        glLoadMatrixf( mesh.texCoordDecode().m );
+    }
+
+    if( count > 1 && !ranges && m_pProgram && mesh.buffer() )
+        calls = drawInstanced( mesh, items, count );
+    else
+        calls = drawLoop( mesh, items, count, ranges, rangeCount );
+
+    if( mesh.isQuantized() )
+    {
+        glMatrixMode( GL_TEXTURE );
+        glLoadIdentity();
+        glMatrixMode( GL_MODELVIEW );
+    }
+    return calls;
+}
+
+/* --------------------------------------------------------------------------
+ *  drawInstanced
+ *
+ *  The instance matrices replace the modelview matrix, which is set to the
+ *  identity. They include the position decode of quantized meshes. The
+ *  shader writes a separate specular color, which the
+ *  fixed-function fragment stage only adds with GL_COLOR_SUM enabled.
+ * -------------------------------------------------------------------------- */
+int InstanceRenderer::drawInstanced( const CachedMesh &mesh,
+                                     const RenderItem *items, int count )
+{
+    const GLuint    flags = items[ 0 ].flags;
+    const bool      quantized = mesh.isQuantized();
+
+    m_Instances.resize( count );
+    for( int i = 0; i < count; i++ )
+    {
+        Instance        &instance = m_Instances[ i ];
+        const Vector3f  &color = *items[ i ].pColor;
+
+        if( quantized )
+            memcpy( instance.matrix,
+                    ( *items[ i ].pMeshMatrix * mesh.positionDecode() ).m,
+                    sizeof( instance.matrix ) );
+        else
+            memcpy( instance.matrix, items[ i ].pMeshMatrix->m,
+                    sizeof( instance.matrix ) );
+        instance.color[ 0 ] = color.x / 255;
+        instance.color[ 1 ] = color.y / 255;
+        instance.color[ 2 ] = color.z / 255;
+        instance.color[ 3 ] = 1.0;
+    }
+
+    m_pProgram->bind();
+    m_pProgram->setUniformValue( m_LightingLocation,
+                                 ( GLint )( ( flags & RenderItem::LIGHTING ) != 0 ) );
+    m_pProgram->setUniformValue( m_ColorMaterialLocation,
+                                 ( GLint )( ( flags & RenderItem::COLOR_MATERIAL ) != 0 ) );
+
+    /* Orphaned and refilled for every draw. */
+    m_InstanceBuffer.bind();
+    m_InstanceBuffer.allocate( &m_Instances[ 0 ], count * sizeof( Instance ) );
+    for( int column = 0; column < 4; column++ )
+    {
+        m_pProgram->enableAttributeArray( MATRIX_ATTRIBUTE + column );
+        m_pProgram->setAttributeBuffer( MATRIX_ATTRIBUTE + column, GL_FLOAT,
+                                        column * 4 * sizeof( GLfloat ), 4,
+                                        sizeof( Instance ) );
+        m_VertexAttribDivisor( MATRIX_ATTRIBUTE + column, 1 );
+    }
+    m_pProgram->enableAttributeArray( COLOR_ATTRIBUTE );
+    m_pProgram->setAttributeBuffer( COLOR_ATTRIBUTE, GL_FLOAT,
+                                    offsetof( Instance, color ), 4,
+                                    sizeof( Instance ) );
+    m_VertexAttribDivisor( COLOR_ATTRIBUTE, 1 );
+    m_InstanceBuffer.release();
+
+    glPushAttrib( GL_ENABLE_BIT );
+    glEnable( GL_COLOR_SUM );
+    glMatrixMode( GL_MODELVIEW );
+    glLoadIdentity();
+
+    MeshBuffer *buffer = mesh.buffer();
+    buffer->bind();
+    m_DrawElementsInstanced( GL_TRIANGLES, buffer->indexCount(),
+                             buffer->indexType(), 0, count );
+    buffer->release();
+
+    glPopAttrib();
+
+    for( int attribute = MATRIX_ATTRIBUTE; attribute <= COLOR_ATTRIBUTE;
+         attribute++ )
+    {
+        m_VertexAttribDivisor( attribute, 0 );
+        m_pProgram->disableAttributeArray( attribute );
+    }
+    m_pProgram->release();
+
+    return 1;
+}
+
+/* --------------------------------------------------------------------------
+ *  drawLoop
+ *
+ *  The colors go through the StateManager like any other material. Ranges
+ *  need buffer objects, without them the whole mesh is drawn, by
+ *  CachedMesh::draw, which decodes quantized positions itself.
+ * -------------------------------------------------------------------------- */
+int InstanceRenderer::drawLoop( const CachedMesh &mesh,
+                                const RenderItem *items, int count,
+                                const IndexRange *ranges, int rangeCount )
+{
+    StateManager    *state = StateManager::getInstance();
+    MeshBuffer      *buffer = mesh.buffer();
+    const bool      colorMaterial =
+                    ( items[ 0 ].flags & RenderItem::COLOR_MATERIAL ) != 0;
+    const bool      decode = buffer && mesh.isQuantized();
+
+    glMatrixMode( GL_MODELVIEW );
+    if( buffer )
+        buffer->bind();
+
+    for( int i = 0; i < count; i++ )
+    {
+        const Matrix4f &meshMatrix = *items[ i ].pMeshMatrix;
+
+        if( decode )
+            glLoadMatrixf( ( meshMatrix * mesh.positionDecode() ).m );
+        else
+            glLoadMatrixf( meshMatrix.m );
+        if( colorMaterial )
+        {
+            const Vector3f &color = *items[ i ].pColor;
+            GLfloat  rgba[] = { color.x / 255, color.y / 255, color.z / 255,
+                                1.0 };
+            state->materialfv( GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE,
+                               rgba );
+            glColor4fv( rgba );
+        }
+
+        if( buffer && ranges )
+            for( int r = 0; r < rangeCount; r++ )
+                buffer->drawElements( ranges[ r ].first, ranges[ r ].count );
+        else if( buffer )
+            buffer->drawElements();
+        else
+            mesh.draw();
+    }
+
+    if( buffer )
+        buffer->release();
+    return buffer && ranges ? count * rangeCount : count;
+}
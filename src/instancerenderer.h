@@ -0,0 +1,90 @@
+/* --------------------------------------------------------------------------
+ * instancerenderer.h
+ *
+ * Draws the render items sharing a mesh with one instanced draw call.
+ *
+ * -------------------------------------------------------------------------- */
+
+#ifndef INSTANCERENDERER_H
+#define INSTANCERENDERER_H
+
+#include <QGLWidget>
+#include <QGLBuffer>
+#include <vector>
+
+struct RenderItem;
+struct IndexRange;
+class CachedMesh;
+class QGLShaderProgram;
+
+/* --------------------------------------------------------------------------
+ *  InstanceRenderer
+ *
+ *  The mesh matrix and color of each instance ( see RenderItem::pMeshMatrix
+ *  and RenderItem::COLOR_MATERIAL ) are streamed into a buffer object and
+ *  read as per-instance vertex attributes ( GL_ARB_instanced_arrays ) by a
+ *  vertex shader, which replaces the fixed-function transformation and
+ *  lighting of the scene: GL_LIGHT0 and the light model ambient, lit from
+ *  the front. Texturing and the rest are left to the fixed-function
+ *  pipeline.
+ *
+ *  Without the extensions, shaders or buffer objects the mesh is drawn
+ *  once per instance, loading each matrix in turn.
+ * -------------------------------------------------------------------------- */
+class InstanceRenderer
+{
+public:
+    InstanceRenderer();
+    ~InstanceRenderer();
+
+    /* Looks up the extensions and builds the shader. Called with the
+     * context current. Until then the fallback is used. */
+    void        initialize();
+    bool        isHardwareInstancing() const { return m_pProgram != NULL; }
+
+    /* Draws the mesh for each of the items, all with the same render state,
+     * which is already set. Returns the number of draw calls made. With
+     * ranges only those parts of the mesh are drawn, one item at a time. */
+    int         draw( const CachedMesh &mesh, const RenderItem *items,
+                      int count, const IndexRange *ranges = NULL,
+                      int rangeCount = 0 );
+
+private:
+    typedef void ( APIENTRY *VertexAttribDivisorFunc )( GLuint index,
+                                                        GLuint divisor );
+    typedef void ( APIENTRY *DrawElementsInstancedFunc )( GLenum mode,
+                    GLsizei count, GLenum type, const GLvoid *indices,
+                    GLsizei primcount );
+
+    /* Layout of the instance buffer. */
+    struct Instance
+    {
+        GLfloat     matrix[ 16 ];
+        GLfloat     color[ 4 ];
+    };
+
+    /* Attribute locations, past the ones aliased by the fixed-function
+     * attributes. The matrix takes four. */
+    enum { MATRIX_ATTRIBUTE = 8, COLOR_ATTRIBUTE = 12 };
+
+    QGLShaderProgram            *m_pProgram;
+    QGLBuffer                   m_InstanceBuffer;
+    std::vector< Instance >     m_Instances;
+    VertexAttribDivisorFunc     m_VertexAttribDivisor;
+    DrawElementsInstancedFunc   m_DrawElementsInstanced;
+    int                         m_LightingLocation;
+    int                         m_ColorMaterialLocation;
+
+    int         drawInstanced( const CachedMesh &mesh,
+                               const RenderItem *items, int count );
+    int         drawLoop( const CachedMesh &mesh, const RenderItem *items,
+                          int count, const IndexRange *ranges,
+                          int rangeCount );
+    void        destroy();
+
+    /* Prevent copying, the program and buffer are owned. */
+    InstanceRenderer( const InstanceRenderer & );
+    InstanceRenderer& operator=( const InstanceRenderer & );
+};
+
+#endif /* INSTANCERENDERER_H */
@@ -118,6 +118,18 @@ void MainWindow::createStatusBar()
 
     statusBar()->addWidget( m_pCoordLabel );
 
+    /* Label for the ACMR of the chosen model, empty for other objects. */
+    m_pMeshLabel = new QLabel;
+    statusBar()->addWidget( m_pMeshLabel );
+    connect( m_pRenderer, SIGNAL( objectChosen( ObjectHandle ) ),
+             this, SLOT( updateMeshStats( ObjectHandle ) ) );
+
+    /* Label for the render queue counters of the last frame. */
+    m_pStatsLabel = new QLabel;
+    statusBar()->addPermanentWidget( m_pStatsLabel );
+    connect( m_pRenderer, SIGNAL( frameDrawn( const FrameStats & ) ),
+             this, SLOT( updateFrameStats( const FrameStats & ) ) );
+
     connect( m_pRenderer, SIGNAL( locationChanged( float, float, float ) ),
              this, SLOT( updateStatusBar( float, float, float) ) );
     connect( m_pRenderer, SIGNAL( locationChanged( const Vector3f & ) ),
@@ -137,7 +149,9 @@ void MainWindow::createScene() //Renderer()
     robot->setPosition( 0, 2, -13 );
     m_pRenderer->attachObject( robot, true );
 
-    WFObject *wf1 = new WFObject( "bowl.obj" );
+    WFObject *wf1 = new WFObject( "bowl.obj",
+                                  WFObject::LOAD_IN_BACKGROUND, BoundingBox(),
+                                  CachedMesh::QUANTIZED_VERTICES );
     wf1->setMaterial( "Marble" );
     wf1->setTexture( "Marble" );
     wf1->setPosition( -1, -2.4, -14.0 );
@@ -155,19 +169,26 @@ void MainWindow::createScene() //Renderer()
     InelasticPBox->setPosition( 1, -1, -13 );
     m_pRenderer->attachObject( InelasticPBox );
 */
-    WFObject *wf2 = new WFObject( "brickwall.obj" );
+    WFObject *wf2 = new WFObject( "brickwall.obj",
+                                  WFObject::LOAD_IN_BACKGROUND, BoundingBox(),
+                                  CachedMesh::QUANTIZED_VERTICES );
     wf2->setMaterial( "Wall" );
     wf2->setTexture( "Wall" );
     wf2->setPosition( 3.5, -2.0, -15.0 );
     m_pRenderer->attachObject( wf2 );
 
-    WFObject *whiteboard = new WFObject( "whiteboard.obj" );
+    WFObject *whiteboard = new WFObject( "whiteboard.obj",
+                                         WFObject::LOAD_IN_BACKGROUND,
+                                         BoundingBox(),
+                                         CachedMesh::QUANTIZED_VERTICES );
     whiteboard->setMaterial( "Material" );
     whiteboard->setTexture( "Whiteboard" );
     whiteboard->setPosition( 0, -0.5, -15.1 );
     m_pRenderer->attachObject( whiteboard );
 
-    WFObject *floor = new WFObject( "floor.obj" );
+    WFObject *floor = new WFObject( "floor.obj",
+                                    WFObject::LOAD_IN_BACKGROUND, BoundingBox(),
+                                    CachedMesh::QUANTIZED_VERTICES );
     floor->setMaterial( "Floor" );
     floor->setTexture( "Floor" );
     floor->setPosition( 1.5, -2.5, -14.0 );
@@ -206,6 +227,47 @@ void MainWindow::updateStatusBar( const Vector3f &pos )
     updateStatusBar( pos.x, pos.y, pos.z );
 }
 
+/* --------------------------------------------------------------------------
+ * MainWindow::updateFrameStats ( SLOT )
+ *
+ * Updates status bar with the counters of the last drawn frame.
+ * -------------------------------------------------------------------------- */
+void MainWindow::updateFrameStats( const FrameStats &stats )
+{
+    m_pStatsLabel->setText( tr( "Drawn: %1 ( %2 draw calls, %3 triangles )  "
+                                "Culled: %4 ( %5 clusters )  "
+                                "State changes: %6 ( %7 dropped )" )
+                            .arg( stats.items ).arg( stats.drawCalls )
+                            .arg( stats.triangles )
+                            .arg( stats.culled ).arg( stats.culledClusters )
+                            .arg( stats.stateChanges )
+                            .arg( stats.droppedCalls ) );
+}
+
+/* --------------------------------------------------------------------------
+ * MainWindow::updateMeshStats ( SLOT )
+ *
+ * Updates status bar with the average cache miss ratio of the chosen
+ * model's mesh, before and after the loader optimized it.
+ * -------------------------------------------------------------------------- */
+void MainWindow::updateMeshStats( ObjectHandle handle )
+{
+    IDrawable *obj = m_pRenderer->object( handle );
+
+    if( !obj || obj->getType() != IDrawable::TYPE_WFOBJECT ||
+        !static_cast< WFObject * >( obj )->isLoaded() )
+    {
+        m_pMeshLabel->clear();
+        return;
+    }
+
+    const MeshOptimizerStats &stats =
+        static_cast< WFObject * >( obj )->meshAsset()->optimizeStats;
+    m_pMeshLabel->setText( tr( "ACMR: %1 -> %2" )
+                           .arg( stats.acmrBefore, 0, 'f', 3 )
+                           .arg( stats.acmrAfter, 0, 'f', 3 ) );
+}
+
 /* --------------------------------------------------------------------------
  * MainWindow::toggleDock
  *
@@ -36,6 +36,10 @@ private:
 
     /* Coordinate label on the status bar. */
     QLabel      *m_pCoordLabel;
+    /* Frame counters label on the status bar. */
+    QLabel      *m_pStatsLabel;
+    /* Vertex cache figures of the chosen model on the status bar. */
+    QLabel      *m_pMeshLabel;
 public:
     MainWindow();
 
@@ -50,6 +54,8 @@ private slots:
     void help();
     void updateStatusBar( float x, float y, float z );
     void updateStatusBar( const Vector3f &pos );
+    void updateFrameStats( const FrameStats &stats );
+    void updateMeshStats( ObjectHandle handle );
     void toggleDock();
 };
 
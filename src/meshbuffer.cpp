@@ -0,0 +1,166 @@
+/* --------------------------------------------------------------------------
+ * meshbuffer.cpp
+ *
+ * Implementation of the MeshBuffer class.
+ *
+ * -------------------------------------------------------------------------- */
+
+#include "meshbuffer.h"
+#include <stddef.h>
+
+MeshBuffer::MeshBuffer() :
+    m_VertexBuffer( QGLBuffer::VertexBuffer ),
+    m_IndexBuffer( QGLBuffer::IndexBuffer ),
+    m_IndexType( GL_UNSIGNED_INT ),
+    m_IndexCount( 0 ),
+    m_IsUploaded( false ),
+    m_IsQuantized( false )
+{
+}
+
+/* --------------------------------------------------------------------------
+ *  upload
+ * -------------------------------------------------------------------------- */
+bool MeshBuffer::upload( const std::vector< MeshVertex > &vertices,
+                         const std::vector< GLuint > &indices )
+{
+    if( vertices.empty() )
+        return false;
+    return upload( &vertices[ 0 ], vertices.size(), sizeof( MeshVertex ),
+                   indices );
+}
+
+bool MeshBuffer::upload( const std::vector< QuantizedVertex > &vertices,
+                         const std::vector< GLuint > &indices )
+{
+    if( vertices.empty() ||
+        !upload( &vertices[ 0 ], vertices.size(), sizeof( QuantizedVertex ),
+                 indices ) )
+        return false;
+    m_IsQuantized = true;
+    return true;
+}
+
+bool MeshBuffer::upload( const GLvoid *vertices, size_t vertexCount,
+                         size_t vertexSize, const std::vector< GLuint > &indices )
+{
+    destroy();
+    if( indices.empty() )
+        return false;
+
+    if( !m_VertexBuffer.create() || !m_IndexBuffer.create() )
+    {
+        destroy();
+        return false;
+    }
+
+    m_VertexBuffer.setUsagePattern( QGLBuffer::StaticDraw );
+    m_VertexBuffer.bind();
+    m_VertexBuffer.allocate( vertices, vertexCount * vertexSize );
+    m_VertexBuffer.release();
+
+    /* Half the index data for meshes of up to 64k vertices. */
+    m_IndexBuffer.setUsagePattern( QGLBuffer::StaticDraw );
+    m_IndexBuffer.bind();
+    if( vertexCount <= 0x10000 )
+    {
+        std::vector< GLushort > shortIndices( indices.begin(), indices.end() );
+        m_IndexBuffer.allocate( &shortIndices[ 0 ],
+                                shortIndices.size() * sizeof( GLushort ) );
+        m_IndexType = GL_UNSIGNED_SHORT;
+    }
+    else
+    {
+        m_IndexBuffer.allocate( &indices[ 0 ], indices.size() * sizeof( GLuint ) );
+        m_IndexType = GL_UNSIGNED_INT;
+    }
+    m_IndexBuffer.release();
+
+    m_IndexCount = indices.size();
+    m_IsUploaded = true;
+    return true;
+}
+
+/* --------------------------------------------------------------------------
+ *  draw, bind, drawElements & release
+ * -------------------------------------------------------------------------- */
+void MeshBuffer::draw()
+{
+    if( !m_IsUploaded )
+        return;
+
+    bind();
+    drawElements();
+    release();
+}
+
+/* With a buffer bound the pointers are offsets into the buffer. */
+void MeshBuffer::bind()
+{
+    m_VertexBuffer.bind();
+    glPushClientAttrib( GL_CLIENT_VERTEX_ARRAY_BIT );
+    setVertexPointers( m_IsQuantized, 0 );
+    m_IndexBuffer.bind();
+}
+
+void MeshBuffer::drawElements()
+{
+    glDrawElements( GL_TRIANGLES, m_IndexCount, m_IndexType, 0 );
+}
+
+void MeshBuffer::drawElements( GLuint firstIndex, GLsizei indexCount )
+{
+    GLuint size = m_IndexType == GL_UNSIGNED_SHORT ? sizeof( GLushort ) :
+                                                     sizeof( GLuint );
+    glDrawElements( GL_TRIANGLES, indexCount, m_IndexType,
+                    ( const GLvoid * )( quintptr )( firstIndex * size ) );
+}
+
+void MeshBuffer::release()
+{
+    glPopClientAttrib();
+    m_IndexBuffer.release();
+    m_VertexBuffer.release();
+}
+
+/* --------------------------------------------------------------------------
+ *  destroy
+ * -------------------------------------------------------------------------- */
+void MeshBuffer::destroy()
+{
+    m_VertexBuffer.destroy();
+    m_IndexBuffer.destroy();
+    m_IndexCount = 0;
+    m_IsUploaded = false;
+    m_IsQuantized = false;
+}
+
+/* --------------------------------------------------------------------------
+ *  setVertexPointers
+ *
+ *  The MeshVertex layout matches GL_T2F_N3F_V3F. The quantized one has no
+ *  interleaved format and is set up array by array, the same way:
+ *  glInterleavedArrays disables the color array as well.
+ * -------------------------------------------------------------------------- */
+void MeshBuffer::setVertexPointers( bool quantized, const GLvoid *vertices )
+{
+    if( !quantized )
+    {
+        glInterleavedArrays( GL_T2F_N3F_V3F, 0, vertices );
+        return;
+    }
+
+    const quintptr  base = ( quintptr )vertices;
+    const GLsizei   stride = sizeof( QuantizedVertex );
+
+    glDisableClientState( GL_COLOR_ARRAY );
+    glEnableClientState( GL_TEXTURE_COORD_ARRAY );
+    glEnableClientState( GL_NORMAL_ARRAY );
+    glEnableClientState( GL_VERTEX_ARRAY );
+    glTexCoordPointer( 2, GL_SHORT, stride, ( const GLvoid * )
+                       ( base + offsetof( QuantizedVertex, texCoord ) ) );
+    glNormalPointer( GL_BYTE, stride, ( const GLvoid * )
+                     ( base + offsetof( QuantizedVertex, normal ) ) );
+    glVertexPointer( 3, GL_SHORT, stride, ( const GLvoid * )
+                     ( base + offsetof( QuantizedVertex, position ) ) );
+}
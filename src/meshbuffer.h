@@ -0,0 +1,87 @@
+/* --------------------------------------------------------------------------
+ * meshbuffer.h
+ *
+ * Vertex and index buffer objects holding a welded mesh ( see ModelData ),
+ * drawn with a single glDrawElements call.
+ *
+ * -------------------------------------------------------------------------- */
+
+#ifndef MESHBUFFER_H
+#define MESHBUFFER_H
+
+#include "renderer.h"
+#include <QGLBuffer>
+
+/* --------------------------------------------------------------------------
+ *  QuantizedVertex
+ *
+ *  Compact vertex of half the size of a MeshVertex ( see
+ *  CachedMesh::quantize ). Positions and texture coordinates are 16-bit
+ *  integers, mapped back to floats by the modelview and texture matrices.
+ *  Normals are signed bytes, which GL maps to [ -1, 1 ] itself. The pads
+ *  keep every attribute on a 4-byte boundary.
+ * -------------------------------------------------------------------------- */
+struct QuantizedVertex
+{
+    GLshort     texCoord[ 2 ];
+    GLbyte      normal[ 4 ];
+    GLshort     position[ 4 ];
+};
+
+/* --------------------------------------------------------------------------
+ *  MeshBuffer
+ *
+ *  The buffers can only be created while a GL context is current, so owners
+ *  upload their mesh on the first draw. If upload() fails, buffer objects
+ *  are not supported and the owner has to draw the mesh in immediate mode.
+ * -------------------------------------------------------------------------- */
+class MeshBuffer
+{
+private:
+    QGLBuffer   m_VertexBuffer;
+    QGLBuffer   m_IndexBuffer;
+    GLenum      m_IndexType;
+    GLsizei     m_IndexCount;
+    bool        m_IsUploaded;
+    bool        m_IsQuantized;
+
+    bool upload( const GLvoid *vertices, size_t vertexCount,
+                 size_t vertexSize, const std::vector< GLuint > &indices );
+
+public:
+    MeshBuffer();
+
+    /* Copies the mesh into new buffer objects. Indices are stored as
+     * GLushort when the vertex count allows it. */
+    bool upload( const std::vector< MeshVertex > &vertices,
+                 const std::vector< GLuint > &indices );
+    bool upload( const std::vector< QuantizedVertex > &vertices,
+                 const std::vector< GLuint > &indices );
+    bool isUploaded() const { return m_IsUploaded; }
+    bool isQuantized() const { return m_IsQuantized; }
+
+    /* Draws the whole mesh with the current matrices and material. */
+    void draw();
+
+    /* draw() in parts, for drawing the mesh many times: bind() sets the
+     * vertex pointers into the buffers, drawElements() draws the mesh and
+     * release() restores the client state. */
+    void bind();
+    void drawElements();
+    /* Draws indexCount indices from firstIndex on. */
+    void drawElements( GLuint firstIndex, GLsizei indexCount );
+    void release();
+
+    GLenum  indexType() const { return m_IndexType; }
+    GLsizei indexCount() const { return m_IndexCount; }
+
+    /* Deletes the buffer objects. */
+    void destroy();
+
+    /* Points the enabled vertex, normal and texture coordinate arrays at
+     * vertices of either layout: an offset into the bound buffer or client
+     * memory. The client state must be pushed. */
+    static void setVertexPointers( bool quantized, const GLvoid *vertices );
+};
+
+#endif /* MESHBUFFER_H */
@@ -0,0 +1,616 @@
+/* --------------------------------------------------------------------------
+ * meshbvh.cpp
+ *
+ * Implementation of the MeshBVH class.
+ *
+ * References: Ingo Wald, 'On fast Construction of SAH-based Bounding Volume
+ *             Hierarchies' ( 2007 )
+ *             Tomas Möller & Ben Trumbore, 'Fast, Minimum Storage Ray/Triangle
+ *             Intersection', Journal of Graphics Tools ( 1997 )
+ *
+ * -------------------------------------------------------------------------- */
+
+#include "meshbvh.h"
+#include <math.h>
+#include <float.h>
+#include <algorithm>
+#include <QThread>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QMutexLocker>
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+/* --------------------------------------------------------------------------
+ *  BuildData, Subtree & BuildTask
+ *
+ *  Triangle bounds and centroids are computed once. The triangle order is
+ *  partitioned in place, each node owning a contiguous range of it, so the
+ *  subtrees can be built in parallel without locking.
+ * -------------------------------------------------------------------------- */
+struct MeshBVH::BuildData
+{
+    std::vector< BoundingBox >  bounds;
+    std::vector< Vector3f >     centroids;
+    std::vector< GLuint >       order;
+};
+
+/* A subtree left for the thread pool. Its nodes are built into a separate
+ * array, root first, and moved into place once all are done. */
+struct MeshBVH::Subtree
+{
+    int                     node;
+    int                     first;
+    int                     count;
+    std::vector< Node >     nodes;
+};
+
+class MeshBVH::BuildTask : public QRunnable
+{
+private:
+    BuildData   *m_pData;
+    Subtree     *m_pSubtree;
+
+public:
+    BuildTask( BuildData *data, Subtree *subtree ) :
+        m_pData( data ), m_pSubtree( subtree ) {}
+    void run()
+    {
+        m_pSubtree->nodes.resize( 1 );
+        buildNode( *m_pData, m_pSubtree->nodes, 0, m_pSubtree->first,
+                   m_pSubtree->count, PARALLEL_DEPTH, NULL );
+    }
+};
+
+/* Inlined versions of BoundingBox::extend() and surfaceArea() for the
+ * inner loops of the build. */
+static inline void grow( BoundingBox &box, const BoundingBox &other )
+{
+    box.min.x = std::min( box.min.x, other.min.x );
+    box.min.y = std::min( box.min.y, other.min.y );
+    box.min.z = std::min( box.min.z, other.min.z );
+    box.max.x = std::max( box.max.x, other.max.x );
+    box.max.y = std::max( box.max.y, other.max.y );
+    box.max.z = std::max( box.max.z, other.max.z );
+}
+
+static inline void grow( BoundingBox &box, const Vector3f &p )
+{
+    box.min.x = std::min( box.min.x, p.x );
+    box.min.y = std::min( box.min.y, p.y );
+    box.min.z = std::min( box.min.z, p.z );
+    box.max.x = std::max( box.max.x, p.x );
+    box.max.y = std::max( box.max.y, p.y );
+    box.max.z = std::max( box.max.z, p.z );
+}
+
+static inline GLfloat area( const BoundingBox &box )
+{
+    GLfloat dx = box.max.x - box.min.x, dy = box.max.y - box.min.y,
+            dz = box.max.z - box.min.z;
+    return dx < 0 ? 0 : 2 * ( dx * dy + dy * dz + dz * dx );
+}
+
+static inline GLfloat axisValue( const Vector3f &v, int axis )
+{
+    return axis == 0 ? v.x : axis == 1 ? v.y : v.z;
+}
+
+/* Small nodes use fewer bins, as most of them would stay empty. */
+static inline int binsFor( int count )
+{
+    return std::min( count, ( int )MeshBVH::BIN_COUNT );
+}
+
+/* Bin of a centroid along an axis, scale being bins / extent of the
+ * centroids. Used both when choosing and when doing the split, so that they
+ * always agree. */
+static inline int binOf( GLfloat value, GLfloat min, GLfloat scale, int bins )
+{
+    int bin = ( int )( ( value - min ) * scale );
+    return std::min( std::max( bin, 0 ), bins - 1 );
+}
+
+static inline GLfloat binScale( const BoundingBox &centroidBounds, int axis,
+                                int bins )
+{
+    return bins / ( axisValue( centroidBounds.max, axis ) -
+                    axisValue( centroidBounds.min, axis ) );
+}
+
+MeshBVH::MeshBVH() : m_DecodeScale( 1 )
+{
+    m_DecodeCenter[ 0 ] = m_DecodeCenter[ 1 ] = m_DecodeCenter[ 2 ] = 0;
+}
+
+void MeshBVH::clear()
+{
+    std::vector< GLfloat >().swap( m_Positions );
+    std::vector< GLshort >().swap( m_QuantizedPositions );
+    std::vector< Node >().swap( m_Nodes );
+    std::vector< GLuint >().swap( m_Indices );
+    std::vector< GLuint >().swap( m_TriangleIds );
+    m_IsBuilt = 0;
+}
+
+inline void MeshBVH::position( GLuint i, GLfloat *p ) const
+{
+    if( m_QuantizedPositions.empty() )
+    {
+        const GLfloat *f = &m_Positions[ i * 3 ];
+        p[ 0 ] = f[ 0 ];
+        p[ 1 ] = f[ 1 ];
+        p[ 2 ] = f[ 2 ];
+    }
+    else
+    {
+        const GLshort *q = &m_QuantizedPositions[ i * 3 ];
+        p[ 0 ] = m_DecodeCenter[ 0 ] + m_DecodeScale * q[ 0 ];
+        p[ 1 ] = m_DecodeCenter[ 1 ] + m_DecodeScale * q[ 1 ];
+        p[ 2 ] = m_DecodeCenter[ 2 ] + m_DecodeScale * q[ 2 ];
+    }
+}
+
+/* --------------------------------------------------------------------------
+ *  setMesh & build
+ * -------------------------------------------------------------------------- */
+void MeshBVH::setMesh( const std::vector< MeshVertex > &vertices,
+                       const std::vector< GLuint > &indices )
+{
+    clear();
+    m_Positions.resize( vertices.size() * 3 );
+    for( size_t i = 0; i < vertices.size(); i++ )
+        for( int k = 0; k < 3; k++ )
+            m_Positions[ i * 3 + k ] = vertices[ i ].position[ k ];
+    m_Indices.assign( indices.begin(),
+                      indices.begin() + indices.size() / 3 * 3 );
+}
+
+/* The decode is column major, its diagonal the scale. */
+void MeshBVH::setMesh( const std::vector< QuantizedVertex > &vertices,
+                       const std::vector< GLuint > &indices,
+                       const Matrix4f &positionDecode )
+{
+    clear();
+    m_QuantizedPositions.resize( vertices.size() * 3 );
+    for( size_t i = 0; i < vertices.size(); i++ )
+        for( int k = 0; k < 3; k++ )
+            m_QuantizedPositions[ i * 3 + k ] = vertices[ i ].position[ k ];
+    m_DecodeScale = positionDecode.m[ 0 ];
+    for( int k = 0; k < 3; k++ )
+        m_DecodeCenter[ k ] = positionDecode.m[ 12 + k ];
+    m_Indices.assign( indices.begin(),
+                      indices.begin() + indices.size() / 3 * 3 );
+}
+
+void MeshBVH::build( const std::vector< MeshVertex > &vertices,
+                     const std::vector< GLuint > &indices, int threads )
+{
+    setMesh( vertices, indices );
+    build( threads );
+}
+
+/* Checked once without the lock, so built trees are queried without
+ * locking. */
+void MeshBVH::build( int threads ) const
+{
+    if( m_IsBuilt.fetchAndAddAcquire( 0 ) )
+        return;
+
+    QMutexLocker locker( &m_BuildMutex );
+    if( m_IsBuilt == 0 )
+    {
+        buildTree( threads );
+        m_IsBuilt.fetchAndStoreRelease( 1 );
+    }
+}
+
+/* --------------------------------------------------------------------------
+ *  buildTree
+ * -------------------------------------------------------------------------- */
+void MeshBVH::buildTree( int threads ) const
+{
+    BuildData   data;
+    int         triangleCount = m_Indices.size() / 3;
+
+    if( triangleCount == 0 )
+        return;
+
+    data.bounds.resize( triangleCount );
+    data.centroids.resize( triangleCount );
+    data.order.resize( triangleCount );
+    for( int i = 0; i < triangleCount; i++ )
+    {
+        BoundingBox &box = data.bounds[ i ];
+        for( int j = 0; j < 3; j++ )
+        {
+            GLfloat p[ 3 ];
+            position( m_Indices[ i * 3 + j ], p );
+            box.extend( Vector3f( p[ 0 ], p[ 1 ], p[ 2 ] ) );
+        }
+        data.centroids[ i ] = box.center();
+        data.order[ i ] = i;
+    }
+
+    /* Top levels here, the subtrees below them on the pool. */
+    std::vector< Subtree > subtrees;
+    bool parallel = triangleCount >= MIN_PARALLEL_TRIANGLES;
+
+    m_Nodes.reserve( triangleCount * 2 / MAX_LEAF_SIZE + 1 );
+    m_Nodes.resize( 1 );
+    buildNode( data, m_Nodes, 0, 0, triangleCount, 0,
+               parallel ? &subtrees : NULL );
+
+    if( !subtrees.empty() )
+    {
+        if( threads <= 0 )
+            threads = QThread::idealThreadCount();
+
+        QThreadPool pool;
+        pool.setMaxThreadCount( qMax( 1, threads ) );
+        for( size_t i = 1; i < subtrees.size(); i++ )
+            pool.start( new BuildTask( &data, &subtrees[ i ] ) );
+        BuildTask( &data, &subtrees[ 0 ] ).run();
+        pool.waitForDone();
+
+        /* The root of each subtree takes the node left for it, the rest
+         * are appended. Child indices move by the same offset. */
+        for( size_t i = 0; i < subtrees.size(); i++ )
+        {
+            std::vector< Node > &nodes = subtrees[ i ].nodes;
+            int base = m_Nodes.size() - 1;
+
+            for( size_t j = 0; j < nodes.size(); j++ )
+                if( nodes[ j ].count == 0 )
+                    nodes[ j ].first += base;
+
+            m_Nodes[ subtrees[ i ].node ] = nodes[ 0 ];
+            m_Nodes.insert( m_Nodes.end(), nodes.begin() + 1, nodes.end() );
+            std::vector< Node >().swap( nodes );
+        }
+    }
+    std::vector< Node >( m_Nodes ).swap( m_Nodes );
+
+    /* Triangles in leaf order. */
+    std::vector< GLuint > indices( m_Indices.size() );
+    for( int i = 0; i < triangleCount; i++ )
+        for( int j = 0; j < 3; j++ )
+            indices[ i * 3 + j ] = m_Indices[ data.order[ i ] * 3 + j ];
+    m_Indices.swap( indices );
+    m_TriangleIds.swap( data.order );
+}
+
+/* --------------------------------------------------------------------------
+ *  buildNode
+ *
+ *  Fills in node for the given range of data.order and builds its children.
+ *  Children at depth PARALLEL_DEPTH are added to deferred instead, if that
+ *  is given.
+ * -------------------------------------------------------------------------- */
+void MeshBVH::buildNode( BuildData &data, std::vector< Node > &nodes,
+                         int node, int first, int count, int depth,
+                         std::vector< Subtree > *deferred )
+{
+    BoundingBox bounds, centroidBounds;
+
+    for( int i = first; i < first + count; i++ )
+    {
+        grow( bounds, data.bounds[ data.order[ i ] ] );
+        grow( centroidBounds, data.centroids[ data.order[ i ] ] );
+    }
+
+    Node &n = nodes[ node ];
+    n.min[ 0 ] = bounds.min.x;
+    n.min[ 1 ] = bounds.min.y;
+    n.min[ 2 ] = bounds.min.z;
+    n.max[ 0 ] = bounds.max.x;
+    n.max[ 1 ] = bounds.max.y;
+    n.max[ 2 ] = bounds.max.z;
+    n.first = first;
+    n.count = count;
+
+    /* Deeper trees would not fit in the traversal stack. */
+    if( count <= 2 || depth >= MAX_DEPTH )
+        return;
+
+    /* Leaf cost is one intersection test per triangle, a split costs one
+     * box test plus the tests of the children weighted by the probability
+     * of hitting them. */
+    int     axis, bin;
+    GLfloat cost;
+    int     split;
+
+    if( findSplit( data, first, count, centroidBounds, axis, bin, cost ) )
+    {
+        if( count <= MAX_LEAF_SIZE &&
+            1 + cost / area( bounds ) >= count )
+            return;
+
+        GLfloat min = axisValue( centroidBounds.min, axis );
+        int     bins = binsFor( count );
+        GLfloat scale = binScale( centroidBounds, axis, bins );
+        GLuint  *begin = &data.order[ 0 ] + first;
+        GLuint  *middle = begin;
+        for( GLuint *p = begin; p != begin + count; ++p )
+        {
+            if( binOf( axisValue( data.centroids[ *p ], axis ), min,
+                       scale, bins ) < bin )
+                std::swap( *p, *middle++ );
+        }
+        split = middle - begin;
+    }
+    else
+    {
+        /* All centroids in one point. */
+        if( count <= MAX_LEAF_SIZE )
+            return;
+        split = count / 2;
+    }
+
+    int left = nodes.size();
+    nodes.resize( left + 2 );
+    nodes[ node ].first = left;
+    nodes[ node ].count = 0;
+
+    if( deferred != NULL && depth + 1 == PARALLEL_DEPTH )
+    {
+        Subtree subtree;
+        subtree.node  = left;
+        subtree.first = first;
+        subtree.count = split;
+        deferred->push_back( subtree );
+        subtree.node  = left + 1;
+        subtree.first = first + split;
+        subtree.count = count - split;
+        deferred->push_back( subtree );
+        return;
+    }
+
+    buildNode( data, nodes, left, first, split, depth + 1, deferred );
+    buildNode( data, nodes, left + 1, first + split, count - split,
+               depth + 1, deferred );
+}
+
+/* --------------------------------------------------------------------------
+ *  findSplit
+ *
+ *  Sorts the centroids into up to BIN_COUNT bins along each axis and
+ *  evaluates the surface area cost of splitting between each pair of bins.
+ *  Returns false if the centroids do not extend along any axis.
+ * -------------------------------------------------------------------------- */
+bool MeshBVH::findSplit( const BuildData &data, int first, int count,
+                         const BoundingBox &centroidBounds, int &axis,
+                         int &bin, GLfloat &cost )
+{
+    bool found = false;
+    int  bins = binsFor( count );
+    cost = FLT_MAX;
+
+    for( int a = 0; a < 3; a++ )
+    {
+        if( axisValue( centroidBounds.max, a ) <=
+            axisValue( centroidBounds.min, a ) )
+            continue;
+
+        BoundingBox binBounds[ BIN_COUNT ];
+        int         binCount[ BIN_COUNT ] = { 0 };
+        GLfloat     min = axisValue( centroidBounds.min, a );
+        GLfloat     scale = binScale( centroidBounds, a, bins );
+
+        for( int i = first; i < first + count; i++ )
+        {
+            GLuint tri = data.order[ i ];
+            int b = binOf( axisValue( data.centroids[ tri ], a ), min, scale,
+                           bins );
+            grow( binBounds[ b ], data.bounds[ tri ] );
+            binCount[ b ]++;
+        }
+
+        /* Sweep from the right for the areas and counts right of each
+         * plane, then from the left evaluating the cost. */
+        GLfloat     rightArea[ BIN_COUNT ];
+        int         rightCount[ BIN_COUNT ];
+        BoundingBox box;
+        int         n = 0;
+        for( int b = bins - 1; b > 0; b-- )
+        {
+            grow( box, binBounds[ b ] );
+            n += binCount[ b ];
+            rightArea[ b ]  = area( box );
+            rightCount[ b ] = n;
+        }
+
+        box = BoundingBox();
+        n = 0;
+        for( int b = 1; b < bins; b++ )
+        {
+            grow( box, binBounds[ b - 1 ] );
+            n += binCount[ b - 1 ];
+            if( n == 0 || rightCount[ b ] == 0 )
+                continue;
+
+            GLfloat c = area( box ) * n + rightArea[ b ] * rightCount[ b ];
+            if( c < cost )
+            {
+                cost  = c;
+                axis  = a;
+                bin   = b;
+                found = true;
+            }
+        }
+    }
+    return found;
+}
+
+/* --------------------------------------------------------------------------
+ *  intersect & occluded
+ * -------------------------------------------------------------------------- */
+bool MeshBVH::intersect( const Vector3f &origin, const Vector3f &direction,
+                         GLfloat maxDistance, RayHit &hit ) const
+{
+    return traverse( origin, direction, maxDistance, false, hit );
+}
+
+bool MeshBVH::occluded( const Vector3f &origin, const Vector3f &direction,
+                        GLfloat maxDistance ) const
+{
+    RayHit hit;
+    return traverse( origin, direction, maxDistance, true, hit );
+}
+
+/* --------------------------------------------------------------------------
+ *  traverse
+ *
+ *  Builds the tree if needed, then walks it depth first, the nearer child
+ *  first. Box tests use SSE when available:
+ *  the slab distances of all three axes are computed at once and reduced
+ *  to the entry and exit distances. The fourth lane holds the node's index
+ *  or count and is left out of the reduction.
+ * -------------------------------------------------------------------------- */
+#ifdef __SSE__
+static inline GLfloat hitBox( const GLfloat *min, const GLfloat *max,
+                              __m128 origin, __m128 inverse, GLfloat tMax )
+{
+    __m128 t1 = _mm_mul_ps( _mm_sub_ps( _mm_loadu_ps( min ), origin ),
+                            inverse );
+    __m128 t2 = _mm_mul_ps( _mm_sub_ps( _mm_loadu_ps( max ), origin ),
+                            inverse );
+    __m128 tNear = _mm_min_ps( t1, t2 );
+    __m128 tFar  = _mm_max_ps( t1, t2 );
+
+    tNear = _mm_max_ss( _mm_max_ss( tNear, _mm_shuffle_ps( tNear, tNear, 1 ) ),
+                        _mm_max_ss( _mm_shuffle_ps( tNear, tNear, 2 ),
+                                    _mm_setzero_ps() ) );
+    tFar  = _mm_min_ss( _mm_min_ss( tFar, _mm_shuffle_ps( tFar, tFar, 1 ) ),
+                        _mm_min_ss( _mm_shuffle_ps( tFar, tFar, 2 ),
+                                    _mm_set_ss( tMax ) ) );
+
+    GLfloat n = _mm_cvtss_f32( tNear ), f = _mm_cvtss_f32( tFar );
+    return n <= f ? n : FLT_MAX;
+}
+#else
+static inline GLfloat hitBox( const GLfloat *min, const GLfloat *max,
+                              const GLfloat *origin, const GLfloat *inverse,
+                              GLfloat tMax )
+{
+    GLfloat tMin = 0;
+    for( int i = 0; i < 3; i++ )
+    {
+        GLfloat t1 = ( min[ i ] - origin[ i ] ) * inverse[ i ];
+        GLfloat t2 = ( max[ i ] - origin[ i ] ) * inverse[ i ];
+        tMin = std::max( tMin, std::min( t1, t2 ) );
+        tMax = std::min( tMax, std::max( t1, t2 ) );
+    }
+    return tMin <= tMax ? tMin : FLT_MAX;
+}
+#endif
+
+bool MeshBVH::traverse( const Vector3f &origin, const Vector3f &direction,
+                        GLfloat maxDistance, bool anyHit, RayHit &hit ) const
+{
+    build();
+    if( m_Nodes.empty() )
+        return false;
+
+    const GLfloat o[ 3 ]   = { origin.x, origin.y, origin.z };
+    const GLfloat d[ 3 ]   = { direction.x, direction.y, direction.z };
+#ifdef __SSE__
+    const __m128  so   = _mm_setr_ps( o[ 0 ], o[ 1 ], o[ 2 ], 0 );
+    const __m128  sinv = _mm_setr_ps( 1 / d[ 0 ], 1 / d[ 1 ], 1 / d[ 2 ], 0 );
+#define HIT_BOX( n, tMax ) hitBox( ( n ).min, ( n ).max, so, sinv, tMax )
+#else
+    const GLfloat inv[ 3 ] = { 1 / d[ 0 ], 1 / d[ 1 ], 1 / d[ 2 ] };
+#define HIT_BOX( n, tMax ) hitBox( ( n ).min, ( n ).max, o, inv, tMax )
+#endif
+
+    GLfloat nearest = maxDistance;
+    bool    found = false;
+    int     stack[ MAX_DEPTH + 1 ];
+    int     top = 0;
+
+    if( HIT_BOX( m_Nodes[ 0 ], nearest ) == FLT_MAX )
+        return false;
+    stack[ top++ ] = 0;
+
+    while( top > 0 )
+    {
+        const Node &node = m_Nodes[ stack[ --top ] ];
+
+        if( node.count > 0 )
+        {
+            for( int i = node.first; i < node.first + node.count; i++ )
+            {
+                /* First vertex and the two edges from it. */
+                const GLuint *tri = &m_Indices[ i * 3 ];
+                GLfloat v0[ 3 ], e1[ 3 ], e2[ 3 ];
+                position( tri[ 0 ], v0 );
+                position( tri[ 1 ], e1 );
+                position( tri[ 2 ], e2 );
+                for( int k = 0; k < 3; k++ )
+                {
+                    e1[ k ] -= v0[ k ];
+                    e2[ k ] -= v0[ k ];
+                }
+
+                /* p = d x e2, det = e1 . p */
+                GLfloat p[ 3 ] = { d[ 1 ] * e2[ 2 ] - d[ 2 ] * e2[ 1 ],
+                                   d[ 2 ] * e2[ 0 ] - d[ 0 ] * e2[ 2 ],
+                                   d[ 0 ] * e2[ 1 ] - d[ 1 ] * e2[ 0 ] };
+                GLfloat det = e1[ 0 ] * p[ 0 ] + e1[ 1 ] * p[ 1 ] +
+                              e1[ 2 ] * p[ 2 ];
+                if( det == 0 )
+                    continue;
+                GLfloat inv = 1 / det;
+
+                GLfloat s[ 3 ] = { o[ 0 ] - v0[ 0 ], o[ 1 ] - v0[ 1 ],
+                                   o[ 2 ] - v0[ 2 ] };
+                GLfloat u = ( s[ 0 ] * p[ 0 ] + s[ 1 ] * p[ 1 ] +
+                              s[ 2 ] * p[ 2 ] ) * inv;
+                if( u < 0 || u > 1 )
+                    continue;
+
+                /* q = s x e1 */
+                GLfloat q[ 3 ] = { s[ 1 ] * e1[ 2 ] - s[ 2 ] * e1[ 1 ],
+                                   s[ 2 ] * e1[ 0 ] - s[ 0 ] * e1[ 2 ],
+                                   s[ 0 ] * e1[ 1 ] - s[ 1 ] * e1[ 0 ] };
+                GLfloat v = ( d[ 0 ] * q[ 0 ] + d[ 1 ] * q[ 1 ] +
+                              d[ 2 ] * q[ 2 ] ) * inv;
+                if( v < 0 || u + v > 1 )
+                    continue;
+
+                GLfloat dist = ( e2[ 0 ] * q[ 0 ] + e2[ 1 ] * q[ 1 ] +
+                                 e2[ 2 ] * q[ 2 ] ) * inv;
+                if( dist <= 0 || dist >= nearest )
+                    continue;
+
+                nearest = dist;
+                found = true;
+                hit.distance = dist;
+                hit.triangle = m_TriangleIds[ i ];
+                hit.u = u;
+                hit.v = v;
+                if( anyHit )
+                    return true;
+            }
+            continue;
+        }
+
+        /* Push the farther child first, so the nearer one is popped next. */
+        int     c1 = node.first, c2 = node.first + 1;
+        GLfloat t1 = HIT_BOX( m_Nodes[ c1 ], nearest );
+        GLfloat t2 = HIT_BOX( m_Nodes[ c2 ], nearest );
+        if( t1 > t2 )
+        {
+            std::swap( t1, t2 );
+            std::swap( c1, c2 );
+        }
+        if( t2 != FLT_MAX )
+            stack[ top++ ] = c2;
+        if( t1 != FLT_MAX )
+            stack[ top++ ] = c1;
+    }
+#undef HIT_BOX
+
+    return found;
+}
@@ -0,0 +1,155 @@
+/* --------------------------------------------------------------------------
+ * meshbvh.h
+ *
+ * Static bounding volume hierarchy over the triangles of a welded mesh
+ * ( see ModelData ), for exact ray queries against the geometry.
+ *
+ * -------------------------------------------------------------------------- */
+
+#ifndef MESHBVH_H
+#define MESHBVH_H
+
+#include "renderer.h"
+#include "meshbuffer.h"
+#include <QAtomicInt>
+#include <QMutex>
+#include <vector>
+
+/* --------------------------------------------------------------------------
+ *  RayHit
+ *
+ *  Closest hit of a ray. triangle is the index of the triangle in the
+ *  index list ( first index / 3 ), u and v the barycentric coordinates of
+ *  the hit on it.
+ * -------------------------------------------------------------------------- */
+struct RayHit
+{
+    GLfloat     distance;
+    GLuint      triangle;
+    GLfloat     u, v;
+
+    RayHit() : distance( 0 ), triangle( 0 ), u( 0 ), v( 0 ) {}
+};
+
+/* --------------------------------------------------------------------------
+ *  MeshBVH
+ *
+ *  Built once with the surface area heuristic evaluated over bins of
+ *  triangle centroids. The top levels are split on the calling thread and
+ *  the subtrees below them are built on a thread pool, the result is the
+ *  same for any number of threads.
+ *
+ *  Nodes are kept in one array in depth first order, the children of a
+ *  node next to each other, and the triangles in the order of the leaves,
+ *  so a query walks memory mostly forwards.
+ *
+ *  The tree keeps its own copy of the mesh: the index list and the
+ *  positions, as floats or as the 16-bit positions of a quantized mesh.
+ *  Triangles are read from these when tested, nothing else is stored per
+ *  triangle but its index in the original list. With setMesh the tree is
+ *  only built on the first query, so meshes that are never ray cast keep
+ *  just the copy.
+ *
+ *  Reference: Ingo Wald, 'On fast Construction of SAH-based Bounding Volume
+ *             Hierarchies' ( 2007 )
+ * -------------------------------------------------------------------------- */
+class MeshBVH
+{
+public:
+    enum { BIN_COUNT = 16, MAX_LEAF_SIZE = 8, MAX_DEPTH = 64 };
+    /* Meshes with at least MIN_PARALLEL_TRIANGLES triangles are split
+     * PARALLEL_DEPTH levels deep before building the subtrees in
+     * parallel. */
+    enum { MIN_PARALLEL_TRIANGLES = 16384, PARALLEL_DEPTH = 4 };
+
+    MeshBVH();
+
+    /* Copies the mesh to build the tree over. The tree is built by the
+     * first query, or by build(). positionDecode maps the quantized
+     * positions to object space and must be a uniform scale and a
+     * translation, like the one of CachedMesh::quantize. Not to be called
+     * while the tree is queried. */
+    void        setMesh( const std::vector< MeshVertex > &vertices,
+                         const std::vector< GLuint > &indices );
+    void        setMesh( const std::vector< QuantizedVertex > &vertices,
+                         const std::vector< GLuint > &indices,
+                         const Matrix4f &positionDecode );
+    /* Builds the tree over the mesh unless it is built already. Can be
+     * called from any thread. threads <= 0 uses
+     * QThread::idealThreadCount(). */
+    void        build( int threads = 0 ) const;
+    /* setMesh and build in one. */
+    void        build( const std::vector< MeshVertex > &vertices,
+                       const std::vector< GLuint > &indices,
+                       int threads = 0 );
+    void        clear();
+    bool        isEmpty() const { return m_Indices.empty(); }
+    bool        isBuilt() const { return m_IsBuilt != 0; }
+
+    /* Nearest hit closer than maxDistance. Distances are in units of
+     * direction. Triangles are hit from both sides. */
+    bool        intersect( const Vector3f &origin, const Vector3f &direction,
+                           GLfloat maxDistance, RayHit &hit ) const;
+
+    /* True if any triangle is hit closer than maxDistance. Stops at the
+     * first hit found. */
+    bool        occluded( const Vector3f &origin, const Vector3f &direction,
+                          GLfloat maxDistance ) const;
+
+    /* 0 until built. */
+    size_t      nodeCount() const { return m_Nodes.size(); }
+    size_t      triangleCount() const { return m_Indices.size() / 3; }
+
+private:
+    /* 32 bytes. Leaves have count > 0 and first the index of their first
+     * triangle, inner nodes have their children at first and first + 1. */
+    struct Node
+    {
+        GLfloat     min[ 3 ];
+        GLint       first;
+        GLfloat     max[ 3 ];
+        GLint       count;
+    };
+
+    struct BuildData;
+    struct Subtree;
+    class  BuildTask;
+
+    /* Three per vertex, either as floats or quantized. */
+    std::vector< GLfloat >  m_Positions;
+    std::vector< GLshort >  m_QuantizedPositions;
+    /* Decode of the quantized positions: object = centre + scale * q. */
+    GLfloat                 m_DecodeCenter[ 3 ];
+    GLfloat                 m_DecodeScale;
+
+    /* Built on demand, so const queries can build them, under the mutex.
+     * The index list is put in the order of the leaves when the tree is
+     * built, the ids keep the index of each triangle in the original
+     * list. */
+    mutable std::vector< Node >     m_Nodes;
+    mutable std::vector< GLuint >   m_Indices;
+    mutable std::vector< GLuint >   m_TriangleIds;
+    mutable QAtomicInt              m_IsBuilt;
+    mutable QMutex                  m_BuildMutex;
+
+    /* Prevent copying, the mutex can't be copied. */
+    MeshBVH( const MeshBVH & );
+    MeshBVH& operator=( const MeshBVH & );
+
+    /* Position of vertex i in object space. */
+    inline void position( GLuint i, GLfloat *p ) const;
+    void        buildTree( int threads ) const;
+
+    static void buildNode( BuildData &data, std::vector< Node > &nodes,
+                           int node, int first, int count, int depth,
+                           std::vector< Subtree > *deferred );
+    static bool findSplit( const BuildData &data, int first, int count,
+                           const BoundingBox &centroidBounds, int &axis,
+                           int &bin, GLfloat &cost );
+
+    bool        traverse( const Vector3f &origin, const Vector3f &direction,
+                          GLfloat maxDistance, bool anyHit,
+                          RayHit &hit ) const;
+};
+
+#endif /* MESHBVH_H */
@@ -0,0 +1,367 @@
+/* --------------------------------------------------------------------------
+ * meshmanager.cpp
+ *
+ * Implementation of the MeshManager class.
+ *
+ * -------------------------------------------------------------------------- */
+
+#include "meshmanager.h"
+#include "wf_loader.h"
+#include "meshoptimizer.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QThreadPool>
+#include <math.h>
+
+MeshManager *MeshManager::m_pInstance = NULL;
+
+/* Guards the creation of the instance, which may be asked for by loader
+ * threads. */
+static QMutex instanceMutex;
+
+/* --------------------------------------------------------------------------
+ *  MeshLoadTask
+ *
+ *  Loads one file for requestMesh. Loads of the same file started by
+ *  getMesh meanwhile are waited for like any other. If the load throws
+ *  ( std::bad_alloc ), the listeners get an empty mesh, as for a file that
+ *  can't be read; nothing may be thrown out of the thread pool.
+ * -------------------------------------------------------------------------- */
+class MeshLoadTask : public QRunnable
+{
+public:
+    MeshLoadTask( const MeshManager::AssetKey &key ) : m_Key( key ) {}
+
+    void run()
+    {
+        MeshManager     *manager = MeshManager::getInstance();
+        MeshAssetPtr    mesh;
+
+        try
+        {
+            mesh = manager->getMesh( m_Key.first.c_str(), m_Key.second );
+        }
+        catch( ... )
+        {
+            mesh = MeshAssetPtr( new MeshAsset );
+        }
+        manager->requestDone( m_Key, mesh );
+    }
+
+private:
+    MeshManager::AssetKey   m_Key;
+};
+
+/* --------------------------------------------------------------------------
+ *  MeshManager ( ctor, dtor ) & getInstance
+ * -------------------------------------------------------------------------- */
+MeshManager::MeshManager() :
+    m_pRenderer( NULL )
+{
+}
+
+MeshManager::MeshManager( const MeshManager & ) {}
+MeshManager &MeshManager::operator=( const MeshManager & ) { return *this; }
+
+MeshManager::~MeshManager()
+{
+}
+
+MeshManager *MeshManager::getInstance()
+{
+    QMutexLocker locker( &instanceMutex );
+    if( !m_pInstance )
+    {
+        m_pInstance = new MeshManager();
+    }
+    return m_pInstance;
+}
+
+/* --------------------------------------------------------------------------
+ *  canonicalPath
+ * -------------------------------------------------------------------------- */
+std::string MeshManager::canonicalPath( const char *filename )
+{
+    QString path = QFileInfo( filename ).canonicalFilePath();
+    if( path.isEmpty() )
+        return std::string( filename );
+    return std::string( QFile::encodeName( path ).constData() );
+}
+
+/* --------------------------------------------------------------------------
+ *  getMesh
+ *
+ *  An entry whose asset has been freed is loaded again like a new one. If
+ *  the load throws, the key is taken off the loading set and the waiting
+ *  threads woken before the exception is passed on, so they try the load
+ *  themselves instead of waiting forever.
+ * -------------------------------------------------------------------------- */
+MeshAssetPtr MeshManager::getMesh( const char *filename,
+                                   CachedMesh::VertexFormat format )
+{
+    const AssetKey      key( canonicalPath( filename ), format );
+    MeshAssetPtr        asset;
+    QMutexLocker        locker( &m_Mutex );
+
+    for( ;; )
+    {
+        AssetMap::iterator it = m_Assets.find( key );
+        if( it != m_Assets.end() )
+        {
+            asset = it->second.toStrongRef();
+            if( asset )
+                return asset;
+        }
+        if( !m_Loading.count( key ) )
+            break;
+        m_Loaded.wait( &m_Mutex );
+    }
+
+    m_Loading.insert( key );
+    locker.unlock();
+
+    try
+    {
+        asset = MeshAssetPtr( load( key.first, format ) );
+    }
+    catch( ... )
+    {
+        locker.relock();
+        m_Loading.erase( key );
+        m_Loaded.wakeAll();
+        throw;
+    }
+
+    locker.relock();
+    m_Assets[ key ] = asset;
+    m_Loading.erase( key );
+    m_Loaded.wakeAll();
+
+    return asset;
+}
+
+/* --------------------------------------------------------------------------
+ *  assetCount
+ * -------------------------------------------------------------------------- */
+int MeshManager::assetCount()
+{
+    QMutexLocker    locker( &m_Mutex );
+    int             count = 0;
+
+    for( AssetMap::iterator it = m_Assets.begin(); it != m_Assets.end(); ++it )
+        if( !it->second.isNull() )
+            count++;
+    return count;
+}
+
+/* --------------------------------------------------------------------------
+ *  requestMesh, requestDone & cancelRequests
+ *
+ *  One task is started per file, however many listeners ask for it before
+ *  it is done.
+ * -------------------------------------------------------------------------- */
+void MeshManager::requestMesh( const char *filename, IMeshListener *listener,
+                               CachedMesh::VertexFormat format )
+{
+    const AssetKey      key( canonicalPath( filename ), format );
+    QMutexLocker        locker( &m_Mutex );
+
+    AssetMap::iterator it = m_Assets.find( key );
+    if( it != m_Assets.end() )
+    {
+        MeshAssetPtr asset = it->second.toStrongRef();
+        if( asset )
+        {
+            m_Deliveries.push_back( std::make_pair( listener, asset ) );
+            notifyRenderer();
+            return;
+        }
+    }
+
+    bool started = m_Requests.count( key ) > 0;
+    m_Requests.insert( std::make_pair( key, listener ) );
+    if( !started )
+        QThreadPool::globalInstance()->start( new MeshLoadTask( key ) );
+}
+
+void MeshManager::requestDone( const AssetKey &key, const MeshAssetPtr &mesh )
+{
+    QMutexLocker locker( &m_Mutex );
+
+    std::pair< RequestMap::iterator, RequestMap::iterator > range =
+        m_Requests.equal_range( key );
+    if( range.first == range.second )
+        return;
+
+    for( RequestMap::iterator it = range.first; it != range.second; ++it )
+        m_Deliveries.push_back( std::make_pair( it->second, mesh ) );
+    m_Requests.erase( range.first, range.second );
+    notifyRenderer();
+}
+
+void MeshManager::cancelRequests( IMeshListener *listener )
+{
+    QMutexLocker locker( &m_Mutex );
+
+    for( RequestMap::iterator it = m_Requests.begin(); it != m_Requests.end(); )
+    {
+        if( it->second == listener )
+            m_Requests.erase( it++ );
+        else
+            ++it;
+    }
+    for( size_t i = 0; i < m_Deliveries.size(); )
+    {
+        if( m_Deliveries[ i ].first == listener )
+            m_Deliveries.erase( m_Deliveries.begin() + i );
+        else
+            i++;
+    }
+}
+
+/* --------------------------------------------------------------------------
+ *  deliverLoaded, setRenderer & notifyRenderer
+ *
+ *  The queue is taken as a whole, so loads finishing during the delivery
+ *  wait for the next call, which their notification causes.
+ * -------------------------------------------------------------------------- */
+int MeshManager::deliverLoaded()
+{
+    DeliveryList deliveries;
+    {
+        QMutexLocker locker( &m_Mutex );
+        deliveries.swap( m_Deliveries );
+    }
+
+    for( size_t i = 0; i < deliveries.size(); i++ )
+    {
+        const MeshLodChain &lods = deliveries[ i ].second->lods;
+        for( int level = 0; level < lods.count; level++ )
+            lods.levels[ level ]->buffer();
+        deliveries[ i ].first->meshLoaded( deliveries[ i ].second );
+    }
+    return deliveries.size();
+}
+
+void MeshManager::setRenderer( Renderer *pRenderer )
+{
+    QMutexLocker locker( &m_Mutex );
+    m_pRenderer = pRenderer;
+}
+
+void MeshManager::notifyRenderer()
+{
+    if( m_pRenderer )
+        QMetaObject::invokeMethod( m_pRenderer, "assetsLoaded",
+                                   Qt::QueuedConnection );
+}
+
+/* --------------------------------------------------------------------------
+ *  load
+ *
+ *  Loads and optimizes the OBJ file with its levels of detail, keeps the
+ *  loader's vertex cache figures, moves the welded mesh out of the loaded
+ *  data and builds the bounds and the meshes of the levels over it. The
+ *  levels are quantized last, as all of these read the float vertices.
+ *  The BVH gets a copy of the mesh in its final format and builds its
+ *  tree on the first ray cast.
+ * -------------------------------------------------------------------------- */
+MeshAsset *MeshManager::load( const std::string &path,
+                              CachedMesh::VertexFormat format )
+{
+    MeshAsset   *asset = new MeshAsset;
+    WFLoader    loader;
+
+    loader.setOptimizeMesh( true );
+    loader.setBuildLods( true );
+    loader.load( path.c_str(), WFLoader::OBJ_FILE );
+    asset->optimizeStats = loader.optimizeStats();
+
+    CachedMesh &mesh = asset->mesh;
+    mesh.vertices.swap( loader.m_LoadedData.weldedVertices );
+    mesh.indices.swap( loader.m_LoadedData.weldedIndices );
+    mesh.clusters.swap( loader.m_LoadedData.clusters );
+
+    const std::vector< MeshVertex > &vertices = mesh.vertices;
+    GLfloat radius = 0;
+
+    for( unsigned int i = 0; i < vertices.size(); i++ )
+        asset->bounds.extend( Vector3f( vertices[ i ].position[ 0 ],
+                                        vertices[ i ].position[ 1 ],
+                                        vertices[ i ].position[ 2 ] ) );
+    asset->lods.levels[ 0 ] = &mesh;
+    asset->lods.errors[ 0 ] = 0;
+    asset->lods.count = 1;
+    if( asset->bounds.isEmpty() )
+        return asset;
+
+    asset->sphere.center = asset->bounds.center();
+    for( unsigned int i = 0; i < vertices.size(); i++ )
+    {
+        GLfloat dx = vertices[ i ].position[ 0 ] - asset->sphere.center.x;
+        GLfloat dy = vertices[ i ].position[ 1 ] - asset->sphere.center.y;
+        GLfloat dz = vertices[ i ].position[ 2 ] - asset->sphere.center.z;
+        GLfloat distance = dx * dx + dy * dy + dz * dz;
+        if( distance > radius )
+            radius = distance;
+    }
+    asset->sphere.radius = sqrt( radius );
+
+    buildLods( *asset, loader.m_LoadedData );
+    if( format == CachedMesh::QUANTIZED_VERTICES )
+    {
+        mesh.quantize();
+        for( int level = 1; level < asset->lods.count; level++ )
+            asset->lodMeshes[ level - 1 ].quantize();
+        asset->bvh.setMesh( mesh.quantizedVertices(), mesh.indices,
+                            mesh.positionDecode() );
+    }
+    else
+    {
+        asset->bvh.setMesh( mesh.vertices, mesh.indices );
+    }
+    return asset;
+}
+
+/* --------------------------------------------------------------------------
+ *  buildLods
+ *
+ *  The loader has made the triangle lists of the levels ( see
+ *  MeshSimplifier::buildLods ), or read them from its cache. Each level
+ *  gets its own copy of the vertices, which the clusters and the vertex
+ *  fetch order are then made for. The errors are made relative to the
+ *  radius of the mesh.
+ * -------------------------------------------------------------------------- */
+void MeshManager::buildLods( MeshAsset &asset, const ModelData &data )
+{
+    const CachedMesh    &mesh = asset.mesh;
+    MeshLodChain        &lods = asset.lods;
+    size_t              first = 0;
+
+    if( asset.sphere.radius <= 0 )
+        return;
+
+    for( size_t i = 0; i < data.lodLevels.size() &&
+                       lods.count < MeshLodChain::MAX_LEVELS; i++ )
+    {
+        const ModelData::LodLevel &source = data.lodLevels[ i ];
+        if( first + source.indexCount > data.lodIndices.size() )
+            break;
+
+        CachedMesh &level = asset.lodMeshes[ lods.count - 1 ];
+        level.vertices = mesh.vertices;
+        level.indices.assign( data.lodIndices.begin() + first,
+                              data.lodIndices.begin() + first +
+                              source.indexCount );
+        MeshOptimizer::buildClusters( level.vertices, level.indices,
+                                      level.clusters );
+        MeshOptimizer::optimizeVertexFetch( level.vertices, level.indices );
+
+        lods.levels[ lods.count ] = &level;
+        lods.errors[ lods.count ] = source.error / asset.sphere.radius;
+        lods.count++;
+        first += source.indexCount;
+    }
+}
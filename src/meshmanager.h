@@ -0,0 +1,164 @@
+/* --------------------------------------------------------------------------
+ * meshmanager.h
+ *
+ * Meshes loaded from WaveFront object files, shared by all the drawables
+ * showing the same file, and loaded in the background if asked to.
+ *
+ * -------------------------------------------------------------------------- */
+
+#ifndef MESHMANAGER_H
+#define MESHMANAGER_H
+
+#include "geometrycache.h"
+#include "meshbvh.h"
+#include "meshoptimizer.h"
+#include <QMutex>
+#include <QWaitCondition>
+#include <QSharedPointer>
+#include <QWeakPointer>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+/* --------------------------------------------------------------------------
+ *  MeshAsset
+ *
+ *  The welded mesh of a model with its triangle BVH, object space bounds
+ *  and simplified levels of detail. Not changed after loading, so it is
+ *  handed out as const and read by any number of drawables and threads.
+ *  The buffer objects of the meshes are uploaded on the first draw ( see
+ *  CachedMesh ). Picking uses the full mesh at any level, through the BVH,
+ *  so all the levels can be quantized. The BVH only builds its tree when
+ *  the asset is first ray cast.
+ * -------------------------------------------------------------------------- */
+struct MeshAsset
+{
+    CachedMesh      mesh;
+    MeshBVH         bvh;
+    BoundingBox     bounds;
+    /* Sphere around the box centre, fitted to the vertices. */
+    BoundingSphere  sphere;
+    /* Levels 1 and up of lods, level 0 being mesh. */
+    CachedMesh      lodMeshes[ MeshLodChain::MAX_LEVELS - 1 ];
+    MeshLodChain    lods;
+    /* Vertex cache figures of the mesh, before and after the loader
+     * optimized it ( see WFLoader::optimizeStats ). */
+    MeshOptimizerStats  optimizeStats;
+};
+
+typedef QSharedPointer< const MeshAsset > MeshAssetPtr;
+
+/* --------------------------------------------------------------------------
+ *  IMeshListener
+ *
+ *  Receives the meshes requested with MeshManager::requestMesh.
+ * -------------------------------------------------------------------------- */
+class IMeshListener
+{
+public:
+    virtual ~IMeshListener() {}
+    /* Called on the GL thread, with the context current and the mesh
+     * uploaded. */
+    virtual void meshLoaded( const MeshAssetPtr &mesh ) = 0;
+};
+
+/* --------------------------------------------------------------------------
+ *  MeshManager
+ *
+ *  Singleton class loading each OBJ file once per vertex format. Assets are
+ *  keyed by the canonical path of the file and the format, and held
+ *  weakly: an asset lives as long as a drawable holds its pointer and is
+ *  loaded again if asked for after that.
+ *  The last holder frees the asset, and with it the buffer objects, so it
+ *  should do so with the GL context current.
+ *
+ *  getMesh can be called from any thread. Files are loaded outside the
+ *  lock; a thread asking for a file already being loaded waits for that
+ *  load instead of starting another.
+ *
+ *  requestMesh returns at once and loads the file on the global thread
+ *  pool. Loaded meshes are queued and the renderer is told through its
+ *  event loop ( Renderer::assetsLoaded ), which uploads them and hands
+ *  them to their listeners with deliverLoaded. Requests, cancels and
+ *  deliveries are made on the GL thread.
+ * -------------------------------------------------------------------------- */
+class MeshManager
+{
+private:
+    typedef std::pair< std::string, CachedMesh::VertexFormat > AssetKey;
+    typedef std::map< AssetKey, QWeakPointer< const MeshAsset > > AssetMap;
+    typedef std::multimap< AssetKey, IMeshListener* >       RequestMap;
+    typedef std::vector< std::pair< IMeshListener*, MeshAssetPtr > >
+                                                            DeliveryList;
+
+    AssetMap                m_Assets;
+    /* Assets being loaded, without an asset yet. */
+    std::set< AssetKey >    m_Loading;
+    QMutex                  m_Mutex;
+    /* Woken when a load finishes. */
+    QWaitCondition          m_Loaded;
+    /* Listeners waiting for a background load, and the meshes loaded for
+     * them but not delivered yet. */
+    RequestMap              m_Requests;
+    DeliveryList            m_Deliveries;
+    Renderer                *m_pRenderer;
+
+    /* Handles own static pointer. */
+    static MeshManager      *m_pInstance;
+
+    /* Prevent outside calling of ctor, copy-ctor and assignment operator. */
+    MeshManager();
+    MeshManager( const MeshManager & );
+    MeshManager& operator=( const MeshManager & );
+
+    static MeshAsset    *load( const std::string &path,
+                               CachedMesh::VertexFormat format );
+    /* Fills in the levels of detail of a loaded asset from the levels the
+     * loader made or read from its cache. */
+    static void         buildLods( MeshAsset &asset, const ModelData &data );
+    /* Queues the mesh for the listeners of the asset, run by the loader
+     * task. */
+    void                requestDone( const AssetKey &key,
+                                     const MeshAssetPtr &mesh );
+    /* Tells the renderer there is something to deliver. Called locked. */
+    void                notifyRenderer();
+
+    friend class MeshLoadTask;
+
+public:
+    ~MeshManager();
+    static MeshManager  *getInstance();
+
+    /* The mesh of the OBJ file, loaded if no one holds it. Never NULL: a
+     * file that can't be read gives an empty mesh, like WFLoader. With
+     * QUANTIZED_VERTICES all its levels are quantized ( see
+     * CachedMesh::quantize ). Exceptions from the load ( std::bad_alloc )
+     * are passed on. */
+    MeshAssetPtr        getMesh( const char *filename,
+                                 CachedMesh::VertexFormat format =
+                                 CachedMesh::FLOAT_VERTICES );
+    /* Number of assets currently held by someone. */
+    int                 assetCount();
+
+    /* Loads the mesh of the OBJ file in the background, unless someone
+     * holds it already, and hands it to the listener in deliverLoaded. */
+    void                requestMesh( const char *filename,
+                                     IMeshListener *listener,
+                                     CachedMesh::VertexFormat format =
+                                     CachedMesh::FLOAT_VERTICES );
+    /* Forgets the listener's requests, to be called before deleting it. */
+    void                cancelRequests( IMeshListener *listener );
+    /* Uploads the meshes loaded since the last call and hands them to
+     * their listeners. Called with the context current. Returns the
+     * number of meshes delivered. */
+    int                 deliverLoaded();
+    /* The renderer told about loaded meshes, or NULL. */
+    void                setRenderer( Renderer *pRenderer );
+
+    /* The key of the file: its canonical path, or the path as given if
+     * the file does not exist. */
+    static std::string  canonicalPath( const char *filename );
+};
+
+#endif /* MESHMANAGER_H */
@@ -0,0 +1,616 @@
+/* --------------------------------------------------------------------------
+ * meshoptimizer.cpp
+ *
+ * Implementation of the MeshOptimizer class.
+ *
+ * References: Tom Forsyth, 'Linear-Speed Vertex Cache Optimisation' ( 2006 )
+ *             Sander, Nehab, Barczak, 'Fast Triangle Reordering for Vertex
+ *             Locality and Reduced Overdraw' ( SIGGRAPH 2007 )
+ *
+ * -------------------------------------------------------------------------- */
+
+#include "meshoptimizer.h"
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+/* --------------------------------------------------------------------------
+ *  optimize
+ *
+ *  Vertex cache order first, then overdraw order on top of it, then the
+ *  clusters, which keep both orders within and between clusters, and
+ *  finally the vertex order for fetch locality.
+ * -------------------------------------------------------------------------- */
+MeshOptimizerStats MeshOptimizer::optimize( ModelData &data )
+{
+    MeshOptimizerStats  stats;
+    size_t              vertexCount = data.weldedVertices.size();
+
+    stats.acmrBefore = computeACMR( data.weldedIndices, vertexCount );
+
+    optimizeVertexCache( data.weldedIndices, vertexCount );
+    optimizeOverdraw( data.weldedIndices, data.weldedVertices );
+    buildClusters( data.weldedVertices, data.weldedIndices, data.clusters );
+    optimizeVertexFetch( data.weldedVertices, data.weldedIndices );
+
+    stats.acmrAfter = computeACMR( data.weldedIndices, vertexCount );
+    return stats;
+}
+
+/* --------------------------------------------------------------------------
+ *  computeACMR
+ *
+ *  Simulates a FIFO post-transform cache and counts the misses.
+ * -------------------------------------------------------------------------- */
+float MeshOptimizer::computeACMR( const std::vector< GLuint > &indices,
+                                  size_t vertexCount, int cacheSize )
+{
+    /* A vertex is in the cache if it was added less than cacheSize
+     * additions ago. */
+    std::vector< unsigned int > addedAt( vertexCount, 0 );
+    unsigned int                time = cacheSize + 1;
+    size_t                      misses = 0;
+
+    if( indices.size() < 3 )
+        return 0;
+
+    for( size_t i = 0; i < indices.size(); i++ )
+    {
+        GLuint v = indices[ i ];
+        if( time - addedAt[ v ] > ( unsigned int )cacheSize )
+        {
+            addedAt[ v ] = time++;
+            ++misses;
+        }
+    }
+    return ( float )misses / ( indices.size() / 3 );
+}
+
+/* --------------------------------------------------------------------------
+ *  optimizeVertexCache
+ *
+ *  Greedily emits the triangle with the highest score. A vertex scores high
+ *  if it is recently used and has few triangles left, which keeps the
+ *  working set small and finishes off vertices before they are evicted.
+ * -------------------------------------------------------------------------- */
+static const int    FORSYTH_CACHE_SIZE = 32;
+static const int    FORSYTH_MAX_VALENCE = 32;
+
+static float        s_CacheScore[ FORSYTH_CACHE_SIZE ];
+static float        s_ValenceScore[ FORSYTH_MAX_VALENCE ];
+
+static void initScoreTables()
+{
+    static bool done = false;
+    if( done ) return;
+
+    for( int i = 0; i < FORSYTH_CACHE_SIZE; i++ )
+    {
+        /* The last triangle's vertices get a fixed score, so that the
+         * next triangle does not just reuse them in a strip like order. */
+        if( i < 3 )
+            s_CacheScore[ i ] = 0.75f;
+        else
+            s_CacheScore[ i ] = ( float )pow( 1.0f - ( float )( i - 3 ) /
+                                              ( FORSYTH_CACHE_SIZE - 3 ), 1.5f );
+    }
+    s_ValenceScore[ 0 ] = 0;
+    for( int i = 1; i < FORSYTH_MAX_VALENCE; i++ )
+        s_ValenceScore[ i ] = 2.0f * ( float )pow( ( float )i, -0.5f );
+    done = true;
+}
+
+static inline float vertexScore( int cachePosition, int remaining )
+{
+    if( remaining == 0 )
+        return -1.0f;
+
+    float score = cachePosition >= 0 ? s_CacheScore[ cachePosition ] : 0.0f;
+    return score + s_ValenceScore[ remaining < FORSYTH_MAX_VALENCE ?
+                                   remaining : FORSYTH_MAX_VALENCE - 1 ];
+}
+
+void MeshOptimizer::optimizeVertexCache( std::vector< GLuint > &indices,
+                                         size_t vertexCount )
+{
+    const size_t            triCount = indices.size() / 3;
+    std::vector< GLuint >   result;
+    std::vector< size_t >   offset( vertexCount + 1, 0 );
+    std::vector< size_t >   adjacency( triCount * 3 );
+    std::vector< int >      remaining( vertexCount, 0 );
+    std::vector< int >      cachePosition( vertexCount, -1 );
+    std::vector< float >    score( vertexCount );
+    std::vector< float >    triScore( triCount );
+    std::vector< bool >     emitted( triCount, false );
+    GLuint                  cache[ FORSYTH_CACHE_SIZE + 3 ];
+    int                     cacheUsed = 0;
+    size_t                  cursor = 0;
+    long                    best = -1;
+
+    if( triCount == 0 )
+        return;
+    initScoreTables();
+
+    /* Triangle lists of each vertex. */
+    for( size_t i = 0; i < triCount * 3; i++ )
+        remaining[ indices[ i ] ]++;
+    for( size_t v = 0; v < vertexCount; v++ )
+        offset[ v + 1 ] = offset[ v ] + remaining[ v ];
+    {
+        std::vector< size_t > fill( offset.begin(), offset.end() - 1 );
+        for( size_t i = 0; i < triCount * 3; i++ )
+            adjacency[ fill[ indices[ i ] ]++ ] = i / 3;
+    }
+
+    for( size_t v = 0; v < vertexCount; v++ )
+        score[ v ] = vertexScore( -1, remaining[ v ] );
+    for( size_t t = 0; t < triCount; t++ )
+    {
+        triScore[ t ] = score[ indices[ 3 * t ] ] +
+                        score[ indices[ 3 * t + 1 ] ] +
+                        score[ indices[ 3 * t + 2 ] ];
+        if( best < 0 || triScore[ t ] > triScore[ best ] )
+            best = t;
+    }
+
+    result.reserve( indices.size() );
+    for( size_t emittedCount = 0; emittedCount < triCount; emittedCount++ )
+    {
+        /* Dead end, continue from the next triangle not yet emitted. */
+        if( best < 0 )
+        {
+            while( emitted[ cursor ] ) ++cursor;
+            best = cursor;
+        }
+
+        const GLuint *tri = &indices[ 3 * best ];
+        GLuint       newCache[ FORSYTH_CACHE_SIZE + 3 ];
+        int          newUsed = 0;
+
+        emitted[ best ] = true;
+        for( int k = 0; k < 3; k++ )
+        {
+            GLuint v = tri[ k ];
+            result.push_back( v );
+
+            /* Remove the triangle from the vertex's list. */
+            size_t *list = &adjacency[ offset[ v ] ];
+            int    count = remaining[ v ];
+            for( int j = 0; j < count; j++ )
+            {
+                if( list[ j ] == ( size_t )best )
+                {
+                    list[ j ] = list[ count - 1 ];
+                    break;
+                }
+            }
+            remaining[ v ]--;
+            newCache[ newUsed++ ] = v;
+        }
+
+        /* Move the triangle's vertices to the front of the LRU cache. */
+        for( int i = 0; i < cacheUsed; i++ )
+        {
+            GLuint v = cache[ i ];
+            if( v != tri[ 0 ] && v != tri[ 1 ] && v != tri[ 2 ] )
+                newCache[ newUsed++ ] = v;
+        }
+
+        /* Rescore the cached vertices and their triangles. */
+        best = -1;
+        float bestScore = -1.0f;
+        for( int i = 0; i < newUsed; i++ )
+        {
+            GLuint v = newCache[ i ];
+            cachePosition[ v ] = i < FORSYTH_CACHE_SIZE ? i : -1;
+            float newScore = vertexScore( cachePosition[ v ], remaining[ v ] );
+            float delta = newScore - score[ v ];
+            score[ v ] = newScore;
+
+            const size_t *list = &adjacency[ offset[ v ] ];
+            for( int j = 0; j < remaining[ v ]; j++ )
+            {
+                size_t t = list[ j ];
+                triScore[ t ] += delta;
+                if( triScore[ t ] > bestScore )
+                {
+                    bestScore = triScore[ t ];
+                    best = t;
+                }
+            }
+        }
+
+        cacheUsed = newUsed < FORSYTH_CACHE_SIZE ? newUsed : FORSYTH_CACHE_SIZE;
+        memcpy( cache, newCache, cacheUsed * sizeof( GLuint ) );
+    }
+
+    indices.swap( result );
+}
+
+/* --------------------------------------------------------------------------
+ *  optimizeOverdraw
+ *
+ *  Splits the triangle list into clusters where the cache starts over ( all
+ *  three vertices of a triangle miss ), so moving a cluster costs next to
+ *  nothing in cache efficiency. Clusters are then sorted so that those
+ *  facing away from the mesh centroid, i.e. the likely occluders, are drawn
+ *  first. The new order is dropped if it costs more than 5 % in ACMR.
+ * -------------------------------------------------------------------------- */
+struct OverdrawCluster
+{
+    size_t      first;
+    size_t      count;
+    float       sortKey;
+
+    bool operator<( const OverdrawCluster &other ) const
+    {
+        return sortKey > other.sortKey;
+    }
+};
+
+void MeshOptimizer::optimizeOverdraw( std::vector< GLuint > &indices,
+                                      const std::vector< MeshVertex > &vertices )
+{
+    const size_t                    triCount = indices.size() / 3;
+    const int                       cacheSize = MEASURE_CACHE_SIZE;
+    std::vector< OverdrawCluster >  clusters;
+    std::vector< unsigned int >     addedAt( vertices.size(), 0 );
+    unsigned int                    time = cacheSize + 1;
+    double                          centroid[ 3 ] = { 0, 0, 0 };
+    double                          totalArea = 0;
+
+    if( triCount < 2 )
+        return;
+
+    /* Cluster boundaries. */
+    for( size_t t = 0; t < triCount; t++ )
+    {
+        int misses = 0;
+        for( int k = 0; k < 3; k++ )
+        {
+            GLuint v = indices[ 3 * t + k ];
+            if( time - addedAt[ v ] > ( unsigned int )cacheSize )
+            {
+                addedAt[ v ] = time++;
+                ++misses;
+            }
+        }
+        if( t == 0 || misses == 3 )
+        {
+            OverdrawCluster cluster = { t, 0, 0 };
+            clusters.push_back( cluster );
+        }
+        clusters.back().count++;
+    }
+    if( clusters.size() < 2 )
+        return;
+
+    /* Area weighted centroid and normal of each cluster and of the mesh. */
+    std::vector< float > normal( 3 * clusters.size() );
+    std::vector< float > position( 3 * clusters.size() );
+    for( size_t c = 0; c < clusters.size(); c++ )
+    {
+        double n[ 3 ] = { 0, 0, 0 }, p[ 3 ] = { 0, 0, 0 }, area = 0;
+
+        for( size_t t = clusters[ c ].first;
+             t < clusters[ c ].first + clusters[ c ].count; t++ )
+        {
+            const GLfloat *a = vertices[ indices[ 3 * t ] ].position;
+            const GLfloat *b = vertices[ indices[ 3 * t + 1 ] ].position;
+            const GLfloat *d = vertices[ indices[ 3 * t + 2 ] ].position;
+            double e1[ 3 ] = { b[ 0 ] - a[ 0 ], b[ 1 ] - a[ 1 ], b[ 2 ] - a[ 2 ] };
+            double e2[ 3 ] = { d[ 0 ] - a[ 0 ], d[ 1 ] - a[ 1 ], d[ 2 ] - a[ 2 ] };
+            double cross[ 3 ] = { e1[ 1 ] * e2[ 2 ] - e1[ 2 ] * e2[ 1 ],
+                                  e1[ 2 ] * e2[ 0 ] - e1[ 0 ] * e2[ 2 ],
+                                  e1[ 0 ] * e2[ 1 ] - e1[ 1 ] * e2[ 0 ] };
+            double triArea = sqrt( cross[ 0 ] * cross[ 0 ] +
+                                   cross[ 1 ] * cross[ 1 ] +
+                                   cross[ 2 ] * cross[ 2 ] );
+            for( int k = 0; k < 3; k++ )
+            {
+                n[ k ] += cross[ k ];
+                p[ k ] += triArea * ( a[ k ] + b[ k ] + d[ k ] ) / 3;
+            }
+            area += triArea;
+        }
+
+        double length = sqrt( n[ 0 ] * n[ 0 ] + n[ 1 ] * n[ 1 ] + n[ 2 ] * n[ 2 ] );
+        for( int k = 0; k < 3; k++ )
+        {
+            normal[ 3 * c + k ]   = length > 0 ? n[ k ] / length : 0;
+            position[ 3 * c + k ] = area > 0 ? p[ k ] / area : 0;
+            centroid[ k ] += p[ k ];
+        }
+        totalArea += area;
+    }
+    if( totalArea <= 0 )
+        return;
+    for( int k = 0; k < 3; k++ )
+        centroid[ k ] /= totalArea;
+
+    for( size_t c = 0; c < clusters.size(); c++ )
+    {
+        float key = 0;
+        for( int k = 0; k < 3; k++ )
+            key += ( position[ 3 * c + k ] - centroid[ k ] ) * normal[ 3 * c + k ];
+        clusters[ c ].sortKey = key;
+    }
+    std::stable_sort( clusters.begin(), clusters.end() );
+
+    std::vector< GLuint > result;
+    result.reserve( indices.size() );
+    for( size_t c = 0; c < clusters.size(); c++ )
+        result.insert( result.end(),
+                       indices.begin() + 3 * clusters[ c ].first,
+                       indices.begin() + 3 * ( clusters[ c ].first +
+                                               clusters[ c ].count ) );
+
+    if( computeACMR( result, vertices.size() ) <=
+        1.05f * computeACMR( indices, vertices.size() ) )
+        indices.swap( result );
+}
+
+/* --------------------------------------------------------------------------
+ *  optimizeVertexFetch
+ *
+ *  Vertices are stored in the order of first use, so that the vertex reads
+ *  of the ( cache optimized ) triangle list walk through memory.
+ * -------------------------------------------------------------------------- */
+void MeshOptimizer::optimizeVertexFetch( std::vector< MeshVertex > &vertices,
+                                         std::vector< GLuint > &indices )
+{
+    const GLuint                UNUSED = ~( GLuint )0;
+    std::vector< GLuint >       remap( vertices.size(), UNUSED );
+    std::vector< MeshVertex >   result;
+
+    result.reserve( vertices.size() );
+    for( size_t i = 0; i < indices.size(); i++ )
+    {
+        GLuint &newIndex = remap[ indices[ i ] ];
+        if( newIndex == UNUSED )
+        {
+            newIndex = ( GLuint )result.size();
+            result.push_back( vertices[ indices[ i ] ] );
+        }
+        indices[ i ] = newIndex;
+    }
+
+    /* Vertices no triangle refers to are dropped. */
+    vertices.swap( result );
+}
+
+/* --------------------------------------------------------------------------
+ *  buildClusters
+ *
+ *  A cluster starts from the first triangle not yet taken and grows over
+ *  the triangles sharing a vertex with it, taking the one adding the
+ *  fewest vertices, of those the one facing most like the cluster so far.
+ *  Clusters are stored in the order of their first triangles, which keeps
+ *  the overdraw order, and the triangles of each are ordered for the
+ *  vertex cache again.
+ *
+ *  The sphere of a cluster is centred on the box around its vertices. The
+ *  cone axis is the mean of the unit face normals, its angle the widest
+ *  one between the axis and a face normal.
+ * -------------------------------------------------------------------------- */
+static Vector3f faceNormal( const std::vector< MeshVertex > &vertices,
+                            const GLuint *triangle )
+{
+    const GLfloat *a = vertices[ triangle[ 0 ] ].position;
+    const GLfloat *b = vertices[ triangle[ 1 ] ].position;
+    const GLfloat *c = vertices[ triangle[ 2 ] ].position;
+    GLfloat ux = b[ 0 ] - a[ 0 ], uy = b[ 1 ] - a[ 1 ], uz = b[ 2 ] - a[ 2 ];
+    GLfloat vx = c[ 0 ] - a[ 0 ], vy = c[ 1 ] - a[ 1 ], vz = c[ 2 ] - a[ 2 ];
+    Vector3f n( uy * vz - uz * vy, uz * vx - ux * vz, ux * vy - uy * vx );
+    GLfloat length = sqrt( n.x * n.x + n.y * n.y + n.z * n.z );
+
+    if( length == 0 )
+        return n;
+    return Vector3f( n.x / length, n.y / length, n.z / length );
+}
+
+static void finishCluster( const std::vector< MeshVertex > &vertices,
+                           const std::vector< GLuint > &indices,
+                           const std::vector< Vector3f > &normals,
+                           MeshCluster &cluster )
+{
+    const GLuint    *first = &indices[ cluster.firstIndex ];
+    const GLuint    *last = first + cluster.indexCount;
+    BoundingBox     box;
+    GLfloat         radius = 0;
+
+    for( const GLuint *i = first; i < last; i++ )
+    {
+        const GLfloat *p = vertices[ *i ].position;
+        box.extend( Vector3f( p[ 0 ], p[ 1 ], p[ 2 ] ) );
+    }
+    Vector3f center = box.center();
+    for( const GLuint *i = first; i < last; i++ )
+    {
+        const GLfloat *p = vertices[ *i ].position;
+        GLfloat dx = p[ 0 ] - center.x;
+        GLfloat dy = p[ 1 ] - center.y;
+        GLfloat dz = p[ 2 ] - center.z;
+        radius = std::max( radius, dx * dx + dy * dy + dz * dz );
+    }
+    cluster.center[ 0 ] = center.x;
+    cluster.center[ 1 ] = center.y;
+    cluster.center[ 2 ] = center.z;
+    cluster.radius = sqrt( radius );
+
+    /* Degenerate triangles have a zero normal and are left out. */
+    const size_t    firstTriangle = cluster.firstIndex / 3;
+    const size_t    triangleCount = cluster.indexCount / 3;
+    Vector3f        axis;
+    bool            hasNormal = false;
+
+    for( size_t t = firstTriangle; t < firstTriangle + triangleCount; t++ )
+        axis = Vector3f( axis.x + normals[ t ].x, axis.y + normals[ t ].y,
+                         axis.z + normals[ t ].z );
+
+    GLfloat length = sqrt( axis.x * axis.x + axis.y * axis.y + axis.z * axis.z );
+    GLfloat minDot = 1;
+    if( length > 0 )
+    {
+        axis = Vector3f( axis.x / length, axis.y / length, axis.z / length );
+        for( size_t t = firstTriangle; t < firstTriangle + triangleCount; t++ )
+        {
+            const Vector3f &n = normals[ t ];
+            if( n.x == 0 && n.y == 0 && n.z == 0 )
+                continue;
+            minDot = std::min( minDot, n.x * axis.x + n.y * axis.y +
+                                       n.z * axis.z );
+            hasNormal = true;
+        }
+    }
+    cluster.coneAxis[ 0 ] = axis.x;
+    cluster.coneAxis[ 1 ] = axis.y;
+    cluster.coneAxis[ 2 ] = axis.z;
+    cluster.coneSin = hasNormal && minDot > 0 ?
+                      sqrt( std::max( 0.0f, 1 - minDot * minDot ) ) : 1;
+}
+
+void MeshOptimizer::buildClusters( const std::vector< MeshVertex > &vertices,
+                                   std::vector< GLuint > &indices,
+                                   std::vector< MeshCluster > &clusters )
+{
+    const size_t    triangleCount = indices.size() / 3;
+    const size_t    NONE = ~( size_t )0;
+
+    clusters.clear();
+    if( triangleCount == 0 )
+        return;
+
+    /* Triangles of each vertex. */
+    std::vector< GLuint > triangleFirst( vertices.size() + 1, 0 );
+    std::vector< GLuint > vertexTriangles( triangleCount * 3 );
+    for( size_t i = 0; i < triangleCount * 3; i++ )
+        triangleFirst[ indices[ i ] + 1 ]++;
+    for( size_t v = 0; v < vertices.size(); v++ )
+        triangleFirst[ v + 1 ] += triangleFirst[ v ];
+    {
+        std::vector< GLuint > next( triangleFirst.begin(),
+                                    triangleFirst.end() - 1 );
+        for( size_t i = 0; i < triangleCount * 3; i++ )
+            vertexTriangles[ next[ indices[ i ] ]++ ] = i / 3;
+    }
+
+    std::vector< Vector3f > normals( triangleCount );
+    for( size_t t = 0; t < triangleCount; t++ )
+        normals[ t ] = faceNormal( vertices, &indices[ t * 3 ] );
+
+    /* Cluster of each vertex and triangle, NONE if not in one yet. */
+    std::vector< size_t >   vertexCluster( vertices.size(), NONE );
+    std::vector< size_t >   triangleCluster( triangleCount, NONE );
+    std::vector< GLuint >   members;
+    std::vector< GLuint >   candidates;
+    std::vector< GLuint >   result;
+    std::vector< GLuint >   local;
+    std::vector< GLuint >   localVertices;
+    size_t                  seed = 0;
+
+    result.reserve( indices.size() );
+    while( result.size() < indices.size() )
+    {
+        while( triangleCluster[ seed ] != NONE )
+            seed++;
+
+        const size_t    current = clusters.size();
+        size_t          vertexCount = 0;
+        Vector3f        normalSum;
+        size_t          next = seed;
+
+        members.clear();
+        candidates.clear();
+        while( next != NONE )
+        {
+            const GLuint *triangle = &indices[ next * 3 ];
+            triangleCluster[ next ] = current;
+            members.push_back( next );
+            normalSum = Vector3f( normalSum.x + normals[ next ].x,
+                                  normalSum.y + normals[ next ].y,
+                                  normalSum.z + normals[ next ].z );
+            for( int k = 0; k < 3; k++ )
+            {
+                GLuint v = triangle[ k ];
+                if( vertexCluster[ v ] == current )
+                    continue;
+                vertexCluster[ v ] = current;
+                vertexCount++;
+                for( GLuint i = triangleFirst[ v ]; i < triangleFirst[ v + 1 ]; i++ )
+                    if( triangleCluster[ vertexTriangles[ i ] ] == NONE )
+                        candidates.push_back( vertexTriangles[ i ] );
+            }
+            if( members.size() == MeshCluster::MAX_TRIANGLES )
+                break;
+
+            /* Best candidate that still fits. Taken ones are dropped on
+             * the way. */
+            size_t  best = NONE;
+            int     bestAdded = 4;
+            GLfloat bestDot = 0;
+            for( size_t c = 0; c < candidates.size(); )
+            {
+                GLuint t = candidates[ c ];
+                if( triangleCluster[ t ] != NONE )
+                {
+                    candidates[ c ] = candidates.back();
+                    candidates.pop_back();
+                    continue;
+                }
+
+                int added = 0;
+                for( int k = 0; k < 3; k++ )
+                    if( vertexCluster[ indices[ t * 3 + k ] ] != current )
+                        added++;
+                GLfloat dot = normals[ t ].x * normalSum.x +
+                              normals[ t ].y * normalSum.y +
+                              normals[ t ].z * normalSum.z;
+                if( vertexCount + added <= MeshCluster::MAX_VERTICES &&
+                    ( added < bestAdded ||
+                      ( added == bestAdded && dot > bestDot ) ) )
+                {
+                    best = t;
+                    bestAdded = added;
+                    bestDot = dot;
+                }
+                c++;
+            }
+            next = best;
+        }
+
+        MeshCluster cluster;
+        memset( &cluster, 0, sizeof( cluster ) );
+        cluster.firstIndex = result.size();
+        cluster.indexCount = members.size() * 3;
+        clusters.push_back( cluster );
+
+        /* The cluster's triangles are ordered for the vertex cache on their
+         * own, numbering its vertices from 0. */
+        local.clear();
+        localVertices.clear();
+        for( size_t m = 0; m < members.size(); m++ )
+            for( int k = 0; k < 3; k++ )
+            {
+                GLuint v = indices[ members[ m ] * 3 + k ];
+                size_t l = std::find( localVertices.begin(),
+                                      localVertices.end(), v ) -
+                           localVertices.begin();
+                if( l == localVertices.size() )
+                    localVertices.push_back( v );
+                local.push_back( l );
+            }
+        optimizeVertexCache( local, localVertices.size() );
+        for( size_t i = 0; i < local.size(); i++ )
+            result.push_back( localVertices[ local[ i ] ] );
+    }
+
+    /* The normals follow the triangles to their new places. */
+    std::vector< Vector3f > clusterNormals;
+    clusterNormals.reserve( triangleCount );
+    indices.swap( result );
+    for( size_t i = 0; i < indices.size(); i += 3 )
+        clusterNormals.push_back( faceNormal( vertices, &indices[ i ] ) );
+    for( size_t c = 0; c < clusters.size(); c++ )
+        finishCluster( vertices, indices, clusterNormals, clusters[ c ] );
+}
@@ -0,0 +1,70 @@
+/* --------------------------------------------------------------------------
+ * meshoptimizer.h
+ *
+ * Reorders the triangles and vertices of welded meshes ( see ModelData ) so
+ * that they make better use of the post-transform vertex cache and cause
+ * less overdraw.
+ *
+ * -------------------------------------------------------------------------- */
+
+#ifndef MESHOPTIMIZER_H
+#define MESHOPTIMIZER_H
+
+#include "renderer.h"
+
+/* --------------------------------------------------------------------------
+ *  MeshOptimizerStats
+ *
+ *  Average cache miss ratio ( transformed vertices per triangle ) of a mesh
+ *  before and after optimization. 3.0 is the worst possible value, 0.5 the
+ *  best achievable one for a large regular grid.
+ * -------------------------------------------------------------------------- */
+struct MeshOptimizerStats
+{
+    float       acmrBefore;
+    float       acmrAfter;
+
+    MeshOptimizerStats() : acmrBefore( 0 ), acmrAfter( 0 ) {}
+};
+
+/* --------------------------------------------------------------------------
+ *  MeshOptimizer
+ *
+ *  Static functions working on the welded index and vertex lists.
+ * -------------------------------------------------------------------------- */
+class MeshOptimizer
+{
+public:
+    /* Size of the FIFO cache used for measuring ACMR. */
+    enum { MEASURE_CACHE_SIZE = 16 };
+
+    /* Runs all the passes below on the welded mesh of data. */
+    static MeshOptimizerStats optimize( ModelData &data );
+
+    /* Returns the average cache miss ratio of the triangle list. */
+    static float computeACMR( const std::vector< GLuint > &indices,
+                              size_t vertexCount,
+                              int cacheSize = MEASURE_CACHE_SIZE );
+
+    /* Reorders triangles for vertex cache locality ( Forsyth's linear speed
+     * algorithm with a 32 entry LRU cache model ). */
+    static void optimizeVertexCache( std::vector< GLuint > &indices,
+                                     size_t vertexCount );
+
+    /* Reorders cache friendly runs of triangles so that the ones facing
+     * away from the centre of the mesh come first. */
+    static void optimizeOverdraw( std::vector< GLuint > &indices,
+                                  const std::vector< MeshVertex > &vertices );
+
+    /* Renumbers the vertices in the order the triangles first use them. */
+    static void optimizeVertexFetch( std::vector< MeshVertex > &vertices,
+                                     std::vector< GLuint > &indices );
+
+    /* Groups the triangles into MeshClusters of connected triangles facing
+     * alike, and reorders the triangle list cluster by cluster. */
+    static void buildClusters( const std::vector< MeshVertex > &vertices,
+                               std::vector< GLuint > &indices,
+                               std::vector< MeshCluster > &clusters );
+};
+
+#endif /* MESHOPTIMIZER_H */
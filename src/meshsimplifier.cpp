@@ -0,0 +1,561 @@
+/* --------------------------------------------------------------------------
+ * meshsimplifier.cpp
+ *
+ * Implementation of the MeshSimplifier class.
+ *
+ * -------------------------------------------------------------------------- */
+
+#include "meshsimplifier.h"
+#include "meshoptimizer.h"
+#include <math.h>
+#include <algorithm>
+
+/* Weight of the planes keeping the borders in place, relative to the
+ * planes of the triangles. */
+static const double BORDER_WEIGHT = 10.0;
+
+/* Smallest cosine of the angle a triangle may turn by in a collapse. */
+static const double MIN_NORMAL_COSINE = 0.2;
+
+/* Levels of detail are made down to this many triangles. */
+static const size_t MIN_LOD_TRIANGLES = 128;
+
+/* --------------------------------------------------------------------------
+ *  Quadric
+ *
+ *  Sum of squared distances to a set of planes, as the symmetric matrix
+ *  of ( a, b, c, d ) ( a, b, c, d )^T summed over the planes.
+ * -------------------------------------------------------------------------- */
+struct Quadric
+{
+    double      a2, ab, ac, ad, b2, bc, bd, c2, cd, d2;
+
+    Quadric() : a2( 0 ), ab( 0 ), ac( 0 ), ad( 0 ), b2( 0 ), bc( 0 ),
+                bd( 0 ), c2( 0 ), cd( 0 ), d2( 0 ) {}
+
+    void addPlane( double a, double b, double c, double d, double w )
+    {
+        a2 += w * a * a; ab += w * a * b; ac += w * a * c; ad += w * a * d;
+        b2 += w * b * b; bc += w * b * c; bd += w * b * d;
+        c2 += w * c * c; cd += w * c * d;
+        d2 += w * d * d;
+    }
+
+    void add( const Quadric &q )
+    {
+        a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad;
+        b2 += q.b2; bc += q.bc; bd += q.bd;
+        c2 += q.c2; cd += q.cd;
+        d2 += q.d2;
+    }
+
+    double error( const Vector3f &p ) const
+    {
+        double x = p.x, y = p.y, z = p.z;
+        double e = a2 * x * x + b2 * y * y + c2 * z * z + d2 +
+                   2 * ( ab * x * y + ac * x * z + bc * y * z +
+                         ad * x + bd * y + cd * z );
+        return e > 0 ? e : 0;
+    }
+};
+
+/* How a position may collapse, see canCollapse. */
+enum PositionKind { KIND_MANIFOLD, KIND_BORDER, KIND_SEAM, KIND_LOCKED };
+
+/* Collapse of the position from onto the position to. */
+struct Collapse
+{
+    GLuint      from;
+    GLuint      to;
+    double      cost;
+
+    bool operator<( const Collapse &other ) const
+    {
+        return cost < other.cost;
+    }
+};
+
+typedef std::pair< GLuint, GLuint > Edge;
+
+static Edge makeEdge( GLuint a, GLuint b )
+{
+    return a < b ? Edge( a, b ) : Edge( b, a );
+}
+
+static Vector3f positionOf( const MeshVertex &vertex )
+{
+    return Vector3f( vertex.position[ 0 ], vertex.position[ 1 ],
+                     vertex.position[ 2 ] );
+}
+
+static Vector3f cross( const Vector3f &a, const Vector3f &b )
+{
+    return Vector3f( a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z,
+                     a.x * b.y - a.y * b.x );
+}
+
+static double dot( const Vector3f &a, const Vector3f &b )
+{
+    return ( double )a.x * b.x + ( double )a.y * b.y + ( double )a.z * b.z;
+}
+
+static Vector3f difference( const Vector3f &a, const Vector3f &b )
+{
+    return Vector3f( a.x - b.x, a.y - b.y, a.z - b.z );
+}
+
+/* Orders vertex indices by the position of the vertex. */
+struct PositionLess
+{
+    const std::vector< MeshVertex > &vertices;
+
+    PositionLess( const std::vector< MeshVertex > &v ) : vertices( v ) {}
+
+    bool operator()( GLuint a, GLuint b ) const
+    {
+        const GLfloat *pa = vertices[ a ].position;
+        const GLfloat *pb = vertices[ b ].position;
+        if( pa[ 0 ] != pb[ 0 ] ) return pa[ 0 ] < pb[ 0 ];
+        if( pa[ 1 ] != pb[ 1 ] ) return pa[ 1 ] < pb[ 1 ];
+        return pa[ 2 ] < pb[ 2 ];
+    }
+};
+
+/* --------------------------------------------------------------------------
+ *  SimplifyState
+ *
+ *  Positions are the distinct vertex positions, each with one vertex per
+ *  side of a seam ( its copies ). Quadrics and kinds are kept per
+ *  position, triangles per vertex.
+ * -------------------------------------------------------------------------- */
+struct SimplifyState
+{
+    const std::vector< MeshVertex > &vertices;
+    std::vector< GLuint >       &indices;
+
+    /* Position of each vertex, and the copies of each position. */
+    std::vector< GLuint >       positionOfVertex;
+    std::vector< GLuint >       copyFirst;
+    std::vector< GLuint >       copies;
+    std::vector< Vector3f >     positions;
+    std::vector< int >          kinds;
+    std::vector< Quadric >      quadrics;
+    /* Position edges used by one triangle only. */
+    std::vector< Edge >         borderEdges;
+
+    /* Triangles around each vertex, rebuilt every pass. */
+    std::vector< GLuint >       triangleFirst;
+    std::vector< GLuint >       triangles;
+
+    SimplifyState( const std::vector< MeshVertex > &v,
+                   std::vector< GLuint > &i ) : vertices( v ), indices( i ) {}
+
+    void        findPositions();
+    void        classify();
+    void        computeQuadrics();
+    void        buildAdjacency();
+
+    bool        isBorderEdge( GLuint a, GLuint b ) const
+                {
+                    return std::binary_search( borderEdges.begin(),
+                                               borderEdges.end(),
+                                               makeEdge( a, b ) );
+                }
+    bool        canCollapse( GLuint from, GLuint to ) const;
+    /* Pairs each copy of from with the one copy of to it shares an edge
+     * with. False if some copy has none or several. */
+    bool        matchCopies( GLuint from, GLuint to,
+                             std::vector< Edge > &pairs ) const;
+    /* True if a triangle kept by the collapse would turn over or
+     * degenerate. */
+    bool        flips( GLuint to, const std::vector< Edge > &pairs ) const;
+};
+
+/* --------------------------------------------------------------------------
+ *  findPositions
+ * -------------------------------------------------------------------------- */
+void SimplifyState::findPositions()
+{
+    const size_t vertexCount = vertices.size();
+    std::vector< GLuint > order( vertexCount );
+
+    for( size_t i = 0; i < vertexCount; i++ )
+        order[ i ] = i;
+    std::sort( order.begin(), order.end(), PositionLess( vertices ) );
+
+    PositionLess less( vertices );
+    positionOfVertex.resize( vertexCount );
+    for( size_t i = 0; i < vertexCount; i++ )
+    {
+        if( i == 0 || less( order[ i - 1 ], order[ i ] ) )
+        {
+            copyFirst.push_back( i );
+            positions.push_back( positionOf( vertices[ order[ i ] ] ) );
+        }
+        positionOfVertex[ order[ i ] ] = positions.size() - 1;
+    }
+    copyFirst.push_back( vertexCount );
+    copies = order;
+}
+
+/* --------------------------------------------------------------------------
+ *  classify
+ *
+ *  Counts the triangles of each position edge: one makes it a border, more
+ *  than two a non-manifold edge.
+ * -------------------------------------------------------------------------- */
+void SimplifyState::classify()
+{
+    const size_t    positionCount = positions.size();
+    std::vector< Edge > edges;
+    std::vector< bool > border( positionCount, false );
+    std::vector< bool > locked( positionCount, false );
+
+    edges.reserve( indices.size() );
+    for( size_t t = 0; t < indices.size(); t += 3 )
+        for( int k = 0; k < 3; k++ )
+        {
+            GLuint a = positionOfVertex[ indices[ t + k ] ];
+            GLuint b = positionOfVertex[ indices[ t + ( k + 1 ) % 3 ] ];
+            if( a == b )
+                locked[ a ] = true;
+            else
+                edges.push_back( makeEdge( a, b ) );
+        }
+    std::sort( edges.begin(), edges.end() );
+
+    for( size_t i = 0; i < edges.size(); )
+    {
+        size_t end = i + 1;
+        while( end < edges.size() && edges[ end ] == edges[ i ] )
+            end++;
+
+        const Edge &edge = edges[ i ];
+        if( end - i == 1 )
+        {
+            border[ edge.first ] = border[ edge.second ] = true;
+            borderEdges.push_back( edge );
+        }
+        else if( end - i > 2 )
+            locked[ edge.first ] = locked[ edge.second ] = true;
+        i = end;
+    }
+
+    kinds.resize( positionCount );
+    for( size_t p = 0; p < positionCount; p++ )
+    {
+        GLuint copyCount = copyFirst[ p + 1 ] - copyFirst[ p ];
+        if( locked[ p ] || copyCount > 2 || ( border[ p ] && copyCount > 1 ) )
+            kinds[ p ] = KIND_LOCKED;
+        else if( border[ p ] )
+            kinds[ p ] = KIND_BORDER;
+        else if( copyCount == 2 )
+            kinds[ p ] = KIND_SEAM;
+        else
+            kinds[ p ] = KIND_MANIFOLD;
+    }
+}
+
+/* --------------------------------------------------------------------------
+ *  computeQuadrics
+ *
+ *  The plane of each triangle, and along the borders a plane through the
+ *  border edge perpendicular to its triangle, which keeps the border from
+ *  moving inwards.
+ * -------------------------------------------------------------------------- */
+void SimplifyState::computeQuadrics()
+{
+    quadrics.assign( positions.size(), Quadric() );
+
+    for( size_t t = 0; t < indices.size(); t += 3 )
+    {
+        GLuint p[ 3 ];
+        for( int k = 0; k < 3; k++ )
+            p[ k ] = positionOfVertex[ indices[ t + k ] ];
+
+        Vector3f n = cross( difference( positions[ p[ 1 ] ], positions[ p[ 0 ] ] ),
+                            difference( positions[ p[ 2 ] ], positions[ p[ 0 ] ] ) );
+        double length = sqrt( dot( n, n ) );
+        if( length == 0 )
+            continue;
+
+        double a = n.x / length, b = n.y / length, c = n.z / length;
+        double d = -( a * positions[ p[ 0 ] ].x + b * positions[ p[ 0 ] ].y +
+                      c * positions[ p[ 0 ] ].z );
+        for( int k = 0; k < 3; k++ )
+            quadrics[ p[ k ] ].addPlane( a, b, c, d, 1 );
+
+        for( int k = 0; k < 3; k++ )
+        {
+            GLuint from = p[ k ], to = p[ ( k + 1 ) % 3 ];
+            if( !isBorderEdge( from, to ) )
+                continue;
+
+            Vector3f m = cross( difference( positions[ to ], positions[ from ] ),
+                                n );
+            double mLength = sqrt( dot( m, m ) );
+            if( mLength == 0 )
+                continue;
+
+            double ma = m.x / mLength, mb = m.y / mLength, mc = m.z / mLength;
+            double md = -( ma * positions[ from ].x + mb * positions[ from ].y +
+                           mc * positions[ from ].z );
+            quadrics[ from ].addPlane( ma, mb, mc, md, BORDER_WEIGHT );
+            quadrics[ to ].addPlane( ma, mb, mc, md, BORDER_WEIGHT );
+        }
+    }
+}
+
+/* --------------------------------------------------------------------------
+ *  buildAdjacency
+ * -------------------------------------------------------------------------- */
+void SimplifyState::buildAdjacency()
+{
+    triangleFirst.assign( vertices.size() + 1, 0 );
+    for( size_t i = 0; i < indices.size(); i++ )
+        triangleFirst[ indices[ i ] + 1 ]++;
+    for( size_t v = 0; v < vertices.size(); v++ )
+        triangleFirst[ v + 1 ] += triangleFirst[ v ];
+
+    std::vector< GLuint > next( triangleFirst.begin(), triangleFirst.end() - 1 );
+    triangles.resize( indices.size() );
+    for( size_t i = 0; i < indices.size(); i++ )
+        triangles[ next[ indices[ i ] ]++ ] = i / 3;
+}
+
+/* --------------------------------------------------------------------------
+ *  canCollapse, matchCopies & flips
+ *
+ *  Inner positions may collapse onto any neighbour, border positions only
+ *  along the border and seam positions only onto another seam position,
+ *  which matchCopies then limits to the seam edges.
+ * -------------------------------------------------------------------------- */
+bool SimplifyState::canCollapse( GLuint from, GLuint to ) const
+{
+    switch( kinds[ from ] )
+    {
+    case KIND_MANIFOLD:
+        return true;
+    case KIND_BORDER:
+        return isBorderEdge( from, to );
+    case KIND_SEAM:
+        return kinds[ to ] == KIND_SEAM || kinds[ to ] == KIND_LOCKED;
+    default:
+        return false;
+    }
+}
+
+bool SimplifyState::matchCopies( GLuint from, GLuint to,
+                                 std::vector< Edge > &pairs ) const
+{
+    pairs.clear();
+    for( GLuint c = copyFirst[ from ]; c < copyFirst[ from + 1 ]; c++ )
+    {
+        GLuint  u = copies[ c ];
+        GLuint  match = u;
+
+        for( GLuint i = triangleFirst[ u ]; i < triangleFirst[ u + 1 ]; i++ )
+        {
+            const GLuint *corner = &indices[ triangles[ i ] * 3 ];
+            for( int k = 0; k < 3; k++ )
+            {
+                if( positionOfVertex[ corner[ k ] ] != to )
+                    continue;
+                if( match != u && match != corner[ k ] )
+                    return false;
+                match = corner[ k ];
+            }
+        }
+        if( match == u )
+            return false;
+        pairs.push_back( Edge( u, match ) );
+    }
+    return true;
+}
+
+bool SimplifyState::flips( GLuint to, const std::vector< Edge > &pairs ) const
+{
+    for( size_t p = 0; p < pairs.size(); p++ )
+    {
+        GLuint u = pairs[ p ].first;
+        for( GLuint i = triangleFirst[ u ]; i < triangleFirst[ u + 1 ]; i++ )
+        {
+            const GLuint    *corner = &indices[ triangles[ i ] * 3 ];
+            Vector3f        before[ 3 ], after[ 3 ];
+            bool            removed = false;
+
+            for( int k = 0; k < 3; k++ )
+            {
+                removed |= positionOfVertex[ corner[ k ] ] == to;
+                before[ k ] = after[ k ] =
+                    positions[ positionOfVertex[ corner[ k ] ] ];
+                if( corner[ k ] == u )
+                    after[ k ] = positions[ to ];
+            }
+            if( removed )
+                continue;
+
+            Vector3f n0 = cross( difference( before[ 1 ], before[ 0 ] ),
+                                 difference( before[ 2 ], before[ 0 ] ) );
+            Vector3f n1 = cross( difference( after[ 1 ], after[ 0 ] ),
+                                 difference( after[ 2 ], after[ 0 ] ) );
+            double length = sqrt( dot( n0, n0 ) * dot( n1, n1 ) );
+            if( length == 0 || dot( n0, n1 ) < MIN_NORMAL_COSINE * length )
+                return true;
+        }
+    }
+    return false;
+}
+
+/* --------------------------------------------------------------------------
+ *  simplify
+ *
+ *  Works in passes. Each pass finds the allowed collapses of all edges and
+ *  makes them cheapest first. A position whose triangles a collapse has
+ *  changed is left alone for the rest of the pass, so the costs and flip
+ *  tests of the pass stay valid; the triangles are rewritten at its end.
+ * -------------------------------------------------------------------------- */
+GLfloat MeshSimplifier::simplify( const std::vector< MeshVertex > &vertices,
+                                  const std::vector< GLuint > &indices,
+                                  size_t targetCount,
+                                  std::vector< GLuint > &result )
+{
+    double error = 0;
+
+    result = indices;
+    if( result.size() / 3 <= targetCount )
+        return 0;
+
+    SimplifyState state( vertices, result );
+    state.findPositions();
+    state.classify();
+    state.computeQuadrics();
+
+    std::vector< Collapse >     collapses;
+    std::vector< Edge >         pairs;
+    std::vector< GLuint >       remap( vertices.size() );
+    std::vector< bool >         touched;
+
+    while( result.size() / 3 > targetCount )
+    {
+        state.buildAdjacency();
+
+        collapses.clear();
+        for( size_t t = 0; t < result.size(); t += 3 )
+            for( int k = 0; k < 3; k++ )
+            {
+                GLuint a = state.positionOfVertex[ result[ t + k ] ];
+                GLuint b = state.positionOfVertex[ result[ t + ( k + 1 ) % 3 ] ];
+                Collapse collapse;
+                collapse.from = a;
+                collapse.to   = b;
+                if( a != b && state.canCollapse( a, b ) )
+                {
+                    collapse.cost = state.quadrics[ a ].error( state.positions[ b ] );
+                    collapses.push_back( collapse );
+                }
+                collapse.from = b;
+                collapse.to   = a;
+                if( a != b && state.canCollapse( b, a ) )
+                {
+                    collapse.cost = state.quadrics[ b ].error( state.positions[ a ] );
+                    collapses.push_back( collapse );
+                }
+            }
+        std::sort( collapses.begin(), collapses.end() );
+
+        for( size_t v = 0; v < remap.size(); v++ )
+            remap[ v ] = v;
+        touched.assign( state.positions.size(), false );
+
+        size_t removed = 0;
+        size_t budget = result.size() / 3 - targetCount;
+        for( size_t i = 0; i < collapses.size() && removed < budget; i++ )
+        {
+            const Collapse &collapse = collapses[ i ];
+            if( touched[ collapse.from ] || touched[ collapse.to ] ||
+                !state.matchCopies( collapse.from, collapse.to, pairs ) ||
+                state.flips( collapse.to, pairs ) )
+                continue;
+
+            for( size_t p = 0; p < pairs.size(); p++ )
+            {
+                GLuint u = pairs[ p ].first;
+                remap[ u ] = pairs[ p ].second;
+                for( GLuint j = state.triangleFirst[ u ];
+                     j < state.triangleFirst[ u + 1 ]; j++ )
+                {
+                    const GLuint *corner = &result[ state.triangles[ j ] * 3 ];
+                    bool gone = false;
+                    for( int k = 0; k < 3; k++ )
+                    {
+                        touched[ state.positionOfVertex[ corner[ k ] ] ] = true;
+                        gone |= state.positionOfVertex[ corner[ k ] ] ==
+                                collapse.to;
+                    }
+                    if( gone )
+                        removed++;
+                }
+            }
+            state.quadrics[ collapse.to ].add( state.quadrics[ collapse.from ] );
+            error = std::max( error, collapse.cost );
+        }
+        if( removed == 0 )
+            break;
+
+        /* Drop the triangles that lost a corner. */
+        size_t kept = 0;
+        for( size_t t = 0; t < result.size(); t += 3 )
+        {
+            GLuint a = remap[ result[ t ] ];
+            GLuint b = remap[ result[ t + 1 ] ];
+            GLuint c = remap[ result[ t + 2 ] ];
+            if( a == b || b == c || c == a )
+                continue;
+            result[ kept++ ] = a;
+            result[ kept++ ] = b;
+            result[ kept++ ] = c;
+        }
+        result.resize( kept );
+    }
+
+    return sqrt( error );
+}
+
+/* --------------------------------------------------------------------------
+ *  buildLods
+ *
+ *  Each level halves the triangles of the one before, simplified from it,
+ *  so the errors of the levels add up. The chain ends when a level would
+ *  keep more than four fifths of the triangles, which happens once the
+ *  seams and borders are all that is left.
+ * -------------------------------------------------------------------------- */
+void MeshSimplifier::buildLods( ModelData &data )
+{
+    std::vector< GLuint >   indices = data.weldedIndices;
+    std::vector< GLuint >   simplified;
+    GLfloat                 error = 0;
+
+    data.lodIndices.clear();
+    data.lodLevels.clear();
+    while( data.lodLevels.size() < MAX_LOD_LEVELS &&
+           indices.size() / 3 >= MIN_LOD_TRIANGLES )
+    {
+        error += simplify( data.weldedVertices, indices, indices.size() / 6,
+                           simplified );
+        if( simplified.size() * 5 > indices.size() * 4 )
+            break;
+
+        ModelData::LodLevel level;
+        level.indexCount = simplified.size();
+        level.error = error;
+        data.lodLevels.push_back( level );
+
+        indices.swap( simplified );
+        simplified = indices;
+        MeshOptimizer::optimizeVertexCache( simplified,
+                                           data.weldedVertices.size() );
+        data.lodIndices.insert( data.lodIndices.end(), simplified.begin(),
+                                simplified.end() );
+    }
+}
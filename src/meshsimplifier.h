@@ -0,0 +1,55 @@
+/* --------------------------------------------------------------------------
+ * meshsimplifier.h
+ *
+ * Reduces the triangle count of welded meshes ( see ModelData ) by edge
+ * collapses ordered by the quadric error metric, for levels of detail.
+ *
+ * -------------------------------------------------------------------------- */
+
+#ifndef MESHSIMPLIFIER_H
+#define MESHSIMPLIFIER_H
+
+#include "renderer.h"
+#include <vector>
+
+/* --------------------------------------------------------------------------
+ *  MeshSimplifier
+ *
+ *  Static function working on the welded index and vertex lists. Vertices
+ *  are never moved or created: an edge collapse replaces one end of the
+ *  edge by the other, so the simplified triangles index the original
+ *  vertices and keep their normals and texture coordinates. The vertices
+ *  left unused are dropped by MeshOptimizer::optimizeVertexFetch.
+ *
+ *  The welded mesh splits a position into several vertices where the
+ *  normal or texture coordinates differ. Such seams, and the open borders
+ *  of the mesh, only shrink along themselves: a seam position collapses
+ *  with all its vertices at once, each onto the vertex on its own side of
+ *  the seam. Positions where three or more vertices, or non-manifold
+ *  edges, meet are kept as they are.
+ *
+ *  Reference: Michael Garland, Paul S. Heckbert, 'Surface Simplification
+ *             Using Quadric Error Metrics' ( SIGGRAPH 1997 )
+ * -------------------------------------------------------------------------- */
+class MeshSimplifier
+{
+public:
+    /* Levels of detail made by buildLods, below the mesh itself. */
+    enum { MAX_LOD_LEVELS = 4 };
+
+    /* Collapses edges of the triangle list, cheapest first, until at most
+     * targetCount triangles are left or no more collapses are allowed.
+     * Returns the largest error of a collapse made, an estimate of the
+     * distance from the original surface in the units of the vertices. */
+    static GLfloat simplify( const std::vector< MeshVertex > &vertices,
+                             const std::vector< GLuint > &indices,
+                             size_t targetCount,
+                             std::vector< GLuint > &result );
+
+    /* Fills the levels of detail of the welded mesh of data, each level
+     * with half the triangles of the one before, optimized for the vertex
+     * cache. The errors are in the units of the vertices. */
+    static void buildLods( ModelData &data );
+};
+
+#endif /* MESHSIMPLIFIER_H */
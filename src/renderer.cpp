@@ -44,7 +44,7 @@
             2.1.1.  Renderer ( ctor & dtor )
             2.1.2.  attachObject
             2.1.3.  removeObject
-            2.1.4.  clearAllObjects
+            2.1.4.  clearAllObjects & object
             2.1.5.  initializeGL
             2.1.6.  resizeGL
             2.1.7.  paintGL
@@ -52,10 +52,15 @@
             2.1.9.  mouseReleaseEvent
             2.1.10. mouseMoveEvent
             2.1.11. keyPressEvent
-            2.1.12. draw
-            2.1.13. objecAtPosition
+            2.1.12. draw & updateScene
+            2.1.13. objecAtPosition & rayCastAtPosition
             2.1.14. changeObjectColor
             2.1.15. changeObjectPosition
+            2.1.16. transformChanged & stateChanged
+            2.1.17. updateIdBuffer
+            2.1.18. assetsLoaded
+            2.1.19. selectLod
+            2.1.20. submitMesh & cullClusters
         2.2. MaterialManager
             2.2.1.  MaterialManager ( ctor, copy-ctor, assignment op. & dtor )
             2.2.2.  getInstance
@@ -64,6 +69,10 @@
             2.2.5.  clearAllMaterials
             2.2.6.  setValue
             2.2.7.  getMaterial
+            2.2.8.  getMaterialId
+        2.3. TextureManager
+        2.4. Matrix4f
+        2.5. BoundingBox & BoundingSphere
  */
 
 
@@ -74,9 +83,31 @@
    ************************************************************************** */
 #include "renderer.h"
 #include <math.h>
+#include <float.h>
 #include <cassert>
+#include <algorithm>
 #include "drawableobjects.h"
-#include "GL/glu.h"
+#include "statemanager.h"
+#include "aabbtree.h"
+#include "scenestore.h"
+#include "meshmanager.h"
+#include <QGLFramebufferObject>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QThreadPool>
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+/* Near and far clipping planes of the projection set up in resizeGL(). */
+static const GLfloat NEAR_PLANE = 4.0;
+static const GLfloat FAR_PLANE  = 20.0;
+
+/* A finer level of detail is taken once the error of the current one
+ * exceeds the allowed error by this factor, a coarser one once its error
+ * falls below the allowed error by this factor. */
+static const GLfloat LOD_REFINE_FACTOR  = 1.25;
+static const GLfloat LOD_COARSEN_FACTOR = 0.8;
 
 /* **************************************************************************
 
@@ -98,55 +129,120 @@
  * -------------------------------------------------------------------------- */
 Renderer::Renderer( QWidget *parent )
     : QGLWidget( parent ),
-      m_pChosenObject( NULL ),
-      m_ObjectDragOngoing( false )
+      m_pScene( new SceneStore() ),
+      m_ChosenObject( NULL_HANDLE ),
+      m_Robot( NULL_HANDLE ),
+      m_ObjectDragOngoing( false ),
+      m_PickMode( PICK_ID_BUFFER ),
+      m_PixelsPerUnit( 0 ),
+      m_LodPixelError( 1.0 ),
+      m_pTree( new AABBTree() ),
+      m_pIdBuffer( NULL ),
+      m_SceneVersion( 1 ),
+      m_IdBufferVersion( 0 ),
+      m_IsInitialized( false )
 {
     /* Specify OpenGL display context. */
     setFormat( QGLFormat( QGL::DoubleBuffer | QGL::DepthBuffer ) );
+    m_RenderQueue.setDepthRange( NEAR_PLANE, FAR_PLANE );
+
+    MeshManager::getInstance()->setRenderer( this );
+
+    /* Load some textures, in the background */
+    TextureManager *texMngrPtr;
+    texMngrPtr = TextureManager::getInstance();
+    texMngrPtr->setRenderer( this );
+    texMngrPtr->loadTexture( "Marble", "marble.jpg" );
+    texMngrPtr->loadTexture( "Wall", "brick_wall.jpg" );
+    texMngrPtr->loadTexture( "Whiteboard", "whiteboard.jpg" );
+    texMngrPtr->loadTexture( "Floor", "floor.jpg" );
 }
 
 Renderer::~Renderer()
 {
+    MeshManager::getInstance()->setRenderer( NULL );
+    TextureManager::getInstance()->setRenderer( NULL );
+
     /* Delete all objects from the drawable list */
     clearAllObjects();
+    delete m_pTree;
+    delete m_pScene;
+
+    /* The buffer belongs to the widget's context. */
+    makeCurrent();
+    delete m_pIdBuffer;
 }
 
 /* --------------------------------------------------------------------------
  *  2.1.2. attachObject
  *
- *  Adds drawable object to the list of objects.
+ *  Adds drawable object to the scene store and to the tree. The object is
+ *  given its handle, which identifies it in picking and signals. Returns
+ *  NULL_HANDLE, without taking the object, if the store is full.
  * -------------------------------------------------------------------------- */
-void Renderer::attachObject( IDrawable *object, bool isRobot )
+ObjectHandle Renderer::attachObject( IDrawable *object, bool isRobot )
 {
-    m_Objects.push_back( object );
+    ObjectHandle handle = m_pScene->add( object );
+    if( handle == NULL_HANDLE )
+        return NULL_HANDLE;
+
+    int index = m_pScene->indexOf( handle );
+    m_pScene->refresh( index );
+    m_pScene->proxy( index ) = m_pTree->createProxy( m_pScene->bounds( index ),
+                                                     handle );
+    object->setHandle( handle );
+    object->setTransformListener( this );
+    m_SceneVersion++;
 
     if( isRobot )
-        m_pRobot = object;
+        m_Robot = handle;
+    return handle;
 }
 
 /* --------------------------------------------------------------------------
  *  2.1.3. removeObject
  *
- *  Removes an object from the drawables list.
+ *  Removes an object from the objects and the tree, and deletes it. Stale
+ *  handles are ignored.
  * -------------------------------------------------------------------------- */
-void Renderer::removeObject( IDrawable *object )
+void Renderer::removeObject( ObjectHandle handle )
 {
-    m_Objects.remove( object );
+    int index = m_pScene->indexOf( handle );
+    if( index < 0 )
+        return;
+
+    m_pTree->destroyProxy( m_pScene->proxy( index ) );
+    /* A dirty handle left in m_DirtyObjects is skipped as stale. */
+    IDrawable *object = m_pScene->remove( handle );
+
+    if( m_ChosenObject == handle )
+    {
+        m_ChosenObject = NULL_HANDLE;
+        m_ObjectDragOngoing = false;
+    }
+    if( m_Robot == handle )
+        m_Robot = NULL_HANDLE;
+    m_SceneVersion++;
+
     delete object;
 }
 
 /* --------------------------------------------------------------------------
  *  2.1.4. clearAllObjects
+ *         object
  *
- *  Clear the object list.
+ *  Clear the objects, and look up an object by its handle.
  * -------------------------------------------------------------------------- */
 void Renderer::clearAllObjects()
 {
-    while( !m_Objects.empty() )
-    {
-        DrawableIterator it = m_Objects.begin();
-        removeObject( *it );
-    }
+    while( !m_pScene->empty() )
+        removeObject( m_pScene->handle( m_pScene->size() - 1 ) );
+}
+
+IDrawable *Renderer::object( ObjectHandle handle ) const
+{
+    int index = m_pScene->indexOf( handle );
+    return index >= 0 ? m_pScene->object( index ) : NULL;
 }
 
 /* --------------------------------------------------------------------------
@@ -156,30 +252,27 @@ void Renderer::clearAllObjects()
  * -------------------------------------------------------------------------- */
 void Renderer::initializeGL()
 {
+    /* New context, all state goes through the state manager from now on. */
+    StateManager *state = StateManager::getInstance();
+    state->invalidate();
+
     /* Set clear color to black. */
     glClearColor( 0.0, 0.0, 0.0, 0.0 );
 
     /* Enable smooth shading. */
-    glShadeModel( GL_SMOOTH );
+    state->shadeModel( GL_SMOOTH );
 
     /* Enable depth comparison and updates to the depth buffer. */
-    glEnable( GL_DEPTH_TEST );
+    state->enable( GL_DEPTH_TEST );
 
-    glEnable( GL_TEXTURE_2D );
+    state->enable( GL_TEXTURE_2D );
+    glTexEnvf( GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE );
 
     /* Enable culling to discard (in our case) back-facing polygons. */
-    glEnable( GL_CULL_FACE );
+    state->enable( GL_CULL_FACE );
 
     /* Ensure that normals are of unit length. */
-    glEnable( GL_NORMALIZE );
-
-    /* Load some textures */
-    TextureManager *texMngrPtr;
-    texMngrPtr = TextureManager::getInstance();
-    texMngrPtr->createTexture( "Marble", QImage("marble.jpg") );
-    texMngrPtr->createTexture( "Wall", QImage("brick_wall.jpg") );
-    texMngrPtr->createTexture( "Whiteboard", QImage("whiteboard.jpg") );
-    texMngrPtr->createTexture( "Floor", QImage("floor.jpg") );
+    state->enable( GL_NORMALIZE );
 
     /* Enable lighting. */
 
@@ -198,9 +291,14 @@ void Renderer::initializeGL()
     glLightf( GL_LIGHT0, GL_QUADRATIC_ATTENUATION, 0.01 );
     glLightModelfv( GL_LIGHT_MODEL_AMBIENT, ambient );
     glLightModeli( GL_LIGHT_MODEL_COLOR_CONTROL, GL_SEPARATE_SPECULAR_COLOR );
-    glEnable( GL_LIGHTING );
-    glEnable( GL_LIGHT0 );
+    state->enable( GL_LIGHTING );
+    state->enable( GL_LIGHT0 );
+
+    m_RenderQueue.initialize();
 
+    /* Textures and meshes loaded so far. */
+    m_IsInitialized = true;
+    assetsLoaded();
 }
 
 /* --------------------------------------------------------------------------
@@ -223,7 +321,13 @@ void Renderer::resizeGL( int width, int height )
 
     /* Calculate width to height ratio and specify perspective projection. */
     GLfloat x = GLfloat( width ) / height;
-    glFrustum( -x, x, -1.0, 1.0, 4.0, 20.0 );
+    glFrustum( -x, x, -1.0, 1.0, NEAR_PLANE, FAR_PLANE );
+
+    /* Same projection for view frustum culling. */
+    m_Projection = Matrix4f::frustum( -x, x, -1.0, 1.0, NEAR_PLANE, FAR_PLANE );
+    m_Frustum.extract( m_Projection );
+    m_PixelsPerUnit = m_Projection.m[ 5 ] * height / 2;
+    m_SceneVersion++;
 //    gluLookAt( 4, 1, 0, 1, 0, -12, 0, 1, 0 );
     /* Change back to modelview matrix. */
     glMatrixMode( GL_MODELVIEW );
@@ -240,6 +344,8 @@ void Renderer::paintGL()
 {
     glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
     draw();
+    StateManager::getInstance()->endFrame();
+    emit frameDrawn( m_FrameStats );
 }
 
 /* --------------------------------------------------------------------------
@@ -252,38 +358,26 @@ void Renderer::paintGL()
  * -------------------------------------------------------------------------- */
 void Renderer::mousePressEvent( QMouseEvent *event )
 {
-    int         objName;
+    ObjectHandle handle;
+    IDrawable   *obj;
 
     m_MouseLastPos = event->pos();
 
     /* Check if an object has been clicked. */
-
-    if( ( objName = objectAtPosition( event->pos() ) ) != -1 )
+    handle = objectAtPosition( event->pos() );
+    if( ( obj = object( handle ) ) != NULL )
     {
-        DrawableIterator it  = m_Objects.begin();
-        DrawableIterator end = m_Objects.end();
+        m_ChosenObject = handle;
+        emit objectChosen( handle );
 
-        IDrawable   *obj;
-        while( it != end )
-        {
-            obj = *it;
-            if( obj->getName() == objName )
-            {
-                m_pChosenObject = obj;
-
-                emit objectRGB( obj->getColor().x, obj->getColor().y,
-                                              obj->getColor().z );
-                if( obj->isMovable() )
-                    m_ObjectDragOngoing = true;
-
-                emit locationChanged( obj->getPosition().x,
-                                      obj->getPosition().y,
-                                      obj->getPosition().z );
-                setFocus();
-                break;
-            }
-            ++it;
-        }
+        emit objectRGB( obj->getColor().x, obj->getColor().y,
+                                      obj->getColor().z );
+        if( obj->isMovable() )
+            m_ObjectDragOngoing = true;
+
+        emit locationChanged( obj->getPosition().x,
+                              obj->getPosition().y,
+                              obj->getPosition().z );
     }
 
     setFocus();
@@ -309,15 +403,15 @@ void Renderer::mouseReleaseEvent( QMouseEvent * )
  * -------------------------------------------------------------------------- */
 void Renderer::mouseMoveEvent( QMouseEvent *event )
 {
-    GLint       nearClippingPlane = 4, objDist;
     GLfloat     rotX, rotY, posX, posY, posZ;
-    GLfloat     whRatio, alpha, theta;
+    GLfloat     whRatio, alpha, theta, objDist;
     GLfloat     objPlaneWidth, objPlaneHeight;
     GLfloat     dx = GLfloat( event->x() - m_MouseLastPos.x() ) / width();
     GLfloat     dy = GLfloat( event->y() - m_MouseLastPos.y() ) / height();
+    IDrawable   *pChosen = object( m_ChosenObject );
 
     /* Do nothing if no object has been chosen yet. */
-    if( m_pChosenObject == NULL )
+    if( pChosen == NULL )
     {
         return;
     }
@@ -344,17 +438,17 @@ void Renderer::mouseMoveEvent( QMouseEvent *event )
             whRatio = ( GLfloat )width() / height();
             /* Alpha and theta are the x- and y-angles of the right triangles
              * of the field of vision. */
-            alpha          = ( GLfloat )atan( whRatio / nearClippingPlane );
-            theta          = ( GLfloat )atan( 1.0 / nearClippingPlane );
-            objDist        = abs( m_pChosenObject->getPosition().z );
+            alpha          = ( GLfloat )atan( whRatio / NEAR_PLANE );
+            theta          = ( GLfloat )atan( 1.0 / NEAR_PLANE );
+            objDist        = ( GLfloat )fabs( pChosen->getPosition().z );
             objPlaneWidth  = 2.0 * objDist * tan( alpha );
             objPlaneHeight = 2.0 * objDist * tan( theta );
 
-            posX = m_pChosenObject->getPosition().x + objPlaneWidth  * dx;
-            posY = m_pChosenObject->getPosition().y - objPlaneHeight * dy;
-            posZ = m_pChosenObject->getPosition().z;
+            posX = pChosen->getPosition().x + objPlaneWidth  * dx;
+            posY = pChosen->getPosition().y - objPlaneHeight * dy;
+            posZ = pChosen->getPosition().z;
 
-            m_pChosenObject->setPosition( posX, posY, posZ );
+            pChosen->setPosition( posX, posY, posZ );
             emit locationChanged( posX, posY, posZ );
             updateGL();
         }
@@ -362,11 +456,11 @@ void Renderer::mouseMoveEvent( QMouseEvent *event )
     /* Rotate object when right button is held. */
     else if( event->buttons() & Qt::RightButton )
     {
-        if( m_pChosenObject->isRotatable() )
+        if( pChosen->isRotatable() )
         {
-            rotX = m_pChosenObject->getRotation().x + 180 * dy;
-            rotY = m_pChosenObject->getRotation().y + 180 * dx;
-            m_pChosenObject->setRotation( rotX, rotY, 0 );
+            rotX = pChosen->getRotation().x + 180 * dy;
+            rotY = pChosen->getRotation().y + 180 * dx;
+            pChosen->setRotation( rotX, rotY, 0 );
             updateGL();
         }
     }
@@ -382,167 +476,239 @@ void Renderer::mouseMoveEvent( QMouseEvent *event )
  * -------------------------------------------------------------------------- */
 void Renderer::keyPressEvent( QKeyEvent *event )
 {
+    IDrawable   *pChosen = object( m_ChosenObject );
+    Robot       *pRobot  = ( Robot* )object( m_Robot );
+
     switch( event->key() )
     {
     case Qt::Key_Right:
-        if( m_pChosenObject != NULL )
-            m_pChosenObject->move( 0.1, 0.0, 0.0 );
+        if( pChosen != NULL )
+            pChosen->move( 0.1, 0.0, 0.0 );
         break;
     case Qt::Key_Left:
-        if( m_pChosenObject != NULL )
-            m_pChosenObject->move( -0.1, 0.0, 0.0 );
+        if( pChosen != NULL )
+            pChosen->move( -0.1, 0.0, 0.0 );
         break;
     case Qt::Key_Up:
-        if( m_pChosenObject != NULL )
-            m_pChosenObject->move( 0.0, 0.1, 0.0 );
+        if( pChosen != NULL )
+            pChosen->move( 0.0, 0.1, 0.0 );
         break;
     case Qt::Key_Down:
-        if( m_pChosenObject != NULL )
-            m_pChosenObject->move( 0.0, -0.1, 0.0 );
+        if( pChosen != NULL )
+            pChosen->move( 0.0, -0.1, 0.0 );
         break;
     case Qt::Key_Period:
-        if( m_pChosenObject != NULL )
-            m_pChosenObject->move( 0.0, 0.0, -0.1 );
+        if( pChosen != NULL )
+            pChosen->move( 0.0, 0.0, -0.1 );
         break;
     case Qt::Key_Comma:
-        if( m_pChosenObject != NULL )
-            m_pChosenObject->move( 0.0, 0.0, 0.1 );
+        if( pChosen != NULL )
+            pChosen->move( 0.0, 0.0, 0.1 );
         break;
     case Qt::Key_M:
-        if( m_pChosenObject != NULL )
-            m_pChosenObject->scale( 0.1, 0.1, 0.1 );
+        if( pChosen != NULL )
+            pChosen->scale( 0.1, 0.1, 0.1 );
         break;
     case Qt::Key_N:
-        if( m_pChosenObject != NULL )
-            m_pChosenObject->scale( -0.1, -0.1, -0.1 );
+        if( pChosen != NULL )
+            pChosen->scale( -0.1, -0.1, -0.1 );
         break;
     case Qt::Key_W:
-        if( m_pRobot != NULL )
+        if( pRobot != NULL )
         {
-            ( ( Robot* )m_pRobot )->move( Robot::FORWARD );
+            pRobot->move( Robot::FORWARD );
             break;
         }
     case Qt::Key_A:
-        if( m_pRobot != NULL )
+        if( pRobot != NULL )
         {
-            ( ( Robot* )m_pRobot )->move( Robot::TURN_LEFT );
+            pRobot->move( Robot::TURN_LEFT );
             break;
         }
     case Qt::Key_S:
-        if( m_pRobot != NULL )
+        if( pRobot != NULL )
         {
-            ( ( Robot* )m_pRobot )->move( Robot::BACKWARD );
+            pRobot->move( Robot::BACKWARD );
         }
         break;
     case Qt::Key_D:
-        if( m_pRobot != NULL )
+        if( pRobot != NULL )
         {
-            ( ( Robot* )m_pRobot )->move( Robot::TURN_RIGHT );
+            pRobot->move( Robot::TURN_RIGHT );
         }
         break;
     case Qt::Key_E:
-        if( m_pRobot != NULL )
+        if( pRobot != NULL )
         {
-            ( ( Robot* )m_pRobot )->move( Robot::TURN_HEAD_RIGHT );
+            pRobot->move( Robot::TURN_HEAD_RIGHT );
         }
         break;
     case Qt::Key_Q:
-        if( m_pRobot != NULL )
+        if( pRobot != NULL )
         {
-            ( ( Robot* )m_pRobot )->move( Robot::TURN_HEAD_LEFT );
+            pRobot->move( Robot::TURN_HEAD_LEFT );
         }
         break;
     }
-    if( m_pChosenObject != NULL )
-        emit locationChanged( m_pChosenObject->getPosition() );
+    if( pChosen != NULL )
+        emit locationChanged( pChosen->getPosition() );
     updateGL();
 }
 
 /* --------------------------------------------------------------------------
  *  2.1.12. draw
+ *          updateScene
  *
- *  Iterate through the list of drawable objects and draw each of them. Before
- *  an object is drawn, it is assosiated with a name to enable mouse hit
- *  detection.
+ *  Refresh the objects changed since the last frame, query the tree for the
+ *  objects inside the view frustum and submit them to the render queue,
+ *  which is then sorted by render state and drawn. Objects that only
+ *  intersect the frustum are tested once more with their exact bounds, as
+ *  the leaves of the tree are slightly enlarged.
+ *
+ *  The query only marks the objects visible. The scene store is then walked
+ *  from start to end, one type batch after another, so the bounds and
+ *  render items are read in order and without calls to the objects. The
+ *  items are pointed at the mesh matrix and color in the store for the
+ *  queue to draw with. Items with levels of detail or clusters are left to
+ *  submitMesh().
  * -------------------------------------------------------------------------- */
 void Renderer::draw()
 {
-    DrawableIterator it  = m_Objects.begin();
-    DrawableIterator end = m_Objects.end();
-    int i = 0;
-    /* Pointer to an IDrawable, makes the code a bit more easier to read. */
-    IDrawable *obj;
+    SceneStore  &scene = *m_pScene;
 
-    while( it != end )
-    {
-        obj = (*it);
+    updateScene();
 
-        if( obj->isMovable() || obj->isRotatable() )
+    m_Visible.clear();
+    m_pTree->query( m_Frustum, m_Visible );
+    for( size_t i = 0; i < m_Visible.size(); i++ )
+        scene.flags( scene.indexOf( m_Visible[ i ] ) ) |= SceneStore::VISIBLE;
+
+    m_RenderQueue.clear();
+    int submitted = 0;
+    int culledClusters = 0;
+    for( int type = 0; type < IDrawable::TYPE_COUNT; type++ )
+    {
+        for( int i = scene.batchBegin( type ); i < scene.batchEnd( type ); i++ )
         {
-            glLoadName( i );
-            obj->setName( i++ );
+            GLuint &flags = scene.flags( i );
+            if( !( flags & SceneStore::VISIBLE ) )
+                continue;
+
+            flags &= ~SceneStore::VISIBLE;
+            if( !m_Frustum.isVisible( scene.bounds( i ) ) )
+                continue;
+
+            RenderItem item = scene.renderItem( i );
+            item.pMeshMatrix = &scene.meshMatrix( i );
+            item.pColor = &scene.color( i );
+            if( item.pLods || ( item.pMesh && !item.pMesh->clusters.empty() ) )
+            {
+                if( !submitMesh( i, item, culledClusters ) )
+                    continue;
+            }
+            else
+                m_RenderQueue.submit( item );
+            ++submitted;
         }
+    }
+
+    m_RenderQueue.sort();
+    m_RenderQueue.execute();
+
+    m_FrameStats = m_RenderQueue.stats();
+    m_FrameStats.culled = scene.size() - submitted;
+    m_FrameStats.culledClusters = culledClusters;
+}
 
-        obj->draw();
-        ++it;
+void Renderer::updateScene()
+{
+    for( size_t i = 0; i < m_DirtyObjects.size(); i++ )
+    {
+        int index = m_pScene->indexOf( m_DirtyObjects[ i ] );
+        if( index < 0 )
+            continue;
+
+        m_pScene->refresh( index );
+        m_pTree->moveProxy( m_pScene->proxy( index ),
+                            m_pScene->bounds( index ) );
     }
+    m_DirtyObjects.clear();
 }
 
 /* --------------------------------------------------------------------------
  *  2.1.13. objectAtPosition
+ *          rayCastAtPosition
+ *
+ *  objectAtPosition reads the object from the ID buffer, which is only
+ *  redrawn if the scene has changed since the last pick, so repeated picks
+ *  cost a memory read each.
  *
- *  Checks if a drawn object is under given position and returns that object's
- *  name. Used for selecting objects with the mouse.
+ *  rayCastAtPosition casts a ray from the camera through the centre of the
+ *  pixel at given position. Candidates are found from the tree with the
+ *  ray, and each pickable candidate is asked for its exact hit, keeping the
+ *  nearest one. Nothing is drawn, so picking does not depend on the GL
+ *  implementation.
  *
- * References: Pages 606-615 in 'OpenGL Programming guide' ( 7th Edition )
- *             Page 202 in 'C++ GUI programming with Qt4' ( 1st Edition )
+ *  The ray is built from m_Projection alone: without a camera
+ *  transformation the eye is at the origin, and a point ( x, y ) in
+ *  normalized device coordinates is on the ray
+ *      ( ( x + m[ 8 ] ) / m[ 0 ], ( y + m[ 9 ] ) / m[ 5 ], -1 ) * t.
+ *  t is then the distance along the view direction, so the far plane is at
+ *  t = m[ 14 ] / ( m[ 10 ] + 1 ).
  * -------------------------------------------------------------------------- */
-int Renderer::objectAtPosition( const QPoint &pos )
+ObjectHandle Renderer::objectAtPosition( const QPoint &pos, GLfloat *distance )
 {
-    /* Data stuctures. */
-    const int   maxSize = 512;
-    GLuint      hitRecords[ maxSize ];
-    GLint       viewport[4];
-    GLfloat     whRatio;
+    if( m_PickMode == PICK_RAY_CAST || distance != NULL || !updateIdBuffer() )
+        return rayCastAtPosition( pos, distance );
 
-    /* Get viewport boundaries. */
-    glGetIntegerv( GL_VIEWPORT, viewport );
+    int x = pos.x(), y = height() - 1 - pos.y();
+    if( x < 0 || x >= width() || y < 0 || y >= height() )
+        return NULL_HANDLE;
 
-    /* Set array to be used for the returned hit records. */
-    glSelectBuffer( maxSize, hitRecords );
+    const GLubyte *pixel = &m_IdPixels[ ( y * width() + x ) * 4 ];
+    GLuint id = pixel[ 0 ] | pixel[ 1 ] << 8 | pixel[ 2 ] << 16;
 
-    /* Enter selection mode. */
-    glRenderMode( GL_SELECT );
+    if( id == 0 || id > m_IdObjects.size() )
+        return NULL_HANDLE;
+    return m_IdObjects[ id - 1 ];
+}
 
-    /* Initialize the name stack. */
-    glInitNames();
-    glPushName(0);
+ObjectHandle Renderer::rayCastAtPosition( const QPoint &pos, GLfloat *distance )
+{
+    const GLfloat *m = m_Projection.m;
 
-    /* Save current projection matrix. */
-    glMatrixMode( GL_PROJECTION );
-    glPushMatrix();
+    if( width() <= 0 || height() <= 0 || m[ 0 ] == 0 || m[ 5 ] == 0 )
+        return NULL_HANDLE;
 
-    /* Restrict drawing to a small region of the viewport. */
-    glLoadIdentity();
-    gluPickMatrix( ( GLdouble )pos.x(), ( GLdouble )( viewport[3] - pos.y() ),
-                   5, 5, viewport );
-    /* Standard projection matrix. */
-    whRatio = GLfloat( width() ) / height();
-    glFrustum( -whRatio, whRatio, -1.0, 1.0, 4.0, 20.0 );
+    GLfloat ndcX = 2.0f * ( pos.x() + 0.5f ) / width() - 1.0f;
+    GLfloat ndcY = 1.0f - 2.0f * ( pos.y() + 0.5f ) / height();
+    Vector3f origin( 0, 0, 0 );
+    Vector3f direction( ( ndcX + m[ 8 ] ) / m[ 0 ],
+                        ( ndcY + m[ 9 ] ) / m[ 5 ], -1 );
+    GLfloat  farDistance = m[ 14 ] / ( m[ 10 ] + 1 );
 
-    /* Draw scene for picking. */
-    draw();
+    std::vector< ObjectHandle > candidates;
+    m_pTree->queryRay( origin, direction, farDistance, candidates );
 
-    /* Restore saved projection matrix. */
-    glMatrixMode( GL_PROJECTION );
-    glPopMatrix();
+    ObjectHandle    nearest = NULL_HANDLE;
+    GLfloat         nearestDistance = farDistance;
 
-    /* Return -1 if selection array overflowed. */
-    if( !glRenderMode( GL_RENDER ) )
-        return -1;
+    for( size_t i = 0; i < candidates.size(); i++ )
+    {
+        int index = m_pScene->indexOf( candidates[ i ] );
+        if( !( m_pScene->flags( index ) &
+               ( SceneStore::MOVABLE | SceneStore::ROTATABLE ) ) )
+            continue;
+
+        /* Only replaces nearestDistance with a closer hit. */
+        if( m_pScene->object( index )->intersectRay( origin, direction,
+                                                     nearestDistance ) )
+            nearest = candidates[ i ];
+    }
 
-    /* Return the first name from the records. */
-    return hitRecords[3];
+    if( nearest != NULL_HANDLE && distance != NULL )
+        *distance = nearestDistance;
+    return nearest;
 }
 
 /* --------------------------------------------------------------------------
@@ -552,9 +718,11 @@ int Renderer::objectAtPosition( const QPoint &pos )
  * -------------------------------------------------------------------------- */
 void Renderer::changeObjectColor( int r, int g, int b )
 {
-    if( m_pChosenObject != NULL )
+    IDrawable *pChosen = object( m_ChosenObject );
+
+    if( pChosen != NULL )
     {
-        m_pChosenObject->setColor( r, g ,b );
+        pChosen->setColor( r, g ,b );
         updateGL();
     }
 }
@@ -566,13 +734,280 @@ void Renderer::changeObjectColor( int r, int g, int b )
  * -------------------------------------------------------------------------- */
 void Renderer::changeObjectPosition( float x, float y, float z )
 {
-    if( m_pChosenObject != NULL )
+    IDrawable *pChosen = object( m_ChosenObject );
+
+    if( pChosen != NULL )
     {
-        m_pChosenObject->setPosition( (GLfloat)x, (GLfloat)y ,(GLfloat)z );
+        pChosen->setPosition( (GLfloat)x, (GLfloat)y ,(GLfloat)z );
         updateGL();
     }
 }
 
+/* --------------------------------------------------------------------------
+ *  2.1.16. transformChanged
+ *          stateChanged
+ *
+ *  Marks the object to be refreshed in the scene store and its leaf in the
+ *  tree to be updated before the next frame, and the ID buffer to be
+ *  redrawn before the next pick.
+ * -------------------------------------------------------------------------- */
+void Renderer::transformChanged( IDrawable *object )
+{
+    int index = m_pScene->indexOf( object->getHandle() );
+    if( index >= 0 && !( m_pScene->flags( index ) & SceneStore::DIRTY ) )
+    {
+        m_pScene->flags( index ) |= SceneStore::DIRTY;
+        m_DirtyObjects.push_back( object->getHandle() );
+    }
+    m_SceneVersion++;
+}
+
+void Renderer::stateChanged( IDrawable *object )
+{
+    transformChanged( object );
+}
+
+/* --------------------------------------------------------------------------
+ *  2.1.17. updateIdBuffer
+ *
+ *  Draws the pickable objects inside the view frustum into the ID buffer
+ *  and copies its pixels to m_IdPixels. The IDs are 24-bit indices stored
+ *  in RGB8, which is exact and works with any implementation, including
+ *  software ones.
+ *
+ *  As drawables may set their own colors, textures and lighting in draw(),
+ *  the ID color is applied with fog: with GL_EXP fog of a huge density the
+ *  fog factor is zero for everything in front of the near plane, so every
+ *  fragment gets the fog color whatever the drawable did.
+ * -------------------------------------------------------------------------- */
+bool Renderer::updateIdBuffer()
+{
+    if( m_pIdBuffer != NULL && m_IdBufferVersion == m_SceneVersion &&
+        m_pIdBuffer->size() == size() )
+        return true;
+
+    if( width() <= 0 || height() <= 0 )
+        return false;
+
+    makeCurrent();
+    if( !QGLFramebufferObject::hasOpenGLFramebufferObjects() )
+        return false;
+
+    if( m_pIdBuffer == NULL || m_pIdBuffer->size() != size() )
+    {
+        delete m_pIdBuffer;
+        m_pIdBuffer = new QGLFramebufferObject( size(),
+                                                QGLFramebufferObject::Depth );
+        if( !m_pIdBuffer->isValid() )
+        {
+            delete m_pIdBuffer;
+            m_pIdBuffer = NULL;
+            m_PickMode = PICK_RAY_CAST;
+            return false;
+        }
+    }
+
+    /* Changed objects are refreshed here too, if no frame has been drawn
+     * since. */
+    updateScene();
+
+    m_Visible.clear();
+    m_pTree->query( m_Frustum, m_Visible );
+
+    StateManager *state = StateManager::getInstance();
+    GLfloat       black[] = { 0, 0, 0, 0 };
+
+    m_pIdBuffer->bind();
+    glPushAttrib( GL_COLOR_BUFFER_BIT | GL_FOG_BIT );
+    glDisable( GL_DITHER );
+    glClearColor( 0, 0, 0, 0 );
+    glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
+
+    state->disable( GL_LIGHTING );
+    state->disable( GL_TEXTURE_2D );
+    glEnable( GL_FOG );
+    glFogi( GL_FOG_MODE, GL_EXP );
+    glFogf( GL_FOG_DENSITY, 1.0e6f );
+    glFogfv( GL_FOG_COLOR, black );
+
+    m_IdObjects.clear();
+    for( size_t i = 0; i < m_Visible.size(); i++ )
+    {
+        int index = m_pScene->indexOf( m_Visible[ i ] );
+        if( !( m_pScene->flags( index ) &
+               ( SceneStore::MOVABLE | SceneStore::ROTATABLE ) ) )
+            continue;
+
+        m_IdObjects.push_back( m_Visible[ i ] );
+        GLuint  id = m_IdObjects.size();
+        GLfloat color[] = { ( id & 0xff ) / 255.0f,
+                            ( id >> 8 & 0xff ) / 255.0f,
+                            ( id >> 16 & 0xff ) / 255.0f, 1 };
+        glFogfv( GL_FOG_COLOR, color );
+        m_pScene->object( index )->draw();
+    }
+
+    m_IdPixels.resize( width() * height() * 4 );
+    glPixelStorei( GL_PACK_ALIGNMENT, 1 );
+    glReadPixels( 0, 0, width(), height(), GL_RGBA, GL_UNSIGNED_BYTE,
+                  &m_IdPixels[ 0 ] );
+
+    glPopAttrib();
+    m_pIdBuffer->release();
+
+    m_IdBufferVersion = m_SceneVersion;
+    return true;
+}
+
+/* --------------------------------------------------------------------------
+ *  2.1.18. assetsLoaded ( SLOT )
+ *
+ *  Creates the textures and uploads the meshes loaded in the background,
+ *  with the context current. The render items of all objects are refreshed
+ *  for new texture ids; objects receiving a mesh refresh their own.
+ * -------------------------------------------------------------------------- */
+void Renderer::assetsLoaded()
+{
+    if( !m_IsInitialized )
+        return;
+
+    makeCurrent();
+    int textures = TextureManager::getInstance()->createLoadedTextures();
+    int meshes   = MeshManager::getInstance()->deliverLoaded();
+
+    if( textures > 0 )
+        for( int i = 0; i < m_pScene->size(); i++ )
+            stateChanged( m_pScene->object( i ) );
+    if( textures > 0 || meshes > 0 )
+        updateGL();
+}
+
+/* --------------------------------------------------------------------------
+ *  2.1.19. selectLod
+ *
+ *  The errors of the levels are scaled by the radius of the bounds and
+ *  projected at the nearest point of the bounding sphere, or at the near
+ *  plane if the sphere reaches past it. The level drawn last is kept while
+ *  its error is within LOD_COARSEN_FACTOR and LOD_REFINE_FACTOR times the
+ *  allowed error, so an object moving about a switching distance does not
+ *  change level every frame.
+ * -------------------------------------------------------------------------- */
+int Renderer::selectLod( const MeshLodChain &lods, const BoundingBox &bounds,
+                         int current ) const
+{
+    Vector3f    center = bounds.center();
+    Vector3f    extents = bounds.extents();
+    GLfloat     radius = sqrt( extents.x * extents.x + extents.y * extents.y +
+                               extents.z * extents.z );
+    GLfloat     distance = sqrt( center.x * center.x + center.y * center.y +
+                                 center.z * center.z ) - radius;
+
+    if( distance < NEAR_PLANE )
+        distance = NEAR_PLANE;
+
+    /* Pixels per unit of relative error. */
+    GLfloat scale = radius * m_PixelsPerUnit / distance;
+    int     lod = std::min( current, lods.count - 1 );
+
+    while( lod > 0 &&
+           lods.errors[ lod ] * scale > LOD_REFINE_FACTOR * m_LodPixelError )
+        lod--;
+    while( lod + 1 < lods.count &&
+           lods.errors[ lod + 1 ] * scale <= LOD_COARSEN_FACTOR * m_LodPixelError )
+        lod++;
+
+    return lod;
+}
+
+/* --------------------------------------------------------------------------
+ *  2.1.20. submitMesh
+ *          cullClusters
+ *
+ *  Clusters are culled only for the meshes of objects that are at least
+ *  partly visible, with the mesh matrix from the scene store. An item whose
+ *  clusters are all visible is submitted without ranges, so it can still
+ *  be drawn as an instance.
+ *
+ *  The frustum planes and the camera are taken into the space of the mesh,
+ *  where the clusters are stored. A cluster faces away from the camera if
+ *  the direction from the camera to any point of its sphere is within
+ *  90 degrees less the cone angle of the cone axis. The test is the
+ *  conservative form of that with the sphere centre, radius and the sine
+ *  of the cone angle. Clusters next to each other in the index list are
+ *  drawn as one range.
+ * -------------------------------------------------------------------------- */
+bool Renderer::submitMesh( int index, RenderItem item, int &culledClusters )
+{
+    SceneStore  &scene = *m_pScene;
+
+    if( item.pLods )
+    {
+        int &lod = scene.lod( index );
+        lod = selectLod( *item.pLods, scene.bounds( index ), lod );
+        item.pMesh = item.pLods->levels[ lod ];
+    }
+
+    const std::vector< MeshCluster > &clusters = item.pMesh->clusters;
+    if( clusters.empty() )
+    {
+        m_RenderQueue.submit( item );
+        return true;
+    }
+
+    int culled = cullClusters( *item.pMesh, *item.pMeshMatrix );
+    culledClusters += culled;
+    if( culled == ( int )clusters.size() )
+        return false;
+
+    if( culled == 0 )
+        m_RenderQueue.submit( item );
+    else
+        m_RenderQueue.submit( item, &m_ClusterRanges[ 0 ],
+                              m_ClusterRanges.size() );
+    return true;
+}
+
+int Renderer::cullClusters( const CachedMesh &mesh, const Matrix4f &meshMatrix )
+{
+    Frustum     frustum;
+    Vector3f    eye = meshMatrix.affineInverse().transformPoint(
+                          Vector3f( 0, 0, 0 ) );
+    int         culled = 0;
+
+    frustum.extract( m_Projection * meshMatrix );
+    m_ClusterRanges.clear();
+
+    for( size_t i = 0; i < mesh.clusters.size(); i++ )
+    {
+        const MeshCluster &cluster = mesh.clusters[ i ];
+        GLfloat dx = cluster.center[ 0 ] - eye.x;
+        GLfloat dy = cluster.center[ 1 ] - eye.y;
+        GLfloat dz = cluster.center[ 2 ] - eye.z;
+        GLfloat distance = sqrt( dx * dx + dy * dy + dz * dz );
+        GLfloat along = dx * cluster.coneAxis[ 0 ] + dy * cluster.coneAxis[ 1 ] +
+                        dz * cluster.coneAxis[ 2 ];
+
+        if( along >= distance * cluster.coneSin +
+                     cluster.radius * ( 1 + cluster.coneSin ) ||
+            !frustum.isVisible( BoundingSphere(
+                Vector3f( cluster.center[ 0 ], cluster.center[ 1 ],
+                          cluster.center[ 2 ] ), cluster.radius ) ) )
+        {
+            culled++;
+            continue;
+        }
+
+        if( !m_ClusterRanges.empty() &&
+            m_ClusterRanges.back().first + m_ClusterRanges.back().count ==
+            cluster.firstIndex )
+            m_ClusterRanges.back().count += cluster.indexCount;
+        else
+            m_ClusterRanges.push_back( IndexRange( cluster.firstIndex,
+                                                   cluster.indexCount ) );
+    }
+    return culled;
+}
+
 /* --------------------------------------------------------------------------
  *  2.2. MaterialManager
  *
@@ -582,11 +1017,15 @@ void Renderer::changeObjectPosition( float x, float y, float z )
 /* Static member */
 MaterialManager *MaterialManager::m_pInstance = NULL;
 
+/* Guards the creation of the instance, which may be asked for by loader
+ * threads. */
+static QMutex materialInstanceMutex;
+
 /* --------------------------------------------------------------------------
  *  2.2.1. MaterialManager ( ctor, copy-ctor, assignment op. & dtor )
  *
  * -------------------------------------------------------------------------- */
-MaterialManager::MaterialManager() {}
+MaterialManager::MaterialManager() : m_NextMaterialId( 1 ) {}
 MaterialManager::MaterialManager( const MaterialManager & ) {}
 MaterialManager &MaterialManager::operator=( const MaterialManager & ) {}
 
@@ -600,6 +1039,7 @@ MaterialManager::~MaterialManager()
  * -------------------------------------------------------------------------- */
 MaterialManager *MaterialManager::getInstance()
 {
+    QMutexLocker locker( &materialInstanceMutex );
     if( !m_pInstance )
     {
         m_pInstance = new MaterialManager();
@@ -614,7 +1054,10 @@ MaterialManager *MaterialManager::getInstance()
  * -------------------------------------------------------------------------- */
 void MaterialManager::addMaterial( const char *name, const MaterialData &data )
 {
+    QMutexLocker locker( &m_Mutex );
     m_Materials.insert( MaterialPair( std::string( name ), data ) );
+    if( m_MaterialIds.find( std::string( name ) ) == m_MaterialIds.end() )
+        m_MaterialIds[ std::string( name ) ] = m_NextMaterialId++;
 }
 
 /* --------------------------------------------------------------------------
@@ -624,12 +1067,14 @@ void MaterialManager::addMaterial( const char *name, const MaterialData &data )
  * -------------------------------------------------------------------------- */
 void MaterialManager::removeMaterial( const char *name )
 {
-    m_Materials.erase( std::string( name ) );
+    removeMaterial( std::string( name ) );
 }
 
 void MaterialManager::removeMaterial( const std::string &name )
 {
+    QMutexLocker locker( &m_Mutex );
     m_Materials.erase( name );
+    m_MaterialIds.erase( name );
 }
 
 /* --------------------------------------------------------------------------
@@ -639,11 +1084,9 @@ void MaterialManager::removeMaterial( const std::string &name )
  * -------------------------------------------------------------------------- */
 void MaterialManager::clearAllMaterials()
 {
-    while( !m_Materials.empty() )
-    {
-        MaterialIterator it = m_Materials.begin();
-        removeMaterial( (*it).first );
-    }
+    QMutexLocker locker( &m_Mutex );
+    m_Materials.clear();
+    m_MaterialIds.clear();
 }
 
 /* --------------------------------------------------------------------------
@@ -655,6 +1098,7 @@ void MaterialManager::clearAllMaterials()
 void MaterialManager::setValue( const char *matName, MaterialAttribute attr,
                                 const Color4f &color )
 {
+    QMutexLocker locker( &m_Mutex );
     MaterialIterator it;
     it = m_Materials.find( std::string( matName ) );
     if( it != m_Materials.end() )
@@ -685,8 +1129,9 @@ void MaterialManager::setValue( const char *matName, MaterialAttribute attr,
  *  Returns a material data from the material map.
  *  Data returned is specified by material name.
  * -------------------------------------------------------------------------- */
-const MaterialData &MaterialManager::getMaterial( const char * name )
+MaterialData MaterialManager::getMaterial( const char * name )
 {
+    QMutexLocker locker( &m_Mutex );
     MaterialData dummy;
     MaterialIterator it = m_Materials.find(std::string( name ) );
     if( it != m_Materials.end() )
@@ -696,6 +1141,25 @@ const MaterialData &MaterialManager::getMaterial( const char * name )
     return dummy;
 }
 
+/* --------------------------------------------------------------------------
+ *  2.2.8. getMaterialId
+ *
+ *  Returns the id of a material. Ids are given in the order the materials
+ *  are added and are not reused, so materials can be told apart by their
+ *  id ( e.g. when sorting render items ).
+ * -------------------------------------------------------------------------- */
+GLuint MaterialManager::getMaterialId( const char *name )
+{
+    QMutexLocker locker( &m_Mutex );
+    std::map< std::string, GLuint >::iterator it;
+    it = m_MaterialIds.find( std::string( name ) );
+    if( it != m_MaterialIds.end() )
+    {
+        return (*it).second;
+    }
+    return 0;
+}
+
 
 /* --------------------------------------------------------------------------
  *  2.3. TextureManager
@@ -706,11 +1170,31 @@ const MaterialData &MaterialManager::getMaterial( const char * name )
 /* Static member */
 TextureManager *TextureManager::m_pInstance = NULL;
 
+/* --------------------------------------------------------------------------
+ *  TextureLoadTask
+ *
+ *  Decodes one image for loadTexture.
+ * -------------------------------------------------------------------------- */
+class TextureLoadTask : public QRunnable
+{
+public:
+    TextureLoadTask( TextureManager *manager, const char *name,
+                     const char *filename ) :
+        m_pManager( manager ), m_Name( name ), m_FileName( filename ) {}
+
+    void run() { m_pManager->imageDecoded( m_Name, QImage( m_FileName ) ); }
+
+private:
+    TextureManager  *m_pManager;
+    QString         m_Name;
+    QString         m_FileName;
+};
+
 /* --------------------------------------------------------------------------
  *  2.3.1. TextureManager ( ctor, copy-ctor, assignment op. & dtor )
  *
  * -------------------------------------------------------------------------- */
-TextureManager::TextureManager() {}
+TextureManager::TextureManager() : m_pRenderer( NULL ) {}
 TextureManager::TextureManager( const TextureManager & ) {}
 TextureManager &TextureManager::operator=( const TextureManager & ) {}
 
@@ -731,7 +1215,11 @@ TextureManager *TextureManager::getInstance()
 
 GLuint TextureManager::bindTexture( const QPixmap &pixmap )
 {
-    return m_pRenderer->bindTexture( pixmap, GL_TEXTURE_2D );
+    GLuint id = m_pRenderer->bindTexture( pixmap, GL_TEXTURE_2D );
+
+    /* Qt binds the texture directly. */
+    StateManager::getInstance()->invalidate();
+    return id;
 }
 
 GLuint TextureManager::createTexture( const char *name, const QImage &image )
@@ -740,11 +1228,12 @@ GLuint TextureManager::createTexture( const char *name, const QImage &image )
 
     assert( !image.isNull() );
 
-    glEnable( GL_TEXTURE_2D );
+    StateManager *state = StateManager::getInstance();
+    state->enable( GL_TEXTURE_2D );
     glGenTextures( 1, &textureId );
 
     /* Create a new texture object and assign the id to it. */
-    glBindTexture( GL_TEXTURE_2D, textureId );
+    state->bindTexture( textureId );
 
     /* Assign filters. */
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
@@ -761,9 +1250,11 @@ GLuint TextureManager::createTexture( const char *name, const QImage &image )
     tex.height    = image.height();
     tex.width     = image.width();
 
-    m_Textures.insert( std::pair< QString, Texture >( QString( name ), tex ) );
+    /* The name may have been looked up, with id 0, before the texture was
+     * created. */
+    m_Textures[ QString( name ) ] = tex;
 
-    glDisable( GL_TEXTURE_2D );
+    state->disable( GL_TEXTURE_2D );
     return textureId;
 }
 
@@ -772,4 +1263,339 @@ const Texture *TextureManager::getTexturePtr( const QString &texName )
     return &m_Textures[ texName ];
 }
 
+/* --------------------------------------------------------------------------
+ *  2.3.3. loadTexture, imageDecoded & createLoadedTextures
+ *
+ *  QImage can be used outside the GUI thread, the texture is created
+ *  with the context on the GL thread.
+ * -------------------------------------------------------------------------- */
+void TextureManager::loadTexture( const char *name, const char *filename )
+{
+    QThreadPool::globalInstance()->start(
+        new TextureLoadTask( this, name, filename ) );
+}
+
+void TextureManager::imageDecoded( const QString &name, const QImage &image )
+{
+    QMutexLocker locker( &m_DecodedMutex );
+    m_Decoded.push_back( std::make_pair( name, image ) );
+    if( m_pRenderer )
+        QMetaObject::invokeMethod( m_pRenderer, "assetsLoaded",
+                                   Qt::QueuedConnection );
+}
+
+int TextureManager::createLoadedTextures()
+{
+    ImageList decoded;
+    {
+        QMutexLocker locker( &m_DecodedMutex );
+        decoded.swap( m_Decoded );
+    }
+
+    for( size_t i = 0; i < decoded.size(); i++ )
+        createTexture( decoded[ i ].first.toLocal8Bit().constData(),
+                       decoded[ i ].second );
+    return decoded.size();
+}
+
+void TextureManager::setRenderer( Renderer *pRenderer )
+{
+    QMutexLocker locker( &m_DecodedMutex );
+    m_pRenderer = pRenderer;
+}
+
+/* --------------------------------------------------------------------------
+ *  2.4. Matrix4f
+ *
+ *  See renderer.h for more details about this structure. Element ( row,
+ *  column ) is stored in m[ column * 4 + row ].
+ * -------------------------------------------------------------------------- */
+Matrix4f::Matrix4f()
+{
+    for( int i = 0; i < 16; i++ )
+        m[ i ] = ( i % 5 == 0 ) ? 1.0f : 0.0f;
+}
+
+Matrix4f Matrix4f::translation( GLfloat x, GLfloat y, GLfloat z )
+{
+    Matrix4f r;
+    r.m[ 12 ] = x;
+    r.m[ 13 ] = y;
+    r.m[ 14 ] = z;
+    return r;
+}
+
+Matrix4f Matrix4f::rotation( GLfloat angle, GLfloat x, GLfloat y, GLfloat z )
+{
+    Matrix4f    r;
+    GLfloat     length = sqrt( x * x + y * y + z * z );
+    GLfloat     radians = angle * M_PI / 180.0;
+    GLfloat     c = cos( radians ), s = sin( radians ), t = 1 - c;
+
+    if( length == 0 || angle == 0 )
+        return r;
+    x /= length;
+    y /= length;
+    z /= length;
+
+    r.m[ 0 ] = x * x * t + c;
+    r.m[ 1 ] = y * x * t + z * s;
+    r.m[ 2 ] = x * z * t - y * s;
+    r.m[ 4 ] = x * y * t - z * s;
+    r.m[ 5 ] = y * y * t + c;
+    r.m[ 6 ] = y * z * t + x * s;
+    r.m[ 8 ] = x * z * t + y * s;
+    r.m[ 9 ] = y * z * t - x * s;
+    r.m[ 10 ] = z * z * t + c;
+    return r;
+}
+
+Matrix4f Matrix4f::rotationXYZ( GLfloat x, GLfloat y, GLfloat z )
+{
+    Matrix4f    r;
+    GLfloat     toRadians = M_PI / 180.0;
+    GLfloat     cx = cos( x * toRadians ), sx = sin( x * toRadians );
+    GLfloat     cy = cos( y * toRadians ), sy = sin( y * toRadians );
+    GLfloat     cz = cos( z * toRadians ), sz = sin( z * toRadians );
+
+    r.m[ 0 ]  = cy * cz;
+    r.m[ 1 ]  = cx * sz + sx * sy * cz;
+    r.m[ 2 ]  = sx * sz - cx * sy * cz;
+    r.m[ 4 ]  = -cy * sz;
+    r.m[ 5 ]  = cx * cz - sx * sy * sz;
+    r.m[ 6 ]  = sx * cz + cx * sy * sz;
+    r.m[ 8 ]  = sy;
+    r.m[ 9 ]  = -sx * cy;
+    r.m[ 10 ] = cx * cy;
+    return r;
+}
+
+Matrix4f Matrix4f::scaling( GLfloat x, GLfloat y, GLfloat z )
+{
+    Matrix4f r;
+    r.m[ 0 ] = x;
+    r.m[ 5 ] = y;
+    r.m[ 10 ] = z;
+    return r;
+}
+
+Matrix4f Matrix4f::frustum( GLfloat left, GLfloat right, GLfloat bottom,
+                            GLfloat top, GLfloat zNear, GLfloat zFar )
+{
+    Matrix4f r;
+    r.m[ 0 ]  = 2 * zNear / ( right - left );
+    r.m[ 5 ]  = 2 * zNear / ( top - bottom );
+    r.m[ 8 ]  = ( right + left ) / ( right - left );
+    r.m[ 9 ]  = ( top + bottom ) / ( top - bottom );
+    r.m[ 10 ] = -( zFar + zNear ) / ( zFar - zNear );
+    r.m[ 11 ] = -1;
+    r.m[ 14 ] = -2 * zFar * zNear / ( zFar - zNear );
+    r.m[ 15 ] = 0;
+    return r;
+}
+
+/* With SSE each column of the result is the columns of this matrix
+ * weighted by a column of the other one, four rows at a time. */
+Matrix4f Matrix4f::operator*( const Matrix4f &other ) const
+{
+    Matrix4f r;
+#ifdef __SSE__
+    __m128 c0 = _mm_loadu_ps( m );
+    __m128 c1 = _mm_loadu_ps( m + 4 );
+    __m128 c2 = _mm_loadu_ps( m + 8 );
+    __m128 c3 = _mm_loadu_ps( m + 12 );
+
+    for( int col = 0; col < 4; col++ )
+    {
+        const GLfloat *o = other.m + col * 4;
+        __m128 a = _mm_add_ps( _mm_mul_ps( c0, _mm_set1_ps( o[ 0 ] ) ),
+                               _mm_mul_ps( c1, _mm_set1_ps( o[ 1 ] ) ) );
+        __m128 b = _mm_add_ps( _mm_mul_ps( c2, _mm_set1_ps( o[ 2 ] ) ),
+                               _mm_mul_ps( c3, _mm_set1_ps( o[ 3 ] ) ) );
+        _mm_storeu_ps( r.m + col * 4, _mm_add_ps( a, b ) );
+    }
+#else
+    for( int col = 0; col < 4; col++ )
+        for( int row = 0; row < 4; row++ )
+            r.m[ col * 4 + row ] = m[ row ]      * other.m[ col * 4 ] +
+                                   m[ 4 + row ]  * other.m[ col * 4 + 1 ] +
+                                   m[ 8 + row ]  * other.m[ col * 4 + 2 ] +
+                                   m[ 12 + row ] * other.m[ col * 4 + 3 ];
+#endif
+    return r;
+}
+
+Vector3f Matrix4f::transformPoint( const Vector3f &p ) const
+{
+    return Vector3f( m[ 0 ] * p.x + m[ 4 ] * p.y + m[ 8 ] * p.z + m[ 12 ],
+                     m[ 1 ] * p.x + m[ 5 ] * p.y + m[ 9 ] * p.z + m[ 13 ],
+                     m[ 2 ] * p.x + m[ 6 ] * p.y + m[ 10 ] * p.z + m[ 14 ] );
+}
+
+Vector3f Matrix4f::transformVector( const Vector3f &v ) const
+{
+    return Vector3f( m[ 0 ] * v.x + m[ 4 ] * v.y + m[ 8 ] * v.z,
+                     m[ 1 ] * v.x + m[ 5 ] * v.y + m[ 9 ] * v.z,
+                     m[ 2 ] * v.x + m[ 6 ] * v.y + m[ 10 ] * v.z );
+}
+
+/* The upper 3x3 part is inverted with cofactors, the translation is the
+ * negated original translation transformed by that inverse. */
+Matrix4f Matrix4f::affineInverse() const
+{
+    Matrix4f r;
+    GLfloat  c0 = m[ 5 ] * m[ 10 ] - m[ 6 ] * m[ 9 ];
+    GLfloat  c1 = m[ 6 ] * m[ 8 ]  - m[ 4 ] * m[ 10 ];
+    GLfloat  c2 = m[ 4 ] * m[ 9 ]  - m[ 5 ] * m[ 8 ];
+    GLfloat  det = m[ 0 ] * c0 + m[ 1 ] * c1 + m[ 2 ] * c2;
+
+    if( det == 0 )
+        return r;
+    GLfloat  inv = 1 / det;
+
+    r.m[ 0 ]  = c0 * inv;
+    r.m[ 4 ]  = c1 * inv;
+    r.m[ 8 ]  = c2 * inv;
+    r.m[ 1 ]  = ( m[ 2 ] * m[ 9 ]  - m[ 1 ] * m[ 10 ] ) * inv;
+    r.m[ 5 ]  = ( m[ 0 ] * m[ 10 ] - m[ 2 ] * m[ 8 ] )  * inv;
+    r.m[ 9 ]  = ( m[ 1 ] * m[ 8 ]  - m[ 0 ] * m[ 9 ] )  * inv;
+    r.m[ 2 ]  = ( m[ 1 ] * m[ 6 ]  - m[ 2 ] * m[ 5 ] )  * inv;
+    r.m[ 6 ]  = ( m[ 2 ] * m[ 4 ]  - m[ 0 ] * m[ 6 ] )  * inv;
+    r.m[ 10 ] = ( m[ 0 ] * m[ 5 ]  - m[ 1 ] * m[ 4 ] )  * inv;
+
+    Vector3f t = r.transformVector( Vector3f( m[ 12 ], m[ 13 ], m[ 14 ] ) );
+    r.m[ 12 ] = -t.x;
+    r.m[ 13 ] = -t.y;
+    r.m[ 14 ] = -t.z;
+    return r;
+}
+
+GLfloat Matrix4f::maxScale() const
+{
+    GLfloat scale = 0;
+    for( int col = 0; col < 3; col++ )
+    {
+        const GLfloat *c = &m[ col * 4 ];
+        GLfloat length = c[ 0 ] * c[ 0 ] + c[ 1 ] * c[ 1 ] + c[ 2 ] * c[ 2 ];
+        if( length > scale )
+            scale = length;
+    }
+    return sqrt( scale );
+}
+
+/* --------------------------------------------------------------------------
+ *  2.5. BoundingBox & BoundingSphere
+ *
+ *  See renderer.h for more details about these structures.
+ * -------------------------------------------------------------------------- */
+void BoundingBox::extend( const Vector3f &p )
+{
+    if( p.x < min.x ) min.x = p.x;
+    if( p.y < min.y ) min.y = p.y;
+    if( p.z < min.z ) min.z = p.z;
+    if( p.x > max.x ) max.x = p.x;
+    if( p.y > max.y ) max.y = p.y;
+    if( p.z > max.z ) max.z = p.z;
+}
+
+void BoundingBox::extend( const BoundingBox &box )
+{
+    if( box.min.x < min.x ) min.x = box.min.x;
+    if( box.min.y < min.y ) min.y = box.min.y;
+    if( box.min.z < min.z ) min.z = box.min.z;
+    if( box.max.x > max.x ) max.x = box.max.x;
+    if( box.max.y > max.y ) max.y = box.max.y;
+    if( box.max.z > max.z ) max.z = box.max.z;
+}
+
+bool BoundingBox::contains( const BoundingBox &box ) const
+{
+    return min.x <= box.min.x && min.y <= box.min.y && min.z <= box.min.z &&
+           max.x >= box.max.x && max.y >= box.max.y && max.z >= box.max.z;
+}
+
+Vector3f BoundingBox::center() const
+{
+    return Vector3f( ( min.x + max.x ) / 2, ( min.y + max.y ) / 2,
+                     ( min.z + max.z ) / 2 );
+}
+
+Vector3f BoundingBox::extents() const
+{
+    return Vector3f( ( max.x - min.x ) / 2, ( max.y - min.y ) / 2,
+                     ( max.z - min.z ) / 2 );
+}
+
+GLfloat BoundingBox::surfaceArea() const
+{
+    if( isEmpty() )
+        return 0;
+
+    GLfloat dx = max.x - min.x, dy = max.y - min.y, dz = max.z - min.z;
+    return 2 * ( dx * dy + dy * dz + dz * dx );
+}
+
+/* Slab test: the ray is inside the box between the largest entry and the
+ * smallest exit distance of the three pairs of planes. */
+bool BoundingBox::intersectRay( const Vector3f &origin,
+                                const Vector3f &direction,
+                                GLfloat maxDistance, GLfloat &distance ) const
+{
+    const GLfloat o[ 3 ]    = { origin.x, origin.y, origin.z };
+    const GLfloat d[ 3 ]    = { direction.x, direction.y, direction.z };
+    const GLfloat bmin[ 3 ] = { min.x, min.y, min.z };
+    const GLfloat bmax[ 3 ] = { max.x, max.y, max.z };
+    GLfloat tMin = 0, tMax = maxDistance;
+
+    for( int i = 0; i < 3; i++ )
+    {
+        if( d[ i ] == 0 )
+        {
+            /* Parallel to the slab. */
+            if( o[ i ] < bmin[ i ] || o[ i ] > bmax[ i ] )
+                return false;
+            continue;
+        }
+
+        GLfloat t1 = ( bmin[ i ] - o[ i ] ) / d[ i ];
+        GLfloat t2 = ( bmax[ i ] - o[ i ] ) / d[ i ];
+        if( t1 > t2 ) std::swap( t1, t2 );
+        if( t1 > tMin ) tMin = t1;
+        if( t2 < tMax ) tMax = t2;
+        if( tMin > tMax )
+            return false;
+    }
+
+    distance = tMin;
+    return true;
+}
+
+/* Transforms the centre and sums the absolute matrix elements times the
+ * extents, instead of transforming all eight corners.
+ * Reference: James Arvo, 'Transforming Axis-Aligned Bounding Boxes',
+ *            Graphics Gems ( 1990 ) */
+BoundingBox BoundingBox::transformed( const Matrix4f &matrix ) const
+{
+    if( isEmpty() )
+        return *this;
+
+    const GLfloat   *m = matrix.m;
+    Vector3f        c = matrix.transformPoint( center() );
+    Vector3f        e = extents();
+    Vector3f        r;
+
+    r.x = fabs( m[ 0 ] ) * e.x + fabs( m[ 4 ] ) * e.y + fabs( m[ 8 ] ) * e.z;
+    r.y = fabs( m[ 1 ] ) * e.x + fabs( m[ 5 ] ) * e.y + fabs( m[ 9 ] ) * e.z;
+    r.z = fabs( m[ 2 ] ) * e.x + fabs( m[ 6 ] ) * e.y + fabs( m[ 10 ] ) * e.z;
+
+    return BoundingBox( Vector3f( c.x - r.x, c.y - r.y, c.z - r.z ),
+                        Vector3f( c.x + r.x, c.y + r.y, c.z + r.z ) );
+}
+
+BoundingSphere BoundingSphere::transformed( const Matrix4f &matrix ) const
+{
+    return BoundingSphere( matrix.transformPoint( center ),
+                           radius * matrix.maxScale() );
+}
+
 /* End of renderer.cpp */
@@ -41,11 +41,17 @@
     2. Data structures
         2.1. Vector3f
         2.2. Color4f
-        2.3. ModelData
-        2.4. MaterialData
-        2.5. Texture
+        2.3. MeshVertex
+        2.4. MeshCluster
+        2.5. ModelData
+        2.6. MaterialData
+        2.7. Texture
+        2.8. Matrix4f
+        2.9. BoundingBox
+        2.10. BoundingSphere
     3. Interfaces
         3.1. IDrawable
+        3.2. ITransformListener
     4. Classes
         4.1. Renderer
         4.2. MaterialManager
@@ -60,7 +66,22 @@
 
 #include <QGLWidget>
 #include <QMouseEvent>
-#include <list>
+#include <QImage>
+#include <QMutex>
+#include <float.h>
+#include <map>
+#include <vector>
+#include "renderqueue.h"
+#include "frustum.h"
+#include "slotmap.h"
+
+class AABBTree;
+class SceneStore;
+class ITransformListener;
+class QGLFramebufferObject;
+
+/* Handle of an object attached to a Renderer. */
+typedef SlotHandle ObjectHandle;
 
 
 /* **************************************************************************
@@ -98,26 +119,88 @@ struct Color4f
 };
 
 /* --------------------------------------------------------------------------
- *  2.3. ModelData
+ *  2.3. MeshVertex
+ *
+ *  Interleaved vertex of a welded mesh. The layout matches
+ *  GL_T2F_N3F_V3F, so an array of these can be given to glInterleavedArrays
+ *  or the gl*Pointer functions as is.
+ * -------------------------------------------------------------------------- */
+struct MeshVertex
+{
+    GLfloat     texCoord[ 2 ];
+    GLfloat     normal[ 3 ];
+    GLfloat     position[ 3 ];
+};
+
+/* --------------------------------------------------------------------------
+ *  2.4. MeshCluster
+ *
+ *  A run of consecutive triangles of a welded mesh, using at most
+ *  MAX_VERTICES vertices, with the bounds for culling it as a whole: a
+ *  sphere around its vertices and a cone around its face normals. coneSin
+ *  is the sine of the half angle of the cone, 1 if the cone is too wide
+ *  for the cluster ever to face away from the viewer entirely.
+ * -------------------------------------------------------------------------- */
+struct MeshCluster
+{
+    enum { MAX_VERTICES = 64, MAX_TRIANGLES = 124 };
+
+    GLuint      firstIndex;
+    GLuint      indexCount;
+    GLfloat     center[ 3 ];
+    GLfloat     radius;
+    GLfloat     coneAxis[ 3 ];
+    GLfloat     coneSin;
+};
+
+/* --------------------------------------------------------------------------
+ *  2.5. ModelData
  *
  *  Stores the geometric information ( vertices, normals, texture coords )
  *  about renderable objects.
  * -------------------------------------------------------------------------- */
 struct ModelData
 {
+    /* Texture coordinates are used in two dimensions only. */
+    struct TexCoord
+    {
+        GLfloat s, t;
+    };
+    /* Index count and error of a level of detail, see lodLevels. */
+    struct LodLevel
+    {
+        GLuint  indexCount;
+        GLfloat error;
+    };
+
     std::vector< Vector3f >     vertices;
     std::vector< Vector3f >     normals;
-    std::vector< Vector3f >     textureCoords;
+    std::vector< TexCoord >     textureCoords;
     std::vector< int >          vertexFaces;
     std::vector< int >          normalFaces;
     std::vector< int >          textureFaces;
     bool                        isSmoothShaded;
 
+    /* Welded mesh: one vertex for each unique vertex/texture/normal index
+     * triple of the faces and a single triangle index list into them. */
+    std::vector< MeshVertex >   weldedVertices;
+    std::vector< GLuint >       weldedIndices;
+    /* Clusters of weldedIndices, made by MeshOptimizer::optimize. */
+    std::vector< MeshCluster >  clusters;
+    /* Levels of detail below the welded mesh, made by
+     * MeshSimplifier::buildLods: the triangle lists of all the levels into
+     * weldedVertices, one after another, and the index count and error of
+     * each level. */
+    std::vector< GLuint >       lodIndices;
+    std::vector< LodLevel >     lodLevels;
+
+    ModelData() : isSmoothShaded( false ) {}
+
     //TODO: Method for clearing all vectors
 };
 
 /* --------------------------------------------------------------------------
- *  2.4. MaterialData
+ *  2.6. MaterialData
  *
  * Stores the material information of renderable objects.
  * ( e.g. ambient reflection )
@@ -132,7 +215,7 @@ struct MaterialData
 };
 
 /* --------------------------------------------------------------------------
- *  2.5. Texture
+ *  2.7. Texture
  *
  * Stores Texture information
  * -------------------------------------------------------------------------- */
@@ -143,6 +226,87 @@ struct Texture
     GLuint      height;
 };
 
+/* --------------------------------------------------------------------------
+ *  2.8. Matrix4f
+ *
+ *  4x4 matrix stored in column-major order like OpenGL matrices, so it can
+ *  be given to glLoadMatrixf as is. The factory functions match their
+ *  glTranslatef, glRotatef, glScalef and glFrustum counterparts.
+ * -------------------------------------------------------------------------- */
+struct Matrix4f
+{
+    GLfloat m[ 16 ];
+
+    /* Identity matrix. */
+    Matrix4f();
+
+    static Matrix4f translation( GLfloat x, GLfloat y, GLfloat z );
+    static Matrix4f rotation( GLfloat angle, GLfloat x, GLfloat y, GLfloat z );
+    /* rotation( x, 1, 0, 0 ) * rotation( y, 0, 1, 0 ) * rotation( z, 0, 0, 1 )
+     * with the products worked out, as in glRotatef order. */
+    static Matrix4f rotationXYZ( GLfloat x, GLfloat y, GLfloat z );
+    static Matrix4f scaling( GLfloat x, GLfloat y, GLfloat z );
+    static Matrix4f frustum( GLfloat left, GLfloat right, GLfloat bottom,
+                             GLfloat top, GLfloat zNear, GLfloat zFar );
+
+    Matrix4f operator*( const Matrix4f &other ) const;
+    Vector3f transformPoint( const Vector3f &p ) const;
+    /* Transforms a direction, ignoring the translation. */
+    Vector3f transformVector( const Vector3f &v ) const;
+    /* Inverse of a matrix whose last row is ( 0, 0, 0, 1 ). Identity if the
+     * matrix is singular. */
+    Matrix4f affineInverse() const;
+    /* Largest scaling factor of the upper 3x3 part. */
+    GLfloat  maxScale() const;
+};
+
+/* --------------------------------------------------------------------------
+ *  2.9. BoundingBox
+ *
+ *  Axis aligned bounding box. A default constructed box is empty.
+ * -------------------------------------------------------------------------- */
+struct BoundingBox
+{
+    Vector3f    min;
+    Vector3f    max;
+
+    BoundingBox() : min( FLT_MAX, FLT_MAX, FLT_MAX ),
+                    max( -FLT_MAX, -FLT_MAX, -FLT_MAX ) {}
+    BoundingBox( const Vector3f &_min, const Vector3f &_max ) :
+        min( _min ), max( _max ) {}
+
+    bool        isEmpty() const { return min.x > max.x; }
+    void        extend( const Vector3f &p );
+    void        extend( const BoundingBox &box );
+    bool        contains( const BoundingBox &box ) const;
+    Vector3f    center() const;
+    Vector3f    extents() const;
+    GLfloat     surfaceArea() const;
+    /* True if the ray enters the box ( or starts inside it ) before
+     * maxDistance. distance is set to the entry distance, in units of
+     * direction. */
+    bool        intersectRay( const Vector3f &origin, const Vector3f &direction,
+                              GLfloat maxDistance, GLfloat &distance ) const;
+    /* Box enclosing this box transformed by the matrix. */
+    BoundingBox transformed( const Matrix4f &matrix ) const;
+};
+
+/* --------------------------------------------------------------------------
+ *  2.10. BoundingSphere
+ * -------------------------------------------------------------------------- */
+struct BoundingSphere
+{
+    Vector3f    center;
+    GLfloat     radius;
+
+    BoundingSphere() : radius( 0 ) {}
+    BoundingSphere( const Vector3f &_center, GLfloat _radius ) :
+        center( _center ), radius( _radius ) {}
+
+    /* Sphere enclosing this sphere transformed by the matrix. */
+    BoundingSphere transformed( const Matrix4f &matrix ) const;
+};
+
 /* **************************************************************************
 
     3. Interfaces
@@ -157,8 +321,15 @@ struct Texture
 class IDrawable
 {
 public:
+    /* Kinds of drawables the Renderer keeps in batches of their own, see
+     * SceneStore. */
+    enum Type { TYPE_BOX, TYPE_PLANE, TYPE_WFOBJECT, TYPE_PARTICLE_BOX,
+                TYPE_OTHER, TYPE_COUNT };
+
     virtual ~IDrawable() {}
 
+    virtual Type        getType()                                       = 0;
+
     /* Setter and getters. */
     virtual void        setMovable( bool state )                        = 0;
     virtual bool        isMovable()                                     = 0;
@@ -173,17 +344,64 @@ public:
     virtual void        setScaling( const Vector3f &scale )             = 0;
     virtual void        setScaling( GLfloat x, GLfloat y, GLfloat z )   = 0;
     virtual void        scale( GLfloat x, GLfloat y, GLfloat z )        = 0;
-    virtual void        setName( int name )                             = 0;
-    virtual int         getName()                                       = 0;
+    virtual void        setHandle( ObjectHandle handle )                = 0;
+    virtual ObjectHandle getHandle()                                    = 0;
     virtual void        move( GLfloat x, GLfloat y, GLfloat z )         = 0;
     virtual void        setColor( int r, int g, int b )                 = 0;
     virtual Vector3f    getColor()                                      = 0;
 
-    /* draw() is called by the Renderer, and is expected to implement
-     * necessary OpenGL commands to draw a required object. */
+    /* Object to world transformation and world space bounds. */
+    virtual Matrix4f        getWorldMatrix()                            = 0;
+    /* Transformation of the mesh of the object's render item, see
+     * RenderItem::pMesh: the world matrix, scaled to the object's size if
+     * the mesh is of unit size. */
+    virtual Matrix4f        getMeshMatrix()                             = 0;
+    virtual BoundingBox     getWorldBounds()                            = 0;
+    virtual BoundingSphere  getBoundingSphere()                         = 0;
+
+    /* The listener is told whenever the world bounds, flags, color or
+     * render item of the object may have changed. Null when the object is
+     * not attached to a Renderer. */
+    virtual void setTransformListener( ITransformListener *listener )   = 0;
+
+    /* Intersects a world space ray with the object. Returns true if the ray
+     * hits it closer than distance, and sets distance to that hit. Distances
+     * are in units of direction. */
+    virtual bool intersectRay( const Vector3f &origin,
+                               const Vector3f &direction,
+                               GLfloat &distance )                      = 0;
+
+    /* Render item of the object. The Renderer keeps a copy, which it asks
+     * for again only after the listener has been told of a change, and
+     * submits the copy every frame the object is visible. */
+    virtual RenderItem getRenderItem()                                  = 0;
+
+    /* Sets the material of the object. Called by the RenderQueue only when
+     * the material of an item differs from the previous one. */
+    virtual void applyMaterial()                                        = 0;
+
+    /* draw() is called by the RenderQueue with the state of the object's
+     * render item already set, and is expected to implement necessary
+     * OpenGL commands to draw a required object. */
     virtual void draw()                                                 = 0;
 };
 
+/* --------------------------------------------------------------------------
+ *  3.2. ITransformListener
+ *
+ *  Interface for receiving the transformation and other state changes of
+ *  drawable objects.
+ * -------------------------------------------------------------------------- */
+class ITransformListener
+{
+public:
+    virtual ~ITransformListener() {}
+
+    virtual void transformChanged( IDrawable *object )                  = 0;
+    /* Flags, color or render state. */
+    virtual void stateChanged( IDrawable *object )                      = 0;
+};
+
 
 /* **************************************************************************
 
@@ -197,38 +415,101 @@ public:
  *  Widget for OpenGL rendering context. Manages drawable objects, calculates
  *  positioning and rotation and draws each object.
  * -------------------------------------------------------------------------- */
-class Renderer : public QGLWidget
+class Renderer : public QGLWidget, public ITransformListener
 {
     Q_OBJECT
 
-private:
+public:
+    /* PICK_ID_BUFFER reads the object from the ID buffer, PICK_RAY_CAST
+     * intersects a ray with the objects. The ID buffer falls back to ray
+     * casting if framebuffer objects are not supported. */
+    enum PickMode { PICK_ID_BUFFER, PICK_RAY_CAST };
 
-    /* Some typedefs to make code cleaner. */
-    typedef std::list< IDrawable* >             DrawableList;
-    typedef DrawableList::iterator              DrawableIterator;
+private:
 
     /* Last saved position of mousepointer. */
     QPoint              m_MouseLastPos;
 
-    /* List of drawable object pointers. */
-    DrawableList        m_Objects;
+    /* The attached objects, by the handles given out by attachObject(). */
+    SceneStore          *m_pScene;
 
-    /* Currently chosen object from the DrawableList. */
-    IDrawable           *m_pChosenObject;
+    /* Currently chosen object. */
+    ObjectHandle        m_ChosenObject;
 
-    IDrawable           *m_pRobot;
+    ObjectHandle        m_Robot;
 
     /* True if an object has been clicked but no mouse
        release event have been received yet. */
     bool                m_ObjectDragOngoing;
 
+    /* Render items of the current frame. */
+    RenderQueue         m_RenderQueue;
+    FrameStats          m_FrameStats;
+
+    PickMode            m_PickMode;
+
+    /* Projection set up in resizeGL() and the planes of its frustum. There
+     * is no camera transformation, so the planes are in world space. */
+    Matrix4f            m_Projection;
+    Frustum             m_Frustum;
+
+    /* Pixels covered by one unit at distance one, from m_Projection and
+     * the height of the viewport, and the error in pixels the levels of
+     * detail are chosen for. */
+    GLfloat             m_PixelsPerUnit;
+    GLfloat             m_LodPixelError;
+    /* Index ranges of the visible clusters, see cullClusters(). */
+    std::vector< IndexRange > m_ClusterRanges;
+
+    /* Spatial index of the objects. Objects that have changed since the
+     * last query are in m_DirtyObjects, and they are refreshed in the scene
+     * store and their leaves updated before the next one. */
+    AABBTree            *m_pTree;
+    std::vector< ObjectHandle > m_DirtyObjects;
+    /* Result of the last frustum query. */
+    std::vector< ObjectHandle > m_Visible;
+
+    /* Offscreen buffer with the pickable objects drawn in colors encoding
+     * their index in m_IdObjects + 1, and a copy of its pixels. The buffer
+     * is redrawn only when m_SceneVersion has changed since. */
+    QGLFramebufferObject        *m_pIdBuffer;
+    std::vector< GLubyte >      m_IdPixels;
+    std::vector< ObjectHandle > m_IdObjects;
+    unsigned int        m_SceneVersion;
+    unsigned int        m_IdBufferVersion;
+
+    /* Set at the end of initializeGL(). Assets loaded before that wait in
+     * their queues. */
+    bool                m_IsInitialized;
+
 public:
     Renderer( QWidget *parent = 0 );
     ~Renderer();
-    void attachObject( IDrawable *object, bool isRobot = false );
-    void removeObject( IDrawable *object );
+    /* The renderer takes ownership of attached objects. The returned
+     * handle stays valid until the object is removed. */
+    ObjectHandle attachObject( IDrawable *object, bool isRobot = false );
+    void removeObject( ObjectHandle handle );
     void clearAllObjects();
 
+    /* NULL if the handle is not valid anymore. */
+    IDrawable *object( ObjectHandle handle ) const;
+    ObjectHandle chosenObject() const { return m_ChosenObject; }
+
+    /* Counters of the last drawn frame. */
+    const FrameStats &frameStats() const { return m_FrameStats; }
+
+    void        setPickMode( PickMode mode ) { m_PickMode = mode; }
+    PickMode    pickMode() const { return m_PickMode; }
+
+    /* Objects with levels of detail are drawn with the coarsest level
+     * whose error, projected on screen, stays around this many pixels. */
+    void        setLodPixelError( GLfloat pixels ) { m_LodPixelError = pixels; }
+    GLfloat     lodPixelError() const { return m_LodPixelError; }
+
+    /* Reimplementations from ITransformListener. */
+    void transformChanged( IDrawable *object );
+    void stateChanged( IDrawable *object );
+
 protected:
     /* Reimplementations from QGLWidget. */
     void initializeGL();
@@ -242,29 +523,66 @@ protected:
     void keyPressEvent( QKeyEvent *event );
 
 private:
-    /* Draws each object in m_Objects. */
+    /* Submits the objects found inside the view frustum from the tree to
+     * the render queue and draws the queue. */
     void draw();
 
-    /* Check if an object lies in spesific position on screen. */
-    int objectAtPosition( const QPoint &pos );
+    /* Refreshes the objects in m_DirtyObjects and moves their leaves. */
+    void updateScene();
+
+    /* Level of detail to draw an object with world bounds with, given the
+     * level it was drawn with last. */
+    int selectLod( const MeshLodChain &lods, const BoundingBox &bounds,
+                   int current ) const;
+
+    /* Submits item, the render item of the object at index in the scene
+     * store, whose mesh has levels of detail or clusters, with the level
+     * and the clusters visible this frame. Returns false if no cluster was
+     * visible and nothing was submitted. */
+    bool submitMesh( int index, RenderItem item, int &culledClusters );
+
+    /* Fills m_ClusterRanges with the clusters of the mesh that are inside
+     * the view frustum and do not face away from the camera. Returns the
+     * number of clusters culled. */
+    int cullClusters( const CachedMesh &mesh, const Matrix4f &meshMatrix );
+
+    /* Returns the nearest pickable object under a position on screen, or
+     * NULL_HANDLE. distance, if given, is set to the distance of the hit
+     * along the view direction, which needs a ray cast. */
+    ObjectHandle objectAtPosition( const QPoint &pos, GLfloat *distance = NULL );
+    ObjectHandle rayCastAtPosition( const QPoint &pos, GLfloat *distance );
+
+    /* Redraws the ID buffer if the scene has changed. Returns false if it
+     * cannot be used. */
+    bool updateIdBuffer();
 
 signals:
     /* Signals for sending object's color and position. */
     void objectRGB( int r, int g, int b );
     void locationChanged( float x, float y, float z );
     void locationChanged( const Vector3f &pos );
+    /* Emitted when an object is clicked. */
+    void objectChosen( ObjectHandle handle );
+    /* Emitted after each painted frame. */
+    void frameDrawn( const FrameStats &stats );
 
 public slots:
     void changeObjectColor( int r, int g, int b );
     void changeObjectPosition( float x, float y, float z );
 
+private slots:
+    /* Invoked through the event loop by the TextureManager and
+     * MeshManager when background loads have finished. */
+    void assetsLoaded();
+
 };
 
 
 /* --------------------------------------------------------------------------
  *  4.2. MaterialManager
  *
- *  Singleton class for keeping track of all material information.
+ *  Singleton class for keeping track of all material information. Material
+ *  libraries are read by the loader threads, so the materials are locked.
  * -------------------------------------------------------------------------- */
 
 class MaterialManager
@@ -275,6 +593,9 @@ private:
     typedef MaterialMap::iterator                   MaterialIterator;
 
     MaterialMap                 m_Materials;
+    std::map< std::string, GLuint > m_MaterialIds;
+    GLuint                      m_NextMaterialId;
+    QMutex                      m_Mutex;
 
     /* Handles own static pointer. */
     static MaterialManager      *m_pInstance;
@@ -297,13 +618,19 @@ public:
     void            clearAllMaterials();
     void            setValue( const char *matName, MaterialAttribute attr,
                               const Color4f &color );
-    const MaterialData    &getMaterial( const char *name );
+    /* A copy, as the material may be changed by another thread. */
+    MaterialData    getMaterial( const char *name );
+    /* Returns a non-zero id for the material, or 0 if there is none. */
+    GLuint          getMaterialId( const char *name );
 };
 
 /* --------------------------------------------------------------------------
  *  4.3. TextureManager
  *
- *  Singleton class for keeping track of all textures
+ *  Singleton class for keeping track of all textures. Images given by file
+ *  name are decoded on the global thread pool and the textures created
+ *  from them on the GL thread, see Renderer::assetsLoaded. Until then the
+ *  texture has id 0.
  * -------------------------------------------------------------------------- */
 class TextureManager
 {
@@ -312,23 +639,38 @@ public:
     typedef TextureMap::iterator                TexMapIt;
 
 private:
+    typedef std::vector< std::pair< QString, QImage > > ImageList;
+
     /* Handles own static pointer. */
     static TextureManager       *m_pInstance;
     TextureMap                  m_Textures;
 
     Renderer                    *m_pRenderer;
 
+    /* Images decoded by the loader threads, waiting for their textures. */
+    ImageList                   m_Decoded;
+    QMutex                      m_DecodedMutex;
+
     /* Prevent outside calling of ctor, copy-ctor and assignment operator. */
     TextureManager();
     TextureManager( const TextureManager & );
     TextureManager& operator=( const TextureManager & );
 
+    /* Queues the image and tells the renderer, run by the loader task. */
+    void        imageDecoded( const QString &name, const QImage &image );
+
+    friend class TextureLoadTask;
 
 public:
     static TextureManager* getInstance();
     GLuint      createTexture( const char *name, const QImage &image );
+    /* Decodes the image file in the background. */
+    void        loadTexture( const char *name, const char *filename );
+    /* Creates the textures of the images decoded since the last call.
+     * Called with the context current. Returns the number created. */
+    int         createLoadedTextures();
     const Texture *getTexturePtr( const QString &texName );
-    void        setRenderer( Renderer *pRenderer ) { m_pRenderer = pRenderer; }
+    void        setRenderer( Renderer *pRenderer );
     GLuint      bindTexture( const QPixmap &pixmap );
 };
 /* -------------------------------------------------------------------------- */
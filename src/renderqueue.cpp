@@ -0,0 +1,195 @@
+/* --------------------------------------------------------------------------
+ * renderqueue.cpp
+ *
+ * Implementation of the RenderQueue class.
+ *
+ * -------------------------------------------------------------------------- */
+
+#include "renderqueue.h"
+#include "renderer.h"
+#include "statemanager.h"
+#include "geometrycache.h"
+
+RenderQueue::RenderQueue() :
+    m_NearPlane( 0 ),
+    m_FarPlane( 1 )
+{
+}
+
+void RenderQueue::setDepthRange( GLfloat nearPlane, GLfloat farPlane )
+{
+    m_NearPlane = nearPlane;
+    m_FarPlane  = farPlane;
+}
+
+/* --------------------------------------------------------------------------
+ *  makeKey
+ * -------------------------------------------------------------------------- */
+quint64 RenderQueue::makeKey( const RenderItem &item ) const
+{
+    const quint64   DEPTH_MAX = ( 1 << 24 ) - 1;
+    GLfloat         depth;
+    quint64         key;
+
+    depth = ( item.depth - m_NearPlane ) / ( m_FarPlane - m_NearPlane );
+    if( depth < 0 ) depth = 0;
+    if( depth > 1 ) depth = 1;
+    if( item.pass == RenderItem::PASS_TRANSPARENT )
+        depth = 1 - depth;
+
+    key  = ( quint64 )( item.pass & 0xf ) << 60;
+    key |= ( quint64 )( item.flags & 0xf ) << 56;
+    key |= ( quint64 )( item.texture & 0xffff ) << 40;
+    key |= ( quint64 )( ( item.material ^ ( item.material >> 16 ) ) & 0xffff ) << 24;
+    if( item.pMesh && item.pass == RenderItem::PASS_OPAQUE )
+    {
+        quintptr mesh = ( quintptr )item.pMesh;
+        key |= ( quint64 )( ( mesh >> 4 ^ mesh >> 12 ) & 0xff ) << 16;
+        key |= ( quint64 )( depth * 0xffff );
+    }
+    else
+        key |= ( quint64 )( depth * DEPTH_MAX );
+    return key;
+}
+
+/* --------------------------------------------------------------------------
+ *  submit
+ * -------------------------------------------------------------------------- */
+void RenderQueue::submit( const RenderItem &item )
+{
+    m_Items.push_back( item );
+    m_Items.back().key = makeKey( item );
+}
+
+void RenderQueue::submit( const RenderItem &item, const IndexRange *ranges,
+                          int rangeCount )
+{
+    submit( item );
+    m_Items.back().firstRange = m_Ranges.size();
+    m_Items.back().rangeCount = rangeCount;
+    m_Ranges.insert( m_Ranges.end(), ranges, ranges + rangeCount );
+}
+
+/* --------------------------------------------------------------------------
+ *  sort
+ *
+ *  One counting pass per key byte. Bytes that are the same in every key
+ *  ( e.g. the pass, as long as there is only one ) are skipped.
+ * -------------------------------------------------------------------------- */
+void RenderQueue::sort()
+{
+    const size_t    count = m_Items.size();
+    RenderItem      *src, *dst;
+
+    if( count < 2 )
+        return;
+
+    m_SortBuffer.resize( count );
+    src = &m_Items[ 0 ];
+    dst = &m_SortBuffer[ 0 ];
+
+    for( int shift = 0; shift < 64; shift += 8 )
+    {
+        size_t offset[ 256 ] = { 0 };
+        size_t sum = 0;
+
+        for( size_t i = 0; i < count; i++ )
+            offset[ ( src[ i ].key >> shift ) & 0xff ]++;
+        if( offset[ ( src[ 0 ].key >> shift ) & 0xff ] == count )
+            continue;
+
+        for( int b = 0; b < 256; b++ )
+        {
+            size_t n = offset[ b ];
+            offset[ b ] = sum;
+            sum += n;
+        }
+        for( size_t i = 0; i < count; i++ )
+            dst[ offset[ ( src[ i ].key >> shift ) & 0xff ]++ ] = src[ i ];
+
+        RenderItem *temp = src;
+        src = dst;
+        dst = temp;
+    }
+
+    if( src != &m_Items[ 0 ] )
+        m_Items.swap( m_SortBuffer );
+}
+
+/* --------------------------------------------------------------------------
+ *  execute
+ *
+ *  The state calls go through the StateManager, which drops the ones that
+ *  change nothing. Materials are compared by id here already, so the
+ *  drawable is not even asked to apply a material that is set.
+ *
+ *  Items with a mesh are drawn by the InstanceRenderer, together with the
+ *  following opaque items of the same mesh and state. Those may set
+ *  per-instance colors over the material.
+ * -------------------------------------------------------------------------- */
+void RenderQueue::execute()
+{
+    StateManager    *state = StateManager::getInstance();
+    unsigned int    issued = state->issuedCount();
+    unsigned int    dropped = state->droppedCount();
+    GLuint          material = 0;
+    bool            materialValid = false;
+
+    m_Stats = FrameStats();
+    m_Stats.items = m_Items.size();
+
+    for( size_t i = 0; i < m_Items.size(); )
+    {
+        const RenderItem    &item = m_Items[ i ];
+
+        state->setEnabled( GL_LIGHTING, item.flags & RenderItem::LIGHTING );
+        state->shadeModel( item.flags & RenderItem::SMOOTH_SHADING ?
+                           GL_SMOOTH : GL_FLAT );
+        state->setEnabled( GL_TEXTURE_2D, item.flags & RenderItem::TEXTURE );
+
+        /* The binding is kept while texturing is disabled. */
+        if( ( item.flags & RenderItem::TEXTURE ) &&
+            state->bindTexture( item.texture ) )
+            m_Stats.textureBinds++;
+
+        if( item.material != 0 &&
+            ( !materialValid || material != item.material ) )
+        {
+            item.pDrawable->applyMaterial();
+            material = item.material;
+            materialValid = true;
+            m_Stats.materialChanges++;
+        }
+
+        size_t end = i + 1;
+        if( item.pMesh && item.rangeCount > 0 )
+        {
+            const IndexRange *ranges = &m_Ranges[ item.firstRange ];
+            m_Stats.drawCalls += m_Instancer.draw( *item.pMesh, &item, 1, ranges,
+                                                   item.rangeCount );
+            for( GLuint r = 0; r < item.rangeCount; r++ )
+                m_Stats.triangles += ranges[ r ].count / 3;
+        }
+        else if( item.pMesh )
+        {
+            if( item.pass == RenderItem::PASS_OPAQUE )
+                while( end < m_Items.size() && sameInstance( item, m_Items[ end ] ) )
+                    end++;
+            m_Stats.drawCalls += m_Instancer.draw( *item.pMesh, &item, end - i );
+            m_Stats.triangles += ( end - i ) * ( item.pMesh->indexCount() / 3 );
+        }
+        else
+        {
+            item.pDrawable->draw();
+            m_Stats.drawCalls++;
+        }
+
+        /* Drawables without a material id may leave any material set. */
+        if( item.material == 0 || ( item.flags & RenderItem::COLOR_MATERIAL ) )
+            materialValid = false;
+        i = end;
+    }
+
+    m_Stats.stateChanges = state->issuedCount() - issued;
+    m_Stats.droppedCalls = state->droppedCount() - dropped;
+}
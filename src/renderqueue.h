@@ -0,0 +1,176 @@
+/* --------------------------------------------------------------------------
+ * renderqueue.h
+ *
+ * Queue of render items, sorted by their render state once a frame so that
+ * the state changes between consecutive draws are kept to a minimum.
+ *
+ * -------------------------------------------------------------------------- */
+
+#ifndef RENDERQUEUE_H
+#define RENDERQUEUE_H
+
+#include <QGLWidget>
+#include <vector>
+#include "instancerenderer.h"
+
+class IDrawable;
+class CachedMesh;
+struct MeshLodChain;
+struct Matrix4f;
+struct Vector3f;
+
+/* --------------------------------------------------------------------------
+ *  RenderItem
+ *
+ *  One draw of a drawable with the state it needs. The texture is bound
+ *  and the material applied ( see IDrawable::applyMaterial ) by the queue,
+ *  so drawables do not set those in draw(). Material 0 means the drawable
+ *  sets its own materials while drawing.
+ *
+ *  Items with a mesh are drawn by the queue instead of the drawable: the
+ *  mesh with the drawable's mesh matrix ( see IDrawable::getMeshMatrix ).
+ *  Opaque items sharing the mesh and state are drawn as instances of it.
+ *  With COLOR_MATERIAL the ambient and diffuse material of each instance
+ *  come from the color of its drawable, so the material id only covers
+ *  the rest of the material. The matrix and the color are read through
+ *  pMeshMatrix and pColor, which the Renderer points at its copies in the
+ *  SceneStore when it submits the item, so drawing makes no virtual calls.
+ *
+ *  Items with levels of detail have pMesh set to one of the levels by the
+ *  Renderer before they are submitted. Items submitted with index ranges
+ *  draw only those parts of their mesh, and are never drawn as instances.
+ * -------------------------------------------------------------------------- */
+struct RenderItem
+{
+    enum Pass { PASS_OPAQUE = 0, PASS_TRANSPARENT };
+    enum Flags { LIGHTING = 1, SMOOTH_SHADING = 2, TEXTURE = 4,
+                 COLOR_MATERIAL = 8 };
+
+    quint64     key;
+    IDrawable   *pDrawable;
+    const CachedMesh *pMesh;
+    const MeshLodChain *pLods;
+    /* Valid until the scene changes, set for items with a mesh. */
+    const Matrix4f *pMeshMatrix;
+    const Vector3f *pColor;
+    GLuint      pass;
+    GLuint      flags;
+    GLuint      texture;
+    GLuint      material;
+    /* Distance from the camera along the view direction. */
+    GLfloat     depth;
+    /* Index ranges of the item in the queue, set by RenderQueue::submit. */
+    GLuint      firstRange;
+    GLuint      rangeCount;
+
+    RenderItem() : key( 0 ), pDrawable( NULL ), pMesh( NULL ), pLods( NULL ),
+                   pMeshMatrix( NULL ), pColor( NULL ), pass( PASS_OPAQUE ), flags( LIGHTING | SMOOTH_SHADING ),
+                   texture( 0 ), material( 0 ), depth( 0 ), firstRange( 0 ),
+                   rangeCount( 0 ) {}
+};
+
+/* --------------------------------------------------------------------------
+ *  IndexRange
+ *
+ *  Part of the index list of a mesh.
+ * -------------------------------------------------------------------------- */
+struct IndexRange
+{
+    GLuint      first;
+    GLsizei     count;
+
+    IndexRange( GLuint _first, GLsizei _count ) :
+        first( _first ), count( _count ) {}
+};
+
+/* --------------------------------------------------------------------------
+ *  FrameStats
+ *
+ *  Counters of the last executed queue. stateChanges is the number of state
+ *  calls passed on to GL, including texture binds and materials, and
+ *  droppedCalls the number of those the StateManager found redundant.
+ *  culled is filled in by the Renderer: objects outside the view frustum,
+ *  which are not submitted at all. drawCalls counts an instanced draw
+ *  once. triangles counts those of the items with a mesh, every instance
+ *  at the level of detail it was drawn with, and only the index ranges
+ *  drawn of partly drawn meshes. culledClusters counts the mesh clusters
+ *  the Renderer left out of the submitted ranges.
+ * -------------------------------------------------------------------------- */
+struct FrameStats
+{
+    int         items;
+    int         culled;
+    int         culledClusters;
+    int         drawCalls;
+    int         triangles;
+    int         stateChanges;
+    int         droppedCalls;
+    int         textureBinds;
+    int         materialChanges;
+
+    FrameStats() : items( 0 ), culled( 0 ), culledClusters( 0 ),
+                   drawCalls( 0 ), triangles( 0 ),
+                   stateChanges( 0 ), droppedCalls( 0 ), textureBinds( 0 ),
+                   materialChanges( 0 ) {}
+};
+
+/* --------------------------------------------------------------------------
+ *  RenderQueue
+ *
+ *  Sort keys, from the most significant bits down:
+ *      4 bits  pass
+ *      4 bits  RenderItem::Flags
+ *     16 bits  texture id
+ *     16 bits  material id ( folded to 16 bits )
+ *     24 bits  depth, front to back ( back to front for PASS_TRANSPARENT )
+ *
+ *  For opaque items with a mesh the top 8 depth bits are taken by a hash
+ *  of the mesh, so the instances of a mesh end up next to each other.
+ * -------------------------------------------------------------------------- */
+class RenderQueue
+{
+private:
+    std::vector< RenderItem >   m_Items;
+    std::vector< RenderItem >   m_SortBuffer;
+    std::vector< IndexRange >   m_Ranges;
+    GLfloat                     m_NearPlane;
+    GLfloat                     m_FarPlane;
+    FrameStats                  m_Stats;
+    InstanceRenderer            m_Instancer;
+
+public:
+    RenderQueue();
+
+    /* Sets up instanced drawing for the current context. */
+    void initialize() { m_Instancer.initialize(); }
+
+    /* Depth range used for quantizing the item depths. */
+    void setDepthRange( GLfloat nearPlane, GLfloat farPlane );
+
+    void clear() { m_Items.clear(); m_Ranges.clear(); }
+    void submit( const RenderItem &item );
+    /* Submits an item drawing only the given ranges of its mesh. */
+    void submit( const RenderItem &item, const IndexRange *ranges,
+                 int rangeCount );
+
+    /* Sorts the items by their keys ( LSD radix sort ). */
+    void sort();
+
+    /* Draws the items in order, setting only the state that changed since
+     * the previous item. */
+    void execute();
+
+    const FrameStats &stats() const { return m_Stats; }
+
+private:
+    quint64 makeKey( const RenderItem &item ) const;
+    /* True if b can be drawn as another instance of a's mesh. */
+    static bool sameInstance( const RenderItem &a, const RenderItem &b )
+    {
+        return a.pMesh == b.pMesh && a.pass == b.pass && a.flags == b.flags &&
+               a.texture == b.texture && a.material == b.material &&
+               a.rangeCount == 0 && b.rangeCount == 0;
+    }
+};
+
+#endif /* RENDERQUEUE_H */
@@ -0,0 +1,134 @@
+/* --------------------------------------------------------------------------
+ * scenestore.cpp
+ *
+ * Implementation of the SceneStore class.
+ *
+ * -------------------------------------------------------------------------- */
+
+#include "scenestore.h"
+
+SceneStore::SceneStore()
+{
+    for( int type = 0; type < IDrawable::TYPE_COUNT; type++ )
+        m_BatchEnd[ type ] = 0;
+}
+
+/* --------------------------------------------------------------------------
+ *  add
+ *
+ *  Makes room at the end of the object's batch by moving the first element
+ *  of each following batch to the end of that batch, last batch first.
+ * -------------------------------------------------------------------------- */
+ObjectHandle SceneStore::add( IDrawable *object )
+{
+    int type = object->getType();
+    if( type < 0 || type >= IDrawable::TYPE_COUNT )
+        type = IDrawable::TYPE_OTHER;
+
+    ObjectHandle handle = m_Indices.insert( -1 );
+    if( handle == NULL_HANDLE )
+        return NULL_HANDLE;
+
+    int hole = m_Objects.size();
+    resize( hole + 1 );
+
+    for( int t = IDrawable::TYPE_COUNT - 1; t > type; t-- )
+    {
+        int first = batchBegin( t );
+        if( first != hole )
+            move( first, hole );
+        hole = first;
+        m_BatchEnd[ t ]++;
+    }
+    m_BatchEnd[ type ]++;
+
+    m_Objects[ hole ] = object;
+    m_Handles[ hole ] = handle;
+    m_Proxies[ hole ] = -1;
+    m_Lods[ hole ]    = 0;
+    m_Flags[ hole ]   = DIRTY;
+    m_Bounds[ hole ]  = BoundingBox();
+    m_Colors[ hole ]  = Vector3f( 0, 0, 0 );
+    m_Items[ hole ]   = RenderItem();
+    *m_Indices.get( handle ) = hole;
+
+    return handle;
+}
+
+/* --------------------------------------------------------------------------
+ *  remove
+ *
+ *  The reverse of add: the last element of the object's batch fills the
+ *  hole, and the hole moves on to the following batches.
+ * -------------------------------------------------------------------------- */
+IDrawable *SceneStore::remove( ObjectHandle handle )
+{
+    int hole = indexOf( handle );
+    if( hole < 0 )
+        return NULL;
+
+    IDrawable *object = m_Objects[ hole ];
+
+    int type = 0;
+    while( hole >= m_BatchEnd[ type ] )
+        type++;
+
+    for( int t = type; t < IDrawable::TYPE_COUNT; t++ )
+    {
+        int last = m_BatchEnd[ t ] - 1;
+        if( last != hole )
+            move( last, hole );
+        hole = last;
+        m_BatchEnd[ t ]--;
+    }
+
+    resize( m_Objects.size() - 1 );
+    m_Indices.remove( handle );
+    return object;
+}
+
+/* --------------------------------------------------------------------------
+ *  refresh
+ * -------------------------------------------------------------------------- */
+void SceneStore::refresh( int index )
+{
+    IDrawable *object = m_Objects[ index ];
+
+    m_Bounds[ index ] = object->getWorldBounds();
+    m_MeshMatrices[ index ] = object->getMeshMatrix();
+    m_Colors[ index ] = object->getColor();
+    m_Items[ index ]  = object->getRenderItem();
+    m_Flags[ index ]  = ( m_Flags[ index ] & VISIBLE ) |
+                        ( object->isMovable() ? MOVABLE : 0 ) |
+                        ( object->isRotatable() ? ROTATABLE : 0 );
+}
+
+/* --------------------------------------------------------------------------
+ *  move & resize
+ * -------------------------------------------------------------------------- */
+void SceneStore::move( int from, int to )
+{
+    m_Objects[ to ] = m_Objects[ from ];
+    m_Handles[ to ] = m_Handles[ from ];
+    m_Proxies[ to ] = m_Proxies[ from ];
+    m_Lods[ to ]    = m_Lods[ from ];
+    m_Flags[ to ]   = m_Flags[ from ];
+    m_Bounds[ to ]  = m_Bounds[ from ];
+    m_MeshMatrices[ to ] = m_MeshMatrices[ from ];
+    m_Colors[ to ]  = m_Colors[ from ];
+    m_Items[ to ]   = m_Items[ from ];
+    *m_Indices.get( m_Handles[ to ] ) = to;
+}
+
+void SceneStore::resize( size_t size )
+{
+    m_Objects.resize( size );
+    m_Handles.resize( size );
+    m_Proxies.resize( size );
+    m_Lods.resize( size );
+    m_Flags.resize( size );
+    m_Bounds.resize( size );
+    m_MeshMatrices.resize( size );
+    m_Colors.resize( size );
+    m_Items.resize( size );
+}
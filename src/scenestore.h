@@ -0,0 +1,92 @@
+/* --------------------------------------------------------------------------
+ * scenestore.h
+ *
+ * Dense, data oriented storage of the objects attached to a Renderer.
+ *
+ * -------------------------------------------------------------------------- */
+
+#ifndef SCENESTORE_H
+#define SCENESTORE_H
+
+#include "renderer.h"
+#include "slotmap.h"
+#include <vector>
+
+/* --------------------------------------------------------------------------
+ *  SceneStore
+ *
+ *  Keeps what the Renderer reads of its objects every frame in parallel
+ *  arrays, one element per object: world bounds, mesh matrix, color,
+ *  flags, the render item and the leaf in the AABBTree. These are copied from the object
+ *  only when it has told it has changed ( see refresh() ), so culling and
+ *  submitting read the arrays and make no virtual calls. The level of
+ *  detail the object was last drawn with is kept by the Renderer, across
+ *  refreshes.
+ *
+ *  The arrays are ordered by IDrawable::Type, the objects of each type in
+ *  one contiguous batch [ batchBegin( type ), batchEnd( type ) ). Adding
+ *  or removing an object moves at most one element of each batch after
+ *  its own. Handles are mapped to the current indices with a SlotMap.
+ * -------------------------------------------------------------------------- */
+class SceneStore
+{
+public:
+    enum Flags { MOVABLE = 1, ROTATABLE = 2, DIRTY = 4, VISIBLE = 8 };
+
+    SceneStore();
+
+    /* Adds an object as DIRTY, without refreshing it. Returns NULL_HANDLE
+     * if the store is full. */
+    ObjectHandle    add( IDrawable *object );
+    /* Returns the removed object, or NULL if handle is stale. */
+    IDrawable       *remove( ObjectHandle handle );
+
+    /* Index of the object, or -1 if handle is stale. Indices change when
+     * objects are added or removed. */
+    int             indexOf( ObjectHandle handle ) const
+                    {
+                        const int *index = m_Indices.get( handle );
+                        return index != NULL ? *index : -1;
+                    }
+
+    /* Copies the bounds, mesh matrix, flags, color and render item of the
+     * object at index from the object itself, and clears DIRTY. */
+    void            refresh( int index );
+
+    int             size() const { return m_Objects.size(); }
+    bool            empty() const { return m_Objects.empty(); }
+    int             batchBegin( int type ) const
+                    { return type == 0 ? 0 : m_BatchEnd[ type - 1 ]; }
+    int             batchEnd( int type ) const { return m_BatchEnd[ type ]; }
+
+    /* The arrays by index. */
+    IDrawable           *object( int i ) const { return m_Objects[ i ]; }
+    ObjectHandle        handle( int i ) const { return m_Handles[ i ]; }
+    int                 &proxy( int i ) { return m_Proxies[ i ]; }
+    int                 &lod( int i ) { return m_Lods[ i ]; }
+    GLuint              &flags( int i ) { return m_Flags[ i ]; }
+    const BoundingBox   &bounds( int i ) const { return m_Bounds[ i ]; }
+    const Matrix4f      &meshMatrix( int i ) const { return m_MeshMatrices[ i ]; }
+    const Vector3f      &color( int i ) const { return m_Colors[ i ]; }
+    const RenderItem    &renderItem( int i ) const { return m_Items[ i ]; }
+
+private:
+    std::vector< IDrawable* >   m_Objects;
+    std::vector< ObjectHandle > m_Handles;
+    std::vector< int >          m_Proxies;
+    std::vector< int >          m_Lods;
+    std::vector< GLuint >       m_Flags;
+    std::vector< BoundingBox >  m_Bounds;
+    std::vector< Matrix4f >     m_MeshMatrices;
+    std::vector< Vector3f >     m_Colors;
+    std::vector< RenderItem >   m_Items;
+
+    SlotMap< int >              m_Indices;
+    int                         m_BatchEnd[ IDrawable::TYPE_COUNT ];
+
+    /* Copies the element at from over the one at to. */
+    void        move( int from, int to );
+    void        resize( size_t size );
+};
+
+#endif /* SCENESTORE_H */
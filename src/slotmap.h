@@ -0,0 +1,172 @@
+/* --------------------------------------------------------------------------
+ * slotmap.h
+ *
+ * Container giving out stable, generation checked handles to its values.
+ *
+ * -------------------------------------------------------------------------- */
+
+#ifndef SLOTMAP_H
+#define SLOTMAP_H
+
+#include <vector>
+#include <stddef.h>
+
+/* Handle to a value in a SlotMap. The low INDEX_BITS bits are the slot and
+ * the rest the generation of the slot, NULL_HANDLE is never given out. */
+typedef unsigned int SlotHandle;
+const SlotHandle NULL_HANDLE = 0;
+
+/* --------------------------------------------------------------------------
+ *  SlotMap
+ *
+ *  The values are kept packed in one array, in no particular order, and
+ *  the slots map handles to positions in it. Insertion, removal and lookup
+ *  are O(1), and iterating with operator[] walks the values contiguously.
+ *  Removal moves the last value into the hole, so pointers to values and
+ *  positions are only valid until the next insert or remove, handles for
+ *  as long as the value exists.
+ *
+ *  A slot's generation changes whenever its value is removed, so stale
+ *  handles are rejected instead of finding the value that reused the slot.
+ *  Slots whose generation would wrap around are retired.
+ * -------------------------------------------------------------------------- */
+template< typename T >
+class SlotMap
+{
+public:
+    typedef SlotHandle Handle;
+
+    enum { INDEX_BITS     = 20,
+           MAX_GENERATION = ( 1 << ( 32 - INDEX_BITS ) ) - 1 };
+
+    SlotMap() : m_FreeSlot( NO_SLOT ) {}
+
+    Handle      insert( const T &value );
+    /* Returns false if handle is stale. */
+    bool        remove( Handle handle );
+    void        clear();
+
+    /* NULL if handle is stale. */
+    T           *get( Handle handle );
+    const T     *get( Handle handle ) const;
+    bool        contains( Handle handle ) const { return get( handle ) != NULL; }
+
+    size_t      size() const { return m_Values.size(); }
+    bool        empty() const { return m_Values.empty(); }
+
+    /* Values and their handles by position, 0 <= i < size(). */
+    T           &operator[]( size_t i ) { return m_Values[ i ]; }
+    const T     &operator[]( size_t i ) const { return m_Values[ i ]; }
+    Handle      handleAt( size_t i ) const;
+
+private:
+    enum { INDEX_MASK = ( 1 << INDEX_BITS ) - 1, NO_SLOT = INDEX_MASK };
+
+    /* position is the index of the value, or of the next free slot if the
+     * slot is free. */
+    struct Slot
+    {
+        unsigned int    position;
+        unsigned int    generation;
+    };
+
+    std::vector< T >            m_Values;
+    /* Slot of each value. */
+    std::vector< unsigned int > m_ValueSlots;
+    std::vector< Slot >         m_Slots;
+    unsigned int                m_FreeSlot;
+
+    Handle      makeHandle( unsigned int slot ) const
+    {
+        return m_Slots[ slot ].generation << INDEX_BITS | slot;
+    }
+};
+
+template< typename T >
+SlotHandle SlotMap< T >::insert( const T &value )
+{
+    unsigned int slot = m_FreeSlot;
+
+    if( slot != NO_SLOT )
+        m_FreeSlot = m_Slots[ slot ].position;
+    else
+    {
+        /* All slots in use, the last index is reserved for NO_SLOT. */
+        if( m_Slots.size() >= NO_SLOT )
+            return NULL_HANDLE;
+
+        Slot newSlot = { 0, 1 };
+        slot = m_Slots.size();
+        m_Slots.push_back( newSlot );
+    }
+
+    m_Slots[ slot ].position = m_Values.size();
+    m_Values.push_back( value );
+    m_ValueSlots.push_back( slot );
+
+    return makeHandle( slot );
+}
+
+template< typename T >
+bool SlotMap< T >::remove( Handle handle )
+{
+    if( !contains( handle ) )
+        return false;
+
+    unsigned int slot     = handle & INDEX_MASK;
+    unsigned int position = m_Slots[ slot ].position;
+    unsigned int last     = m_Values.size() - 1;
+
+    if( position != last )
+    {
+        m_Values[ position ]     = m_Values[ last ];
+        m_ValueSlots[ position ] = m_ValueSlots[ last ];
+        m_Slots[ m_ValueSlots[ position ] ].position = position;
+    }
+    m_Values.pop_back();
+    m_ValueSlots.pop_back();
+
+    if( m_Slots[ slot ].generation < MAX_GENERATION )
+    {
+        m_Slots[ slot ].generation++;
+        m_Slots[ slot ].position = m_FreeSlot;
+        m_FreeSlot = slot;
+    }
+    else
+        m_Slots[ slot ].generation = 0;
+
+    return true;
+}
+
+template< typename T >
+void SlotMap< T >::clear()
+{
+    while( !m_Values.empty() )
+        remove( handleAt( m_Values.size() - 1 ) );
+}
+
+template< typename T >
+T *SlotMap< T >::get( Handle handle )
+{
+    unsigned int slot = handle & INDEX_MASK;
+
+    /* Generation 0 marks retired slots, and NULL_HANDLE. */
+    if( slot >= m_Slots.size() || ( handle >> INDEX_BITS ) == 0 ||
+        makeHandle( slot ) != handle )
+        return NULL;
+    return &m_Values[ m_Slots[ slot ].position ];
+}
+
+template< typename T >
+const T *SlotMap< T >::get( Handle handle ) const
+{
+    return const_cast< SlotMap* >( this )->get( handle );
+}
+
+template< typename T >
+SlotHandle SlotMap< T >::handleAt( size_t i ) const
+{
+    return makeHandle( m_ValueSlots[ i ] );
+}
+
+#endif /* SLOTMAP_H */
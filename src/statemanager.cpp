@@ -0,0 +1,275 @@
+/* --------------------------------------------------------------------------
+ * statemanager.cpp
+ *
+ * Implementation of the StateManager class.
+ *
+ * -------------------------------------------------------------------------- */
+
+#include "statemanager.h"
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+
+/* Static member */
+StateManager *StateManager::m_pInstance = NULL;
+
+/* Capabilities with a shadow copy, in the order of capIndex(). */
+static const GLenum s_Caps[] = { GL_LIGHTING, GL_TEXTURE_2D, GL_DEPTH_TEST,
+                                 GL_CULL_FACE, GL_NORMALIZE, GL_LIGHT0 };
+
+static const GLenum s_Faces[] = { GL_FRONT, GL_BACK };
+
+static const GLenum s_Params[] = { GL_AMBIENT, GL_DIFFUSE, GL_SPECULAR,
+                                   GL_EMISSION, GL_SHININESS };
+
+/* --------------------------------------------------------------------------
+ *  StateManager ( ctor, copy-ctor & assignment op. )
+ * -------------------------------------------------------------------------- */
+StateManager::StateManager() :
+    m_FramesToCheck( 0 ),
+    m_Issued( 0 ),
+    m_Dropped( 0 )
+{
+#ifdef QT_NO_DEBUG
+    m_CheckInterval = 0;
+#else
+    m_CheckInterval = 60;
+#endif
+    invalidate();
+}
+StateManager::StateManager( const StateManager & ) {}
+StateManager &StateManager::operator=( const StateManager & ) { return *this; }
+
+/* --------------------------------------------------------------------------
+ *  getInstance
+ *
+ *  Returns the one and only instance to StateManager object.
+ * -------------------------------------------------------------------------- */
+StateManager *StateManager::getInstance()
+{
+    if( !m_pInstance )
+    {
+        m_pInstance = new StateManager();
+    }
+    return m_pInstance;
+}
+
+/* --------------------------------------------------------------------------
+ *  invalidate
+ * -------------------------------------------------------------------------- */
+void StateManager::invalidate()
+{
+    for( int i = 0; i < CAP_COUNT; i++ )
+        m_EnabledValid[ i ] = false;
+    m_ShadeModel = 0;
+    m_Texture = ~0u;
+    memset( m_MaterialValid, 0, sizeof( m_MaterialValid ) );
+}
+
+int StateManager::capIndex( GLenum cap )
+{
+    for( int i = 0; i < CAP_COUNT; i++ )
+        if( s_Caps[ i ] == cap )
+            return i;
+    return -1;
+}
+
+/* --------------------------------------------------------------------------
+ *  setEnabled
+ *
+ *  Capabilities without a shadow copy are always passed on.
+ * -------------------------------------------------------------------------- */
+bool StateManager::setEnabled( GLenum cap, bool state )
+{
+    int i = capIndex( cap );
+
+    if( i >= 0 && m_EnabledValid[ i ] && m_Enabled[ i ] == state )
+    {
+        m_Dropped++;
+        return false;
+    }
+
+    if( state )
+        glEnable( cap );
+    else
+        glDisable( cap );
+    if( i >= 0 )
+    {
+        m_Enabled[ i ] = state;
+        m_EnabledValid[ i ] = true;
+    }
+    m_Issued++;
+    return true;
+}
+
+/* --------------------------------------------------------------------------
+ *  shadeModel
+ * -------------------------------------------------------------------------- */
+bool StateManager::shadeModel( GLenum mode )
+{
+    if( m_ShadeModel == mode )
+    {
+        m_Dropped++;
+        return false;
+    }
+    glShadeModel( mode );
+    m_ShadeModel = mode;
+    m_Issued++;
+    return true;
+}
+
+/* --------------------------------------------------------------------------
+ *  bindTexture
+ * -------------------------------------------------------------------------- */
+bool StateManager::bindTexture( GLuint id )
+{
+    if( m_Texture == id )
+    {
+        m_Dropped++;
+        return false;
+    }
+    glBindTexture( GL_TEXTURE_2D, id );
+    m_Texture = id;
+    m_Issued++;
+    return true;
+}
+
+/* --------------------------------------------------------------------------
+ *  materialfv
+ *
+ *  GL_FRONT_AND_BACK and GL_AMBIENT_AND_DIFFUSE cover several values. The
+ *  call is dropped only if all of them are already set, otherwise it is
+ *  passed on as is.
+ * -------------------------------------------------------------------------- */
+bool StateManager::materialfv( GLenum face, GLenum pname,
+                               const GLfloat *params )
+{
+    int     firstFace = 0, lastFace = FACE_COUNT - 1;
+    int     firstParam, lastParam;
+    int     size = pname == GL_SHININESS ? 1 : 4;
+    bool    same = true;
+
+    if( face == GL_FRONT ) lastFace = 0;
+    else if( face == GL_BACK ) firstFace = 1;
+
+    switch( pname )
+    {
+    case GL_AMBIENT:                firstParam = lastParam = 0; break;
+    case GL_DIFFUSE:                firstParam = lastParam = 1; break;
+    case GL_AMBIENT_AND_DIFFUSE:    firstParam = 0; lastParam = 1; break;
+    case GL_SPECULAR:               firstParam = lastParam = 2; break;
+    case GL_EMISSION:               firstParam = lastParam = 3; break;
+    case GL_SHININESS:              firstParam = lastParam = 4; break;
+    default:
+        /* e.g. GL_COLOR_INDEXES, not tracked. */
+        glMaterialfv( face, pname, params );
+        m_Issued++;
+        return true;
+    }
+
+    for( int f = firstFace; f <= lastFace && same; f++ )
+        for( int p = firstParam; p <= lastParam && same; p++ )
+            same = m_MaterialValid[ f ][ p ] &&
+                   memcmp( m_Material[ f ][ p ], params,
+                           size * sizeof( GLfloat ) ) == 0;
+    if( same )
+    {
+        m_Dropped++;
+        return false;
+    }
+
+    glMaterialfv( face, pname, params );
+    for( int f = firstFace; f <= lastFace; f++ )
+        for( int p = firstParam; p <= lastParam; p++ )
+        {
+            memcpy( m_Material[ f ][ p ], params, size * sizeof( GLfloat ) );
+            m_MaterialValid[ f ][ p ] = true;
+        }
+    m_Issued++;
+    return true;
+}
+
+/* --------------------------------------------------------------------------
+ *  setCheckInterval & endFrame
+ * -------------------------------------------------------------------------- */
+void StateManager::setCheckInterval( int frames )
+{
+    m_CheckInterval = frames;
+    m_FramesToCheck = 0;
+}
+
+void StateManager::endFrame()
+{
+    if( m_CheckInterval <= 0 )
+        return;
+    if( --m_FramesToCheck <= 0 )
+    {
+        check();
+        m_FramesToCheck = m_CheckInterval;
+    }
+}
+
+/* --------------------------------------------------------------------------
+ *  check
+ *
+ *  Only values with a valid shadow copy are compared.
+ * -------------------------------------------------------------------------- */
+bool StateManager::check()
+{
+    bool    ok = true;
+    GLint   value;
+
+    for( int i = 0; i < CAP_COUNT; i++ )
+    {
+        bool state = glIsEnabled( s_Caps[ i ] ) == GL_TRUE;
+        if( m_EnabledValid[ i ] && m_Enabled[ i ] != state )
+        {
+            fprintf( stderr, "StateManager: capability 0x%x is %d, "
+                     "expected %d\n", s_Caps[ i ], state, m_Enabled[ i ] );
+            m_Enabled[ i ] = state;
+            ok = false;
+        }
+    }
+
+    glGetIntegerv( GL_SHADE_MODEL, &value );
+    if( m_ShadeModel != 0 && m_ShadeModel != ( GLenum )value )
+    {
+        fprintf( stderr, "StateManager: shade model is 0x%x, expected 0x%x\n",
+                 value, m_ShadeModel );
+        m_ShadeModel = value;
+        ok = false;
+    }
+
+    glGetIntegerv( GL_TEXTURE_BINDING_2D, &value );
+    if( m_Texture != ~0u && m_Texture != ( GLuint )value )
+    {
+        fprintf( stderr, "StateManager: bound texture is %d, expected %u\n",
+                 value, m_Texture );
+        m_Texture = value;
+        ok = false;
+    }
+
+    for( int f = 0; f < FACE_COUNT; f++ )
+        for( int p = 0; p < PARAM_COUNT; p++ )
+        {
+            GLfloat actual[ 4 ];
+            int     size = s_Params[ p ] == GL_SHININESS ? 1 : 4;
+
+            if( !m_MaterialValid[ f ][ p ] )
+                continue;
+            glGetMaterialfv( s_Faces[ f ], s_Params[ p ], actual );
+            for( int k = 0; k < size; k++ )
+            {
+                if( fabs( actual[ k ] - m_Material[ f ][ p ][ k ] ) > 1e-4f )
+                {
+                    fprintf( stderr, "StateManager: material 0x%x of face "
+                             "0x%x differs\n", s_Params[ p ], s_Faces[ f ] );
+                    memcpy( m_Material[ f ][ p ], actual, sizeof( actual ) );
+                    ok = false;
+                    break;
+                }
+            }
+        }
+
+    return ok;
+}
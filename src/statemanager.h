@@ -0,0 +1,88 @@
+/* --------------------------------------------------------------------------
+ * statemanager.h
+ *
+ * Shadow copy of the fixed-function GL state, used for dropping calls that
+ * would not change anything.
+ *
+ * -------------------------------------------------------------------------- */
+
+#ifndef STATEMANAGER_H
+#define STATEMANAGER_H
+
+#include <QGLWidget>
+
+/* --------------------------------------------------------------------------
+ *  StateManager
+ *
+ *  Singleton class through which all enable/disable, shade model, texture
+ *  binding and material calls are made. The shadow state only stays valid
+ *  if nothing changes that state behind its back, so it must be
+ *  invalidated when the context is created and after any GL code that does
+ *  not use it.
+ *
+ *  In debug mode the shadow state is compared against glGet every
+ *  checkInterval frames. Differences are reported and the shadow state is
+ *  corrected.
+ * -------------------------------------------------------------------------- */
+class StateManager
+{
+private:
+    enum { CAP_COUNT = 6, FACE_COUNT = 2, PARAM_COUNT = 5 };
+
+    /* Handles own static pointer. */
+    static StateManager *m_pInstance;
+
+    /* Tracked capabilities, see capIndex(). */
+    bool                m_Enabled[ CAP_COUNT ];
+    bool                m_EnabledValid[ CAP_COUNT ];
+    GLenum              m_ShadeModel;
+    GLuint              m_Texture;
+    GLfloat             m_Material[ FACE_COUNT ][ PARAM_COUNT ][ 4 ];
+    bool                m_MaterialValid[ FACE_COUNT ][ PARAM_COUNT ];
+
+    int                 m_CheckInterval;
+    int                 m_FramesToCheck;
+    unsigned int        m_Issued;
+    unsigned int        m_Dropped;
+
+    /* Prevent outside calling of ctor, copy-ctor and assignment operator. */
+    StateManager();
+    StateManager( const StateManager & );
+    StateManager& operator=( const StateManager & );
+
+public:
+    static StateManager* getInstance();
+
+    /* Forgets all of the shadow state. The next call of each kind is always
+     * passed on to GL. */
+    void        invalidate();
+
+    /* Each returns true if the call was passed on to GL. */
+    bool        enable( GLenum cap ) { return setEnabled( cap, true ); }
+    bool        disable( GLenum cap ) { return setEnabled( cap, false ); }
+    bool        setEnabled( GLenum cap, bool state );
+    bool        shadeModel( GLenum mode );
+    /* Binds a GL_TEXTURE_2D texture on the active texture unit. */
+    bool        bindTexture( GLuint id );
+    bool        materialfv( GLenum face, GLenum pname, const GLfloat *params );
+    bool        materialf( GLenum face, GLenum pname, GLfloat param )
+                          { return materialfv( face, pname, &param ); }
+
+    /* Number of calls passed on to GL and dropped since startup. */
+    unsigned int issuedCount() const { return m_Issued; }
+    unsigned int droppedCount() const { return m_Dropped; }
+
+    /* Frames between debug checks, 0 disables them. Checking is on by
+     * default in debug builds. */
+    void        setCheckInterval( int frames );
+    /* Called by the Renderer after each frame. */
+    void        endFrame();
+    /* Compares the shadow state against glGet. Returns false and fixes the
+     * shadow state if they differ. */
+    bool        check();
+
+private:
+    static int  capIndex( GLenum cap );
+};
+
+#endif /* STATEMANAGER_H */
@@ -0,0 +1,132 @@
+/* --------------------------------------------------------------------------
+ * transformhierarchy.cpp
+ *
+ * Implementation of the TransformHierarchy class.
+ *
+ * -------------------------------------------------------------------------- */
+
+#include "transformhierarchy.h"
+#include <cassert>
+
+TransformHierarchy::TransformHierarchy() :
+    m_NeedsUpdate( false )
+{
+}
+
+/* --------------------------------------------------------------------------
+ *  addNode, clear, setLocal & setBounds
+ * -------------------------------------------------------------------------- */
+int TransformHierarchy::addNode( int parent, const Matrix4f &local,
+                                 const BoundingBox &bounds )
+{
+    assert( parent >= NO_PARENT && parent < size() );
+
+    m_Parents.push_back( parent );
+    m_Local.push_back( local );
+    m_World.push_back( local );
+    m_Bounds.push_back( bounds );
+    m_WorldBounds.push_back( BoundingBox() );
+    m_Changed.push_back( true );
+    m_NeedsUpdate = true;
+
+    return size() - 1;
+}
+
+void TransformHierarchy::clear()
+{
+    m_Parents.clear();
+    m_Local.clear();
+    m_World.clear();
+    m_Bounds.clear();
+    m_WorldBounds.clear();
+    m_Changed.clear();
+    m_NeedsUpdate = false;
+}
+
+void TransformHierarchy::setLocal( int node, const Matrix4f &local )
+{
+    m_Local[ node ] = local;
+    m_Changed[ node ] = true;
+    m_NeedsUpdate = true;
+}
+
+void TransformHierarchy::setBounds( int node, const BoundingBox &bounds )
+{
+    m_Bounds[ node ] = bounds;
+    m_Changed[ node ] = true;
+    m_NeedsUpdate = true;
+}
+
+/* --------------------------------------------------------------------------
+ *  update
+ *
+ *  A node has changed if it was changed itself or its parent has, which is
+ *  known by the time the node is reached. The flags are cleared in a second
+ *  pass, as the children still need them.
+ * -------------------------------------------------------------------------- */
+void TransformHierarchy::update()
+{
+    if( !m_NeedsUpdate )
+        return;
+
+    const int count = size();
+    for( int node = 0; node < count; node++ )
+    {
+        int parent = m_Parents[ node ];
+        if( parent != NO_PARENT && m_Changed[ parent ] )
+            m_Changed[ node ] = true;
+        if( !m_Changed[ node ] )
+            continue;
+
+        m_World[ node ] = parent == NO_PARENT ?
+                          m_Local[ node ] :
+                          m_World[ parent ] * m_Local[ node ];
+        m_WorldBounds[ node ] = m_Bounds[ node ].isEmpty() ?
+                                BoundingBox() :
+                                m_Bounds[ node ].transformed( m_World[ node ] );
+    }
+
+    m_Changed.assign( count, false );
+    m_NeedsUpdate = false;
+}
+
+/* --------------------------------------------------------------------------
+ *  bounds & intersectRay
+ * -------------------------------------------------------------------------- */
+BoundingBox TransformHierarchy::bounds() const
+{
+    BoundingBox box;
+    for( int node = 0; node < size(); node++ )
+        if( !m_WorldBounds[ node ].isEmpty() )
+            box.extend( m_WorldBounds[ node ] );
+    return box;
+}
+
+/* Each node's bounds are tested in the node's own space, see
+ * BaseDrawable::intersectRay. */
+int TransformHierarchy::intersectRay( const Vector3f &origin,
+                                      const Vector3f &direction,
+                                      GLfloat &distance ) const
+{
+    int nearest = -1;
+
+    for( int node = 0; node < size(); node++ )
+    {
+        GLfloat hit;
+
+        if( m_Bounds[ node ].isEmpty() ||
+            !m_WorldBounds[ node ].intersectRay( origin, direction,
+                                                 distance, hit ) )
+            continue;
+
+        Matrix4f toLocal = m_World[ node ].affineInverse();
+        if( m_Bounds[ node ].intersectRay( toLocal.transformPoint( origin ),
+                                           toLocal.transformVector( direction ),
+                                           distance, hit ) )
+        {
+            distance = hit;
+            nearest = node;
+        }
+    }
+    return nearest;
+}
@@ -0,0 +1,75 @@
+/* --------------------------------------------------------------------------
+ * transformhierarchy.h
+ *
+ * Parent/child transformations of the parts of an articulated drawable.
+ *
+ * -------------------------------------------------------------------------- */
+
+#ifndef TRANSFORMHIERARCHY_H
+#define TRANSFORMHIERARCHY_H
+
+#include "renderer.h"
+#include <vector>
+
+/* --------------------------------------------------------------------------
+ *  TransformHierarchy
+ *
+ *  Nodes with a transformation relative to their parent and optional
+ *  bounds in their own space. The nodes are kept in flat arrays in which a
+ *  parent always comes before its children, so update() brings every world
+ *  matrix up to date in one pass from first to last. Only nodes whose local
+ *  transformation has changed, and their descendants, are recomputed.
+ *
+ *  World matrices are relative to whatever the roots are placed in; a
+ *  drawable sets the local transformation of its root to its own world
+ *  matrix.
+ * -------------------------------------------------------------------------- */
+class TransformHierarchy
+{
+public:
+    enum { NO_PARENT = -1 };
+
+    TransformHierarchy();
+
+    /* Appends a node and returns its index. parent is NO_PARENT or an
+     * existing node. Nodes with empty bounds are not hit by rays and do not
+     * add to bounds(). */
+    int         addNode( int parent, const Matrix4f &local = Matrix4f(),
+                         const BoundingBox &bounds = BoundingBox() );
+    void        clear();
+
+    void        setLocal( int node, const Matrix4f &local );
+    void        setBounds( int node, const BoundingBox &bounds );
+
+    int             size() const { return m_Parents.size(); }
+    int             getParent( int node ) const { return m_Parents[ node ]; }
+    const Matrix4f  &getLocal( int node ) const { return m_Local[ node ]; }
+
+    /* Recomputes the world matrices and bounds of the changed nodes. */
+    void        update();
+    bool        needsUpdate() const { return m_NeedsUpdate; }
+
+    /* Valid after update(). */
+    const Matrix4f      &getWorld( int node ) const { return m_World[ node ]; }
+    const BoundingBox   &getWorldBounds( int node ) const
+                        { return m_WorldBounds[ node ]; }
+    /* Union of the world bounds of the nodes. */
+    BoundingBox         bounds() const;
+    /* Node whose bounds the ray hits nearest and closer than distance, or
+     * -1. distance is set to the hit. */
+    int                 intersectRay( const Vector3f &origin,
+                                      const Vector3f &direction,
+                                      GLfloat &distance ) const;
+
+private:
+    std::vector< int >          m_Parents;
+    std::vector< Matrix4f >     m_Local;
+    std::vector< Matrix4f >     m_World;
+    std::vector< BoundingBox >  m_Bounds;
+    std::vector< BoundingBox >  m_WorldBounds;
+    /* Set for the nodes changed since the last update(). */
+    std::vector< bool >         m_Changed;
+    bool                        m_NeedsUpdate;
+};
+
+#endif /* TRANSFORMHIERARCHY_H */
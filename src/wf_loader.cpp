@@ -3,160 +3,1172 @@
 #include <vector>
 #include <iostream>
 #include <cassert>
+#include <QFile>
+#include <QFileInfo>
+#include <QTemporaryFile>
+#include <QDateTime>
+#include <QThread>
+#include <QThreadPool>
+#include <QRunnable>
 #include "wf_loader.h"
+#include "meshsimplifier.h"
 
 using namespace std;
 
-bool WFLoader::load( const char *filepath, FileType type )
+/* --------------------------------------------------------------------------
+ *  Tokenizer helpers
+ *
+ *  The OBJ data is parsed straight from the mapped file. The data handed to
+ *  the tokenizers always ends in a newline, which none of them skip over, so
+ *  they can run without checking for the end of the buffer.
+ * -------------------------------------------------------------------------- */
+static inline bool isBlank( char c )
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline const char *skipBlanks( const char *p )
+{
+    while( isBlank( *p ) ) ++p;
+    return p;
+}
+
+static inline const char *skipLine( const char *p, const char *end )
+{
+    const char *nl = ( const char * )memchr( p, '\n', end - p );
+    return nl != NULL ? nl + 1 : end;
+}
+
+/* Powers of ten used by parseFloat, 1e0 ... 1e22 are exact in a double. */
+static const double s_Pow10[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+/* Scales the mantissa by 10^exponent. Exponents within the table are
+ * applied with a single multiplication or division, which keeps the result
+ * correctly rounded for the usual 6-9 digit values of OBJ files. */
+static inline double scaleByPow10( double value, int exponent )
+{
+    while( exponent > 22 )
+    {
+        value *= 1e22;
+        exponent -= 22;
+    }
+    while( exponent < -22 )
+    {
+        value /= 1e22;
+        exponent += 22;
+    }
+    return exponent >= 0 ? value * s_Pow10[ exponent ]
+                         : value / s_Pow10[ -exponent ];
+}
+
+/* Parses an integer. Returns false if no digits were found. */
+static inline bool parseInt( const char *&p, int &value )
 {
-    FILE        *pFile;
-    int         c;
-    int         i = 0;
-    /* Max line width 100 */
-    char        line[ 100 ] = "\0";
+    bool        negative = false;
+    unsigned    digit;
+    int         result;
 
-    pFile = fopen( filepath, "r" );
-    if( pFile != NULL )
+    if( *p == '-' || *p == '+' )
+        negative = *p++ == '-';
+
+    if( ( digit = ( unsigned )( *p - '0' ) ) > 9 )
+        return false;
+
+    result = digit;
+    while( ( digit = ( unsigned )( *++p - '0' ) ) <= 9 )
+        result = result * 10 + digit;
+
+    value = negative ? -result : result;
+    return true;
+}
+
+/* Parses a decimal floating point number with an optional exponent.
+ * Up to 19 significant digits are accumulated into an integer mantissa,
+ * which is then scaled once by a power of ten. */
+static inline bool parseFloat( const char *&p, float &value )
+{
+    bool                negative = false;
+    unsigned long long  mantissa = 0;
+    unsigned            digit;
+    int                 digits = 0;
+    int                 exponent = 0;
+    const char          *start;
+
+    if( *p == '-' || *p == '+' )
+        negative = *p++ == '-';
+    start = p;
+
+    for( ; ( digit = ( unsigned )( *p - '0' ) ) <= 9; ++p )
     {
-        while( ( c = fgetc( pFile ) ) != EOF )
+        if( digits < 19 )
         {
-            if( c != '\n' && i < 99 )
-            {
-                line[ i++ ] = c;
-            }
-            else
+            mantissa = mantissa * 10 + digit;
+            if( mantissa != 0 ) ++digits;
+        }
+        else
+        {
+            ++exponent;
+        }
+    }
+    if( *p == '.' )
+    {
+        for( ++p; ( digit = ( unsigned )( *p - '0' ) ) <= 9; ++p )
+        {
+            if( digits < 19 )
             {
-                line[ i ] = '\0';
-                switch( type )
-                {
-                case OBJ_FILE:
-                    parseObjectFile( line );
-                    break;
-                case MTL_FILE:
-                    parseMaterialFile( line );
-                    break;
-                default:
-                    assert( 0 );
-                }
-                line[ 0 ] = '\0';
-                i = 0;
+                mantissa = mantissa * 10 + digit;
+                if( mantissa != 0 ) ++digits;
+                --exponent;
             }
         }
-        fclose( pFile );
+    }
+    if( p == start || ( p == start + 1 && *start == '.' ) )
+        return false;
+
+    if( *p == 'e' || *p == 'E' )
+    {
+        const char  *save = p++;
+        int         e;
+        if( parseInt( p, e ) ) exponent += e;
+        else p = save;
+    }
+
+    double result = ( double )mantissa;
+    if( exponent != 0 && mantissa != 0 )
+        result = scaleByPow10( result, exponent );
+
+    value = ( float )( negative ? -result : result );
+    return true;
+}
+
+/* Parses up to three floats of a 'v', 'vn' or 'vt' line. Missing values are
+ * left to zero. */
+static inline Vector3f parseVector( const char *&p )
+{
+    float       xyz[ 3 ] = { 0, 0, 0 };
+
+    for( int i = 0; i < 3; i++ )
+    {
+        p = skipBlanks( p );
+        if( !parseFloat( p, xyz[ i ] ) )
+            break;
+    }
+    return Vector3f( xyz[ 0 ], xyz[ 1 ], xyz[ 2 ] );
+}
+
+/* Converts a WaveFront index to the 1-based absolute index used in
+ * ModelData. Negative indices are relative to the end of the list. */
+static inline int resolveIndex( int index, size_t count )
+{
+    return index < 0 ? ( int )count + index + 1 : index;
+}
+
+/* --------------------------------------------------------------------------
+ *  hashBytes
+ *
+ *  64-bit content hash used to key the mesh cache. Consumes 32 bytes per
+ *  round in four independent lanes, in the manner of xxHash, so that hashing
+ *  stays well below the cost of parsing the same data.
+ * -------------------------------------------------------------------------- */
+static const quint64 HASH_PRIME1 = Q_UINT64_C( 11400714785074694791 );
+static const quint64 HASH_PRIME2 = Q_UINT64_C( 14029467366897019727 );
+static const quint64 HASH_PRIME3 = Q_UINT64_C( 1609587929392839161 );
+static const quint64 HASH_PRIME4 = Q_UINT64_C( 9650029242287828579 );
+
+static inline quint64 rotl64( quint64 x, int r )
+{
+    return ( x << r ) | ( x >> ( 64 - r ) );
+}
+
+static inline quint64 readWord( const char *p )
+{
+    quint64 w;
+    memcpy( &w, p, sizeof( w ) );
+    return w;
+}
+
+static inline quint64 hashRound( quint64 acc, quint64 word )
+{
+    return rotl64( acc + word * HASH_PRIME2, 31 ) * HASH_PRIME1;
+}
+
+static quint64 hashBytes( const char *data, size_t size )
+{
+    const char  *p = data;
+    const char  *end = data + size;
+    quint64     h;
+
+    if( size >= 32 )
+    {
+        quint64 lane[ 4 ] = { HASH_PRIME1 + HASH_PRIME2, HASH_PRIME2, 0,
+                              ( quint64 )0 - HASH_PRIME1 };
+        for( ; p + 32 <= end; p += 32 )
+        {
+            lane[ 0 ] = hashRound( lane[ 0 ], readWord( p ) );
+            lane[ 1 ] = hashRound( lane[ 1 ], readWord( p + 8 ) );
+            lane[ 2 ] = hashRound( lane[ 2 ], readWord( p + 16 ) );
+            lane[ 3 ] = hashRound( lane[ 3 ], readWord( p + 24 ) );
+        }
+        h = rotl64( lane[ 0 ], 1 ) + rotl64( lane[ 1 ], 7 ) +
+            rotl64( lane[ 2 ], 12 ) + rotl64( lane[ 3 ], 18 );
+        for( int i = 0; i < 4; i++ )
+            h = ( h ^ hashRound( 0, lane[ i ] ) ) * HASH_PRIME1 + HASH_PRIME4;
+    }
+    else
+    {
+        h = HASH_PRIME3;
+    }
+
+    h += size;
+    for( ; p + 8 <= end; p += 8 )
+        h = rotl64( h ^ hashRound( 0, readWord( p ) ), 27 ) * HASH_PRIME1 +
+            HASH_PRIME4;
+    for( ; p < end; ++p )
+        h = rotl64( h ^ ( ( unsigned char )*p * HASH_PRIME3 ), 11 ) *
+            HASH_PRIME1;
+
+    /* Final avalanche. */
+    h ^= h >> 33;
+    h *= HASH_PRIME2;
+    h ^= h >> 29;
+    h *= HASH_PRIME3;
+    h ^= h >> 32;
+    return h;
+}
+
+/* --------------------------------------------------------------------------
+ *  load
+ *
+ *  Memory maps the given file and parses it in place.
+ * -------------------------------------------------------------------------- */
+bool WFLoader::load( const char *filepath, FileType type )
+{
+    QFile       file( filepath );
+    const char  *data;
+    qint64      size;
+
+    if( !file.open( QFile::ReadOnly ) )
+        return false;
+
+    size = file.size();
+    if( size == 0 )
         return true;
+
+    data = ( const char * )file.map( 0, size );
+    if( data == NULL )
+        return false;
+
+    switch( type )
+    {
+    case OBJ_FILE:
+    {
+        /* Use the binary cache if it matches the file, otherwise parse the
+         * text and write a new cache. */
+        QString     cachePath;
+        qint64      time = QFileInfo( filepath ).lastModified().toTime_t();
+
+        if( m_CacheEnabled && m_LoadedData.vertices.empty() &&
+            m_LoadedData.vertexFaces.empty() )
+            cachePath = cachePathFor( filepath );
+        if( cachePath.isEmpty() || !readCache( cachePath, data, size, time ) )
+        {
+            parseObjectFile( data, data + size );
+            weldVertices();
+            m_OptimizeStats = MeshOptimizerStats();
+            if( m_OptimizeMesh )
+                m_OptimizeStats = MeshOptimizer::optimize( m_LoadedData );
+            if( m_BuildLods )
+                MeshSimplifier::buildLods( m_LoadedData );
+            if( !cachePath.isEmpty() )
+                writeCache( cachePath, filepath, hashBytes( data, size ),
+                            time, size );
+        }
+        break;
     }
-    return false;
+    case MTL_FILE:
+    {
+        /* Material files are small, hand them over one line at a time. */
+        const char  *p = data;
+        const char  *end = data + size;
+        std::string line;
+        while( p < end )
+        {
+            const char *next = skipLine( p, end );
+            const char *eol = next;
+            while( eol > p && ( eol[ -1 ] == '\n' || eol[ -1 ] == '\r' ) )
+                --eol;
+            line.assign( p, eol - p );
+            parseMaterialFile( line.c_str() );
+            p = next;
+        }
+        break;
+    }
+    default:
+        assert( 0 );
+    }
+
+    file.unmap( ( uchar * )data );
+    file.close();
+    return true;
 }
 
-void WFLoader::parseObjectFile( const char *line )
+/* --------------------------------------------------------------------------
+ *  ObjChunk
+ *
+ *  Result of parsing one newline aligned slice of an OBJ file. Relative
+ *  (negative) indices can only be resolved against the chunk's own lists
+ *  while parsing, so their positions are recorded and the sizes of the
+ *  preceding chunks are added to them when the chunks are merged.
+ * -------------------------------------------------------------------------- */
+struct ObjChunk
 {
-    char        tempStr[20] = "\0";
-    float       x, y, z;
-    int         v1 = -1, v2, v3;
-    int         t1 = -1, t2, t3;
-    int         n1 = -1, n2, n3;
-    char        *pStr = NULL;
+    const char                  *begin;
+    const char                  *end;
+    ModelData                   data;
+    std::vector< size_t >       vertexFixups;
+    std::vector< size_t >       normalFixups;
+    std::vector< size_t >       textureFixups;
+    /* Last smoothing group seen, -1 if the chunk has no 's' lines. */
+    int                         smoothing;
+    std::vector< std::string >  materialLibs;
 
-    if( strlen( line ) > 0 )
+    /* Prefix sums: where this chunk's lists start in the merged data. */
+    size_t                      vertexOffset;
+    size_t                      normalOffset;
+    size_t                      textureOffset;
+    size_t                      vertexFaceOffset;
+    size_t                      normalFaceOffset;
+    size_t                      textureFaceOffset;
+
+    ObjChunk() : begin( NULL ), end( NULL ), smoothing( -1 ) {}
+};
+
+/* Vertex, texture and normal index of a face corner. */
+struct Corner
+{
+    int         index[ 3 ];
+    bool        relative[ 3 ];
+};
+
+/* Smallest slice of a file worth handing to a thread of its own. */
+static const qint64 MIN_CHUNK_SIZE = 1 << 20;
+
+/* --------------------------------------------------------------------------
+ *  reserveChunk
+ *
+ *  Counts the element lines of the chunk and reserves room for them, so
+ *  that its vectors are not reallocated while parsing.
+ * -------------------------------------------------------------------------- */
+static void reserveChunk( ObjChunk &chunk )
+{
+    size_t      vertices = 0, normals = 0, textureCoords = 0, faces = 0;
+    const char  *p = chunk.begin;
+    const char  *end = chunk.end;
+
+    while( p < end )
     {
-        if( line[ 0 ] == 'm' )
+        if( p[ 0 ] == 'v' )
         {
-            sscanf( line, "%s", tempStr );
-            /* Material library file information */
-            if( strcmp( tempStr, "mtllib" ) == 0 )
-            {
-                sscanf( line, "%*s %s", tempStr );
-                load( tempStr, MTL_FILE );
-            }
+            if( p[ 1 ] == 'n' ) ++normals;
+            else if( p[ 1 ] == 't' ) ++textureCoords;
+            else ++vertices;
+        }
+        else if( p[ 0 ] == 'f' )
+        {
+            ++faces;
         }
+        p = skipLine( p, end );
+    }
+
+    chunk.data.vertices.reserve( vertices );
+    chunk.data.normals.reserve( normals );
+    chunk.data.textureCoords.reserve( textureCoords );
+    chunk.data.vertexFaces.reserve( 3 * faces );
+    if( textureCoords > 0 )
+        chunk.data.textureFaces.reserve( 3 * faces );
+    if( normals > 0 )
+        chunk.data.normalFaces.reserve( 3 * faces );
+}
+
+/* --------------------------------------------------------------------------
+ *  parseChunk
+ *
+ *  Parses the OBJ data of a chunk. The data must end in a newline. Faces
+ *  with more than three corners are split into a triangle fan. Once a face
+ *  of the chunk has texture or normal indices, that list is kept as long
+ *  as the vertex list, with 0 for the corners that have none.
+ * -------------------------------------------------------------------------- */
+static void parseChunk( ObjChunk &chunk )
+{
+    const char  *p = chunk.begin;
+    const char  *end = chunk.end;
+    ModelData   &data = chunk.data;
+    /* Corners of the face being parsed, fan triangulated as they arrive. */
+    Corner      face[ 3 ];
+    int         corners;
+    size_t      listSize[ 3 ];
+    bool        hasTexture, hasNormal;
+
+    reserveChunk( chunk );
+
+    while( p < end )
+    {
+        p = skipBlanks( p );
+
+        switch( *p )
+        {
         /* Vertex information
          */
-        else if( line[ 0 ] == 'v' )
-        {
-            /* What type of data. */
-            switch( line[ 1 ] )
+        case 'v':
+            switch( p[ 1 ] )
             {
             /* Vertex coordinates */
             case ' ':
-                sscanf( line, "%*s %f %f %f", &x, &y, &z );
-                m_LoadedData.vertices.push_back( Vector3f( x, y, z ) );
+            case '\t':
+                p += 1;
+                data.vertices.push_back( parseVector( p ) );
                 break;
             /* Normal vectors */
             case 'n':
-                sscanf( line, "%*s %f %f %f", &x, &y, &z );
-                m_LoadedData.normals.push_back( Vector3f( x, y, z ) );
+                p += 2;
+                data.normals.push_back( parseVector( p ) );
                 break;
             /* Texture coordinates */
             case 't':
-                sscanf( line, "%*s %f %f", &x, &y );
-                m_LoadedData.textureCoords.push_back( Vector3f( x, y, 0 ) );
+            {
+                p += 2;
+                Vector3f uv = parseVector( p );
+                ModelData::TexCoord texCoord = { uv.x, uv.y };
+                data.textureCoords.push_back( texCoord );
                 break;
+            }
             default:
                 break;
             }
-        }
-        /* Shading information
-         */
-        else if( line[ 0 ] == 's' )
-        {
-            sscanf( line, "%*c %d", &v2 );
-            if( v2 > 0 ) m_LoadedData.isSmoothShaded = true;
-            else m_LoadedData.isSmoothShaded = false;
-        }
+            break;
+
         /* Face information
          */
-        else if( line[ 0 ] == 'f' )
-        {
-            sscanf( line, "%*c %s", tempStr );
-
-            /* Check which ones of the possible vertex/texture/normal indice
-               information is available. */
-            if( ( pStr = strchr( tempStr, '/' ) ) != NULL )
+        case 'f':
+            if( !isBlank( p[ 1 ] ) ) break;
+            p += 1;
+            corners = 0;
+            hasTexture = hasNormal = false;
+            listSize[ 0 ] = data.vertices.size();
+            listSize[ 1 ] = data.textureCoords.size();
+            listSize[ 2 ] = data.normals.size();
+            for( ;; )
             {
-                if( strchr( pStr+1, '/' ) != NULL )
+                Corner c = { { 0, 0, 0 }, { false, false, false } };
+
+                p = skipBlanks( p );
+                if( !parseInt( p, c.index[ 0 ] ) ) break;
+
+                /* Optional texture and normal indices: v/t, v//n or v/t/n. */
+                if( *p == '/' )
                 {
-                    /* Vertex and normal indices available,
-                       no texture indices. */
-                    if( *(pStr + 1) == '/' )
+                    ++p;
+                    hasTexture |= parseInt( p, c.index[ 1 ] );
+                    if( *p == '/' )
                     {
-                        sscanf( line, "%*c %d%*2c%d %d%*2c%d %d%*2c%d", &v1, &n1, &v2, &n2, &v3, &n3 );
+                        ++p;
+                        hasNormal |= parseInt( p, c.index[ 2 ] );
                     }
-                    /* Vertex, texture and normal indices available. */
-                    else
+                }
+
+                for( int k = 0; k < 3; k++ )
+                {
+                    if( c.index[ k ] < 0 )
                     {
-                        sscanf( line, "%*c %d%*c%d%*c%d %d%*c%d%*c%d %d%*c%d%*c%d",
-                                &v1, &t1, &n1, &v2, &t2, &n2, &v3, &t3, &n3 );
+                        c.index[ k ] = resolveIndex( c.index[ k ], listSize[ k ] );
+                        c.relative[ k ] = true;
                     }
                 }
-                /* Vertex and texture indices available, no normal indices. */
+
+                if( corners < 3 )
+                {
+                    face[ corners++ ] = c;
+                }
                 else
                 {
-                    scanf( line, "%*c %d%*c%d %d%*c%d %d%*c%d", &v1, &t1, &v2, &t2, &v3, &t3 );
+                    /* Start the next triangle of the fan. */
+                    face[ 1 ] = face[ 2 ];
+                    face[ 2 ] = c;
+                }
+
+                if( corners == 3 )
+                {
+                    /* Save face data. */
+                    for( int i = 0; i < 3; i++ )
+                    {
+                        if( face[ i ].relative[ 0 ] )
+                            chunk.vertexFixups.push_back( data.vertexFaces.size() );
+                        data.vertexFaces.push_back( face[ i ].index[ 0 ] );
+                    }
+                    if( hasTexture || !data.textureFaces.empty() )
+                    {
+                        data.textureFaces.resize( data.vertexFaces.size() - 3, 0 );
+                        for( int i = 0; i < 3; i++ )
+                        {
+                            if( face[ i ].relative[ 1 ] )
+                                chunk.textureFixups.push_back( data.textureFaces.size() );
+                            data.textureFaces.push_back( face[ i ].index[ 1 ] );
+                        }
+                    }
+                    if( hasNormal || !data.normalFaces.empty() )
+                    {
+                        data.normalFaces.resize( data.vertexFaces.size() - 3, 0 );
+                        for( int i = 0; i < 3; i++ )
+                        {
+                            if( face[ i ].relative[ 2 ] )
+                                chunk.normalFixups.push_back( data.normalFaces.size() );
+                            data.normalFaces.push_back( face[ i ].index[ 2 ] );
+                        }
+                    }
                 }
             }
-            /* Only vertex indices available. */
-            else
-            {
-                scanf( line, "%*c %d %d %d", &v1, &v2, &v3 );
-            }
-            /* Save face data. */
-            m_LoadedData.vertexFaces.push_back( v1 );
-            m_LoadedData.vertexFaces.push_back( v2 );
-            m_LoadedData.vertexFaces.push_back( v3 );
-            if( t1 != -1 )
+            break;
+
+        /* Shading information
+         */
+        case 's':
+        {
+            int group = 0;
+            p = skipBlanks( p + 1 );
+            if( !parseInt( p, group ) ) group = 0;
+            chunk.smoothing = group;
+            break;
+        }
+
+        /* Material library file information */
+        case 'm':
+            if( strncmp( p, "mtllib", 6 ) == 0 &&
+                isBlank( p[ 6 ] ) )
             {
-                m_LoadedData.textureFaces.push_back( t1 );
-                m_LoadedData.textureFaces.push_back( t2 );
-                m_LoadedData.textureFaces.push_back( t3 );
+                const char *name = skipBlanks( p + 6 );
+                const char *nameEnd = skipLine( name, end );
+                while( nameEnd > name && ( isBlank( nameEnd[ -1 ] ) ||
+                                           nameEnd[ -1 ] == '\n' ) )
+                    --nameEnd;
+                if( nameEnd > name )
+                    chunk.materialLibs.push_back( std::string( name, nameEnd ) );
+                p = nameEnd;
             }
-            if( n1 != -1 )
+            break;
+
+        default:
+            break;
+        }
+
+        /* The parsers above stop at the newline, skip whatever is left. */
+        p = *p == '\n' ? p + 1 : skipLine( p, end );
+    }
+}
+
+/* --------------------------------------------------------------------------
+ *  copyChunk
+ *
+ *  Copies the lists of a chunk to their place in the merged data and adds
+ *  the preceding list sizes to the relative indices. The merged vectors must
+ *  already be resized.
+ * -------------------------------------------------------------------------- */
+template< typename T >
+static inline void copyList( const std::vector< T > &from,
+                             std::vector< T > &to, size_t offset )
+{
+    if( !from.empty() )
+        memcpy( &to[ offset ], &from[ 0 ], from.size() * sizeof( T ) );
+}
+
+static inline void fixIndices( const std::vector< size_t > &fixups,
+                               std::vector< int > &faces, size_t faceOffset,
+                               size_t listOffset )
+{
+    for( size_t i = 0; i < fixups.size(); i++ )
+        faces[ faceOffset + fixups[ i ] ] += ( int )listOffset;
+}
+
+static void copyChunk( const ObjChunk &chunk, ModelData &target )
+{
+    const ModelData &data = chunk.data;
+
+    copyList( data.vertices, target.vertices, chunk.vertexOffset );
+    copyList( data.normals, target.normals, chunk.normalOffset );
+    copyList( data.textureCoords, target.textureCoords, chunk.textureOffset );
+    copyList( data.vertexFaces, target.vertexFaces, chunk.vertexFaceOffset );
+    copyList( data.normalFaces, target.normalFaces, chunk.normalFaceOffset );
+    copyList( data.textureFaces, target.textureFaces, chunk.textureFaceOffset );
+
+    fixIndices( chunk.vertexFixups, target.vertexFaces,
+                chunk.vertexFaceOffset, chunk.vertexOffset );
+    fixIndices( chunk.normalFixups, target.normalFaces,
+                chunk.normalFaceOffset, chunk.normalOffset );
+    fixIndices( chunk.textureFixups, target.textureFaces,
+                chunk.textureFaceOffset, chunk.textureOffset );
+}
+
+/* --------------------------------------------------------------------------
+ *  ParseTask & MergeTask
+ *
+ *  Thread pool jobs for parsing a chunk and for copying it into the merged
+ *  data.
+ * -------------------------------------------------------------------------- */
+class ParseTask : public QRunnable
+{
+private:
+    ObjChunk    *m_pChunk;
+
+public:
+    ParseTask( ObjChunk *chunk ) : m_pChunk( chunk ) {}
+    void run() { parseChunk( *m_pChunk ); }
+};
+
+class MergeTask : public QRunnable
+{
+private:
+    const ObjChunk  *m_pChunk;
+    ModelData       *m_pTarget;
+
+public:
+    MergeTask( const ObjChunk *chunk, ModelData *target ) :
+        m_pChunk( chunk ), m_pTarget( target ) {}
+    void run() { copyChunk( *m_pChunk, *m_pTarget ); }
+};
+
+/* --------------------------------------------------------------------------
+ *  parseObjectFile
+ *
+ *  Splits the OBJ data at newline boundaries into one chunk per thread,
+ *  parses the chunks on a thread pool and merges them into m_LoadedData in
+ *  file order. The result is the same for any number of threads.
+ * -------------------------------------------------------------------------- */
+void WFLoader::parseObjectFile( const char *begin, const char *end )
+{
+    std::vector< ObjChunk >     chunks;
+    std::string                 lastLine;
+    const char                  *tail = end;
+    int                         threads = m_ThreadCount;
+    qint64                      chunkSize;
+
+    /* Everything up to the last newline is parsed in place. A last line
+     * without a newline is copied and terminated. */
+    while( tail > begin && tail[ -1 ] != '\n' )
+        --tail;
+
+    if( threads <= 0 )
+        threads = QThread::idealThreadCount();
+    threads = qMax( 1, qMin< int >( threads, ( tail - begin ) / MIN_CHUNK_SIZE ) );
+    chunkSize = ( tail - begin ) / threads;
+
+    chunks.resize( threads + ( tail < end ? 1 : 0 ) );
+    for( int i = 0; i < threads; i++ )
+    {
+        chunks[ i ].begin = i == 0 ? begin : chunks[ i - 1 ].end;
+        chunks[ i ].end   = i == threads - 1 ? tail :
+                            skipLine( begin + ( i + 1 ) * chunkSize, tail );
+        if( chunks[ i ].end < chunks[ i ].begin )
+            chunks[ i ].end = chunks[ i ].begin;
+    }
+    if( tail < end )
+    {
+        lastLine.assign( tail, end );
+        lastLine += '\n';
+        chunks.back().begin = lastLine.data();
+        chunks.back().end   = lastLine.data() + lastLine.size();
+    }
+
+    /* Parse, the calling thread takes the first chunk. */
+    QThreadPool pool;
+    pool.setMaxThreadCount( threads );
+    for( size_t i = 1; i < chunks.size(); i++ )
+        pool.start( new ParseTask( &chunks[ i ] ) );
+    parseChunk( chunks[ 0 ] );
+    pool.waitForDone();
+
+    /* Merge. A single chunk can be handed over as is. */
+    if( chunks.size() == 1 && m_LoadedData.vertices.empty() &&
+        m_LoadedData.vertexFaces.empty() )
+    {
+        ModelData &data = chunks[ 0 ].data;
+        m_LoadedData.vertices.swap( data.vertices );
+        m_LoadedData.normals.swap( data.normals );
+        m_LoadedData.textureCoords.swap( data.textureCoords );
+        m_LoadedData.vertexFaces.swap( data.vertexFaces );
+        m_LoadedData.normalFaces.swap( data.normalFaces );
+        m_LoadedData.textureFaces.swap( data.textureFaces );
+    }
+    else
+    {
+        /* Chunks without texture or normal indices get zeros, if any
+         * other chunk has them, to keep the lists in step. */
+        bool hasTexture = !m_LoadedData.textureFaces.empty();
+        bool hasNormal = !m_LoadedData.normalFaces.empty();
+        for( size_t i = 0; i < chunks.size(); i++ )
+        {
+            hasTexture |= !chunks[ i ].data.textureFaces.empty();
+            hasNormal |= !chunks[ i ].data.normalFaces.empty();
+        }
+        for( size_t i = 0; i < chunks.size(); i++ )
+        {
+            ModelData &data = chunks[ i ].data;
+            if( hasTexture )
+                data.textureFaces.resize( data.vertexFaces.size(), 0 );
+            if( hasNormal )
+                data.normalFaces.resize( data.vertexFaces.size(), 0 );
+        }
+        if( hasTexture )
+            m_LoadedData.textureFaces.resize( m_LoadedData.vertexFaces.size(), 0 );
+        if( hasNormal )
+            m_LoadedData.normalFaces.resize( m_LoadedData.vertexFaces.size(), 0 );
+
+        ModelData &target = m_LoadedData;
+        for( size_t i = 0; i < chunks.size(); i++ )
+        {
+            ObjChunk &chunk = chunks[ i ];
+            chunk.vertexOffset      = target.vertices.size();
+            chunk.normalOffset      = target.normals.size();
+            chunk.textureOffset     = target.textureCoords.size();
+            chunk.vertexFaceOffset  = target.vertexFaces.size();
+            chunk.normalFaceOffset  = target.normalFaces.size();
+            chunk.textureFaceOffset = target.textureFaces.size();
+
+            target.vertices.resize( chunk.vertexOffset +
+                                    chunk.data.vertices.size() );
+            target.normals.resize( chunk.normalOffset +
+                                   chunk.data.normals.size() );
+            target.textureCoords.resize( chunk.textureOffset +
+                                         chunk.data.textureCoords.size() );
+            target.vertexFaces.resize( chunk.vertexFaceOffset +
+                                       chunk.data.vertexFaces.size() );
+            target.normalFaces.resize( chunk.normalFaceOffset +
+                                       chunk.data.normalFaces.size() );
+            target.textureFaces.resize( chunk.textureFaceOffset +
+                                        chunk.data.textureFaces.size() );
+        }
+
+        for( size_t i = 1; i < chunks.size(); i++ )
+            pool.start( new MergeTask( &chunks[ i ], &target ) );
+        copyChunk( chunks[ 0 ], target );
+        pool.waitForDone();
+    }
+
+    /* Smoothing and material libraries in file order. */
+    for( size_t i = 0; i < chunks.size(); i++ )
+    {
+        if( chunks[ i ].smoothing >= 0 )
+            m_LoadedData.isSmoothShaded = chunks[ i ].smoothing > 0;
+        for( size_t j = 0; j < chunks[ i ].materialLibs.size(); j++ )
+        {
+            m_MaterialLibs.push_back( chunks[ i ].materialLibs[ j ] );
+            load( chunks[ i ].materialLibs[ j ].c_str(), MTL_FILE );
+        }
+    }
+}
+
+/* --------------------------------------------------------------------------
+ *  weldVertices
+ *
+ *  Builds the welded mesh of m_LoadedData: every unique vertex/texture/
+ *  normal index triple of the faces becomes one MeshVertex and the faces
+ *  become a single index list, ready for glDrawElements. The triples are
+ *  looked up in an open addressing hash table sized from the face count.
+ *  Missing or invalid texture and normal indices give zero attributes.
+ * -------------------------------------------------------------------------- */
+struct WeldKey
+{
+    int         v, t, n;
+};
+
+static inline quint32 hashWeldKey( const WeldKey &key )
+{
+    quint32 h = ( quint32 )key.v * 0x9E3779B1u;
+    h ^= ( ( quint32 )key.t * 0x85EBCA77u ) + ( h << 6 ) + ( h >> 2 );
+    h ^= ( ( quint32 )key.n * 0xC2B2AE3Du ) + ( h << 6 ) + ( h >> 2 );
+    return h ^ ( h >> 16 );
+}
+
+static inline void copyAttribute( const std::vector< Vector3f > &list,
+                                  int index, GLfloat *to, int components )
+{
+    if( index < 1 || index > ( int )list.size() )
+    {
+        for( int i = 0; i < components; i++ ) to[ i ] = 0;
+        return;
+    }
+    const Vector3f &from = list[ index - 1 ];
+    to[ 0 ] = from.x;
+    to[ 1 ] = from.y;
+    if( components > 2 ) to[ 2 ] = from.z;
+}
+
+static inline void copyAttribute( const std::vector< ModelData::TexCoord > &list,
+                                  int index, GLfloat *to )
+{
+    if( index < 1 || index > ( int )list.size() )
+    {
+        to[ 0 ] = to[ 1 ] = 0;
+        return;
+    }
+    to[ 0 ] = list[ index - 1 ].s;
+    to[ 1 ] = list[ index - 1 ].t;
+}
+
+void WFLoader::weldVertices()
+{
+    ModelData                   &data = m_LoadedData;
+    const size_t                corners = data.vertexFaces.size();
+    const bool                  hasTexture = data.textureFaces.size() == corners;
+    const bool                  hasNormal = data.normalFaces.size() == corners;
+    const GLuint                EMPTY = ~( GLuint )0;
+    std::vector< GLuint >       table;
+    std::vector< WeldKey >      keys;
+    size_t                      mask;
+
+    /* A closed mesh has about half as many vertices as triangles, seams
+     * add to that. Start at twice the face count and grow if needed. */
+    size_t capacity = 16;
+    while( capacity < 2 * ( corners / 3 ) ) capacity <<= 1;
+    table.assign( capacity, EMPTY );
+    mask = capacity - 1;
+
+    keys.reserve( corners / 3 );
+    data.weldedIndices.resize( corners );
+
+    for( size_t i = 0; i < corners; i++ )
+    {
+        WeldKey key;
+        key.v = data.vertexFaces[ i ];
+        key.t = hasTexture ? data.textureFaces[ i ] : 0;
+        key.n = hasNormal ? data.normalFaces[ i ] : 0;
+
+        size_t slot = hashWeldKey( key ) & mask;
+        while( table[ slot ] != EMPTY )
+        {
+            const WeldKey &other = keys[ table[ slot ] ];
+            if( other.v == key.v && other.t == key.t && other.n == key.n )
+                break;
+            slot = ( slot + 1 ) & mask;
+        }
+
+        if( table[ slot ] == EMPTY )
+        {
+            table[ slot ] = ( GLuint )keys.size();
+            keys.push_back( key );
+
+            /* Keep the load factor under one half. */
+            if( 2 * keys.size() > capacity )
             {
-                m_LoadedData.normalFaces.push_back( n1 );
-                m_LoadedData.normalFaces.push_back( n2 );
-                m_LoadedData.normalFaces.push_back( n3 );
+                capacity <<= 1;
+                mask = capacity - 1;
+                table.assign( capacity, EMPTY );
+                for( size_t k = 0; k < keys.size(); k++ )
+                {
+                    size_t s = hashWeldKey( keys[ k ] ) & mask;
+                    while( table[ s ] != EMPTY ) s = ( s + 1 ) & mask;
+                    table[ s ] = ( GLuint )k;
+                }
+                data.weldedIndices[ i ] = ( GLuint )keys.size() - 1;
+                continue;
             }
         }
+        data.weldedIndices[ i ] = table[ slot ];
+    }
+
+    data.weldedVertices.resize( keys.size() );
+    for( size_t i = 0; i < keys.size(); i++ )
+    {
+        MeshVertex &vertex = data.weldedVertices[ i ];
+        copyAttribute( data.vertices, keys[ i ].v, vertex.position, 3 );
+        copyAttribute( data.normals, keys[ i ].n, vertex.normal, 3 );
+        copyAttribute( data.textureCoords, keys[ i ].t, vertex.texCoord );
+    }
+}
+
+/* --------------------------------------------------------------------------
+ *  Mesh cache ( .tmesh )
+ *
+ *  Binary image of the parsed ModelData, written next to the OBJ file. The
+ *  header carries the hash, modification time and size of the source file
+ *  and a table of sections, each with its own hash. A cache that does not
+ *  match the source or fails any check is ignored and rewritten. Each
+ *  setting of the optimization and levels of detail has its own file
+ *  ( see cachePathFor ), whose flags are checked as well.
+ * -------------------------------------------------------------------------- */
+static const char       CACHE_MAGIC[ 4 ] = { 'T', 'M', 'S', 'H' };
+static const quint32    CACHE_VERSION = 7;
+
+enum CacheSection
+{
+    SECTION_VERTICES = 0,
+    SECTION_NORMALS,
+    SECTION_TEXTURE_COORDS,
+    SECTION_VERTEX_FACES,
+    SECTION_NORMAL_FACES,
+    SECTION_TEXTURE_FACES,
+    SECTION_MATERIAL_LIBS,
+    SECTION_WELDED_VERTICES,
+    SECTION_WELDED_INDICES,
+    SECTION_CLUSTERS,
+    SECTION_LOD_INDICES,
+    SECTION_LOD_LEVELS,
+    SECTION_COUNT
+};
+
+enum CacheFlags { CACHE_SMOOTH_SHADED = 1, CACHE_OPTIMIZED = 2, CACHE_LODS = 4 };
+
+struct CacheHeader
+{
+    char        magic[ 4 ];
+    quint32     version;
+    quint64     sourceHash;
+    qint64      sourceTime;
+    qint64      sourceSize;
+    quint32     flags;
+    quint32     sectionCount;
+    float       acmrBefore;     /* see MeshOptimizerStats */
+    float       acmrAfter;
+    struct
+    {
+        quint64 offset;
+        quint64 size;
+        quint64 hash;
+    }           sections[ SECTION_COUNT ];
+};
+
+/* Copies a section of the mapped cache into a vector. */
+template< typename T >
+static bool readSection( const char *base, qint64 fileSize,
+                         const CacheHeader &header, int section,
+                         std::vector< T > &to )
+{
+    quint64     offset = header.sections[ section ].offset;
+    quint64     size   = header.sections[ section ].size;
+
+    if( offset % sizeof( quint32 ) != 0 || size % sizeof( T ) != 0 ||
+        offset > ( quint64 )fileSize || size > ( quint64 )fileSize - offset )
+        return false;
+    if( hashBytes( base + offset, size ) != header.sections[ section ].hash )
+        return false;
+
+    const T *first = ( const T * )( base + offset );
+    to.assign( first, first + size / sizeof( T ) );
+    return true;
+}
+
+/* --------------------------------------------------------------------------
+ *  cachePathFor
+ *
+ *  Name of the cache file of an OBJ file, e.g. bowl.obj -> bowl.tmesh,
+ *  bowl.opt.tmesh when optimized and bowl.opt.lod.tmesh with levels of
+ *  detail as well.
+ * -------------------------------------------------------------------------- */
+QString WFLoader::cachePathFor( const char *filepath ) const
+{
+    QFileInfo   info( filepath );
+    QString     suffix;
+
+    if( m_OptimizeMesh )
+        suffix += ".opt";
+    if( m_BuildLods )
+        suffix += ".lod";
+    return info.path() + "/" + info.completeBaseName() + suffix + ".tmesh";
+}
+
+/* --------------------------------------------------------------------------
+ *  readCache
+ *
+ *  Fills m_LoadedData from the cache file if it was written for the given
+ *  source and with the same optimization and level of detail settings.
+ *  A source of the same size and modification time is taken as unchanged
+ *  without reading it. Only when the time differs, or when verifying ( see
+ *  setVerifyCache ), is the source hashed and compared. Material libraries
+ *  named in the cache are loaded as well.
+ * -------------------------------------------------------------------------- */
+bool WFLoader::readCache( const QString &cachePath, const char *source,
+                          qint64 sourceSize, qint64 sourceTime )
+{
+    QFile               file( cachePath );
+    const char          *base;
+    qint64              size;
+    CacheHeader         header;
+    ModelData           data;
+    std::vector< char > libs;
+    bool                ok;
+
+    if( !file.open( QFile::ReadOnly ) )
+        return false;
+    size = file.size();
+    if( size < ( qint64 )sizeof( header ) )
+        return false;
+    base = ( const char * )file.map( 0, size );
+    if( base == NULL )
+        return false;
+
+    memcpy( &header, base, sizeof( header ) );
+    ok = memcmp( header.magic, CACHE_MAGIC, sizeof( CACHE_MAGIC ) ) == 0 &&
+         header.version == CACHE_VERSION &&
+         header.sectionCount == SECTION_COUNT &&
+         header.sourceSize == sourceSize &&
+         ( ( header.flags & CACHE_OPTIMIZED ) != 0 ) == m_OptimizeMesh &&
+         ( ( header.flags & CACHE_LODS ) != 0 ) == m_BuildLods;
+    if( ok && ( m_VerifyCache || header.sourceTime != sourceTime ) )
+        ok = header.sourceHash == hashBytes( source, sourceSize );
+
+    ok = ok &&
+        readSection( base, size, header, SECTION_VERTICES, data.vertices ) &&
+        readSection( base, size, header, SECTION_NORMALS, data.normals ) &&
+        readSection( base, size, header, SECTION_TEXTURE_COORDS,
+                     data.textureCoords ) &&
+        readSection( base, size, header, SECTION_VERTEX_FACES,
+                     data.vertexFaces ) &&
+        readSection( base, size, header, SECTION_NORMAL_FACES,
+                     data.normalFaces ) &&
+        readSection( base, size, header, SECTION_TEXTURE_FACES,
+                     data.textureFaces ) &&
+        readSection( base, size, header, SECTION_MATERIAL_LIBS, libs ) &&
+        readSection( base, size, header, SECTION_WELDED_VERTICES,
+                     data.weldedVertices ) &&
+        readSection( base, size, header, SECTION_WELDED_INDICES,
+                     data.weldedIndices ) &&
+        readSection( base, size, header, SECTION_CLUSTERS, data.clusters ) &&
+        ( !m_BuildLods ||
+          ( readSection( base, size, header, SECTION_LOD_INDICES,
+                         data.lodIndices ) &&
+            readSection( base, size, header, SECTION_LOD_LEVELS,
+                         data.lodLevels ) ) );
+
+    file.unmap( ( uchar * )base );
+    file.close();
+    if( !ok )
+        return false;
+
+    m_LoadedData.vertices.swap( data.vertices );
+    m_LoadedData.normals.swap( data.normals );
+    m_LoadedData.textureCoords.swap( data.textureCoords );
+    m_LoadedData.vertexFaces.swap( data.vertexFaces );
+    m_LoadedData.normalFaces.swap( data.normalFaces );
+    m_LoadedData.textureFaces.swap( data.textureFaces );
+    m_LoadedData.weldedVertices.swap( data.weldedVertices );
+    m_LoadedData.weldedIndices.swap( data.weldedIndices );
+    m_LoadedData.clusters.swap( data.clusters );
+    m_LoadedData.lodIndices.swap( data.lodIndices );
+    m_LoadedData.lodLevels.swap( data.lodLevels );
+    m_LoadedData.isSmoothShaded = ( header.flags & CACHE_SMOOTH_SHADED ) != 0;
+    m_OptimizeStats.acmrBefore = header.acmrBefore;
+    m_OptimizeStats.acmrAfter = header.acmrAfter;
+
+    /* Material library names are stored null terminated. */
+    for( size_t i = 0; i < libs.size(); )
+    {
+        std::string name( &libs[ i ] );
+        i += name.size() + 1;
+        m_MaterialLibs.push_back( name );
+        load( name.c_str(), MTL_FILE );
     }
+    return true;
+}
+
+/* --------------------------------------------------------------------------
+ *  writeCache
+ *
+ *  Writes m_LoadedData to the cache file. Each writer writes a temporary
+ *  file of its own, with a unique name in the same directory, and renames
+ *  it over the cache in one step, so loads of the same file on other
+ *  threads or in other processes never see a partial or mixed cache. If
+ *  the rename fails the temporary file is removed and the cache left as
+ *  it is. The cache gets the read and write permissions of the source
+ *  file. Failures ( e.g. a read-only directory ) are silently ignored.
+ * -------------------------------------------------------------------------- */
+void WFLoader::writeCache( const QString &cachePath, const char *sourcePath,
+                           quint64 sourceHash, qint64 sourceTime,
+                           qint64 sourceSize ) const
+{
+    CacheHeader         header;
+    const char          *sections[ SECTION_COUNT ];
+    std::string         libs;
+    quint64             offset;
+    static const char   padding[ 8 ] = { 0 };
+
+    for( size_t i = 0; i < m_MaterialLibs.size(); i++ )
+    {
+        libs += m_MaterialLibs[ i ];
+        libs += '\0';
+    }
+
+    memset( &header, 0, sizeof( header ) );
+    memcpy( header.magic, CACHE_MAGIC, sizeof( CACHE_MAGIC ) );
+    header.version      = CACHE_VERSION;
+    header.sourceHash   = sourceHash;
+    header.sourceTime   = sourceTime;
+    header.sourceSize   = sourceSize;
+    header.flags        = m_LoadedData.isSmoothShaded ? CACHE_SMOOTH_SHADED : 0;
+    header.sectionCount = SECTION_COUNT;
+    header.acmrBefore   = m_OptimizeStats.acmrBefore;
+    header.acmrAfter    = m_OptimizeStats.acmrAfter;
+    if( m_OptimizeMesh )
+        header.flags |= CACHE_OPTIMIZED;
+    if( m_BuildLods )
+        header.flags |= CACHE_LODS;
+
+#define CACHE_SECTION( id, vec ) \
+    sections[ id ] = ( vec ).empty() ? NULL : ( const char * )&( vec )[ 0 ]; \
+    header.sections[ id ].size = ( vec ).size() * sizeof( ( vec )[ 0 ] );
+    CACHE_SECTION( SECTION_VERTICES,       m_LoadedData.vertices )
+    CACHE_SECTION( SECTION_NORMALS,        m_LoadedData.normals )
+    CACHE_SECTION( SECTION_TEXTURE_COORDS, m_LoadedData.textureCoords )
+    CACHE_SECTION( SECTION_VERTEX_FACES,   m_LoadedData.vertexFaces )
+    CACHE_SECTION( SECTION_NORMAL_FACES,   m_LoadedData.normalFaces )
+    CACHE_SECTION( SECTION_TEXTURE_FACES,  m_LoadedData.textureFaces )
+    CACHE_SECTION( SECTION_MATERIAL_LIBS,  libs )
+    CACHE_SECTION( SECTION_WELDED_VERTICES, m_LoadedData.weldedVertices )
+    CACHE_SECTION( SECTION_WELDED_INDICES, m_LoadedData.weldedIndices )
+    CACHE_SECTION( SECTION_CLUSTERS,       m_LoadedData.clusters )
+    CACHE_SECTION( SECTION_LOD_INDICES,    m_LoadedData.lodIndices )
+    CACHE_SECTION( SECTION_LOD_LEVELS,     m_LoadedData.lodLevels )
+#undef CACHE_SECTION
+
+    /* Sections follow the header, each aligned to 8 bytes. */
+    offset = sizeof( header );
+    for( int i = 0; i < SECTION_COUNT; i++ )
+    {
+        header.sections[ i ].offset = offset;
+        header.sections[ i ].hash   = hashBytes( sections[ i ],
+                                                 header.sections[ i ].size );
+        offset += ( header.sections[ i ].size + 7 ) & ~( quint64 )7;
+    }
+
+    /* Removed when it goes out of scope, unless renamed. */
+    QTemporaryFile  file( cachePath + ".XXXXXX" );
+    bool            ok;
+
+    if( !file.open() )
+        return;
+
+    ok = file.write( ( const char * )&header, sizeof( header ) ) ==
+         ( qint64 )sizeof( header );
+    for( int i = 0; ok && i < SECTION_COUNT; i++ )
+    {
+        qint64 size = header.sections[ i ].size;
+        ok = size == 0 || file.write( sections[ i ], size ) == size;
+        if( ok && size % 8 != 0 )
+            ok = file.write( padding, 8 - size % 8 ) == 8 - size % 8;
+    }
+    file.close();
+
+    /* QTemporaryFile creates the file readable by its owner only. */
+    QFile::Permissions permissions = QFile::permissions( sourcePath ) &
+        ( QFile::ReadOwner | QFile::WriteOwner | QFile::ReadGroup |
+          QFile::WriteGroup | QFile::ReadOther | QFile::WriteOther );
+    ok = ok && file.setPermissions( permissions | QFile::ReadOwner |
+                                    QFile::WriteOwner );
+
+    /* QFile::rename does not replace an existing file, rename does
+     * ( atomically on POSIX systems ). */
+    if( ok && rename( QFile::encodeName( file.fileName() ).constData(),
+                      QFile::encodeName( cachePath ).constData() ) == 0 )
+        file.setAutoRemove( false );
 }
 
 void WFLoader::parseMaterialFile( const char *line )
@@ -2,6 +2,7 @@
 #define WF_LOADER_H
 
 #include "renderer.h"
+#include "meshoptimizer.h"
 
 class WFLoader
 {
@@ -10,12 +11,58 @@ public:
     ModelData           m_LoadedData;
     char                m_CurrentMatName[50];
 
-    WFLoader() {}
+    WFLoader() : m_ThreadCount( 0 ), m_CacheEnabled( true ),
+                 m_VerifyCache( false ), m_OptimizeMesh( false ),
+                 m_BuildLods( false ) {}
     bool load( const char *filepath, FileType type );
     void printData();
 
+    /* Number of threads used for parsing OBJ files. 0 ( default ) uses one
+     * per core, 1 parses on the calling thread only. */
+    void setThreadCount( int count ) { m_ThreadCount = count; }
+
+    /* Read and write the binary .tmesh cache next to OBJ files ( default ). */
+    void setCacheEnabled( bool state ) { m_CacheEnabled = state; }
+    /* Hash the OBJ file on every cache hit, not only when its modification
+     * time differs from the cached one ( off by default ). */
+    void setVerifyCache( bool state ) { m_VerifyCache = state; }
+
+    /* Run the MeshOptimizer passes on OBJ meshes after welding ( off by
+     * default ). Optimized meshes are cached in a file of their own, see
+     * cachePathFor. */
+    void setOptimizeMesh( bool state ) { m_OptimizeMesh = state; }
+    /* Vertex cache figures of the last optimized OBJ file, also when it was
+     * read from the cache. Nothing is printed, callers report these. */
+    const MeshOptimizerStats &optimizeStats() const { return m_OptimizeStats; }
+
+    /* Make the levels of detail of OBJ meshes with MeshSimplifier::buildLods
+     * after welding and optimizing ( off by default ). The levels are
+     * cached with the mesh, in a file of its own, so they are only made
+     * when the cache misses. */
+    void setBuildLods( bool state ) { m_BuildLods = state; }
+
 private:
-    void parseObjectFile( const char *line );
+    int                         m_ThreadCount;
+    bool                        m_CacheEnabled;
+    bool                        m_VerifyCache;
+    bool                        m_OptimizeMesh;
+    bool                        m_BuildLods;
+    MeshOptimizerStats          m_OptimizeStats;
+    /* Material libraries named by the loaded OBJ file. */
+    std::vector< std::string >  m_MaterialLibs;
+
+    /* One cache per source file and setting of the optimization and
+     * levels of detail, so loaders with different settings do not
+     * overwrite each other's caches. */
+    QString cachePathFor( const char *filepath ) const;
+    bool readCache( const QString &cachePath, const char *source,
+                    qint64 sourceSize, qint64 sourceTime );
+    void writeCache( const QString &cachePath, const char *sourcePath,
+                     quint64 sourceHash, qint64 sourceTime,
+                     qint64 sourceSize ) const;
+
+    void parseObjectFile( const char *begin, const char *end );
+    void weldVertices();
     void parseMaterialFile( const char * line );
 };
 
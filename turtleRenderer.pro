@@ -18,6 +18,20 @@ HEADERS += src/drawableobjects.h \
            src/mainwindow.h \
            src/renderer.h \
            src/wf_loader.h \
+           src/meshoptimizer.h \
+           src/meshbuffer.h \
+           src/meshbvh.h \
+           src/renderqueue.h \
+           src/statemanager.h \
+           src/frustum.h \
+           src/aabbtree.h \
+           src/slotmap.h \
+           src/scenestore.h \
+           src/transformhierarchy.h \
+           src/geometrycache.h \
+           src/instancerenderer.h \
+           src/meshmanager.h \
+           src/meshsimplifier.h \
            src/timer.h
 
 SOURCES += src/drawableobjects.cpp \
@@ -25,5 +39,18 @@ SOURCES += src/drawableobjects.cpp \
            src/mainwindow.cpp \
            src/renderer.cpp \
            src/wf_loader.cpp \
+           src/meshoptimizer.cpp \
+           src/meshbuffer.cpp \
+           src/meshbvh.cpp \
+           src/renderqueue.cpp \
+           src/statemanager.cpp \
+           src/frustum.cpp \
+           src/aabbtree.cpp \
+           src/scenestore.cpp \
+           src/transformhierarchy.cpp \
+           src/geometrycache.cpp \
+           src/instancerenderer.cpp \
+           src/meshmanager.cpp \
+           src/meshsimplifier.cpp \
            src/timer.cpp
 